@@ -876,6 +876,27 @@ void WriteLineToLog(FILE *LogFile, const char *outline)
 }
 
 
+static thread_local FPrintCapture *PrintCapture;
+
+void FPrintCapture::Begin()
+{
+	PrintCapture = this;
+}
+
+void FPrintCapture::End()
+{
+	PrintCapture = nullptr;
+}
+
+void FPrintCapture::Flush()
+{
+	for (auto &line : Lines)
+	{
+		PrintString(line.PrintLevel, line.Text);
+	}
+	Lines.Clear();
+}
+
 int PrintString (int iprintlevel, const char *outline)
 {
 	int printlevel = iprintlevel & PRINT_TYPES;
@@ -883,6 +904,11 @@ int PrintString (int iprintlevel, const char *outline)
 	{
 		return 0;
 	}
+	if (PrintCapture != nullptr)
+	{
+		PrintCapture->Lines.Push({ iprintlevel, outline });
+		return (int)strlen(outline);
+	}
 	if (printlevel != PRINT_LOG || Logfile != nullptr)
 	{
 		// Convert everything coming through here to UTF-8 so that all console text is in a consistent format
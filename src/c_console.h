@@ -36,6 +36,8 @@
 
 #include <stdarg.h>
 #include "basictypes.h"
+#include "tarray.h"
+#include "zstring.h"
 
 struct event_t;
 
@@ -70,6 +72,22 @@ int PrintString (int printlevel, const char *string);
 int PrintStringHigh (const char *string);
 int VPrintf (int printlevel, const char *format, va_list parms) GCCFORMAT(2);
 
+// Collects the console output of a worker thread so that the main thread
+// can print it later, in the same order as if the work had been done there.
+struct FPrintCapture
+{
+	struct FLine
+	{
+		int PrintLevel;
+		FString Text;
+	};
+	TArray<FLine> Lines;
+
+	void Begin();	// starts collecting the output of the calling thread
+	void End();
+	void Flush();	// prints and clears everything collected so far
+};
+
 void C_DrawConsole ();
 void C_ToggleConsole (void);
 void C_FullConsole (void);
@@ -102,6 +102,7 @@
 #include "i_system.h"
 #include "g_cvars.h"
 #include "r_data/r_vanillatrans.h"
+#include "p_benchmark.h"
 
 EXTERN_CVAR(Bool, hud_althud)
 EXTERN_CVAR(Int, vr_mode)
@@ -995,6 +996,28 @@ void D_DoomLoop ()
 	{
 		try
 		{
+			JitUpdateBackground();
+
+			if (benchmarking)
+			{
+				// Headless benchmark: no input, no display, no frame pacing.
+				P_BenchmarkStartTic ();
+				GC::NewFrame ();
+				G_BuildTiccmd (&netcmds[consoleplayer][maketic%BACKUPTICS]);
+				if (advancedemo)
+					D_DoAdvanceDemo ();
+				G_Ticker ();
+				BenchCycles[BENCH_Sound].Clock();
+				S_UpdateSounds (players[consoleplayer].camera);
+				BenchCycles[BENCH_Sound].Unclock();
+				gametic++;
+				maketic++;
+				GC::CheckGC ();
+				Net_NewMakeTic ();
+				P_BenchmarkEndTic ();
+				continue;
+			}
+
 			// frame syncronous IO operations
 			if (gametic > lasttic)
 			{
@@ -1002,6 +1025,7 @@ void D_DoomLoop ()
 				I_StartFrame ();
 			}
 			I_SetFrameTime();
+			GC::NewFrame ();
 
 			// process one or more tics
 			if (singletics)
@@ -2293,6 +2317,7 @@ void D_DoomMain (void)
 		}
 		Printf("\n");
 	}
+	P_SetupBenchmark();
 
 	if (Args->CheckParm("-hashfiles"))
 	{
@@ -2510,6 +2535,7 @@ void D_DoomMain (void)
 		StartScreen->Progress ();
 
 		ParseGLDefs();
+		Wads.ReleasePreloadedLumps();
 
 		if (!batchrun) Printf ("R_Init: Init %s refresh subsystem.\n", gameinfo.ConfigName.GetChars());
 		StartScreen->LoadingStatus ("Loading graphics", 0x3f);
@@ -2553,6 +2579,9 @@ void D_DoomMain (void)
 		// clean up the compiler symbols which are not needed any longer.
 		RemoveUnusedSymbols();
 
+		// With vm_jit_aot the script functions get compiled while the rest starts up.
+		JitCompileAhead();
+
 		InitActorNumsFromMapinfo();
 		InitSpawnablesFromMapinfo();
 		PClassActor::StaticSetActorNums();
@@ -37,10 +37,12 @@
 #include <stdlib.h>
 #include <type_traits>
 #include "doomtype.h"
+#include "dobjpool.h"
 
 #include "vectors.h"
 
 class PClass;
+class DThinker;
 class PType;
 class FSerializer;
 class FSoundID;
@@ -261,22 +263,23 @@ public:
 private:
 	struct nonew
 	{
+		bool pooled;
 	};
 
-	void *operator new(size_t len, nonew&)
+	void *operator new(size_t len, nonew &nono)
 	{
-		return M_Malloc(len);
+		return M_AllocObject(len, nono.pooled);
 	}
 public:
 
 	void operator delete (void *mem, nonew&)
 	{
-		M_Free(mem);
+		M_FreeObject(mem);
 	}
 
 	void operator delete (void *mem)
 	{
-		M_Free(mem);
+		M_FreeObject(mem);
 	}
 
 	// GC fiddling
@@ -343,7 +346,7 @@ protected:
 
 	void operator delete (void *mem, EInPlace *)
 	{
-		M_Free (mem);
+		M_FreeObject (mem);
 	}
 
 	template<typename T, typename... Args>
@@ -357,7 +360,7 @@ protected:
 template<typename T, typename... Args>
 T* Create(Args&&... args)
 {
-	DObject::nonew nono;
+	DObject::nonew nono = { std::is_base_of<DThinker, T>::value };
 	T *object = new(nono) T(std::forward<Args>(args)...);
 	if (object != nullptr)
 	{
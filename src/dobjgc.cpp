@@ -73,6 +73,8 @@
 #include "intermission/intermission.h"
 #include "g_levellocals.h"
 #include "events.h"
+#include "stats.h"
+#include "i_time.h"
 
 // MACROS ------------------------------------------------------------------
 
@@ -104,6 +106,60 @@
 
 // TYPES -------------------------------------------------------------------
 
+// Pause times in power of two buckets of microseconds, up to about 8 seconds.
+struct FPauseHistogram
+{
+	enum { NUM_BUCKETS = 24 };
+
+	uint64_t Buckets[NUM_BUCKETS];
+	uint64_t Count;
+	uint64_t MaxNS;
+
+	void Reset()
+	{
+		memset(this, 0, sizeof(*this));
+	}
+
+	void Add(uint64_t ns)
+	{
+		uint64_t us = ns / 1000;
+		int bucket = 0;
+		while (us > 1 && bucket < NUM_BUCKETS - 1)
+		{
+			us >>= 1;
+			bucket++;
+		}
+		Buckets[bucket]++;
+		Count++;
+		if (ns > MaxNS) MaxNS = ns;
+	}
+
+	// Returns the upper end of the bucket containing the given percentile.
+	unsigned Percentile(int percent) const
+	{
+		uint64_t limit = (Count * percent + 99) / 100;
+		uint64_t sum = 0;
+		for (int i = 0; i < NUM_BUCKETS; i++)
+		{
+			sum += Buckets[i];
+			if (sum >= limit && sum > 0) return 2u << i;
+		}
+		return 0;
+	}
+
+	void Print(const char *name) const
+	{
+		Printf("%s: %llu samples, max %.3f ms, p99 < %u us\n", name, (unsigned long long)Count, MaxNS / 1000000., Percentile(99));
+		for (int i = 0; i < NUM_BUCKETS; i++)
+		{
+			if (Buckets[i] > 0)
+			{
+				Printf("  %8u - %8u us: %llu\n", i == 0 ? 0 : 1u << i, 2u << i, (unsigned long long)Buckets[i]);
+			}
+		}
+	}
+};
+
 // EXTERNAL FUNCTION PROTOTYPES --------------------------------------------
 
 // PUBLIC FUNCTION PROTOTYPES ----------------------------------------------
@@ -116,6 +172,18 @@ extern DThinker *NextToThink;
 
 // PUBLIC DATA DEFINITIONS -------------------------------------------------
 
+cycle_t GCCycles;
+
+// Wall-clock time in microseconds the collector may use per frame. 0 paces
+// the collector by allocation alone.
+CUSTOM_CVAR(Int, gc_budget, 0, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
+{
+	if (self < 0) self = 0;
+}
+
+// Prints every collector pause longer than this many microseconds.
+CVAR(Int, gc_tracepause, 0, 0)
+
 namespace GC
 {
 size_t AllocBytes;
@@ -135,6 +203,17 @@ bool FinalGC;
 
 // PRIVATE DATA DEFINITIONS ------------------------------------------------
 
+static const char *StateStrings[] = {
+	"  Pause  ",
+	"Propagate",
+	"  Sweep  ",
+	"Finalize " };
+
+static FPauseHistogram StepPauses, FramePauses;
+static uint64_t FrameTime;		// collector time spent in this frame, in ns
+static bool BudgetDeferred;		// this frame's budget is used up
+static int BudgetOverruns;
+
 // CODE --------------------------------------------------------------------
 
 //==========================================================================
@@ -379,6 +458,7 @@ static size_t SingleStep()
 	  }
 
 	case GCS_Finalize:
+		M_TrimObjectPools();
 		State = GCS_Pause;		// end collection
 		Dept = 0;
 		return 0;
@@ -391,14 +471,14 @@ static size_t SingleStep()
 
 //==========================================================================
 //
-// Step
+// PacedStep
 //
 // Performs enough single steps to cover GCSTEPSIZE * StepMul% bytes of
 // memory.
 //
 //==========================================================================
 
-void Step()
+static void PacedStep()
 {
 	size_t lim = (GCSTEPSIZE/100) * StepMul;
 	size_t olim;
@@ -429,7 +509,125 @@ void Step()
 		assert(AllocBytes >= Estimate);
 		SetThreshold();
 	}
+}
+
+//==========================================================================
+//
+// BudgetStep
+//
+// Performs single steps until the collection is finished or the time
+// budget for this frame is used up. The work is then postponed to the
+// next frame, unless allocations outrun the collector by too much in the
+// meantime, in which case it falls back to allocation paced steps.
+//
+//==========================================================================
+
+static void BudgetStep(uint64_t start)
+{
+	const uint64_t budget = uint64_t(gc_budget) * 1000;
+
+	if (FrameTime >= budget)
+	{
+		if (BudgetDeferred)
+		{
+			BudgetOverruns++;
+			PacedStep();
+			return;
+		}
+	}
+	else
+	{
+		do
+		{
+			SingleStep();
+		} while (State != GCS_Pause && FrameTime + (I_nsTime() - start) < budget);
+
+		if (State == GCS_Pause)
+		{
+			SetThreshold();
+			return;
+		}
+	}
+	BudgetDeferred = true;
+	Threshold = AllocBytes + MAX<size_t>(Estimate / 4, GCSTEPSIZE * 256);
+}
+
+//==========================================================================
+//
+// RecordPause
+//
+//==========================================================================
+
+static void RecordPause(uint64_t ns)
+{
+	StepPauses.Add(ns);
+	FrameTime += ns;
+	if (gc_tracepause > 0 && ns >= uint64_t(gc_tracepause) * 1000)
+	{
+		Printf("GC pause of %llu us [%s]\n", (unsigned long long)(ns / 1000), StateStrings[State]);
+	}
+}
+
+//==========================================================================
+//
+// Step
+//
+// Does one collection step, either paced by allocation or limited by
+// the per frame time budget.
+//
+//==========================================================================
+
+void Step()
+{
+	uint64_t start = I_nsTime();
+	GCCycles.Clock();
+	if (gc_budget > 0)
+	{
+		BudgetStep(start);
+	}
+	else
+	{
+		PacedStep();
+	}
 	StepCount++;
+	GCCycles.Unclock();
+	RecordPause(I_nsTime() - start);
+}
+
+//==========================================================================
+//
+// NewFrame
+//
+// Must be called once per frame. Collects the frame's pause time and
+// resumes a collection that was postponed because of the time budget.
+//
+//==========================================================================
+
+void NewFrame()
+{
+	FramePauses.Add(FrameTime);
+	FrameTime = 0;
+	if (BudgetDeferred)
+	{
+		BudgetDeferred = false;
+		if (State != GCS_Pause)
+		{
+			Threshold = AllocBytes;
+		}
+	}
+}
+
+//==========================================================================
+//
+// ResetPauses
+//
+//==========================================================================
+
+void ResetPauses()
+{
+	StepPauses.Reset();
+	FramePauses.Reset();
+	BudgetOverruns = 0;
 }
 
 //==========================================================================
@@ -442,6 +640,7 @@ void Step()
 
 void FullGC()
 {
+	uint64_t start = I_nsTime();
 	if (State <= GCS_Propagate)
 	{
 		// Reset sweep mark to sweep all elements (returning them to white)
@@ -461,6 +660,8 @@ void FullGC()
 		SingleStep();
 	}
 	SetThreshold();
+	BudgetDeferred = false;
+	RecordPause(I_nsTime() - start);
 }
 
 //==========================================================================
@@ -591,11 +792,7 @@ void DelSoftRoot(DObject *obj)
 
 ADD_STAT(gc)
 {
-	static const char *StateStrings[] = {
-		"  Pause  ",
-		"Propagate",
-		"  Sweep  ",
-		"Finalize " };
+	using namespace GC;
 	FString out;
 	out.Format("[%s] Alloc:%6zuK  Thresh:%6zuK  Est:%6zuK  Steps: %d",
 		StateStrings[GC::State],
@@ -607,6 +804,13 @@ ADD_STAT(gc)
 	{
 		out.AppendFormat("  %zuK", (GC::Dept + 1023) >> 10);
 	}
+	out.AppendFormat("\nPause max %.2f ms p99 <%uus  Frame max %.2f ms p99 <%uus",
+		StepPauses.MaxNS / 1000000., StepPauses.Percentile(99),
+		FramePauses.MaxNS / 1000000., FramePauses.Percentile(99));
+	if (gc_budget > 0)
+	{
+		out.AppendFormat("  Budget %dus  Overruns %d", *gc_budget, BudgetOverruns);
+	}
 	return out;
 }
 
@@ -622,7 +826,7 @@ CCMD(gc)
 {
 	if (argv.argc() == 1)
 	{
-		Printf ("Usage: gc stop|now|full|count|pause [size]|stepmul [size]\n");
+		Printf ("Usage: gc stop|now|full|count|pause [size]|stepmul [size]|budget [usec]|pauses|resetpauses\n");
 		return;
 	}
 	if (stricmp(argv[1], "stop") == 0)
@@ -665,5 +869,26 @@ CCMD(gc)
 			GC::StepMul = MAX(100, atoi(argv[2]));
 		}
 	}
+	else if (stricmp(argv[1], "budget") == 0)
+	{
+		if (argv.argc() == 2)
+		{
+			Printf ("Current GC budget is %d us per frame\n", *gc_budget);
+		}
+		else
+		{
+			gc_budget = atoi(argv[2]);
+		}
+	}
+	else if (stricmp(argv[1], "pauses") == 0)
+	{
+		GC::StepPauses.Print("Step pauses");
+		GC::FramePauses.Print("Frame pauses");
+		Printf("Budget overruns: %d\n", GC::BudgetOverruns);
+	}
+	else if (stricmp(argv[1], "resetpauses") == 0)
+	{
+		GC::ResetPauses();
+	}
 }
 
@@ -81,6 +81,13 @@ namespace GC
 	// Does one collection step.
 	void Step();
 
+	// Marks the start of a new frame for the pause statistics and the
+	// time budgeted collector.
+	void NewFrame();
+
+	// Clears the pause statistics.
+	void ResetPauses();
+
 	// Does a complete collection.
 	void FullGC();
 
@@ -0,0 +1,298 @@
+//-----------------------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/
+//
+//-----------------------------------------------------------------------------
+//
+// DESCRIPTION:
+//		Slab pools for thinker memory.
+//
+//		Actors and other thinkers are created and destroyed constantly
+//		during play, so instead of going through malloc each time they
+//		are allocated from slabs holding objects of one size class. A
+//		slot freed by the collector goes back onto its slab's free list
+//		and is reused by the next object of that size. Slabs that are
+//		completely empty after a sweep are returned to the system, except
+//		for one spare per size class.
+//
+//		Every object is preceded by a small header pointing to its slab,
+//		or null for objects that live on the heap.
+//
+//-----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "doomerrors.h"
+#include "dobject.h"
+#include "c_cvars.h"
+#include "stats.h"
+
+// MACROS ------------------------------------------------------------------
+
+#define POOL_GRANULARITY	16
+#define MAX_POOLED_SIZE		4096
+#define NUM_POOLS			(MAX_POOLED_SIZE / POOL_GRANULARITY)
+#define SLAB_SIZE			65536
+#define MIN_SLAB_SLOTS		8
+
+// TYPES -------------------------------------------------------------------
+
+struct FObjectSlab;
+struct FObjectPool;
+
+struct alignas(POOL_GRANULARITY) FObjectHeader
+{
+	FObjectSlab *Slab;
+};
+
+struct FFreeSlot
+{
+	FFreeSlot *Next;
+};
+
+struct alignas(POOL_GRANULARITY) FObjectSlab
+{
+	FObjectPool *Pool;
+	FObjectSlab *Prev, *Next;	// partial list, only valid while Used < Capacity
+	FFreeSlot *FreeList;
+	unsigned Used;
+	unsigned Bumped;			// slots that were handed out at least once
+	unsigned Capacity;
+
+	uint8_t *Slots() { return reinterpret_cast<uint8_t *>(this + 1); }
+};
+
+struct FObjectPool
+{
+	size_t SlotSize;
+	unsigned SlotsPerSlab;
+	FObjectSlab *Partial;		// slabs with free slots
+	unsigned NumSlabs;
+	unsigned Used;
+	size_t Allocs, Frees;
+};
+
+// PUBLIC DATA DEFINITIONS -------------------------------------------------
+
+CVAR(Bool, gc_objpool, true, 0)
+
+// PRIVATE DATA DEFINITIONS ------------------------------------------------
+
+static FObjectPool Pools[NUM_POOLS];
+static size_t HeapObjects;
+static size_t SlabsFreed;
+
+// CODE --------------------------------------------------------------------
+
+//==========================================================================
+//
+// LinkPartial / UnlinkPartial
+//
+//==========================================================================
+
+static void LinkPartial(FObjectPool *pool, FObjectSlab *slab)
+{
+	slab->Prev = nullptr;
+	slab->Next = pool->Partial;
+	if (pool->Partial != nullptr) pool->Partial->Prev = slab;
+	pool->Partial = slab;
+}
+
+static void UnlinkPartial(FObjectPool *pool, FObjectSlab *slab)
+{
+	if (slab->Prev != nullptr) slab->Prev->Next = slab->Next;
+	else pool->Partial = slab->Next;
+	if (slab->Next != nullptr) slab->Next->Prev = slab->Prev;
+	slab->Prev = slab->Next = nullptr;
+}
+
+//==========================================================================
+//
+// NewSlab
+//
+// Slab memory is not counted in GC::AllocBytes. Only the slots that are
+// in use are, so that the collector's pacing is the same as with the heap.
+//
+//==========================================================================
+
+static FObjectSlab *NewSlab(FObjectPool *pool)
+{
+	size_t size = sizeof(FObjectSlab) + pool->SlotsPerSlab * pool->SlotSize;
+	auto slab = (FObjectSlab *)malloc(size);
+	if (slab == nullptr)
+	{
+		I_FatalError("Could not malloc %zu bytes", size);
+	}
+	slab->Pool = pool;
+	slab->FreeList = nullptr;
+	slab->Used = 0;
+	slab->Bumped = 0;
+	slab->Capacity = pool->SlotsPerSlab;
+	LinkPartial(pool, slab);
+	pool->NumSlabs++;
+	return slab;
+}
+
+//==========================================================================
+//
+// M_AllocObject
+//
+//==========================================================================
+
+void *M_AllocObject(size_t size, bool pooled)
+{
+	size_t total = size + sizeof(FObjectHeader);
+	FObjectHeader *header;
+
+	if (pooled && gc_objpool && total <= MAX_POOLED_SIZE)
+	{
+		FObjectPool *pool = &Pools[(total - 1) / POOL_GRANULARITY];
+		if (pool->SlotSize == 0)
+		{
+			pool->SlotSize = (total + POOL_GRANULARITY - 1) & ~size_t(POOL_GRANULARITY - 1);
+			pool->SlotsPerSlab = unsigned(SLAB_SIZE / pool->SlotSize);
+			if (pool->SlotsPerSlab < MIN_SLAB_SLOTS) pool->SlotsPerSlab = MIN_SLAB_SLOTS;
+		}
+
+		FObjectSlab *slab = pool->Partial;
+		if (slab == nullptr)
+		{
+			slab = NewSlab(pool);
+		}
+		if (slab->FreeList != nullptr)
+		{
+			header = (FObjectHeader *)slab->FreeList;
+			slab->FreeList = slab->FreeList->Next;
+		}
+		else
+		{
+			header = (FObjectHeader *)(slab->Slots() + slab->Bumped++ * pool->SlotSize);
+		}
+		if (++slab->Used == slab->Capacity)
+		{
+			UnlinkPartial(pool, slab);
+		}
+		pool->Used++;
+		pool->Allocs++;
+		GC::AllocBytes += pool->SlotSize;
+		header->Slab = slab;
+	}
+	else
+	{
+		header = (FObjectHeader *)M_Malloc(total);
+		header->Slab = nullptr;
+		HeapObjects++;
+	}
+	return header + 1;
+}
+
+//==========================================================================
+//
+// M_FreeObject
+//
+//==========================================================================
+
+void M_FreeObject(void *mem)
+{
+	if (mem == nullptr) return;
+
+	auto header = (FObjectHeader *)mem - 1;
+	FObjectSlab *slab = header->Slab;
+	if (slab == nullptr)
+	{
+		HeapObjects--;
+		M_Free(header);
+		return;
+	}
+
+	FObjectPool *pool = slab->Pool;
+	auto slot = (FFreeSlot *)header;
+	slot->Next = slab->FreeList;
+	slab->FreeList = slot;
+	if (slab->Used-- == slab->Capacity)
+	{
+		LinkPartial(pool, slab);
+	}
+	pool->Used--;
+	pool->Frees++;
+	GC::AllocBytes -= pool->SlotSize;
+}
+
+//==========================================================================
+//
+// M_TrimObjectPools
+//
+//==========================================================================
+
+void M_TrimObjectPools()
+{
+	for (auto &pool : Pools)
+	{
+		bool spare = false;
+		FObjectSlab *next;
+		for (FObjectSlab *slab = pool.Partial; slab != nullptr; slab = next)
+		{
+			next = slab->Next;
+			if (slab->Used == 0)
+			{
+				if (!spare)
+				{
+					spare = true;
+				}
+				else
+				{
+					UnlinkPartial(&pool, slab);
+					free(slab);
+					pool.NumSlabs--;
+					SlabsFreed++;
+				}
+			}
+		}
+	}
+}
+
+//==========================================================================
+//
+// STAT objpools
+//
+//==========================================================================
+
+ADD_STAT(objpools)
+{
+	unsigned numpools = 0, numslabs = 0, emptyslabs = 0;
+	size_t used = 0, capacity = 0, bytes = 0, allocs = 0, frees = 0;
+
+	for (auto &pool : Pools)
+	{
+		if (pool.NumSlabs == 0) continue;
+		numpools++;
+		numslabs += pool.NumSlabs;
+		used += pool.Used;
+		capacity += size_t(pool.NumSlabs) * pool.SlotsPerSlab;
+		bytes += pool.NumSlabs * (sizeof(FObjectSlab) + pool.SlotsPerSlab * pool.SlotSize);
+		allocs += pool.Allocs;
+		frees += pool.Frees;
+		for (FObjectSlab *slab = pool.Partial; slab != nullptr; slab = slab->Next)
+		{
+			if (slab->Used == 0) emptyslabs++;
+		}
+	}
+
+	FString out;
+	out.Format("Pools: %u  Slabs: %u (%u empty, %zu released)  Slots: %zu/%zu  Memory: %zuK\n"
+		"Allocs: %zu  Frees: %zu  Heap objects: %zu",
+		numpools, numslabs, emptyslabs, SlabsFreed, used, capacity, (bytes + 1023) >> 10,
+		allocs, frees, HeapObjects);
+	return out;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <stddef.h>
+
+// Memory for DObjects. Pooled requests are served from per-size slabs with
+// their own free lists, everything else goes to the heap. Both kinds must be
+// released with M_FreeObject.
+void *M_AllocObject(size_t size, bool pooled);
+void M_FreeObject(void *mem);
+
+// Releases slabs that became empty. Called by the collector after each sweep.
+void M_TrimObjectPools();
@@ -449,7 +449,7 @@ PClass *PClass::FindClass (FName zaname)
 
 DObject *PClass::CreateNew()
 {
-	uint8_t *mem = (uint8_t *)M_Malloc (Size);
+	uint8_t *mem = (uint8_t *)M_AllocObject (Size, IsDescendantOf(RUNTIME_CLASS(DThinker)));
 	assert (mem != nullptr);
 
 	// Set this object's defaults before constructing it.
@@ -460,7 +460,7 @@ DObject *PClass::CreateNew()
 
 	if (ConstructNative == nullptr)
 	{
-		M_Free(mem);
+		M_FreeObject(mem);
 		I_Error("Attempt to instantiate abstract class %s.", TypeName.GetChars());
 	}
 	ConstructNative (mem);
@@ -58,6 +58,7 @@ typedef TMap<int, PClassActor *> FClassMap;
 #include "basictypes.h"
 
 extern bool batchrun;
+extern bool benchmarking;
 
 // Bounding box coordinate storage.
 enum
@@ -79,6 +79,7 @@
 #include "g_hub.h"
 #include "g_levellocals.h"
 #include "events.h"
+#include "p_benchmark.h"
 
 
 static FRandom pr_dmspawn ("DMSpawn");
@@ -2839,6 +2840,10 @@ bool G_CheckDemoStatus (void)
 		{
 			StatusBar->AttachToPlayer (&players[0]);
 		}
+		if (benchmarking)
+		{
+			P_FinishBenchmark();
+		}
 		if (singledemo || timingdemo)
 		{
 			if (timingdemo)
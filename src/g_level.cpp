@@ -1106,6 +1106,7 @@ void FLevelLocals::DoLoadLevel(const FString &nextmapname, int position, bool au
 	}
 
 	P_SetupLevel (this, position, newGame);
+	JitCompileAhead();
 
 
 
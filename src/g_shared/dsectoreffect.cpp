@@ -158,6 +158,8 @@ EMoveResult sector_t::MoveFloor(double speed, double dest, int crush, int direct
 	double		move;
 	//double		destheight;	//jff 02/04/98 used to keep floors/ceilings
 							// from moving thru each other
+	P_InvalidateSightQueries();
+	changecount++;
 	lastpos = floorplane.fD();
 	switch (direction)
 	{
@@ -294,6 +296,8 @@ EMoveResult sector_t::MoveCeiling(double speed, double dest, int crush, int dire
 	//double		destheight;	//jff 02/04/98 used to keep floors/ceilings
 	// from moving thru each other
 
+	P_InvalidateSightQueries();
+	changecount++;
 	lastpos = ceilingplane.fD();
 	switch (direction)
 	{
@@ -45,7 +45,7 @@
 
 
 static int ThinkCount;
-static cycle_t ThinkCycles;
+cycle_t ThinkCycles;
 extern cycle_t BotSupportCycles;
 extern cycle_t ActionCycles;
 extern int BotWTG;
@@ -67,6 +67,49 @@ static TMap<FName, ProfileInfo> Profiles;
 static unsigned int profilethinkers, profilelimit;
 DThinker *NextToThink;
 
+// Prefetch the frequently accessed fields of the next thinker in the list
+// while the current one is ticking. On maps with many actors nearly every
+// step through the thinker list is a cache miss otherwise.
+CVAR(Bool, think_prefetch, true, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
+
+#if defined __GNUC__ || defined __clang__
+#define PREFETCH(p) __builtin_prefetch(p)
+#elif defined _MSC_VER && (defined _M_IX86 || defined _M_X64)
+#include <xmmintrin.h>
+#define PREFETCH(p) _mm_prefetch((const char *)(p), _MM_HINT_T0)
+#else
+#define PREFETCH(p) ((void)(p))
+#endif
+
+//==========================================================================
+//
+// PrefetchThinker
+//
+// The offsets are those of the AActor fields that get touched by nearly
+// every call to AActor::Tick. Prefetches cannot fault so this is harmless
+// for smaller thinker types, or for the list's sentinel.
+//
+//==========================================================================
+
+static const size_t HotOffsets[] =
+{
+	0,
+	myoffsetof(AActor, __Pos),
+	myoffsetof(AActor, flags),
+	myoffsetof(AActor, Vel),
+	myoffsetof(AActor, Sector),
+	myoffsetof(AActor, tics),
+};
+
+static inline void PrefetchThinker(DThinker *node)
+{
+	auto p = reinterpret_cast<const char *>(node);
+	for (auto ofs : HotOffsets)
+	{
+		PREFETCH(p + ofs);
+	}
+}
+
 //==========================================================================
 //
 //
@@ -111,8 +154,13 @@ void FThinkerCollection::RunThinkers(FLevelLocals *Level)
 		// Tick every thinker left from last time
 		for (i = STAT_FIRST_THINKING; i <= MAX_STATNUM; ++i)
 		{
+			if (i == STAT_DEFAULT)
+			{
+				P_PrepareSightQueries(Level);
+			}
 			Thinkers[i].TickThinkers(nullptr);
 		}
+		P_InvalidateSightQueries();
 
 		// Keep ticking the fresh thinkers until there are no new ones.
 		do
@@ -550,10 +598,16 @@ int FThinkerList::TickThinkers(FThinkerList *dest)
 		return 0;
 	}
 
+	const bool prefetch = think_prefetch;
+
 	while (node != Sentinel)
 	{
 		++count;
 		NextToThink = node->NextThinker;
+		if (prefetch)
+		{
+			PrefetchThinker(NextToThink);
+		}
 		if (node->ObjectFlags & OF_JustSpawned)
 		{
 			// Leave OF_JustSpawn set until after Tick() so the ticker can check it.
@@ -36,6 +36,10 @@
 
 #include "g_levellocals.h"
 #include "actorinlines.h"
+#include "parallel_for.h"
+#include "c_dispatch.h"
+#include "g_game.h"
+#include <thread>
 
 static FRandom pr_botchecksight ("BotCheckSight");
 static FRandom pr_checksight ("CheckSight");
@@ -51,8 +55,7 @@ This uses specialized forms of the maputils routines for optimized performance
 */
 
 // Performance meters
-static int sightcounts[6];
-static cycle_t SightCycles;
+cycle_t SightCycles;
 static cycle_t MaxSightCycles;
 
 enum
@@ -87,12 +90,95 @@ struct SightTask
 };
 
 
-static TArray<intercept_t> intercepts (128);
-static TArray<SightTask> portals(32);
+//==========================================================================
+//
+// Scratch space for sight checks. A SightCheck only works on the buffers
+// it is given and visited lines and polyobjects are tracked with a stamp
+// private to these buffers instead of validcount, so checks using
+// different buffers can run concurrently.
+//
+//==========================================================================
+
+struct SightBuffers
+{
+	TArray<intercept_t> intercepts;
+	TArray<SightTask> portals;
+	TArray<int> linestamps;
+	TArray<int> polystamps;
+	int stamp = 0;
+	int sightcounts[6] = {};
+
+	// Sectors whose planes and lines whose flags the current traversal
+	// depended on. Only collected while recording is set, so that results
+	// can be reused later.
+	TArray<int> sectorstamps;
+	TArray<int> touchedsectors;
+	TArray<int> touchedlines;
+	int sectorstamp = 0;
+	bool recording = false;
+
+	// Lines of all precomputed queries this worker ran.
+	TArray<int> querylines;
+
+	void StartRecording(FLevelLocals *Level)
+	{
+		if (sectorstamps.Size() != Level->sectors.Size() || sectorstamp == INT_MAX)
+		{
+			sectorstamps.Resize(Level->sectors.Size());
+			if (sectorstamps.Size() > 0) memset(&sectorstamps[0], 0, sectorstamps.Size() * sizeof(int));
+			sectorstamp = 0;
+		}
+		sectorstamp++;
+		touchedsectors.Clear();
+		touchedlines.Clear();
+		recording = true;
+	}
+
+	void RecordLine(line_t *ld)
+	{
+		if (recording) touchedlines.Push(ld->Index());
+	}
+
+	void RecordSector(sector_t *sec)
+	{
+		if (!recording || sec == nullptr) return;
+
+		int &s = sectorstamps[sec->Index()];
+		if (s == sectorstamp) return;
+		s = sectorstamp;
+		touchedsectors.Push(sec->Index());
+
+		// 3D floors are moved through their control sector.
+		for (auto rover : sec->e->XFloor.ffloors)
+		{
+			RecordSector(rover->model);
+		}
+	}
+
+	int NewStamp(FLevelLocals *Level)
+	{
+		if (linestamps.Size() != Level->lines.Size() || polystamps.Size() != Level->Polyobjects.Size() || stamp == INT_MAX)
+		{
+			linestamps.Resize(Level->lines.Size());
+			polystamps.Resize(Level->Polyobjects.Size());
+			if (linestamps.Size() > 0) memset(&linestamps[0], 0, linestamps.Size() * sizeof(int));
+			if (polystamps.Size() > 0) memset(&polystamps[0], 0, polystamps.Size() * sizeof(int));
+			stamp = 0;
+		}
+		return ++stamp;
+	}
+};
+
+// Used by P_CheckSight, which may only be called from the main thread.
+static SightBuffers sightbuffers;
+// One set per worker for P_CheckSightBatch.
+static TArray<SightBuffers> BatchSightBuffers;
 
 class SightCheck
 {
 	FLevelLocals *Level;
+	SightBuffers &buf;
+	int stamp;
 	DVector3 sightstart;
 	DVector2 sightend;
 	double Startfrac;
@@ -117,9 +203,11 @@ class SightCheck
 	bool LineBlocksSight(line_t *ld);
 
 public:
-	SightCheck(FLevelLocals *l)
+	SightCheck(FLevelLocals *l, SightBuffers &b)
+		: buf(b)
 	{
 		Level = l;
+		stamp = 0;
 	}
 
 	bool P_SightPathTraverse ();
@@ -216,6 +304,8 @@ bool SightCheck::PTR_SightTraverse (intercept_t *in)
 	int  frontflag = -1;
 
 	li = in->d.line;
+	buf.RecordSector(li->frontsector);
+	buf.RecordSector(li->backsector);
 
 //
 // crosses a two sided line
@@ -279,16 +369,16 @@ bool SightCheck::PTR_SightTraverse (intercept_t *in)
 
 		if (portaldir != sector_t::floor && (open.portalflags & SO_TOPBACK) && !(open.portalflags & SO_TOPFRONT))
 		{
-			portals.Push({ in->frac, topslope, bottomslope, sector_t::ceiling, backsec->GetOppositePortalGroup(sector_t::ceiling) });
+			buf.portals.Push({ in->frac, topslope, bottomslope, sector_t::ceiling, backsec->GetOppositePortalGroup(sector_t::ceiling) });
 		}
 		if (portaldir != sector_t::ceiling && (open.portalflags & SO_BOTTOMBACK) && !(open.portalflags & SO_BOTTOMFRONT))
 		{
-			portals.Push({ in->frac, topslope, bottomslope, sector_t::floor, backsec->GetOppositePortalGroup(sector_t::floor) });
+			buf.portals.Push({ in->frac, topslope, bottomslope, sector_t::floor, backsec->GetOppositePortalGroup(sector_t::floor) });
 		}
 	}
 	if (lport != nullptr && lport->mDestination != nullptr)
 	{
-		portals.Push({ in->frac, topslope, bottomslope, portaldir, lport->mDestination->frontsector->PortalGroup });
+		buf.portals.Push({ in->frac, topslope, bottomslope, portaldir, lport->mDestination->frontsector->PortalGroup });
 		return false;
 	}
 
@@ -434,11 +524,12 @@ bool SightCheck::P_SightCheckLine (line_t *ld)
 {
 	divline_t dl;
 
-	if (ld->validcount == validcount)
+	int &linestamp = buf.linestamps[ld->Index()];
+	if (linestamp == stamp)
 	{
 		return true;
 	}
-	ld->validcount = validcount;
+	linestamp = stamp;
 	if (P_PointOnDivlineSide (ld->v1->fPos(), &Trace) ==
 		P_PointOnDivlineSide (ld->v2->fPos(), &Trace))
 	{
@@ -450,18 +541,19 @@ bool SightCheck::P_SightCheckLine (line_t *ld)
 	{
 		return true;		// line isn't crossed
 	}
+	buf.RecordLine(ld);
 
 	if (!portalfound)	// when portals come into play, the quick-outs here may not be performed
 	{
 		if (LineBlocksSight(ld)) return false;
 	}
 
-	sightcounts[3]++;
+	buf.sightcounts[3]++;
 	// store the line for later intersection testing
 	intercept_t newintercept;
 	newintercept.isaline = true;
 	newintercept.d.line = ld;
-	intercepts.Push (newintercept);
+	buf.intercepts.Push (newintercept);
 
 	return true;
 }
@@ -495,9 +587,10 @@ int SightCheck::P_SightBlockLinesIterator (int x, int y)
 	{
 		if (polyLink->polyobj)
 		{ // only check non-empty links
-			if (polyLink->polyobj->validcount != validcount)
+			int &polystamp = buf.polystamps[polyLink->polyobj - Level->Polyobjects.Data()];
+			if (polystamp != stamp)
 			{
-				polyLink->polyobj->validcount = validcount;
+				polystamp = stamp;
 				for (i = 0; i < polyLink->polyobj->Linedefs.Size(); i++)
 				{
 					if (!P_SightCheckLine(polyLink->polyobj->Linedefs[i]))
@@ -540,13 +633,13 @@ bool SightCheck::P_SightTraverseIntercepts ()
 	unsigned scanpos;
 	divline_t dl;
 
-	count = intercepts.Size ();
+	count = buf.intercepts.Size ();
 //
 // calculate intercept distance
 //
-	for (scanpos = 0; scanpos < intercepts.Size (); scanpos++)
+	for (scanpos = 0; scanpos < buf.intercepts.Size (); scanpos++)
 	{
-		scan = &intercepts[scanpos];
+		scan = &buf.intercepts[scanpos];
 		P_MakeDivline (scan->d.line, &dl);
 		scan->frac = P_InterceptVector (&Trace, &dl);
 		if (scan->frac < Startfrac)
@@ -565,9 +658,9 @@ bool SightCheck::P_SightTraverseIntercepts ()
 	while (count--)
 	{
 		dist = INT_MAX;
-		for (scanpos = 0; scanpos < intercepts.Size (); scanpos++)
+		for (scanpos = 0; scanpos < buf.intercepts.Size (); scanpos++)
 		{
-			scan = &intercepts[scanpos];
+			scan = &buf.intercepts[scanpos];
 			if (scan->frac < dist)
 			{
 				dist = scan->frac;
@@ -627,13 +720,15 @@ bool SightCheck::P_SightPathTraverse ()
 	int mapx, mapy, mapxstep, mapystep;
 	int count;
 
-	validcount++;
-	intercepts.Clear ();
+	stamp = buf.NewStamp(Level);
+	buf.intercepts.Clear ();
 	x1 = sightstart.X + Startfrac * Trace.dx;
 	y1 = sightstart.Y + Startfrac * Trace.dy;
 	x2 = sightend.X;
 	y2 = sightend.Y;
 	if (lastsector == NULL) lastsector = Level->PointInSector(x1, y1);
+	buf.RecordSector(lastsector);
+	buf.RecordSector(seeingthing->Sector);
 
 	// for FF_SEETHROUGH the following rule applies:
 	// If the viewer is in an area without FF_SEETHROUGH he can only see into areas without this flag
@@ -660,11 +755,11 @@ bool SightCheck::P_SightPathTraverse ()
 	// We also must check if the starting sector contains  portals, and start sight checks in those as well.
 	if (portaldir != sector_t::floor && checkceiling && !lastsector->PortalBlocksSight(sector_t::ceiling))
 	{
-		portals.Push({ 0, topslope, bottomslope, sector_t::ceiling, lastsector->GetOppositePortalGroup(sector_t::ceiling) });
+		buf.portals.Push({ 0, topslope, bottomslope, sector_t::ceiling, lastsector->GetOppositePortalGroup(sector_t::ceiling) });
 	}
 	if (portaldir != sector_t::ceiling && checkfloor && !lastsector->PortalBlocksSight(sector_t::floor))
 	{
-		portals.Push({ 0, topslope, bottomslope, sector_t::floor, lastsector->GetOppositePortalGroup(sector_t::floor) });
+		buf.portals.Push({ 0, topslope, bottomslope, sector_t::floor, lastsector->GetOppositePortalGroup(sector_t::floor) });
 	}
 
 	x1 -= Level->blockmap.bmaporgx;
@@ -760,7 +855,7 @@ bool SightCheck::P_SightPathTraverse ()
 		itres = P_SightBlockLinesIterator(mapx, mapy);
 		if (itres == 0)
 		{
-			sightcounts[1]++;
+			buf.sightcounts[1]++;
 			return false;	// early out
 		}
 
@@ -771,7 +866,7 @@ bool SightCheck::P_SightPathTraverse ()
 		switch (((xs_FloorToInt(yintercept) == mapy) << 1) | (xs_FloorToInt(xintercept) == mapx))
 		{
 		case 0:		// neither xintercept nor yintercept match!
-sightcounts[5]++;
+buf.sightcounts[5]++;
 			// Continuing won't make things any better, so we might as well stop right here
 			count = 1000;
 			break;
@@ -791,7 +886,7 @@ sightcounts[5]++;
 			break;
 
 		case 3:		// xintercept and yintercept both match
-			sightcounts[4]++;
+			buf.sightcounts[4]++;
 			// The trace is exiting a block through its corner. Not only does the block
 			// being entered need to be checked (which will happen when this loop
 			// continues), but the other two blocks adjacent to the corner also need to
@@ -799,7 +894,7 @@ sightcounts[5]++;
 			if (!P_SightBlockLinesIterator (mapx + mapxstep, mapy) ||
 				!P_SightBlockLinesIterator (mapx, mapy + mapystep))
 			{
-sightcounts[1]++;
+buf.sightcounts[1]++;
 				return false;
 			}
 			xintercept += xstep;
@@ -818,7 +913,7 @@ sightcounts[1]++;
 //
 // couldn't early out, so go through the sorted list
 //
-sightcounts[2]++;
+buf.sightcounts[2]++;
 
 	bool traverseres = P_SightTraverseIntercepts ( );
 	if (itres == -1) return false;	// if the iterator had an early out there was no line of sight. The traverser was only called to collect more portals.
@@ -826,6 +921,589 @@ sightcounts[2]++;
 	return traverseres;
 }
 
+/*
+=====================
+=
+= P_SightTraverse
+=
+= Does the actual line of sight traversal from t1's eyes to t2,
+= including all portals that get crossed on the way.
+=
+=====================
+*/
+
+static bool P_SightTraverse (AActor *t1, AActor *t2, int flags, SightBuffers &buf)
+{
+	sector_t *sec;
+	double lookheight = t1->Z() + t1->Height*0.75;
+	t1->GetPortalTransition(lookheight, &sec);
+
+	double bottomslope = t2->Z() - lookheight;
+	double topslope = bottomslope + t2->Height;
+	SightTask task = { 0, topslope, bottomslope, -1, sec->PortalGroup };
+
+	buf.portals.Clear();
+	SightCheck s(t1->Level, buf);
+	s.init(t1, t2, sec, &task, flags);
+	if (s.P_SightPathTraverse ())
+	{
+		return true;
+	}
+
+	double dist = t1->Distance2D(t2);
+	for (unsigned i = 0; i < buf.portals.Size(); i++)
+	{
+		buf.portals[i].Frac += 1 / dist;
+		s.init(t1, t2, NULL, &buf.portals[i], flags);
+		if (s.P_SightPathTraverse())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+//==========================================================================
+//
+// P_BlockedByFakeFloors
+//
+// killough 4/19/98: make fake floors and ceilings block monster view
+//
+//==========================================================================
+
+static bool P_BlockedByFakeFloors (AActor *t1, AActor *t2)
+{
+	auto s1 = t1->Sector;
+	auto s2 = t2->Sector;
+
+	return (s1->GetHeightSec() &&
+		((t1->Top() <= s1->heightsec->floorplane.ZatPoint(t1) &&
+		  t2->Z() >= s1->heightsec->floorplane.ZatPoint(t2)) ||
+		 (t1->Z() >= s1->heightsec->ceilingplane.ZatPoint(t1) &&
+		  t2->Top() <= s1->heightsec->ceilingplane.ZatPoint(t2))))
+		||
+		(s2->GetHeightSec() &&
+		 ((t2->Top() <= s2->heightsec->floorplane.ZatPoint(t2) &&
+		   t1->Z() >= s2->heightsec->floorplane.ZatPoint(t1)) ||
+		  (t2->Z() >= s2->heightsec->ceilingplane.ZatPoint(t2) &&
+		   t1->Top() <= s2->heightsec->ceilingplane.ZatPoint(t1))));
+}
+
+//==========================================================================
+//
+// P_CheckSightNoRandom
+//
+// P_CheckSight without the random chance of seeing invisible actors,
+// i.e. as if SF_IGNOREVISIBILITY was always set. This only reads from
+// the level and the given buffers and can be run on any thread.
+//
+//==========================================================================
+
+static bool P_CheckSightNoRandom (AActor *t1, AActor *t2, int flags, SightBuffers &buf)
+{
+	if (!t1->Level->CheckReject(t1->Sector, t2->Sector))
+	{
+		return false;
+	}
+	if (!(flags & SF_IGNOREWATERBOUNDARY) && P_BlockedByFakeFloors(t1, t2))
+	{
+		return false;
+	}
+	return P_SightTraverse(t1, t2, flags, buf);
+}
+
+//==========================================================================
+//
+// LineSightHash
+//
+// Combines everything about a list of lines that LineBlocksSight looks at.
+// These are all fields ZScript can write to directly, so the only way to
+// notice changes to them is to compare.
+//
+//==========================================================================
+
+static unsigned LineSightHash(FLevelLocals *Level, const int *lines, unsigned count)
+{
+	unsigned hash = 0;
+	for (unsigned i = 0; i < count; i++)
+	{
+		auto &ld = Level->lines[lines[i]];
+		hash = hash * 31 + ld.flags;
+		hash = hash * 31 + ld.activation;
+		hash = hash * 31 + ld.special;
+		hash = hash * 31 + ld.args[1];
+	}
+	return hash;
+}
+
+//==========================================================================
+//
+// P_CheckSightBatch
+//
+// Checks a list of actor pairs at once, spread across all available
+// cores. The results are the same P_CheckSight would return with
+// SF_IGNOREVISIBILITY set. Both actors of every pair must be valid and
+// nothing may modify the level while this is running.
+//
+//==========================================================================
+
+struct SightQuery;
+static TArray<int> SightQueryLines;
+
+static void RunSightBatch (FSightRequest *requests, unsigned count, SightQuery *queries);
+
+void P_CheckSightBatch (FSightRequest *requests, unsigned count)
+{
+	RunSightBatch(requests, count, nullptr);
+}
+
+//==========================================================================
+//
+// Precomputed sight queries
+//
+// Right before the regular actors get ticked the traversals that monsters
+// are about to need in this tic are run on all available cores. P_CheckSight
+// will use these results if neither actor has changed since and nothing
+// that may affect sight has happened in the meantime. All checks that
+// consume random numbers are still done in P_CheckSight itself, so the
+// random number sequence is the same as without precomputation.
+//
+// Anything that can alter map geometry during the actor phase must call
+// P_InvalidateSightQueries. Line specials, ACS, plane movement, polyobject
+// movement and Sector.ClearPortal already do that. The lines each query
+// crossed are remembered as well, so that ZScript writing to line flags or
+// specials directly is noticed too.
+//
+// This changes the amount of work done in a tic but never its outcome.
+// It still is a server setting so that all nodes and demos always agree.
+//
+//==========================================================================
+
+CVAR(Bool, think_parallelsight, false, CVAR_SERVERINFO)
+
+// Only the flags that affect the traversal itself are relevant for the cache.
+enum
+{
+	SF_TRAVERSALFLAGS = SF_SEEPASTSHOOTABLELINES | SF_SEEPASTBLOCKEVERYTHING | SF_IGNOREWATERBOUNDARY,
+	MIN_PARALLEL_SIGHTQUERIES = 64,
+};
+
+struct SightQueryKey
+{
+	AActor *t1, *t2;
+	int flags;
+
+	bool operator!=(const SightQueryKey &other) const
+	{
+		return t1 != other.t1 || t2 != other.t2 || flags != other.flags;
+	}
+};
+
+template<> struct THashTraits<SightQueryKey>
+{
+	hash_t Hash(const SightQueryKey &key)
+	{
+		return (hash_t)(((uintptr_t)key.t1 >> 4) * 31 + ((uintptr_t)key.t2 >> 4)) ^ key.flags;
+	}
+	int Compare(const SightQueryKey &left, const SightQueryKey &right) { return left != right; }
+};
+
+// The state of both actors when the query was run.
+struct SightQuery
+{
+	AActor *t1, *t2;
+	DVector3 pos1, pos2;
+	double height1, height2;
+	sector_t *sector1, *sector2;
+	uint32_t spawnorder1, spawnorder2;
+
+	// The lines the traversal crossed, in SightQueryLines.
+	unsigned firstline, numlines;
+	unsigned linehash;
+
+	bool IsCurrent() const
+	{
+		return t1->Pos() == pos1 && t2->Pos() == pos2 &&
+			t1->Height == height1 && t2->Height == height2 &&
+			t1->Sector == sector1 && t2->Sector == sector2 &&
+			t1->SpawnOrder == spawnorder1 && t2->SpawnOrder == spawnorder2 &&
+			(numlines == 0 || LineSightHash(t1->Level, &SightQueryLines[firstline], numlines) == linehash);
+	}
+};
+
+static TArray<SightQuery> SightQueries;
+static TArray<FSightRequest> SightRequests;
+static TMap<SightQueryKey, unsigned> SightQueryMap;
+static bool SightQueriesValid;
+
+static void AddSightQuery(AActor *t1, AActor *t2, int flags)
+{
+	if (t2 == nullptr || t1 == t2 || !t1->Level->CheckReject(t1->Sector, t2->Sector))
+	{
+		return;
+	}
+
+	SightQueryKey key = { t1, t2, flags };
+	if (SightQueryMap.CheckKey(key) != nullptr)
+	{
+		return;
+	}
+	SightQueryMap[key] = SightQueries.Size();
+
+	SightQuery q = { t1, t2, t1->Pos(), t2->Pos(), t1->Height, t2->Height, t1->Sector, t2->Sector, t1->SpawnOrder, t2->SpawnOrder, 0, 0, 0 };
+	SightQueries.Push(q);
+	SightRequests.Push({ t1, t2, flags, false });
+}
+
+//==========================================================================
+//
+// RunSightBatch
+//
+// If queries is given, the lines each traversal crossed get recorded
+// there as well.
+//
+//==========================================================================
+
+static void RunSightBatch (FSightRequest *requests, unsigned count, SightQuery *queries)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	if (BatchSightBuffers.Size() == 0)
+	{
+		BatchSightBuffers.Resize(clamp<unsigned>(std::thread::hardware_concurrency(), 1, 16));
+	}
+	const int numworkers = (int)MIN(BatchSightBuffers.Size(), count);
+	auto range = [=](int worker, unsigned &first, unsigned &last)
+	{
+		first = unsigned(uint64_t(count) * worker / numworkers);
+		last = unsigned(uint64_t(count) * (worker + 1) / numworkers);
+	};
+
+	parallel_for(numworkers, [=](int worker)
+	{
+		auto &buf = BatchSightBuffers[worker];
+		unsigned first, last;
+		range(worker, first, last);
+		buf.querylines.Clear();
+
+		for (unsigned i = first; i < last; i++)
+		{
+			auto &req = requests[i];
+			if (queries == nullptr)
+			{
+				req.result = P_CheckSightNoRandom(req.t1, req.t2, req.flags, buf);
+				continue;
+			}
+
+			buf.StartRecording(req.t1->Level);
+			req.result = P_CheckSightNoRandom(req.t1, req.t2, req.flags, buf);
+			buf.recording = false;
+
+			auto &q = queries[i];
+			q.firstline = buf.querylines.Size();
+			q.numlines = buf.touchedlines.Size();
+			q.linehash = q.numlines > 0 ? LineSightHash(req.t1->Level, &buf.touchedlines[0], q.numlines) : 0;
+			buf.querylines.Append(buf.touchedlines);
+		}
+	});
+
+	if (queries != nullptr)
+	{
+		// Move the lines from all workers into one array.
+		SightQueryLines.Clear();
+		for (int worker = 0; worker < numworkers; worker++)
+		{
+			unsigned first, last;
+			range(worker, first, last);
+			unsigned base = SightQueryLines.Size();
+			for (unsigned i = first; i < last; i++)
+			{
+				queries[i].firstline += base;
+			}
+			SightQueryLines.Append(BatchSightBuffers[worker].querylines);
+		}
+	}
+}
+
+//==========================================================================
+//
+// P_PrepareSightQueries
+//
+// Only monsters whose state is about to advance will run an action
+// function in this tic, so those are the only ones worth checking.
+// Monsters with a target will check if they can attack it, all others
+// will look for players.
+//
+//==========================================================================
+
+void P_PrepareSightQueries (FLevelLocals *Level)
+{
+	P_InvalidateSightQueries();
+	if (!think_parallelsight)
+	{
+		return;
+	}
+
+	auto it = Level->GetThinkerIterator<AActor>(NAME_None, STAT_DEFAULT);
+	AActor *mo;
+	while ((mo = it.Next()))
+	{
+		if (!(mo->flags3 & MF3_ISMONSTER) || mo->health <= 0 || mo->tics != 1 || mo->isFrozen())
+		{
+			continue;
+		}
+		if (mo->target != nullptr)
+		{
+			AddSightQuery(mo, mo->target, SF_SEEPASTBLOCKEVERYTHING);
+		}
+		else
+		{
+			for (int i = 0; i < MAXPLAYERS; i++)
+			{
+				if (Level->PlayerInGame(i))
+				{
+					AddSightQuery(mo, Level->Players[i]->mo, SF_SEEPASTSHOOTABLELINES);
+				}
+			}
+		}
+	}
+
+	if (SightQueries.Size() < MIN_PARALLEL_SIGHTQUERIES)
+	{
+		P_InvalidateSightQueries();
+		return;
+	}
+
+	RunSightBatch(&SightRequests[0], SightRequests.Size(), &SightQueries[0]);
+	SightQueriesValid = true;
+}
+
+//==========================================================================
+//
+// P_InvalidateSightQueries
+//
+//==========================================================================
+
+void P_InvalidateSightQueries ()
+{
+	if (SightQueries.Size() > 0)
+	{
+		SightQueries.Clear();
+		SightRequests.Clear();
+		SightQueryMap.Clear();
+		SightQueryLines.Clear();
+	}
+	SightQueriesValid = false;
+}
+
+//==========================================================================
+//
+// FindSightQuery
+//
+//==========================================================================
+
+static bool FindSightQuery(AActor *t1, AActor *t2, int flags, bool &res)
+{
+	if (!SightQueriesValid)
+	{
+		return false;
+	}
+	SightQueryKey key = { t1, t2, flags & SF_TRAVERSALFLAGS };
+	auto index = SightQueryMap.CheckKey(key);
+	if (index == nullptr || !SightQueries[*index].IsCurrent())
+	{
+		return false;
+	}
+	res = SightRequests[*index].result;
+	return true;
+}
+
+//==========================================================================
+//
+// Sight result cache
+//
+// Remembers traversal results per pair of subsectors and z-bands of the
+// eye and target. Each result is stored with the sectors and lines the
+// traversal crossed and is discarded as soon as the plane of any of these
+// sectors has moved or anything LineBlocksSight looks at has changed on
+// one of the lines, no matter if that was done by a special or by ZScript
+// writing to the line directly. Polyobject movement, line blocking changes
+// and Sector.ClearPortal flush the whole cache.
+//
+// Two actors in the same subsectors and z-bands do not necessarily have
+// the same line of sight, so this is an approximation and off by default.
+//
+//==========================================================================
+
+CVAR(Bool, sv_sightcache, false, CVAR_SERVERINFO)
+
+enum
+{
+	SIGHTCACHE_ZBAND = 32,
+	MAX_SIGHTCACHE_ENTRIES = 65536,
+	MAX_SIGHTCACHE_SECTORS = 1024 * 1024,
+	MAX_SIGHTCACHE_LINES = 4 * 1024 * 1024,
+};
+
+struct SightCacheKey
+{
+	int ss1, ss2;
+	int eyeband, bottomband, topband;
+	int flags;
+
+	bool operator!=(const SightCacheKey &other) const
+	{
+		return ss1 != other.ss1 || ss2 != other.ss2 || eyeband != other.eyeband ||
+			bottomband != other.bottomband || topband != other.topband || flags != other.flags;
+	}
+};
+
+template<> struct THashTraits<SightCacheKey>
+{
+	hash_t Hash(const SightCacheKey &key)
+	{
+		hash_t h = key.ss1 * 65599 + key.ss2;
+		h = h * 31 + key.eyeband;
+		h = h * 31 + key.bottomband;
+		h = h * 31 + key.topband;
+		return h ^ key.flags;
+	}
+	int Compare(const SightCacheKey &left, const SightCacheKey &right) { return left != right; }
+};
+
+struct SightCacheEntry
+{
+	unsigned firstsector;
+	unsigned numsectors;
+	unsigned changesum;		// sum of changecount over all sectors
+	unsigned firstline;
+	unsigned numlines;
+	unsigned linehash;		// LineSightHash over all lines
+	bool result;
+};
+
+static TMap<SightCacheKey, SightCacheEntry> SightCache;
+static TArray<int> SightCacheSectors;
+static TArray<int> SightCacheLines;
+static FLevelLocals *SightCacheLevel;
+static int SightCacheHits, SightCacheMisses, SightCacheStale;
+
+//==========================================================================
+//
+// P_FlushSightCache
+//
+//==========================================================================
+
+void P_FlushSightCache ()
+{
+	if (SightCache.CountUsed() > 0)
+	{
+		SightCache.Clear();
+	}
+	SightCacheSectors.Clear();
+	SightCacheLines.Clear();
+	SightCacheLevel = nullptr;
+}
+
+//==========================================================================
+//
+// SightCacheChangeSum
+//
+//==========================================================================
+
+static unsigned SightCacheChangeSum(FLevelLocals *Level, const int *sectors, unsigned count)
+{
+	unsigned sum = 0;
+	for (unsigned i = 0; i < count; i++)
+	{
+		sum += Level->sectors[sectors[i]].changecount;
+	}
+	return sum;
+}
+
+//==========================================================================
+//
+// P_CachedSightTraverse
+//
+//==========================================================================
+
+static bool P_CachedSightTraverse (AActor *t1, AActor *t2, int flags)
+{
+	auto Level = t1->Level;
+	if (t1->subsector == nullptr || t2->subsector == nullptr)
+	{
+		return P_SightTraverse(t1, t2, flags, sightbuffers);
+	}
+	if (Level != SightCacheLevel)
+	{
+		P_FlushSightCache();
+		SightCacheLevel = Level;
+	}
+
+	SightCacheKey key;
+	key.ss1 = t1->subsector->Index();
+	key.ss2 = t2->subsector->Index();
+	key.eyeband = xs_FloorToInt((t1->Z() + t1->Height * 0.75) / SIGHTCACHE_ZBAND);
+	key.bottomband = xs_FloorToInt(t2->Z() / SIGHTCACHE_ZBAND);
+	key.topband = xs_FloorToInt(t2->Top() / SIGHTCACHE_ZBAND);
+	key.flags = flags & SF_TRAVERSALFLAGS;
+
+	auto entry = SightCache.CheckKey(key);
+	if (entry != nullptr)
+	{
+		if (entry->changesum == SightCacheChangeSum(Level, &SightCacheSectors[entry->firstsector], entry->numsectors) &&
+			(entry->numlines == 0 || entry->linehash == LineSightHash(Level, &SightCacheLines[entry->firstline], entry->numlines)))
+		{
+			SightCacheHits++;
+			return entry->result;
+		}
+		SightCacheStale++;
+	}
+	else
+	{
+		SightCacheMisses++;
+	}
+
+	sightbuffers.StartRecording(Level);
+	bool res = P_SightTraverse(t1, t2, flags, sightbuffers);
+	sightbuffers.recording = false;
+
+	auto &touched = sightbuffers.touchedsectors;
+	auto &lines = sightbuffers.touchedlines;
+	if (SightCache.CountUsed() >= MAX_SIGHTCACHE_ENTRIES || SightCacheSectors.Size() + touched.Size() > MAX_SIGHTCACHE_SECTORS ||
+		SightCacheLines.Size() + lines.Size() > MAX_SIGHTCACHE_LINES)
+	{
+		P_FlushSightCache();
+		SightCacheLevel = Level;
+		entry = nullptr;
+	}
+
+	SightCacheEntry newentry;
+	newentry.firstsector = SightCacheSectors.Size();
+	newentry.numsectors = touched.Size();
+	newentry.changesum = touched.Size() > 0 ? SightCacheChangeSum(Level, &touched[0], touched.Size()) : 0;
+	newentry.firstline = SightCacheLines.Size();
+	newentry.numlines = lines.Size();
+	newentry.linehash = lines.Size() > 0 ? LineSightHash(Level, &lines[0], lines.Size()) : 0;
+	newentry.result = res;
+	SightCacheSectors.Append(touched);
+	SightCacheLines.Append(lines);
+	if (entry != nullptr) *entry = newentry;
+	else SightCache.Insert(key, newentry);
+	return res;
+}
+
+ADD_STAT (sightcache)
+{
+	FString out;
+	out.Format("%d hits, %d misses, %d stale, %d entries, %u sectors, %u lines",
+		SightCacheHits, SightCacheMisses, SightCacheStale, (int)SightCache.CountUsed(), SightCacheSectors.Size(), SightCacheLines.Size());
+	return out;
+}
+
 /*
 =====================
 =
@@ -857,7 +1535,7 @@ int P_CheckSight (AActor *t1, AActor *t2, int flags)
 	//
 	if (!t1->Level->CheckReject(s1, s2))
 	{
-sightcounts[0]++;
+sightbuffers.sightcounts[0]++;
 		res = false;			// can't possibly be connected
 		goto done;
 	}
@@ -878,57 +1556,18 @@ sightcounts[0]++;
 
 	// killough 4/19/98: make fake floors and ceilings block monster view
 
-	if (!(flags & SF_IGNOREWATERBOUNDARY))
+	if (!(flags & SF_IGNOREWATERBOUNDARY) && P_BlockedByFakeFloors(t1, t2))
 	{
-		if ((s1->GetHeightSec() &&
-			((t1->Top() <= s1->heightsec->floorplane.ZatPoint(t1) &&
-			  t2->Z() >= s1->heightsec->floorplane.ZatPoint(t2)) ||
-			 (t1->Z() >= s1->heightsec->ceilingplane.ZatPoint(t1) &&
-			  t2->Top() <= s1->heightsec->ceilingplane.ZatPoint(t2))))
-			||
-			(s2->GetHeightSec() &&
-			 ((t2->Top() <= s2->heightsec->floorplane.ZatPoint(t2) &&
-			   t1->Z() >= s2->heightsec->floorplane.ZatPoint(t1)) ||
-			  (t2->Z() >= s2->heightsec->ceilingplane.ZatPoint(t2) &&
-			   t1->Top() <= s2->heightsec->ceilingplane.ZatPoint(t1)))))
-		{
-			res = false;
-			goto done;
-		}
+		res = false;
+		goto done;
 	}
 
 	// An unobstructed LOS is possible.
 	// Now look from eyes of t1 to any part of t2.
 
-	validcount++;
-	portals.Clear();
+	if (!FindSightQuery(t1, t2, flags, res))
 	{
-		sector_t *sec;
-		double lookheight = t1->Z() + t1->Height*0.75;
-		t1->GetPortalTransition(lookheight, &sec);
-
-		double bottomslope = t2->Z() - lookheight;
-		double topslope = bottomslope + t2->Height;
-		SightTask task = { 0, topslope, bottomslope, -1, sec->PortalGroup };
-
-
-		SightCheck s(t1->Level);
-		s.init(t1, t2, sec, &task, flags);
-		res = s.P_SightPathTraverse ();
-		if (!res)
-		{
-			double dist = t1->Distance2D(t2);
-			for (unsigned i = 0; i < portals.Size(); i++)
-			{
-				portals[i].Frac += 1 / dist;
-				s.init(t1, t2, NULL, &portals[i], flags);
-				if (s.P_SightPathTraverse())
-				{
-					res = true;
-					break;
-				}
-			}
-		}
+		res = sv_sightcache ? P_CachedSightTraverse(t1, t2, flags) : P_SightTraverse(t1, t2, flags, sightbuffers);
 	}
 
 done:
@@ -939,6 +1578,7 @@ done:
 ADD_STAT (sight)
 {
 	FString out;
+	auto &sightcounts = sightbuffers.sightcounts;
 	out.Format ("%04.1f ms (%04.1f max), %5d %2d%4d%4d%4d%4d\n",
 		SightCycles.TimeMS(), MaxSightCycles.TimeMS(),
 		sightcounts[3], sightcounts[0], sightcounts[1], sightcounts[2], sightcounts[4], sightcounts[5]);
@@ -956,5 +1596,82 @@ void P_ResetSightCounters (bool full)
 		MaxSightCycles = SightCycles;
 	}
 	SightCycles.Reset();
-	memset (sightcounts, 0, sizeof(sightcounts));
+	memset (sightbuffers.sightcounts, 0, sizeof(sightbuffers.sightcounts));
+	SightCacheHits = SightCacheMisses = SightCacheStale = 0;
+}
+
+//==========================================================================
+//
+// CCMD sightbench
+//
+// Checks every monster in the level against every player and its current
+// target, first one at a time and then as a batch, and reports the
+// throughput of both.
+//
+//==========================================================================
+
+CCMD (sightbench)
+{
+	if (gamestate != GS_LEVEL)
+	{
+		Printf("sightbench: not in a level\n");
+		return;
+	}
+
+	int repeat = argv.argc() > 1 ? clamp(atoi(argv[1]), 1, 1000) : 10;
+	auto Level = primaryLevel;
+	TArray<FSightRequest> requests;
+
+	auto it = Level->GetThinkerIterator<AActor>();
+	AActor *mo;
+	while ((mo = it.Next()) != nullptr)
+	{
+		if (!(mo->flags3 & MF3_ISMONSTER) || mo->health <= 0) continue;
+
+		if (mo->target != nullptr)
+		{
+			requests.Push({ mo, mo->target, SF_SEEPASTBLOCKEVERYTHING, false });
+		}
+		for (int i = 0; i < MAXPLAYERS; i++)
+		{
+			if (Level->PlayerInGame(i) && Level->Players[i]->mo != nullptr)
+			{
+				requests.Push({ mo, Level->Players[i]->mo, SF_SEEPASTSHOOTABLELINES, false });
+			}
+		}
+	}
+
+	if (requests.Size() == 0)
+	{
+		Printf("sightbench: no monsters\n");
+		return;
+	}
+
+	cycle_t serial, batch;
+	serial.Reset();
+	batch.Reset();
+	int visible = 0;
+
+	serial.Clock();
+	for (int r = 0; r < repeat; r++)
+	{
+		for (auto &req : requests)
+		{
+			req.result = P_CheckSightNoRandom(req.t1, req.t2, req.flags, sightbuffers);
+		}
+	}
+	serial.Unclock();
+	for (auto &req : requests) visible += req.result;
+
+	batch.Clock();
+	for (int r = 0; r < repeat; r++)
+	{
+		P_CheckSightBatch(&requests[0], requests.Size());
+	}
+	batch.Unclock();
+
+	double total = double(requests.Size()) * repeat;
+	Printf("%u checks x %d, %d visible\n", requests.Size(), repeat, visible);
+	Printf("serial: %.3f ms, %.0f checks/s\n", serial.TimeMS(), total * 1000. / MAX(serial.TimeMS(), 1e-6));
+	Printf("batch:  %.3f ms, %.0f checks/s (%u threads)\n", batch.TimeMS(), total * 1000. / MAX(batch.TimeMS(), 1e-6), MIN(BatchSightBuffers.Size(), requests.Size()));
 }
@@ -859,6 +859,8 @@ void FPolyObj::CalcCenter()
 bool FPolyObj::MovePolyobj (const DVector2 &pos, bool force)
 {
 	FBoundingBox oldbounds = Bounds;
+	P_InvalidateSightQueries();
+	P_FlushSightCache();
 	UnLinkPolyobj ();
 	DoMovePolyobj (pos);
 
@@ -941,6 +943,8 @@ bool FPolyObj::RotatePolyobj (DAngle angle, bool fromsave)
 
 	an = Angle + angle;
 
+	P_InvalidateSightQueries();
+	P_FlushSightCache();
 	UnLinkPolyobj();
 
 	for(unsigned i=0;i < Vertices.Size(); i++)
@@ -41,6 +41,15 @@
 #include "cmdlib.h"
 #include "v_text.h"
 #include "w_wad.h"
+#include "c_cvars.h"
+#include "templates.h"
+#include <algorithm>
+
+// Solid archives compress many files into one block, so reading a single
+// file means decoding everything in front of it. This many megabytes of
+// decoded blocks are kept per archive, in addition to the last one used.
+// The blocks decoded during startup are dropped once it is done.
+CVAR(Int, archive_blockcache, 16, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
 
 
 
@@ -106,6 +115,13 @@ struct CZDFileInStream
 
 struct C7zArchive
 {
+	struct CBlock
+	{
+		UInt32 Index;
+		Byte *Buffer;
+		size_t Size;
+	};
+
 	CSzArEx DB;
 	CZDFileInStream ArchiveStream;
 	CLookToRead2 LookStream;
@@ -113,6 +129,8 @@ struct C7zArchive
 	UInt32 BlockIndex;
 	Byte *OutBuffer;
 	size_t OutBufferSize;
+	TArray<CBlock> Blocks;		// previously decoded blocks, most recently used first
+	size_t BlocksSize;
 
 	C7zArchive(FileReader &file) : ArchiveStream(file)
 	{
@@ -130,6 +148,7 @@ struct C7zArchive
 		BlockIndex = 0xFFFFFFFF;
 		OutBuffer = NULL;
 		OutBufferSize = 0;
+		BlocksSize = 0;
 	}
 
 	~C7zArchive()
@@ -138,9 +157,60 @@ struct C7zArchive
 		{
 			IAlloc_Free(&g_Alloc, OutBuffer);
 		}
+		FreeBlocks();
 		SzArEx_Free(&DB, &g_Alloc);
 	}
 
+	void FreeBlocks()
+	{
+		for (auto &block : Blocks)
+		{
+			IAlloc_Free(&g_Alloc, block.Buffer);
+		}
+		Blocks.Clear();
+		BlocksSize = 0;
+	}
+
+	// The 7z SDK only reuses the block it decoded last. Park that one in the
+	// cache and take the wanted block out of it if it has been decoded before.
+	void SelectBlock(UInt32 file_index)
+	{
+		UInt32 folder = DB.FileToFolder[file_index];
+		if (folder == (UInt32)-1 || (folder == BlockIndex && OutBuffer != NULL))
+			return;
+
+		if (OutBuffer != NULL)
+		{
+			Blocks.Insert(0, { BlockIndex, OutBuffer, OutBufferSize });
+			BlocksSize += OutBufferSize;
+		}
+		BlockIndex = 0xFFFFFFFF;
+		OutBuffer = NULL;
+		OutBufferSize = 0;
+
+		for (unsigned i = 0; i < Blocks.Size(); i++)
+		{
+			if (Blocks[i].Index == folder)
+			{
+				BlockIndex = folder;
+				OutBuffer = Blocks[i].Buffer;
+				OutBufferSize = Blocks[i].Size;
+				BlocksSize -= Blocks[i].Size;
+				Blocks.Delete(i);
+				break;
+			}
+		}
+
+		size_t limit = (size_t)MAX(*archive_blockcache, 0) << 20;
+		while (BlocksSize > limit)
+		{
+			auto &block = Blocks.Last();
+			IAlloc_Free(&g_Alloc, block.Buffer);
+			BlocksSize -= block.Size;
+			Blocks.Pop();
+		}
+	}
+
 	SRes Open()
 	{
 		return SzArEx_Open(&DB, &LookStream.vt, &g_Alloc, &g_Alloc);
@@ -149,6 +219,7 @@ struct C7zArchive
 	SRes Extract(UInt32 file_index, char *buffer)
 	{
 		size_t offset, out_size_processed;
+		SelectBlock(file_index);
 		SRes res = SzArEx_Extract(&DB, &LookStream.vt, file_index,
 			&BlockIndex, &OutBuffer, &OutBufferSize,
 			&offset, &out_size_processed,
@@ -193,6 +264,8 @@ public:
 	bool Open(bool quiet);
 	virtual ~F7ZFile();
 	virtual FResourceLump *GetLump(int no) { return ((unsigned)no < NumLumps)? &Lumps[no] : NULL; }
+	virtual void CacheLumps(TArray<FResourceLump *> &lumps);
+	virtual void ReleaseCaches();
 };
 
 
@@ -338,6 +411,37 @@ F7ZFile::~F7ZFile()
 	}
 }
 
+//==========================================================================
+//
+// Extracts the lumps in archive order. The files of a solid block are
+// stored one after another, so this decodes every block only once, no
+// matter how small the block cache is.
+//
+//==========================================================================
+
+void F7ZFile::CacheLumps(TArray<FResourceLump *> &lumps)
+{
+	std::sort(lumps.begin(), lumps.end(), [](FResourceLump *a, FResourceLump *b)
+	{
+		return static_cast<F7ZLump *>(a)->Position < static_cast<F7ZLump *>(b)->Position;
+	});
+	FResourceFile::CacheLumps(lumps);
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+void F7ZFile::ReleaseCaches()
+{
+	if (Archive != NULL)
+	{
+		Archive->FreeBlocks();
+	}
+}
+
 //==========================================================================
 //
 // Fills the lump cache and performs decompression
@@ -599,6 +599,30 @@ void FResourceFile::FindStrifeTeaserVoices ()
 {
 }
 
+//==========================================================================
+//
+// Caches a batch of lumps. A lump that cannot be read is left uncached so
+// that the error shows up where it is actually used.
+//
+//==========================================================================
+
+void FResourceFile::CacheLumps(TArray<FResourceLump *> &lumps)
+{
+	for (auto lump : lumps)
+	{
+		try
+		{
+			lump->CacheLump();
+		}
+		catch (...)
+		{
+			delete[] lump->Cache;
+			lump->Cache = nullptr;
+			lump->RefCount = 0;
+		}
+	}
+}
+
 //==========================================================================
 //
 // Finds a lump by a given name. Used for savegames
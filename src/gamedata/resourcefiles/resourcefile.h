@@ -116,6 +116,8 @@ public:
 	virtual void FindStrifeTeaserVoices ();
 	virtual bool Open(bool quiet) = 0;
 	virtual FResourceLump *GetLump(int no) = 0;
+	virtual void CacheLumps(TArray<FResourceLump *> &lumps);	// caches a batch of this file's lumps, in whatever order suits the file best
+	virtual void ReleaseCaches() {}		// frees data kept around to speed up reading many lumps
 	FResourceLump *FindLump(const char *name);
 };
 
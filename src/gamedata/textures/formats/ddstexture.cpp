@@ -288,6 +288,7 @@ FDDSTexture::FDDSTexture (FileReader &lump, int lumpnum, void *vsurfdesc)
 	DDSURFACEDESC2 *surf = (DDSURFACEDESC2 *)vsurfdesc;
 
 	bMasked = false;
+	bDiskCache = true;
 	Width = uint16_t(surf->Width);
 	Height = uint16_t(surf->Height);
 
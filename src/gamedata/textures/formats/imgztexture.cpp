@@ -122,8 +122,8 @@ FIMGZTexture::FIMGZTexture (int lumpnum, uint16_t w, uint16_t h, int16_t l, int1
 
 TArray<uint8_t> FIMGZTexture::CreatePalettedPixels(int conversion)
 {
-	FMemLump lump = Wads.ReadLump (SourceLump);
-	const ImageHeader *imgz = (const ImageHeader *)lump.GetMem();
+	FLumpView lump = Wads.ViewLump (SourceLump);
+	const ImageHeader *imgz = (const ImageHeader *)lump.Data();
 	const uint8_t *data = (const uint8_t *)&imgz[1];
 
 	uint8_t *dest_p;
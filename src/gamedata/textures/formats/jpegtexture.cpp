@@ -249,6 +249,7 @@ FJPEGTexture::FJPEGTexture (int lumpnum, int width, int height)
 : FImageSource(lumpnum)
 {
 	bMasked = false;
+	bDiskCache = true;
 
 	Width = width;
 	Height = height;
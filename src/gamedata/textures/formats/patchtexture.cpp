@@ -170,8 +170,8 @@ TArray<uint8_t> FPatchTexture::CreatePalettedPixels(int conversion)
 	const column_t *maxcol;
 	int x;
 
-	FMemLump lump = Wads.ReadLump (SourceLump);
-	const patch_t *patch = (const patch_t *)lump.GetMem();
+	FLumpView lump = Wads.ViewLump (SourceLump);
+	const patch_t *patch = (const patch_t *)lump.Data();
 
 	maxcol = (const column_t *)((const uint8_t *)patch + Wads.LumpLength (SourceLump) - 3);
 
@@ -280,8 +280,8 @@ void FPatchTexture::DetectBadPatches ()
 	// Check if this patch is likely to be a problem.
 	// It must be 256 pixels tall, and all its columns must have exactly
 	// one post, where each post has a supposed length of 0.
-	FMemLump lump = Wads.ReadLump (SourceLump);
-	const patch_t *realpatch = (patch_t *)lump.GetMem();
+	FLumpView lump = Wads.ViewLump (SourceLump);
+	const patch_t *realpatch = (const patch_t *)lump.Data();
 	const uint32_t *cofs = realpatch->columnofs;
 	int x, x2 = LittleShort(realpatch->width);
 
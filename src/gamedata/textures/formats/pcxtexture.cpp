@@ -145,6 +145,7 @@ FPCXTexture::FPCXTexture(int lumpnum, PCXHeader & hdr)
 : FImageSource(lumpnum)
 {
 	bMasked = false;
+	bDiskCache = true;
 	Width = LittleShort(hdr.xmax) - LittleShort(hdr.xmin) + 1;
 	Height = LittleShort(hdr.ymax) - LittleShort(hdr.ymin) + 1;
 }
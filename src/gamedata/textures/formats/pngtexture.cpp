@@ -161,6 +161,7 @@ FPNGTexture::FPNGTexture (FileReader &lump, int lumpnum, int width, int height,
 	int i;
 
 	bMasked = false;
+	bDiskCache = true;
 
 	Width = width;
 	Height = height;
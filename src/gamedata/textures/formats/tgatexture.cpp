@@ -135,6 +135,7 @@ FTGATexture::FTGATexture (int lumpnum, TGAHeader * hdr)
 	Height = hdr->height;
 	// Alpha channel is used only for 32 bit RGBA and paletted images with RGBA palettes.
 	bMasked = (hdr->img_desc&15)==8 && (hdr->bpp==32 || (hdr->img_type==1 && hdr->cm_size==32));
+	bDiskCache = true;
 }
 
 //==========================================================================
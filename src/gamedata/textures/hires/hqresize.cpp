@@ -44,6 +44,7 @@
 #include "xbr/xbrz_old.h"
 #include "parallel_for.h"
 #include "hwrenderer/textures/hw_material.h"
+#include "textures/texturecache.h"
 
 EXTERN_CVAR(Int, gl_texture_hqresizemult)
 CUSTOM_CVAR(Int, gl_texture_hqresizemode, 0, CVAR_ARCHIVE | CVAR_GLOBALCONFIG | CVAR_NOINITCALL)
@@ -346,6 +347,32 @@ static void xbrzOldScale(size_t factor, const uint32_t* src, uint32_t* trg, int
 }
 
 
+//===========================================================================
+//
+// Replaces the buffer with the upsampled version from the disk cache.
+//
+//===========================================================================
+
+static bool ReadCachedBuffer(FTextureBuffer &texbuffer, const FTextureDiskCache::FKey &key, int mult)
+{
+	int outWidth = texbuffer.mWidth * mult;
+	int outHeight = texbuffer.mHeight * mult;
+	int trans;
+	bool masked;
+
+	unsigned char *newBuffer = new unsigned char[outWidth*outHeight*4];
+	if (!FTextureDiskCache::Read(key, newBuffer, outWidth*outHeight*4, trans, masked))
+	{
+		delete[] newBuffer;
+		return false;
+	}
+	delete[] texbuffer.mBuffer;
+	texbuffer.mBuffer = newBuffer;
+	texbuffer.mWidth = outWidth;
+	texbuffer.mHeight = outHeight;
+	return true;
+}
+
 //===========================================================================
 // 
 // [BB] Upsamples the texture in texbuffer.mBuffer, frees texbuffer.mBuffer and returns
@@ -400,7 +427,18 @@ void FTexture::CreateUpsampledTextureBuffer(FTextureBuffer &texbuffer, bool hasA
 	if (mult < 2 || mult > 6 || type < 1 || type > 6) return;
 	if (type < 4 && mult > 4) mult = 4;
 
-	if (!checkonly)
+	// Translated copies and font characters would fill the cache with lots of small entries.
+	FContentIdBuilder sourceId;
+	sourceId.id = texbuffer.mContentId;
+	FTextureDiskCache::FKey key;
+	bool usecache = !checkonly && sourceId.translation == 0 && UseType != ETextureType::FontChar &&
+		FTextureDiskCache::BufferKey(texbuffer.mBuffer, inWidth, inHeight, type, mult, key);
+
+	if (usecache && ReadCachedBuffer(texbuffer, key, mult))
+	{
+		// The scaler's output from an earlier session was still on disk.
+	}
+	else if (!checkonly)
 	{
 		if (type == 1)
 		{
@@ -442,6 +480,11 @@ void FTexture::CreateUpsampledTextureBuffer(FTextureBuffer &texbuffer, bool hasA
 			texbuffer.mBuffer = normalNxHelper(&normalNx, mult, texbuffer.mBuffer, inWidth, inHeight, texbuffer.mWidth, texbuffer.mHeight);
 		else
 			return;
+
+		if (usecache)
+		{
+			FTextureDiskCache::Write(key, texbuffer.mBuffer, texbuffer.mWidth * texbuffer.mHeight * 4, 0, false);
+		}
 	}
 	else
 	{
@@ -39,6 +39,7 @@
 #include "image.h"
 #include "w_wad.h"
 #include "files.h"
+#include "texturecache.h"
 
 FMemArena FImageSource::ImageArena(32768);
 TArray<FImageSource *>FImageSource::ImageForLump;
@@ -119,7 +120,7 @@ PalettedPixels FImageSource::GetCachedPalettedPixels(int conversion)
 		{
 			// This is either the only copy needed or some access outside the caching block. In these cases create a new one and directly return it.
 			//Printf("returning fresh copy of %s\n", name.GetChars());
-			ret.PixelStore = CreatePalettedPixels(conversion);
+			ret.PixelStore = CreateOrLoadPalettedPixels(conversion);
 			ret.Pixels.Set(ret.PixelStore.Data(), ret.PixelStore.Size());
 		}
 		else
@@ -131,7 +132,7 @@ PalettedPixels FImageSource::GetCachedPalettedPixels(int conversion)
 			pdp->ImageID = imageID;
 			pdp->RefCount = info->second - 1;
 			info->second = 0;
-			pdp->Pixels = CreatePalettedPixels(normal);
+			pdp->Pixels = CreateOrLoadPalettedPixels(normal);
 			ret.Pixels.Set(pdp->Pixels.Data(), pdp->Pixels.Size());
 		}
 	}
@@ -188,6 +189,57 @@ int FImageSource::CopyTranslatedPixels(FBitmap *bmp, PalEntry *remap)
 	return 0;
 }
 
+//===========================================================================
+//
+// Decoding wrappers that go through the disk cache if the image is
+// slow enough to create for it to be worth it.
+//
+//===========================================================================
+
+TArray<uint8_t> FImageSource::CreateOrLoadPalettedPixels(int conversion)
+{
+	FTextureDiskCache::FKey key;
+	if (!bDiskCache || !FTextureDiskCache::ImageKey(SourceLump, 1, conversion, key))
+	{
+		return CreatePalettedPixels(conversion);
+	}
+
+	TArray<uint8_t> Pixels(Width * Height, true);
+	int trans;
+	bool masked;
+	if (FTextureDiskCache::Read(key, Pixels.Data(), Pixels.Size(), trans, masked))
+	{
+		bMasked |= masked;
+		return Pixels;
+	}
+	Pixels = CreatePalettedPixels(conversion);
+	if (Pixels.Size() == unsigned(Width * Height))
+	{
+		FTextureDiskCache::Write(key, Pixels.Data(), Pixels.Size(), 0, bMasked);
+	}
+	return Pixels;
+}
+
+int FImageSource::CopyOrLoadPixels(FBitmap *bmp, int conversion)
+{
+	FTextureDiskCache::FKey key;
+	if (!bDiskCache || bmp->GetPitch() != Width * 4 || !FTextureDiskCache::ImageKey(SourceLump, 4, conversion, key))
+	{
+		return CopyPixels(bmp, conversion);
+	}
+
+	int trans;
+	bool masked;
+	if (FTextureDiskCache::Read(key, bmp->GetPixels(), Width * Height * 4, trans, masked))
+	{
+		bMasked |= masked;
+		return trans;
+	}
+	trans = CopyPixels(bmp, conversion);
+	FTextureDiskCache::Write(key, bmp->GetPixels(), Width * Height * 4, trans, bMasked);
+	return trans;
+}
+
 //==========================================================================
 //
 //
@@ -240,7 +292,7 @@ FBitmap FImageSource::GetCachedBitmap(PalEntry *remap, int conversion, int *ptra
 				// This should never happen if the function is implemented correctly
 				//Printf("something bad happened for %s, refcount = %d\n", name.GetChars(), cache->RefCount);
 				ret.Create(Width, Height);
-				trans = CopyPixels(&ret, normal);
+				trans = CopyOrLoadPixels(&ret, normal);
 			}
 		}
 		else
@@ -252,7 +304,7 @@ FBitmap FImageSource::GetCachedBitmap(PalEntry *remap, int conversion, int *ptra
 				// This is either the only copy needed or some access outside the caching block. In these cases create a new one and directly return it.
 				//Printf("returning fresh copy of %s\n", name.GetChars());
 				ret.Create(Width, Height);
-				trans = CopyPixels(&ret, conversion);
+				trans = CopyOrLoadPixels(&ret, conversion);
 			}
 			else
 			{
@@ -264,7 +316,7 @@ FBitmap FImageSource::GetCachedBitmap(PalEntry *remap, int conversion, int *ptra
 				pdr->RefCount = info->first - 1;
 				info->first = 0;
 				pdr->Pixels.Create(Width, Height);
-				trans = pdr->TransInfo = CopyPixels(&pdr->Pixels, normal);
+				trans = pdr->TransInfo = CopyOrLoadPixels(&pdr->Pixels, normal);
 				ret.Copy(pdr->Pixels, false);
 			}
 		}
@@ -295,6 +347,14 @@ void FImageSource::CollectForPrecache(PrecacheInfo &info, bool requiretruecolor)
 	}
 }
 
+void FImageSource::ClearImages()
+{
+	ImageArena.FreeAll();
+	ImageForLump.Clear();
+	NextID = 0;
+	FTextureDiskCache::Clear();
+}
+
 void FImageSource::BeginPrecaching()
 {
 	precacheInfo.Clear();
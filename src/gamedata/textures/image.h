@@ -36,6 +36,7 @@ protected:
 	int Width = 0, Height = 0;
 	int LeftOffset = 0, TopOffset = 0;			// Offsets stored in the image.
 	bool bUseGamePalette = false;				// true if this is an image without its own color set.
+	bool bDiskCache = false;					// true if decoding is slow enough to keep the result in the disk cache.
 	int ImageID = -1;
 
 	// Internal image creation functions. All external access should go through the cache interface,
@@ -44,6 +45,8 @@ protected:
 	virtual TArray<uint8_t> CreatePalettedPixels(int conversion);
 	virtual int CopyPixels(FBitmap *bmp, int conversion);			// This will always ignore 'luminance'.
 	int CopyTranslatedPixels(FBitmap *bmp, PalEntry *remap);
+	TArray<uint8_t> CreateOrLoadPalettedPixels(int conversion);
+	int CopyOrLoadPixels(FBitmap *bmp, int conversion);
 
 
 public:
@@ -78,7 +81,7 @@ public:
 	// Unlile for paletted images there is no variant here that returns a persistent bitmap, because all users have to process the returned image into another format.
 	FBitmap GetCachedBitmap(PalEntry *remap, int conversion, int *trans = nullptr);
 
-	static void ClearImages() { ImageArena.FreeAll(); ImageForLump.Clear(); NextID = 0; }
+	static void ClearImages();
 	static FImageSource * GetImage(int lumpnum, ETextureType usetype);
 
 
@@ -0,0 +1,376 @@
+/*
+** texturecache.cpp
+** On-disk cache for decoded and upscaled textures
+**
+**---------------------------------------------------------------------------
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+**
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+** 3. The name of the author may not be used to endorse or promote products
+**    derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+** OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+** IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+** INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+** NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+** THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**---------------------------------------------------------------------------
+**
+** Every entry is one file named after its key, holding a short header
+** followed by the pixels exactly as the caller passed them in. Entries are
+** written to a temporary file first and then renamed, so a partially
+** written entry never has a name that gets read. Reading an entry updates
+** its modification time, and once the directory grows beyond its size
+** limit the entries that were used least recently get deleted.
+**
+*/
+
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+#include "texturecache.h"
+#include "c_cvars.h"
+#include "w_wad.h"
+#include "v_palette.h"
+#include "m_misc.h"
+#include "cmdlib.h"
+#include "files.h"
+#include "md5.h"
+#include "templates.h"
+
+CVAR(Bool, texture_diskcache, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
+CVAR(Int, texture_diskcache_size, 512, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)	// in megabytes
+
+static const char CacheMagic[4] = { 'T', 'X', 'C', '1' };
+static const uint32_t CacheVersion = 1;
+
+// Lumps smaller than this decode faster than a cache file can be opened.
+static const int MinLumpSize = 4096;
+// The same goes for upscaling images with fewer pixels than this.
+static const int MinBufferPixels = 64 * 64;
+
+struct FCacheHeader
+{
+	char Magic[4];
+	uint32_t Version;
+	uint8_t Key[16];
+	int32_t TransInfo;
+	uint32_t Masked;
+	uint64_t Size;
+};
+
+static std::mutex CacheMutex;
+static TMap<int, FTextureDiskCache::FKey> LumpDigests;
+static bool CacheDirCreated;
+static uint64_t CacheBytes;			// size of the cache directory, as far as this session knows
+static std::atomic<unsigned> TempFileCounter;
+
+//==========================================================================
+//
+// File system helpers
+//
+//==========================================================================
+
+static bool GetFileInfo(const char *path, uint64_t &size, time_t &mtime)
+{
+#ifndef _WIN32
+	struct stat info;
+	if (stat(path, &info) != 0) return false;
+#else
+	struct _stat64 info;
+	if (_wstat64(WideString(path).c_str(), &info) != 0) return false;
+#endif
+	size = info.st_size;
+	mtime = info.st_mtime;
+	return true;
+}
+
+static void TouchFile(const char *path)
+{
+#ifndef _WIN32
+	utime(path, nullptr);
+#else
+	_wutime(WideString(path).c_str(), nullptr);
+#endif
+}
+
+static bool RenameFile(const char *from, const char *to)
+{
+#ifndef _WIN32
+	return rename(from, to) == 0;
+#else
+	return _wrename(WideString(from).c_str(), WideString(to).c_str()) == 0;
+#endif
+}
+
+static bool RemoveFile(const char *path)
+{
+#ifndef _WIN32
+	return remove(path) == 0;
+#else
+	return _wremove(WideString(path).c_str()) == 0;
+#endif
+}
+
+//==========================================================================
+//
+// PruneCache
+//
+// Deletes the least recently used entries until the directory is well
+// below its limit again, so that this doesn't happen on every write.
+// Must be called with CacheMutex held.
+//
+//==========================================================================
+
+static void PruneCache(const FString &dir)
+{
+	struct FEntry
+	{
+		FString Path;
+		uint64_t Size;
+		time_t Time;
+	};
+
+	TArray<FFileList> list;
+	TArray<FEntry> entries;
+	ScanDirectory(list, dir + "/");
+	CacheBytes = 0;
+	for (auto &file : list)
+	{
+		FEntry entry;
+		if (!file.isDirectory && GetFileInfo(file.Filename, entry.Size, entry.Time))
+		{
+			entry.Path = file.Filename;
+			entries.Push(entry);
+			CacheBytes += entry.Size;
+		}
+	}
+
+	uint64_t limit = uint64_t(MAX(*texture_diskcache_size, 0)) << 20;
+	if (CacheBytes <= limit)
+	{
+		return;
+	}
+	std::sort(entries.begin(), entries.end(), [](const FEntry &a, const FEntry &b) { return a.Time < b.Time; });
+	for (auto &entry : entries)
+	{
+		if (CacheBytes <= limit / 4 * 3) break;
+		if (RemoveFile(entry.Path)) CacheBytes -= entry.Size;
+	}
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+static FString GetCacheDir(bool create)
+{
+	FString path = M_GetCachePath(create);
+	path << "/textures";
+	if (create)
+	{
+		std::lock_guard<std::mutex> lock(CacheMutex);
+		if (!CacheDirCreated)
+		{
+			CreatePath(path);
+			PruneCache(path);
+			CacheDirCreated = true;
+		}
+	}
+	return path;
+}
+
+static FString GetCacheFileName(const FString &dir, const FTextureDiskCache::FKey &key)
+{
+	FString path = dir;
+	path << '/';
+	for (auto b : key.Digest) path.AppendFormat("%02x", b);
+	path << ".tex";
+	return path;
+}
+
+//==========================================================================
+//
+// Hashing the lump is much cheaper than decoding it, but it still needs to
+// read the entire lump so it is only done once per session.
+//
+//==========================================================================
+
+bool FTextureDiskCache::ImageKey(int lumpnum, int bytesperpixel, int conversion, FKey &key)
+{
+	if (!texture_diskcache || lumpnum < 0 || Wads.LumpLength(lumpnum) < MinLumpSize)
+	{
+		return false;
+	}
+
+	FKey lumpdigest;
+	{
+		std::lock_guard<std::mutex> lock(CacheMutex);
+		auto digest = LumpDigests.CheckKey(lumpnum);
+		if (digest != nullptr)
+		{
+			lumpdigest = *digest;
+		}
+		else
+		{
+			auto view = Wads.ViewLump(lumpnum);
+			MD5Context md5;
+			md5.Update(view.Data(), (unsigned)view.Size());
+			md5.Final(lumpdigest.Digest);
+			LumpDigests.Insert(lumpnum, lumpdigest);
+		}
+	}
+
+	// The alpha values get changed temporarily during conversion so they must stay out of the key.
+	uint8_t palette[768];
+	for (int i = 0; i < 256; i++)
+	{
+		palette[i * 3 + 0] = GPalette.BaseColors[i].r;
+		palette[i * 3 + 1] = GPalette.BaseColors[i].g;
+		palette[i * 3 + 2] = GPalette.BaseColors[i].b;
+	}
+
+	int32_t params[3] = { 0, bytesperpixel, conversion };
+	MD5Context md5;
+	md5.Update((const uint8_t *)params, sizeof(params));
+	md5.Update(lumpdigest.Digest, 16);
+	md5.Update(palette, sizeof(palette));
+	md5.Final(key.Digest);
+	return true;
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+bool FTextureDiskCache::BufferKey(const uint8_t *pixels, int width, int height, int scaler, int mult, FKey &key)
+{
+	if (!texture_diskcache || width * height < MinBufferPixels)
+	{
+		return false;
+	}
+
+	int32_t params[5] = { 1, width, height, scaler, mult };
+	MD5Context md5;
+	md5.Update((const uint8_t *)params, sizeof(params));
+	md5.Update(pixels, width * height * 4);
+	md5.Final(key.Digest);
+	return true;
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+bool FTextureDiskCache::Read(const FKey &key, uint8_t *pixels, size_t size, int &transinfo, bool &masked)
+{
+	FString path = GetCacheFileName(GetCacheDir(false), key);
+	FileReader fr;
+	if (!fr.OpenFile(path))
+	{
+		return false;
+	}
+
+	FCacheHeader header;
+	if (fr.GetLength() != long(sizeof(header) + size) || fr.Read(&header, sizeof(header)) != sizeof(header))
+	{
+		return false;
+	}
+	if (memcmp(header.Magic, CacheMagic, 4) != 0 || header.Version != CacheVersion || memcmp(header.Key, key.Digest, 16) != 0 || header.Size != size)
+	{
+		return false;
+	}
+	if (fr.Read(pixels, (long)size) != (long)size)
+	{
+		return false;
+	}
+	transinfo = header.TransInfo;
+	masked = !!header.Masked;
+	fr.Close();
+	TouchFile(path);
+	return true;
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+void FTextureDiskCache::Write(const FKey &key, const uint8_t *pixels, size_t size, int transinfo, bool masked)
+{
+	FString dir = GetCacheDir(true);
+	FString path = GetCacheFileName(dir, key);
+	FString temppath;
+	temppath.Format("%s.%u.tmp", path.GetChars(), TempFileCounter++);
+
+	FCacheHeader header;
+	memcpy(header.Magic, CacheMagic, 4);
+	header.Version = CacheVersion;
+	memcpy(header.Key, key.Digest, 16);
+	header.TransInfo = transinfo;
+	header.Masked = masked;
+	header.Size = size;
+
+	std::unique_ptr<FileWriter> fw(FileWriter::Open(temppath));
+	if (fw == nullptr)
+	{
+		return;
+	}
+	bool written = fw->Write(&header, sizeof(header)) == sizeof(header) && fw->Write(pixels, size) == size;
+	fw.reset();
+
+	// If the rename fails another thread or process stored the same entry first.
+	if (!written || !RenameFile(temppath, path))
+	{
+		RemoveFile(temppath);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(CacheMutex);
+	CacheBytes += sizeof(header) + size;
+	if (CacheBytes > uint64_t(MAX(*texture_diskcache_size, 0)) << 20)
+	{
+		PruneCache(dir);
+	}
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+void FTextureDiskCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(CacheMutex);
+	LumpDigests.Clear();
+}
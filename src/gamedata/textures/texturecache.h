@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Keeps image data that is slow to create on disk between sessions, i.e.
+// decoded PNG/JPEG/TGA/DDS/PCX images and upscaled texture buffers.
+// Entries are stored raw so that loading one costs no more than reading it.
+class FTextureDiskCache
+{
+public:
+	struct FKey
+	{
+		uint8_t Digest[16];
+	};
+
+	// Key for a decoded image, made from the lump's contents, the output format, the conversion mode and the game palette.
+	static bool ImageKey(int lumpnum, int bytesperpixel, int conversion, FKey &key);
+	// Key for an upscaled buffer, made from the source pixels and the scaler settings. Small images are not cached.
+	static bool BufferKey(const uint8_t *pixels, int width, int height, int scaler, int mult, FKey &key);
+
+	static bool Read(const FKey &key, uint8_t *pixels, size_t size, int &transinfo, bool &masked);
+	static void Write(const FKey &key, const uint8_t *pixels, size_t size, int transinfo, bool masked);
+
+	// Lump numbers are only valid until the next restart.
+	static void Clear();
+};
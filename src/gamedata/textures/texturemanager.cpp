@@ -595,6 +595,22 @@ void FTextureManager::AddGroup(int wadnum, int ns, ETextureType usetype)
 	// later ones), the texture is only inserted if it is the one returned
 	// by doing a check by name in the list of wads.
 
+	if (ns != ns_flats)
+	{
+		// Only flats need to look at lumps outside their namespace.
+		for (auto lump : Wads.GetLumpsInNamespace(ns, wadnum))
+		{
+			Wads.GetLumpName (Name, lump);
+
+			if (Wads.CheckNumForName (Name, ns) == (int)lump)
+			{
+				CreateTexture (lump, usetype);
+			}
+			StartScreen->Progress();
+		}
+		return;
+	}
+
 	for (; firsttx <= lasttx; ++firsttx)
 	{
 		if (Wads.GetLumpNamespace(firsttx) == ns)
@@ -626,59 +642,48 @@ void FTextureManager::AddGroup(int wadnum, int ns, ETextureType usetype)
 
 void FTextureManager::AddHiresTextures (int wadnum)
 {
-	int firsttx = Wads.GetFirstLump(wadnum);
-	int lasttx = Wads.GetLastLump(wadnum);
-
 	FString Name;
 	TArray<FTextureID> tlist;
 
-	if (firsttx == -1 || lasttx == -1)
+	for (int firsttx : Wads.GetLumpsInNamespace(ns_hires, wadnum))
 	{
-		return;
-	}
+		Wads.GetLumpName (Name, firsttx);
 
-	for (;firsttx <= lasttx; ++firsttx)
-	{
-		if (Wads.GetLumpNamespace(firsttx) == ns_hires)
+		if (Wads.CheckNumForName (Name, ns_hires) == firsttx)
 		{
-			Wads.GetLumpName (Name, firsttx);
-
-			if (Wads.CheckNumForName (Name, ns_hires) == firsttx)
+			tlist.Clear();
+			int amount = ListTextures(Name, tlist);
+			if (amount == 0)
 			{
-				tlist.Clear();
-				int amount = ListTextures(Name, tlist);
-				if (amount == 0)
+				// A texture with this name does not yet exist
+				FTexture * newtex = FTexture::CreateTexture (Name, firsttx, ETextureType::Any);
+				if (newtex != NULL)
 				{
-					// A texture with this name does not yet exist
-					FTexture * newtex = FTexture::CreateTexture (Name, firsttx, ETextureType::Any);
-					if (newtex != NULL)
-					{
-						newtex->UseType=ETextureType::Override;
-						AddTexture(newtex);
-					}
+					newtex->UseType=ETextureType::Override;
+					AddTexture(newtex);
 				}
-				else
+			}
+			else
+			{
+				for(unsigned int i = 0; i < tlist.Size(); i++)
 				{
-					for(unsigned int i = 0; i < tlist.Size(); i++)
+					FTexture * newtex = FTexture::CreateTexture ("", firsttx, ETextureType::Any);
+					if (newtex != NULL)
 					{
-						FTexture * newtex = FTexture::CreateTexture ("", firsttx, ETextureType::Any);
-						if (newtex != NULL)
-						{
-							FTexture * oldtex = Textures[tlist[i].GetIndex()].Texture;
+						FTexture * oldtex = Textures[tlist[i].GetIndex()].Texture;
 
-							// Replace the entire texture and adjust the scaling and offset factors.
-							newtex->bWorldPanning = true;
-							newtex->SetScaledSize(oldtex->GetScaledWidth(), oldtex->GetScaledHeight());
-							newtex->_LeftOffset[0] = int(oldtex->GetScaledLeftOffset(0) * newtex->Scale.X);
-							newtex->_LeftOffset[1] = int(oldtex->GetScaledLeftOffset(1) * newtex->Scale.X);
-							newtex->_TopOffset[0] = int(oldtex->GetScaledTopOffset(0) * newtex->Scale.Y);
-							newtex->_TopOffset[1] = int(oldtex->GetScaledTopOffset(1) * newtex->Scale.Y);
-							ReplaceTexture(tlist[i], newtex, true);
-						}
+						// Replace the entire texture and adjust the scaling and offset factors.
+						newtex->bWorldPanning = true;
+						newtex->SetScaledSize(oldtex->GetScaledWidth(), oldtex->GetScaledHeight());
+						newtex->_LeftOffset[0] = int(oldtex->GetScaledLeftOffset(0) * newtex->Scale.X);
+						newtex->_LeftOffset[1] = int(oldtex->GetScaledLeftOffset(1) * newtex->Scale.X);
+						newtex->_TopOffset[0] = int(oldtex->GetScaledTopOffset(0) * newtex->Scale.Y);
+						newtex->_TopOffset[1] = int(oldtex->GetScaledTopOffset(1) * newtex->Scale.Y);
+						ReplaceTexture(tlist[i], newtex, true);
 					}
 				}
-				StartScreen->Progress();
 			}
+			StartScreen->Progress();
 		}
 	}
 }
@@ -519,11 +519,9 @@ public:
 };
 
 
-class FxAddSub;
 // Texture manager
 class FTextureManager
 {
-	friend class FxAddSub;	// needs access to do a bounds check on the texture ID.
 public:
 	FTextureManager ();
 	~FTextureManager ();
@@ -617,6 +615,12 @@ public:
 	void ReplaceTexture (FTextureID picnum, FTexture *newtexture, bool free);
 
 	int NumTextures () const { return (int)Textures.Size(); }
+	// The script VM's bounds check on texture IDs reads the count through this, since it can change at run time.
+	const unsigned int *GetTextureCountAddress()
+	{
+		auto ptr = (FArray*)&Textures;
+		return &ptr->Count;
+	}
 
 	void UpdateAnimations (uint64_t mstime);
 	int GuesstimateNumTextures ();
@@ -52,6 +52,14 @@
 #include "md5.h"
 #include "doomstat.h"
 #include "vm.h"
+#include "c_cvars.h"
+#include "c_console.h"
+#include "stats.h"
+#include "templates.h"
+#include "parallel_for.h"
+#include <algorithm>
+#include <exception>
+#include <vector>
 
 // MACROS ------------------------------------------------------------------
 
@@ -79,6 +87,20 @@ static void PrintLastError ();
 
 FWadCollection Wads;
 
+// Map resource files into memory instead of reading their uncompressed lumps into copies.
+CVAR(Bool, mmap_resourcefiles, true, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
+CVAR(Bool, resource_parallel, true, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
+
+struct FWadCollection::FOpenedFile
+{
+	FString FileName;
+	bool IsLoose = true;			// a file on disk, not something already opened by the caller
+	FileReader Reader;
+	FResourceFile *ResFile = nullptr;
+	FPrintCapture Output;			// messages from opening it on a worker thread
+	std::exception_ptr Error;
+};
+
 // PRIVATE DATA DEFINITIONS ------------------------------------------------
 
 // CODE --------------------------------------------------------------------
@@ -111,6 +133,10 @@ FWadCollection::~FWadCollection ()
 
 void FWadCollection::DeleteAll ()
 {
+	PreloadedLumps.Clear();
+	FullNameTable.Clear();
+	SortedFullNames.Clear();
+	NamespaceIndex.Clear();
 	LumpInfo.Clear();
 	NumLumps = 0;
 
@@ -123,6 +149,30 @@ void FWadCollection::DeleteAll ()
 	Files.Clear();
 }
 
+//==========================================================================
+//
+// RunJobs
+//
+// Calls work(0) to work(count-1), in parallel if resource_parallel is set.
+//
+//==========================================================================
+
+template<class Function>
+static void RunJobs (unsigned count, const Function &work)
+{
+	if (resource_parallel)
+	{
+		parallel_for(0u, count, 1u, work);
+	}
+	else
+	{
+		for (unsigned i = 0; i < count; i++)
+		{
+			work(i);
+		}
+	}
+}
+
 //==========================================================================
 //
 // W_InitMultipleFiles
@@ -138,21 +188,58 @@ void FWadCollection::InitMultipleFiles (TArray<FString> &filenames, const TArray
 {
 	int numfiles;
 
+	cycle_t opentime, addtime, hashtime, preloadtime;
+	opentime.Reset();
+	addtime.Reset();
+	hashtime.Reset();
+	preloadtime.Reset();
+
 	// open all the files, load headers, and count lumps
 	DeleteAll();
 	numfiles = 0;
+	NextSkinNamespace = ns_firstskin;
 
-	for(unsigned i=0;i<filenames.Size(); i++)
+	// The archives are opened and indexed in parallel. Their messages and
+	// lumps are then added in order on this thread, so the result is the
+	// same as loading them one by one.
+	std::vector<FOpenedFile> opened(filenames.Size());
+	for (unsigned i = 0; i < filenames.Size(); i++)
 	{
-		int baselump = NumLumps;
-		AddFile (filenames[i]);
+		opened[i].FileName = filenames[i];
 	}
 
+	opentime.Clock();
+	RunJobs(filenames.Size(), [&](unsigned i)
+	{
+		opened[i].Output.Begin();
+		try
+		{
+			PrepareFile(opened[i]);
+		}
+		catch (...)
+		{
+			opened[i].Error = std::current_exception();
+		}
+		opened[i].Output.End();
+	});
+	opentime.Unclock();
+
+	addtime.Clock();
+	for (unsigned i = 0; i < opened.size(); i++)
+	{
+		opened[i].Output.Flush();
+		if (opened[i].Error) std::rethrow_exception(opened[i].Error);
+		AddPreparedFile(opened[i]);
+	}
+	addtime.Unclock();
+
 	NumLumps = LumpInfo.Size();
 	if (NumLumps == 0)
 	{
 		I_FatalError ("W_InitMultipleFiles: no files found");
 	}
+
+	hashtime.Clock();
 	RenameNerve();
 	RenameSprites(deletelumps);
 	FixMacHexen();
@@ -168,6 +255,89 @@ void FWadCollection::InitMultipleFiles (TArray<FString> &filenames, const TArray
 	InitHashChains ();
 	LumpInfo.ShrinkToFit();
 	Files.ShrinkToFit();
+	hashtime.Unclock();
+
+	preloadtime.Clock();
+	PreloadLumps();
+	preloadtime.Unclock();
+
+	DPrintf(DMSG_NOTIFY, "W_Init: %u files, %u lumps. Open %.1f ms, add %.1f ms, hash %.1f ms, preload %.1f ms (%u lumps)\n",
+		Files.Size(), NumLumps, opentime.TimeMS(), addtime.TimeMS(), hashtime.TimeMS(), preloadtime.TimeMS(), PreloadedLumps.Size());
+}
+
+//==========================================================================
+//
+// PreloadLumps
+//
+// Decompresses the definition lumps every game start parses. Lumps from
+// the same archive share its reader, so each archive is one work item.
+//
+//==========================================================================
+
+void FWadCollection::PreloadLumps ()
+{
+	static const char *const preloadnames[] = { "ZSCRIPT", "DECORATE", "MAPINFO", "ZMAPINFO", "TEXTURES", "GLDEFS" };
+
+	ReleasePreloadedLumps();
+
+	TArray<TArray<FResourceLump *>> perfile(Files.Size(), true);
+	for (unsigned i = 0; i < NumLumps; i++)
+	{
+		auto lump = LumpInfo[i].lump;
+		if (LumpInfo[i].wadnum < 0 || !(lump->Flags & LUMPF_COMPRESSED) || lump->Cache != nullptr) continue;
+
+		bool wanted = false;
+		if (lump->Namespace == ns_global)
+		{
+			for (auto name : preloadnames)
+			{
+				if (!strnicmp(lump->Name, name, 8)) wanted = true;
+			}
+		}
+		// ZScript is split into many included files.
+		if (lump->FullName.Len() > 3 && !lump->FullName.Right(3).CompareNoCase(".zs")) wanted = true;
+
+		if (wanted) perfile[LumpInfo[i].wadnum].Push(lump);
+	}
+
+	TArray<FPrintCapture> output(Files.Size(), true);
+	RunJobs(Files.Size(), [&](unsigned i)
+	{
+		output[i].Begin();
+		if (perfile[i].Size() > 0) Files[i]->CacheLumps(perfile[i]);
+		output[i].End();
+	});
+
+	for (unsigned i = 0; i < Files.Size(); i++)
+	{
+		output[i].Flush();
+		for (auto lump : perfile[i])
+		{
+			if (lump->Cache != nullptr) PreloadedLumps.Push(lump);
+		}
+	}
+}
+
+//==========================================================================
+//
+// ReleasePreloadedLumps
+//
+// Drops the references PreloadLumps took once startup is done with them,
+// along with whatever the resource files kept to read them faster.
+//
+//==========================================================================
+
+void FWadCollection::ReleasePreloadedLumps ()
+{
+	for (auto lump : PreloadedLumps)
+	{
+		lump->ReleaseCache();
+	}
+	PreloadedLumps.Clear();
+	for (auto file : Files)
+	{
+		file->ReleaseCaches();
+	}
 }
 
 //-----------------------------------------------------------------------
@@ -200,11 +370,29 @@ int FWadCollection::AddExternalFile(const char *filename)
 
 void FWadCollection::AddFile (const char *filename, FileReader *wadr)
 {
-	int startlump;
+	FOpenedFile file;
+	file.FileName = filename;
+	if (wadr != nullptr) file.Reader = std::move(*wadr);
+	file.IsLoose = wadr == nullptr;
+	PrepareFile(file);
+	AddPreparedFile(file);
+}
+
+//==========================================================================
+//
+// PrepareFile
+//
+// Opens the file and reads its directory. This does not touch the
+// collection, so it can run on a worker thread.
+//
+//==========================================================================
+
+void FWadCollection::PrepareFile (FOpenedFile &file)
+{
+	const char *filename = file.FileName;
 	bool isdir = false;
-	FileReader wadreader;
 
-	if (wadr == nullptr)
+	if (file.IsLoose)
 	{
 		// Does this exist? If so, is it a directory?
 		if (!DirEntryExists(filename, &isdir))
@@ -216,7 +404,7 @@ void FWadCollection::AddFile (const char *filename, FileReader *wadr)
 
 		if (!isdir)
 		{
-			if (!wadreader.OpenFile(filename))
+			if (!(mmap_resourcefiles ? file.Reader.OpenMappedFile(filename) : file.Reader.OpenFile(filename)))
 			{ // Didn't find file
 				Printf (TEXTCOLOR_RED "%s: File not found\n", filename);
 				PrintLastError ();
@@ -224,22 +412,43 @@ void FWadCollection::AddFile (const char *filename, FileReader *wadr)
 			}
 		}
 	}
-	else wadreader = std::move(*wadr);
 
 	if (!batchrun) Printf (" adding %s", filename);
-	startlump = NumLumps;
 
-	FResourceFile *resfile;
-	
 	if (!isdir)
-		resfile = FResourceFile::OpenResourceFile(filename, wadreader);
+		file.ResFile = FResourceFile::OpenResourceFile(filename, file.Reader);
 	else
-		resfile = FResourceFile::OpenDirectory(filename);
+		file.ResFile = FResourceFile::OpenDirectory(filename);
+}
+
+//==========================================================================
+//
+// AddPreparedFile
+//
+// Appends the lumps of an opened file to the collection.
+//
+//==========================================================================
+
+void FWadCollection::AddPreparedFile (FOpenedFile &file)
+{
+	const char *filename = file.FileName;
+	FileReader &wadreader = file.Reader;
+	FResourceFile *resfile = file.ResFile;
 
 	if (resfile != NULL)
 	{
 		uint32_t lumpstart = LumpInfo.Size();
 
+		// Skins get a namespace of their own, numbered in load order.
+		if (resfile->LumpCount() > 0 && resfile->GetLump(0)->Namespace == ns_firstskin)
+		{
+			for (uint32_t i = 0; i < resfile->LumpCount(); i++)
+			{
+				resfile->GetLump(i)->Namespace = NextSkinNamespace;
+			}
+			NextSkinNamespace++;
+		}
+
 		resfile->SetFirstLump(lumpstart);
 		for (uint32_t i=0; i < resfile->LumpCount(); i++)
 		{
@@ -514,18 +723,23 @@ int FWadCollection::CheckNumForFullName (const char *name, bool trynormal, int n
 	{
 		return -1;
 	}
-	uint32_t *fli = ignoreext ? FirstLumpIndex_NoExt : FirstLumpIndex_FullName;
-	uint32_t *nli = ignoreext ? NextLumpIndex_NoExt : NextLumpIndex_FullName;
-	auto len = strlen(name);
-
-	for (i = fli[MakeKey(name) % NumLumps]; i != NULL_INDEX; i = nli[i])
+	if (!ignoreext)
 	{
-		if (strnicmp(name, LumpInfo[i].lump->FullName, len)) continue;
-		if (LumpInfo[i].lump->FullName[len] == 0) break;	// this is a full match
-		if (ignoreext && LumpInfo[i].lump->FullName[len] == '.') 
+		i = FindFullName(name);
+	}
+	else
+	{
+		auto len = strlen(name);
+
+		for (i = FirstLumpIndex_NoExt[MakeKey(name) % NumLumps]; i != NULL_INDEX; i = NextLumpIndex_NoExt[i])
 		{
-			// is this the last '.' in the last path element, indicating that the remaining part of the name is only an extension?
-			if (strpbrk(LumpInfo[i].lump->FullName.GetChars() + len + 1, "./") == nullptr) break;	
+			if (strnicmp(name, LumpInfo[i].lump->FullName, len)) continue;
+			if (LumpInfo[i].lump->FullName[len] == 0) break;	// this is a full match
+			if (LumpInfo[i].lump->FullName[len] == '.')
+			{
+				// is this the last '.' in the last path element, indicating that the remaining part of the name is only an extension?
+				if (strpbrk(LumpInfo[i].lump->FullName.GetChars() + len + 1, "./") == nullptr) break;
+			}
 		}
 	}
 
@@ -565,6 +779,34 @@ int FWadCollection::CheckNumForFullName (const char *name, int wadnum)
 	return i != NULL_INDEX ? i : -1;
 }
 
+//==========================================================================
+//
+// FindFullName
+//
+// Looks up a full path in the open addressing table.
+//
+//==========================================================================
+
+uint32_t FWadCollection::FindFullName (const char *name) const
+{
+	if (FullNameTable.Size() == 0)
+	{
+		return NULL_INDEX;
+	}
+
+	uint32_t hash = MakeKey(name);
+	uint32_t mask = FullNameTable.Size() - 1;
+	for (uint32_t j = hash & mask; FullNameTable[j].Lump != NULL_INDEX; j = (j + 1) & mask)
+	{
+		auto &slot = FullNameTable[j];
+		if (slot.Hash == hash && !stricmp(name, LumpInfo[slot.Lump].lump->FullName))
+		{
+			return slot.Lump;
+		}
+	}
+	return NULL_INDEX;
+}
+
 //==========================================================================
 //
 // W_GetNumForFullName
@@ -742,6 +984,53 @@ void FWadCollection::InitHashChains (void)
 
 		}
 	}
+
+	// The full path table is kept at most half full. Since the lumps are
+	// added in order, a later lump with the same path replaces the earlier one.
+	unsigned tablesize = 16;
+	while (tablesize < NumLumps * 2) tablesize <<= 1;
+	FullNameTable.Resize(tablesize);
+	for (auto &slot : FullNameTable)
+	{
+		slot.Lump = NULL_INDEX;
+	}
+	SortedFullNames.Clear();
+
+	for (i = 0; i < (unsigned)NumLumps; i++)
+	{
+		const FString &fullname = LumpInfo[i].lump->FullName;
+		if (fullname.IsEmpty()) continue;
+
+		uint32_t hash = MakeKey(fullname);
+		for (j = hash & (tablesize - 1); ; j = (j + 1) & (tablesize - 1))
+		{
+			auto &slot = FullNameTable[j];
+			if (slot.Lump == NULL_INDEX || (slot.Hash == hash && !stricmp(fullname, LumpInfo[slot.Lump].lump->FullName)))
+			{
+				slot.Hash = hash;
+				slot.Lump = i;
+				break;
+			}
+		}
+		SortedFullNames.Push(i);
+	}
+
+	std::sort(SortedFullNames.begin(), SortedFullNames.end(), [&](uint32_t a, uint32_t b)
+	{
+		int cmp = strcmp(LumpInfo[a].lump->FullName, LumpInfo[b].lump->FullName);
+		return cmp < 0 || (cmp == 0 && a < b);
+	});
+
+	NamespaceIndex.Resize(NumLumps);
+	for (i = 0; i < (unsigned)NumLumps; i++)
+	{
+		NamespaceIndex[i] = i;
+	}
+	std::sort(NamespaceIndex.begin(), NamespaceIndex.end(), [&](uint32_t a, uint32_t b)
+	{
+		int nsa = LumpInfo[a].lump->Namespace, nsb = LumpInfo[b].lump->Namespace;
+		return nsa < nsb || (nsa == nsb && a < b);
+	});
 }
 
 //==========================================================================
@@ -1285,13 +1574,6 @@ FResourceLump *FWadCollection::GetLumpRecord(int lump) const
 //
 //==========================================================================
 
-static int folderentrycmp(const void *a, const void *b)
-{
-	auto A = (FolderEntry*)a;
-	auto B = (FolderEntry*)b;
-	return strcmp(A->name, B->name);
-}
-
 unsigned FWadCollection::GetLumpsInFolder(const char *inpath, TArray<FolderEntry> &result, bool atomic) const
 {
 	FString path = inpath;
@@ -1299,15 +1581,18 @@ unsigned FWadCollection::GetLumpsInFolder(const char *inpath, TArray<FolderEntry
 	path.ToLower();
 	if (path[path.Len() - 1] != '/') path += '/';
 	result.Clear();
-	for (unsigned i = 0; i < LumpInfo.Size(); i++)
+
+	// Everything in the folder is in one range of the sorted paths, and that range is already in the order the result needs.
+	auto it = std::lower_bound(SortedFullNames.begin(), SortedFullNames.end(), path, [&](uint32_t lump, const FString &key)
 	{
-		if (LumpInfo[i].lump->FullName.IndexOf(path) == 0)
+		return strcmp(LumpInfo[lump].lump->FullName, key) < 0;
+	});
+	for (; it != SortedFullNames.end() && !strncmp(LumpInfo[*it].lump->FullName, path, path.Len()); ++it)
+	{
+		// Only if it hasn't been replaced.
+		if (FindFullName(LumpInfo[*it].lump->FullName) == *it)
 		{
-			// Only if it hasn't been replaced.
-			if ((unsigned)Wads.CheckNumForFullName(LumpInfo[i].lump->FullName) == i)
-			{
-				result.Push({ LumpInfo[i].lump->FullName.GetChars(), i });
-			}
+			result.Push({ LumpInfo[*it].lump->FullName.GetChars(), *it });
 		}
 	}
 	if (result.Size())
@@ -1327,11 +1612,38 @@ unsigned FWadCollection::GetLumpsInFolder(const char *inpath, TArray<FolderEntry
 				if (Wads.GetLumpFile(result[i].lumpnum) != maxfile) result.Delete(i);
 			}
 		}
-		qsort(result.Data(), result.Size(), sizeof(FolderEntry), folderentrycmp);
 	}
 	return result.Size();
 }
 
+//==========================================================================
+//
+// GetLumpsInNamespace
+//
+// The lumps of one file are numbered consecutively, so they form a
+// single range in the namespace index.
+//
+//==========================================================================
+
+TArrayView<const uint32_t> FWadCollection::GetLumpsInNamespace(int ns, int wadnum) const
+{
+	if ((unsigned)wadnum >= Files.Size() || Files[wadnum]->LumpCount() == 0 || NamespaceIndex.Size() == 0)
+	{
+		return TArrayView<const uint32_t>(nullptr, 0);
+	}
+
+	uint32_t first = Files[wadnum]->GetFirstLump();
+	uint32_t last = first + Files[wadnum]->LumpCount();
+	auto before = [&](uint32_t lump, uint32_t key)
+	{
+		int lumpns = LumpInfo[lump].lump->Namespace;
+		return lumpns < ns || (lumpns == ns && lump < key);
+	};
+	auto start = std::lower_bound(NamespaceIndex.begin(), NamespaceIndex.end(), first, before);
+	auto end = std::lower_bound(start, NamespaceIndex.end(), last, before);
+	return TArrayView<const uint32_t>(NamespaceIndex.Data() + (start - NamespaceIndex.begin()), unsigned(end - start));
+}
+
 //==========================================================================
 //
 // W_ReadLump
@@ -1390,6 +1702,32 @@ FMemLump FWadCollection::ReadLump (int lump)
 	return FMemLump(FString(ELumpNum(lump)));
 }
 
+//==========================================================================
+//
+// ViewLump
+//
+// Returns the lump's data without making a copy of it if possible.
+//
+//==========================================================================
+
+FLumpView FWadCollection::ViewLump (int lump)
+{
+	if ((unsigned)lump >= (unsigned)LumpInfo.Size())
+	{
+		I_Error("W_ViewLump: %u >= NumLumps", lump);
+	}
+
+	FLumpView view;
+	auto rl = LumpInfo[lump].lump;
+	if (rl->LumpSize > 0)
+	{
+		view.Lump = rl;
+		view.Mem = (const uint8_t *)rl->CacheLump();
+		view.Len = rl->LumpSize;
+	}
+	return view;
+}
+
 DEFINE_ACTION_FUNCTION(_Wads, ReadLump)
 {
 	PARAM_PROLOGUE;
@@ -1599,6 +1937,47 @@ FMemLump::~FMemLump ()
 {
 }
 
+// FLumpView ----------------------------------------------------------------
+
+FLumpView::FLumpView (FLumpView &&other)
+: Lump (other.Lump), Mem (other.Mem), Len (other.Len)
+{
+	other.Lump = nullptr;
+	other.Mem = nullptr;
+	other.Len = 0;
+}
+
+FLumpView &FLumpView::operator= (FLumpView &&other)
+{
+	if (this != &other)
+	{
+		Release();
+		Lump = other.Lump;
+		Mem = other.Mem;
+		Len = other.Len;
+		other.Lump = nullptr;
+		other.Mem = nullptr;
+		other.Len = 0;
+	}
+	return *this;
+}
+
+FLumpView::~FLumpView ()
+{
+	Release();
+}
+
+void FLumpView::Release ()
+{
+	if (Lump != nullptr)
+	{
+		Lump->ReleaseCache();
+		Lump = nullptr;
+	}
+	Mem = nullptr;
+	Len = 0;
+}
+
 FString::FString (ELumpNum lumpnum)
 {
 	auto lumpr = Wads.OpenLumpReader ((int)lumpnum);
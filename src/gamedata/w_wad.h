@@ -101,6 +101,32 @@ private:
 	friend class FWadCollection;
 };
 
+// Read-only access to a lump's data without copying it. For uncompressed
+// lumps in a memory mapped file this points directly into the mapping;
+// everything else is held in the lump cache for as long as the view exists.
+class FLumpView
+{
+public:
+	FLumpView() {}
+	FLumpView(FLumpView &&other);
+	FLumpView &operator= (FLumpView &&other);
+	~FLumpView();
+
+	const uint8_t *Data() const { return Mem; }
+	size_t Size() const { return Len; }
+
+private:
+	FLumpView(const FLumpView &) = delete;
+	FLumpView &operator= (const FLumpView &) = delete;
+	void Release();
+
+	FResourceLump *Lump = nullptr;
+	const uint8_t *Mem = nullptr;
+	size_t Len = 0;
+
+	friend class FWadCollection;
+};
+
 struct FolderEntry
 {
 	const char *name;
@@ -157,6 +183,7 @@ public:
 	TArray<uint8_t> ReadLumpIntoArray(int lump, int pad = 0);	// reads lump into a writable buffer and optionally adds some padding at the end. (FMemLump isn't writable!)
 	FMemLump ReadLump (int lump);
 	FMemLump ReadLump (const char *name) { return ReadLump (GetNumForName (name)); }
+	FLumpView ViewLump (int lump);
 
 	FileReader OpenLumpReader(int lump);		// opens a reader that redirects to the containing file's one.
 	FileReader ReopenLumpReader(int lump, bool alwayscache = false);		// opens an independent reader.
@@ -180,6 +207,7 @@ public:
 	FResourceLump *GetLumpRecord(int lump) const;	// Returns the FResourceLump, in case the caller wants to have direct access to the lump cache.
 	bool CheckLumpName (int lump, const char *name) const;	// [RH] Returns true if the names match
 	unsigned GetLumpsInFolder(const char *path, TArray<FolderEntry> &result, bool atomic) const;
+	TArrayView<const uint32_t> GetLumpsInNamespace(int ns, int wadnum) const;	// all lumps of one file in the given namespace, in lump order
 
 	bool IsEncryptedFile(int lump) const;
 
@@ -187,6 +215,7 @@ public:
 	int GetNumWads () const;
 
 	int AddExternalFile(const char *filename);
+	void ReleasePreloadedLumps();	// called once startup has parsed everything InitMultipleFiles preloaded
 
 protected:
 
@@ -205,14 +234,33 @@ protected:
 	uint32_t *FirstLumpIndex_NoExt;	// The same information for fully qualified paths from .zips
 	uint32_t *NextLumpIndex_NoExt;
 
+	// Open addressing table from a full path to the last lump using it
+	struct FullNameSlot
+	{
+		uint32_t Hash;
+		uint32_t Lump;
+	};
+	TArray<FullNameSlot> FullNameTable;
+	TArray<uint32_t> SortedFullNames;	// all lumps with a full path, sorted by it so that a folder is one contiguous range
+	TArray<uint32_t> NamespaceIndex;	// all lumps, sorted by namespace and then lump number
+
 	uint32_t NumLumps = 0;					// Not necessarily the same as LumpInfo.Size()
 	uint32_t NumWads;
 
 	int IwadIndex;
 
 	void InitHashChains ();								// [RH] Set up the lumpinfo hashing
+	uint32_t FindFullName (const char *name) const;
 
 private:
+	struct FOpenedFile;
+
+	TArray<FResourceLump *> PreloadedLumps;
+	int NextSkinNamespace = ns_firstskin;
+
+	void PrepareFile(FOpenedFile &file);
+	void AddPreparedFile(FOpenedFile &file);
+	void PreloadLumps();
 	void RenameSprites(const TArray<FString> &deletelumps);
 	void RenameNerve();
 	void FixMacHexen();
@@ -0,0 +1,536 @@
+//-----------------------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/
+//
+//-----------------------------------------------------------------------------
+//
+// DESCRIPTION:
+//		Builds a REJECT table for maps that do not have a usable one.
+//
+//		The table is computed from the GL nodes in a background thread:
+//		for every subsector a 2D portal flow through all two-sided segs
+//		finds the subsectors a straight line could possibly reach, while
+//		ignoring plane heights, line flags and polyobjects since all of
+//		these can change during play. Only sector pairs no such line can
+//		connect are rejected, so the table never changes the outcome of
+//		a sight check, it only makes the impossible ones cheap.
+//
+//		Finished tables are cached on disk by the map's MD5. Whether they
+//		come from the cache or the builder, they are only installed on a
+//		fixed tic of the map, because the reject check comes before the
+//		random number roll in P_CheckSight and every node and demo has to
+//		start using the table at the same time.
+//
+//-----------------------------------------------------------------------------
+
+#include <zlib.h>
+#include <thread>
+#include <atomic>
+
+#include "p_setup.h"
+#include "g_levellocals.h"
+#include "c_cvars.h"
+#include "m_misc.h"
+#include "cmdlib.h"
+#include "files.h"
+#include "i_time.h"
+#include "doomstat.h"
+
+CVAR(Bool, gen_reject, false, CVAR_SERVERINFO)
+
+enum
+{
+	// Map time at which the table gets installed. If the builder is not
+	// done by then the game waits for it.
+	REJECT_INSTALL_TIC = 5 * TICRATE,
+
+
+	// Flow steps allowed per source subsector. If this gets exceeded the
+	// subsector's sector is assumed to see everything.
+	MAX_FLOW_STEPS = 250000,
+
+	// The table has one bit per sector pair, which is 128 MB at this size.
+	MAX_REJECT_SECTORS = 32768,
+};
+
+// Tolerance for the wedge clipping, in map units. Erring towards
+// 'visible' keeps the table conservative.
+static const double FLOW_EPSILON = 0.1;
+
+// Everything that changes the generated table, so that a cached table is
+// only used by a session that would have generated the same one.
+struct FRejectCacheHeader
+{
+	char Magic[4];
+	uint32_t Version;
+	uint32_t NumSectors;
+	uint32_t NumSubsectors;
+	uint32_t NumGameSubsectors;
+	uint32_t Flags;
+};
+
+enum
+{
+	REJECT_CACHE_VERSION = 2,
+	RCF_DILATE = 1,
+};
+
+struct FRejectPortal
+{
+	DVector2 v1, v2;	// left and right end as seen when passing through
+	int to;				// subsector on the other side
+};
+
+struct FRejectSubsector
+{
+	int sector;
+	unsigned firstportal;
+	unsigned numportals;
+};
+
+struct FRejectBuilder
+{
+	FLevelLocals *Level;
+	FString CacheFile;
+	FRejectCacheHeader CacheHeader;
+	int NumSectors;
+	bool Dilate;
+
+	TArray<FRejectPortal> Portals;
+	TArray<FRejectSubsector> Subsectors;
+	TArray<std::pair<int, int>> Neighbours;
+
+	TArray<uint8_t> SubVisible;
+	TArray<uint8_t> OnStack;
+	TArray<uint8_t> Visible;	// sector x sector bit matrix, every row starts on a byte boundary
+	size_t RowBytes;
+	int Steps;
+
+	TArray<uint8_t> Result;
+	uint64_t StartTime;
+	int Overflows = 0;
+
+	std::thread Thread;
+	std::atomic<bool> Cancel{ false };
+
+	bool IsVisible(size_t i, size_t j) const
+	{
+		return (Visible[i * RowBytes + (j >> 3)] >> (j & 7)) & 1;
+	}
+
+	void SetVisible(size_t i, size_t j)
+	{
+		Visible[i * RowBytes + (j >> 3)] |= 1 << (j & 7);
+	}
+
+	void Run();
+	void Symmetrize();
+	void FlowSubsector(int source);
+	bool Flow(int sub, DVector2 sl, DVector2 sr, const DVector2 &pl, const DVector2 &pr, bool first);
+	void WriteCache();
+};
+
+static FRejectBuilder *RejectBuilder;
+
+//==========================================================================
+//
+// ClipLeft
+//
+// Clips the segment a-b to the part that is not left of the directed
+// line p1->p2. Returns false if nothing remains.
+//
+//==========================================================================
+
+static bool ClipLeft(DVector2 &a, DVector2 &b, const DVector2 &p1, const DVector2 &p2)
+{
+	DVector2 dir = p2 - p1;
+	double len = dir.Length();
+	if (len == 0) return true;
+
+	double sa = (dir.X * (a.Y - p1.Y) - dir.Y * (a.X - p1.X)) / len;
+	double sb = (dir.X * (b.Y - p1.Y) - dir.Y * (b.X - p1.X)) / len;
+
+	if (sa > FLOW_EPSILON && sb > FLOW_EPSILON) return false;
+	if (sa <= FLOW_EPSILON && sb <= FLOW_EPSILON) return true;
+
+	DVector2 cut = a + (b - a) * ((sa - FLOW_EPSILON) / (sa - sb));
+	if (sa > FLOW_EPSILON) a = cut;
+	else b = cut;
+	return true;
+}
+
+//==========================================================================
+//
+// ClipToWedge
+//
+// Clips the segment l-r to the area visible from source portal sl-sr
+// through pass portal pl-pr.
+//
+//==========================================================================
+
+static bool ClipToWedge(DVector2 &l, DVector2 &r, const DVector2 &sl, const DVector2 &sr, const DVector2 &pl, const DVector2 &pr)
+{
+	return ClipLeft(l, r, sr, pl) && ClipLeft(l, r, pr, sl);
+}
+
+//==========================================================================
+//
+// FRejectBuilder :: Flow
+//
+// Returns false if the step limit was exceeded.
+//
+//==========================================================================
+
+bool FRejectBuilder::Flow(int sub, DVector2 sl, DVector2 sr, const DVector2 &pl, const DVector2 &pr, bool first)
+{
+	SubVisible[sub] = true;
+	if (++Steps > MAX_FLOW_STEPS || Cancel)
+	{
+		return false;
+	}
+
+	OnStack[sub] = true;
+	auto &ss = Subsectors[sub];
+	for (unsigned i = 0; i < ss.numportals; i++)
+	{
+		auto &portal = Portals[ss.firstportal + i];
+		if (OnStack[portal.to]) continue;
+
+		DVector2 tl = portal.v1, tr = portal.v2;
+		DVector2 nsl = sl, nsr = sr;
+		if (!first)
+		{
+			// Narrow down the next portal to what can be seen through the
+			// current one, and the source to what can see the next portal.
+			if (!ClipToWedge(tl, tr, sl, sr, pl, pr)) continue;
+			if (!ClipToWedge(nsl, nsr, tr, tl, pr, pl)) continue;
+		}
+		if (!Flow(portal.to, nsl, nsr, tl, tr, false))
+		{
+			OnStack[sub] = false;
+			return false;
+		}
+	}
+	OnStack[sub] = false;
+	return true;
+}
+
+//==========================================================================
+//
+// FRejectBuilder :: FlowSubsector
+//
+//==========================================================================
+
+void FRejectBuilder::FlowSubsector(int source)
+{
+	auto &ss = Subsectors[source];
+	memset(SubVisible.Data(), 0, SubVisible.Size());
+	SubVisible[source] = true;
+	Steps = 0;
+
+	bool overflow = false;
+	OnStack[source] = true;
+	for (unsigned i = 0; i < ss.numportals && !overflow; i++)
+	{
+		auto &portal = Portals[ss.firstportal + i];
+		overflow = !Flow(portal.to, portal.v1, portal.v2, portal.v1, portal.v2, true);
+	}
+	OnStack[source] = false;
+
+	if (overflow)
+	{
+		memset(&Visible[ss.sector * RowBytes], 0xff, RowBytes);
+		Overflows++;
+		return;
+	}
+	for (unsigned i = 0; i < Subsectors.Size(); i++)
+	{
+		if (SubVisible[i]) SetVisible(ss.sector, Subsectors[i].sector);
+	}
+}
+
+//==========================================================================
+//
+// FRejectBuilder :: Symmetrize
+//
+// Sight is symmetric, so a pair is only rejected if neither side can
+// see the other.
+//
+//==========================================================================
+
+void FRejectBuilder::Symmetrize()
+{
+	for (size_t i = 0; i < size_t(NumSectors); i++)
+	{
+		for (size_t j = i + 1; j < size_t(NumSectors); j++)
+		{
+			if (IsVisible(i, j) != IsVisible(j, i))
+			{
+				SetVisible(i, j);
+				SetVisible(j, i);
+			}
+		}
+	}
+}
+
+//==========================================================================
+//
+// FRejectBuilder :: Run
+//
+//==========================================================================
+
+void FRejectBuilder::Run()
+{
+	SubVisible.Resize(Subsectors.Size());
+	OnStack.Resize(Subsectors.Size());
+	memset(OnStack.Data(), 0, OnStack.Size());
+	RowBytes = (size_t(NumSectors) + 7) >> 3;
+	Visible.Resize(unsigned(RowBytes * NumSectors));
+	memset(Visible.Data(), 0, Visible.Size());
+
+	for (unsigned i = 0; i < Subsectors.Size() && !Cancel; i++)
+	{
+		FlowSubsector(i);
+	}
+	if (Cancel) return;
+
+	Symmetrize();
+
+	// When gameplay uses the map's original nodes instead of the GL nodes an
+	// actor may be in a different sector than the GL subsector it is in,
+	// which on broken maps can happen anywhere near a sector boundary.
+	// Everything adjacent to a visible sector is considered visible then.
+	// Since the matrix is symmetric, merging the rows of two neighbours
+	// does this for both of them. Doing it in place lets visibility spread
+	// further than one neighbour, which only makes the table reject less.
+	if (Dilate)
+	{
+		for (auto &n : Neighbours)
+		{
+			uint8_t *a = &Visible[n.first * RowBytes];
+			uint8_t *b = &Visible[n.second * RowBytes];
+			for (size_t k = 0; k < RowBytes; k++)
+			{
+				a[k] = b[k] = a[k] | b[k];
+			}
+		}
+		Symmetrize();
+	}
+
+	// Pack the rows and invert them in place. No bit is written before it
+	// has been read because a packed position is never after the padded one.
+	for (size_t i = 0; i < size_t(NumSectors); i++)
+	{
+		for (size_t j = 0; j < size_t(NumSectors); j++)
+		{
+			size_t pnum = i * NumSectors + j;
+			if (IsVisible(i, j)) Visible[pnum >> 3] &= ~(1 << (pnum & 7));
+			else Visible[pnum >> 3] |= 1 << (pnum & 7);
+		}
+	}
+	Visible.Resize(unsigned((size_t(NumSectors) * NumSectors + 7) >> 3));
+	Result = std::move(Visible);
+	SubVisible.Reset();
+	OnStack.Reset();
+
+	WriteCache();
+}
+
+//==========================================================================
+//
+// FRejectBuilder :: WriteCache
+//
+//==========================================================================
+
+void FRejectBuilder::WriteCache()
+{
+	const size_t hsize = sizeof(CacheHeader);
+	uLongf outlen = compressBound(Result.Size());
+	TArray<Bytef> compressed(unsigned(outlen + hsize), true);
+	if (compress(compressed.Data() + hsize, &outlen, Result.Data(), Result.Size()) != Z_OK)
+	{
+		return;
+	}
+	memcpy(compressed.Data(), &CacheHeader, hsize);
+
+	FileWriter *fw = FileWriter::Open(CacheFile);
+	if (fw != nullptr)
+	{
+		fw->Write(compressed.Data(), outlen + hsize);
+		delete fw;
+	}
+}
+
+//==========================================================================
+//
+// ReadCachedReject
+//
+//==========================================================================
+
+static bool ReadCachedReject(const FRejectCacheHeader &expected, const FString &path, TArray<uint8_t> &reject)
+{
+	FileReader fr;
+	FRejectCacheHeader header;
+
+	if (!fr.OpenFile(path)) return false;
+	if (fr.Read(&header, sizeof(header)) != sizeof(header) || memcmp(&header, &expected, sizeof(header))) return false;
+
+	size_t num = LittleLong(header.NumSectors);
+	auto compressed = fr.Read();
+	reject.Resize(unsigned((num * num + 7) >> 3));
+	uLongf outlen = reject.Size();
+	if (uncompress(reject.Data(), &outlen, compressed.Data(), compressed.Size()) != Z_OK || outlen != reject.Size())
+	{
+		reject.Clear();
+		return false;
+	}
+	return true;
+}
+
+//==========================================================================
+//
+// P_StartRejectBuilder
+//
+// Must be called after the level has been completely set up.
+//
+//==========================================================================
+
+void P_StartRejectBuilder(FLevelLocals *Level)
+{
+	if (!gen_reject || Level->rejectmatrix.Size() > 0 || Level->sectors.Size() < 2 || Level->sectors.Size() > MAX_REJECT_SECTORS)
+	{
+		return;
+	}
+
+	// Sight crosses linked portals, which this does not know about.
+	if (Level->linePortals.Size() > 0 || Level->PortalBlockmap.hasLinkedSectorPortals)
+	{
+		return;
+	}
+
+	FString path = M_GetCachePath(true);
+	path << "/reject";
+	CreatePath(path);
+	path << '/';
+	for (auto b : Level->md5) path.AppendFormat("%02x", b);
+	path << ".rej";
+
+	P_CancelRejectBuilder(nullptr);
+
+	auto builder = new FRejectBuilder;
+	builder->Level = Level;
+	builder->CacheFile = path;
+	builder->NumSectors = Level->sectors.Size();
+	builder->Dilate = Level->gamesubsectors.Size() > 0;
+	builder->StartTime = I_msTime();
+	RejectBuilder = builder;
+
+	auto &header = builder->CacheHeader;
+	memcpy(header.Magic, "REJC", 4);
+	header.Version = LittleLong(uint32_t(REJECT_CACHE_VERSION));
+	header.NumSectors = LittleLong(uint32_t(Level->sectors.Size()));
+	header.NumSubsectors = LittleLong(uint32_t(Level->subsectors.Size()));
+	header.NumGameSubsectors = LittleLong(uint32_t(Level->gamesubsectors.Size()));
+	header.Flags = LittleLong(uint32_t(builder->Dilate ? RCF_DILATE : 0));
+
+	if (ReadCachedReject(header, path, builder->Result))
+	{
+		DPrintf(DMSG_NOTIFY, "Loaded generated REJECT from %s\n", path.GetChars());
+		return;
+	}
+
+	builder->Subsectors.Resize(Level->subsectors.Size());
+	for (auto &sub : Level->subsectors)
+	{
+		auto &ss = builder->Subsectors[sub.Index()];
+		ss.sector = sub.sector->Index();
+		ss.firstportal = builder->Portals.Size();
+		for (unsigned i = 0; i < sub.numlines; i++)
+		{
+			auto &seg = sub.firstline[i];
+			if (seg.PartnerSeg == nullptr || seg.PartnerSeg->Subsector == nullptr) continue;
+			if (seg.linedef != nullptr && seg.backsector == nullptr) continue;
+			if (seg.v1->fPos() == seg.v2->fPos()) continue;
+			builder->Portals.Push({ seg.v1->fPos(), seg.v2->fPos(), seg.PartnerSeg->Subsector->Index() });
+		}
+		ss.numportals = builder->Portals.Size() - ss.firstportal;
+	}
+
+	if (builder->Dilate)
+	{
+		for (auto &line : Level->lines)
+		{
+			if (line.frontsector != nullptr && line.backsector != nullptr && line.frontsector != line.backsector)
+			{
+				builder->Neighbours.Push({ line.frontsector->Index(), line.backsector->Index() });
+			}
+		}
+	}
+
+	builder->Thread = std::thread([=]() { builder->Run(); });
+}
+
+//==========================================================================
+//
+// P_UpdateRejectBuilder
+//
+// Installs the table on REJECT_INSTALL_TIC, or on the first tic after
+// loading a savegame made later than that. Waits for the builder if it
+// is not done yet, so that the tic does not depend on how fast it ran.
+//
+//==========================================================================
+
+void P_UpdateRejectBuilder(FLevelLocals *Level)
+{
+	auto builder = RejectBuilder;
+	if (builder == nullptr || builder->Level != Level || Level->maptime < REJECT_INSTALL_TIC)
+	{
+		return;
+	}
+
+	if (builder->Thread.joinable())
+	{
+		builder->Thread.join();
+		DPrintf(DMSG_NOTIFY, "Generated REJECT in %llu ms (%d sectors, %d overflows)\n",
+			(unsigned long long)(I_msTime() - builder->StartTime), builder->NumSectors, builder->Overflows);
+	}
+	if (builder->Result.Size() > 0)
+	{
+		Level->rejectmatrix = std::move(builder->Result);
+	}
+	delete builder;
+	RejectBuilder = nullptr;
+}
+
+//==========================================================================
+//
+// P_CancelRejectBuilder
+//
+// Stops the builder if it works on the given level. nullptr stops any.
+//
+//==========================================================================
+
+void P_CancelRejectBuilder(FLevelLocals *Level)
+{
+	auto builder = RejectBuilder;
+	if (builder == nullptr || (Level != nullptr && builder->Level != Level))
+	{
+		return;
+	}
+
+	builder->Cancel = true;
+	if (builder->Thread.joinable()) builder->Thread.join();
+	delete builder;
+	RejectBuilder = nullptr;
+}
@@ -75,400 +75,12 @@
 #include "actorinlines.h"
 #include "types.h"
 #include "scriptutil.h"
+#include "p_acspcodes.h"
+#ifdef HAVE_VM_JIT
+#include "p_acsjit.h"
 
-	// P-codes for ACS scripts
-	enum
-	{
-/*  0*/	PCD_NOP,
-		PCD_TERMINATE,
-		PCD_SUSPEND,
-		PCD_PUSHNUMBER,
-		PCD_LSPEC1,
-		PCD_LSPEC2,
-		PCD_LSPEC3,
-		PCD_LSPEC4,
-		PCD_LSPEC5,
-		PCD_LSPEC1DIRECT,
-/* 10*/	PCD_LSPEC2DIRECT,
-		PCD_LSPEC3DIRECT,
-		PCD_LSPEC4DIRECT,
-		PCD_LSPEC5DIRECT,
-		PCD_ADD,
-		PCD_SUBTRACT,
-		PCD_MULTIPLY,
-		PCD_DIVIDE,
-		PCD_MODULUS,
-		PCD_EQ,
-/* 20*/ PCD_NE,
-		PCD_LT,
-		PCD_GT,
-		PCD_LE,
-		PCD_GE,
-		PCD_ASSIGNSCRIPTVAR,
-		PCD_ASSIGNMAPVAR,
-		PCD_ASSIGNWORLDVAR,
-		PCD_PUSHSCRIPTVAR,
-		PCD_PUSHMAPVAR,
-/* 30*/	PCD_PUSHWORLDVAR,
-		PCD_ADDSCRIPTVAR,
-		PCD_ADDMAPVAR,
-		PCD_ADDWORLDVAR,
-		PCD_SUBSCRIPTVAR,
-		PCD_SUBMAPVAR,
-		PCD_SUBWORLDVAR,
-		PCD_MULSCRIPTVAR,
-		PCD_MULMAPVAR,
-		PCD_MULWORLDVAR,
-/* 40*/	PCD_DIVSCRIPTVAR,
-		PCD_DIVMAPVAR,
-		PCD_DIVWORLDVAR,
-		PCD_MODSCRIPTVAR,
-		PCD_MODMAPVAR,
-		PCD_MODWORLDVAR,
-		PCD_INCSCRIPTVAR,
-		PCD_INCMAPVAR,
-		PCD_INCWORLDVAR,
-		PCD_DECSCRIPTVAR,
-/* 50*/	PCD_DECMAPVAR,
-		PCD_DECWORLDVAR,
-		PCD_GOTO,
-		PCD_IFGOTO,
-		PCD_DROP,
-		PCD_DELAY,
-		PCD_DELAYDIRECT,
-		PCD_RANDOM,
-		PCD_RANDOMDIRECT,
-		PCD_THINGCOUNT,
-/* 60*/	PCD_THINGCOUNTDIRECT,
-		PCD_TAGWAIT,
-		PCD_TAGWAITDIRECT,
-		PCD_POLYWAIT,
-		PCD_POLYWAITDIRECT,
-		PCD_CHANGEFLOOR,
-		PCD_CHANGEFLOORDIRECT,
-		PCD_CHANGECEILING,
-		PCD_CHANGECEILINGDIRECT,
-		PCD_RESTART,
-/* 70*/	PCD_ANDLOGICAL,
-		PCD_ORLOGICAL,
-		PCD_ANDBITWISE,
-		PCD_ORBITWISE,
-		PCD_EORBITWISE,
-		PCD_NEGATELOGICAL,
-		PCD_LSHIFT,
-		PCD_RSHIFT,
-		PCD_UNARYMINUS,
-		PCD_IFNOTGOTO,
-/* 80*/	PCD_LINESIDE,
-		PCD_SCRIPTWAIT,
-		PCD_SCRIPTWAITDIRECT,
-		PCD_CLEARLINESPECIAL,
-		PCD_CASEGOTO,
-		PCD_BEGINPRINT,
-		PCD_ENDPRINT,
-		PCD_PRINTSTRING,
-		PCD_PRINTNUMBER,
-		PCD_PRINTCHARACTER,
-/* 90*/	PCD_PLAYERCOUNT,
-		PCD_GAMETYPE,
-		PCD_GAMESKILL,
-		PCD_TIMER,
-		PCD_SECTORSOUND,
-		PCD_AMBIENTSOUND,
-		PCD_SOUNDSEQUENCE,
-		PCD_SETLINETEXTURE,
-		PCD_SETLINEBLOCKING,
-		PCD_SETLINESPECIAL,
-/*100*/	PCD_THINGSOUND,
-		PCD_ENDPRINTBOLD,		// [RH] End of Hexen p-codes
-		PCD_ACTIVATORSOUND,
-		PCD_LOCALAMBIENTSOUND,
-		PCD_SETLINEMONSTERBLOCKING,
-		PCD_PLAYERBLUESKULL,	// [BC] Start of new [Skull Tag] pcodes
-		PCD_PLAYERREDSKULL,
-		PCD_PLAYERYELLOWSKULL,
-		PCD_PLAYERMASTERSKULL,
-		PCD_PLAYERBLUECARD,
-/*110*/	PCD_PLAYERREDCARD,
-		PCD_PLAYERYELLOWCARD,
-		PCD_PLAYERMASTERCARD,
-		PCD_PLAYERBLACKSKULL,
-		PCD_PLAYERSILVERSKULL,
-		PCD_PLAYERGOLDSKULL,
-		PCD_PLAYERBLACKCARD,
-		PCD_PLAYERSILVERCARD,
-		PCD_ISNETWORKGAME,
-		PCD_PLAYERTEAM,
-/*120*/	PCD_PLAYERHEALTH,
-		PCD_PLAYERARMORPOINTS,
-		PCD_PLAYERFRAGS,
-		PCD_PLAYEREXPERT,
-		PCD_BLUETEAMCOUNT,
-		PCD_REDTEAMCOUNT,
-		PCD_BLUETEAMSCORE,
-		PCD_REDTEAMSCORE,
-		PCD_ISONEFLAGCTF,
-		PCD_LSPEC6,				// These are never used. They should probably
-/*130*/	PCD_LSPEC6DIRECT,		// be given names like PCD_DUMMY.
-		PCD_PRINTNAME,
-		PCD_MUSICCHANGE,
-		PCD_CONSOLECOMMANDDIRECT,
-		PCD_CONSOLECOMMAND,
-		PCD_SINGLEPLAYER,		// [RH] End of Skull Tag p-codes
-		PCD_FIXEDMUL,
-		PCD_FIXEDDIV,
-		PCD_SETGRAVITY,
-		PCD_SETGRAVITYDIRECT,
-/*140*/	PCD_SETAIRCONTROL,
-		PCD_SETAIRCONTROLDIRECT,
-		PCD_CLEARINVENTORY,
-		PCD_GIVEINVENTORY,
-		PCD_GIVEINVENTORYDIRECT,
-		PCD_TAKEINVENTORY,
-		PCD_TAKEINVENTORYDIRECT,
-		PCD_CHECKINVENTORY,
-		PCD_CHECKINVENTORYDIRECT,
-		PCD_SPAWN,
-/*150*/	PCD_SPAWNDIRECT,
-		PCD_SPAWNSPOT,
-		PCD_SPAWNSPOTDIRECT,
-		PCD_SETMUSIC,
-		PCD_SETMUSICDIRECT,
-		PCD_LOCALSETMUSIC,
-		PCD_LOCALSETMUSICDIRECT,
-		PCD_PRINTFIXED,
-		PCD_PRINTLOCALIZED,
-		PCD_MOREHUDMESSAGE,
-/*160*/	PCD_OPTHUDMESSAGE,
-		PCD_ENDHUDMESSAGE,
-		PCD_ENDHUDMESSAGEBOLD,
-		PCD_SETSTYLE,
-		PCD_SETSTYLEDIRECT,
-		PCD_SETFONT,
-		PCD_SETFONTDIRECT,
-		PCD_PUSHBYTE,
-		PCD_LSPEC1DIRECTB,
-		PCD_LSPEC2DIRECTB,
-/*170*/	PCD_LSPEC3DIRECTB,
-		PCD_LSPEC4DIRECTB,
-		PCD_LSPEC5DIRECTB,
-		PCD_DELAYDIRECTB,
-		PCD_RANDOMDIRECTB,
-		PCD_PUSHBYTES,
-		PCD_PUSH2BYTES,
-		PCD_PUSH3BYTES,
-		PCD_PUSH4BYTES,
-		PCD_PUSH5BYTES,
-/*180*/	PCD_SETTHINGSPECIAL,
-		PCD_ASSIGNGLOBALVAR,
-		PCD_PUSHGLOBALVAR,
-		PCD_ADDGLOBALVAR,
-		PCD_SUBGLOBALVAR,
-		PCD_MULGLOBALVAR,
-		PCD_DIVGLOBALVAR,
-		PCD_MODGLOBALVAR,
-		PCD_INCGLOBALVAR,
-		PCD_DECGLOBALVAR,
-/*190*/	PCD_FADETO,
-		PCD_FADERANGE,
-		PCD_CANCELFADE,
-		PCD_PLAYMOVIE,
-		PCD_SETFLOORTRIGGER,
-		PCD_SETCEILINGTRIGGER,
-		PCD_GETACTORX,
-		PCD_GETACTORY,
-		PCD_GETACTORZ,
-		PCD_STARTTRANSLATION,
-/*200*/	PCD_TRANSLATIONRANGE1,
-		PCD_TRANSLATIONRANGE2,
-		PCD_ENDTRANSLATION,
-		PCD_CALL,
-		PCD_CALLDISCARD,
-		PCD_RETURNVOID,
-		PCD_RETURNVAL,
-		PCD_PUSHMAPARRAY,
-		PCD_ASSIGNMAPARRAY,
-		PCD_ADDMAPARRAY,
-/*210*/	PCD_SUBMAPARRAY,
-		PCD_MULMAPARRAY,
-		PCD_DIVMAPARRAY,
-		PCD_MODMAPARRAY,
-		PCD_INCMAPARRAY,
-		PCD_DECMAPARRAY,
-		PCD_DUP,
-		PCD_SWAP,
-		PCD_WRITETOINI,
-		PCD_GETFROMINI,
-/*220*/ PCD_SIN,
-		PCD_COS,
-		PCD_VECTORANGLE,
-		PCD_CHECKWEAPON,
-		PCD_SETWEAPON,
-		PCD_TAGSTRING,
-		PCD_PUSHWORLDARRAY,
-		PCD_ASSIGNWORLDARRAY,
-		PCD_ADDWORLDARRAY,
-		PCD_SUBWORLDARRAY,
-/*230*/	PCD_MULWORLDARRAY,
-		PCD_DIVWORLDARRAY,
-		PCD_MODWORLDARRAY,
-		PCD_INCWORLDARRAY,
-		PCD_DECWORLDARRAY,
-		PCD_PUSHGLOBALARRAY,
-		PCD_ASSIGNGLOBALARRAY,
-		PCD_ADDGLOBALARRAY,
-		PCD_SUBGLOBALARRAY,
-		PCD_MULGLOBALARRAY,
-/*240*/	PCD_DIVGLOBALARRAY,
-		PCD_MODGLOBALARRAY,
-		PCD_INCGLOBALARRAY,
-		PCD_DECGLOBALARRAY,
-		PCD_SETMARINEWEAPON,
-		PCD_SETACTORPROPERTY,
-		PCD_GETACTORPROPERTY,
-		PCD_PLAYERNUMBER,
-		PCD_ACTIVATORTID,
-		PCD_SETMARINESPRITE,
-/*250*/	PCD_GETSCREENWIDTH,
-		PCD_GETSCREENHEIGHT,
-		PCD_THING_PROJECTILE2,
-		PCD_STRLEN,
-		PCD_SETHUDSIZE,
-		PCD_GETCVAR,
-		PCD_CASEGOTOSORTED,
-		PCD_SETRESULTVALUE,
-		PCD_GETLINEROWOFFSET,
-		PCD_GETACTORFLOORZ,
-/*260*/	PCD_GETACTORANGLE,
-		PCD_GETSECTORFLOORZ,
-		PCD_GETSECTORCEILINGZ,
-		PCD_LSPEC5RESULT,
-		PCD_GETSIGILPIECES,
-		PCD_GETLEVELINFO,
-		PCD_CHANGESKY,
-		PCD_PLAYERINGAME,
-		PCD_PLAYERISBOT,
-		PCD_SETCAMERATOTEXTURE,
-/*270*/	PCD_ENDLOG,
-		PCD_GETAMMOCAPACITY,
-		PCD_SETAMMOCAPACITY,
-		PCD_PRINTMAPCHARARRAY,		// [JB] start of new p-codes
-		PCD_PRINTWORLDCHARARRAY,
-		PCD_PRINTGLOBALCHARARRAY,	// [JB] end of new p-codes
-		PCD_SETACTORANGLE,			// [GRB]
-		PCD_GRABINPUT,				// Unused but acc defines them
-		PCD_SETMOUSEPOINTER,		// "
-		PCD_MOVEMOUSEPOINTER,		// "
-/*280*/	PCD_SPAWNPROJECTILE,
-		PCD_GETSECTORLIGHTLEVEL,
-		PCD_GETACTORCEILINGZ,
-		PCD_SETACTORPOSITION,
-		PCD_CLEARACTORINVENTORY,
-		PCD_GIVEACTORINVENTORY,
-		PCD_TAKEACTORINVENTORY,
-		PCD_CHECKACTORINVENTORY,
-		PCD_THINGCOUNTNAME,
-		PCD_SPAWNSPOTFACING,
-/*290*/	PCD_PLAYERCLASS,			// [GRB]
-		//[MW] start my p-codes
-		PCD_ANDSCRIPTVAR,
-		PCD_ANDMAPVAR, 
-		PCD_ANDWORLDVAR, 
-		PCD_ANDGLOBALVAR, 
-		PCD_ANDMAPARRAY, 
-		PCD_ANDWORLDARRAY, 
-		PCD_ANDGLOBALARRAY,
-		PCD_EORSCRIPTVAR, 
-		PCD_EORMAPVAR, 
-/*300*/	PCD_EORWORLDVAR, 
-		PCD_EORGLOBALVAR, 
-		PCD_EORMAPARRAY, 
-		PCD_EORWORLDARRAY, 
-		PCD_EORGLOBALARRAY,
-		PCD_ORSCRIPTVAR, 
-		PCD_ORMAPVAR, 
-		PCD_ORWORLDVAR, 
-		PCD_ORGLOBALVAR, 
-		PCD_ORMAPARRAY, 
-/*310*/	PCD_ORWORLDARRAY, 
-		PCD_ORGLOBALARRAY,
-		PCD_LSSCRIPTVAR, 
-		PCD_LSMAPVAR, 
-		PCD_LSWORLDVAR, 
-		PCD_LSGLOBALVAR, 
-		PCD_LSMAPARRAY, 
-		PCD_LSWORLDARRAY, 
-		PCD_LSGLOBALARRAY,
-		PCD_RSSCRIPTVAR, 
-/*320*/	PCD_RSMAPVAR, 
-		PCD_RSWORLDVAR, 
-		PCD_RSGLOBALVAR, 
-		PCD_RSMAPARRAY, 
-		PCD_RSWORLDARRAY, 
-		PCD_RSGLOBALARRAY, 
-		//[MW] end my p-codes
-		PCD_GETPLAYERINFO,			// [GRB]
-		PCD_CHANGELEVEL,
-		PCD_SECTORDAMAGE,
-		PCD_REPLACETEXTURES,
-/*330*/	PCD_NEGATEBINARY,
-		PCD_GETACTORPITCH,
-		PCD_SETACTORPITCH,
-		PCD_PRINTBIND,
-		PCD_SETACTORSTATE,
-		PCD_THINGDAMAGE2,
-		PCD_USEINVENTORY,
-		PCD_USEACTORINVENTORY,
-		PCD_CHECKACTORCEILINGTEXTURE,
-		PCD_CHECKACTORFLOORTEXTURE,
-/*340*/	PCD_GETACTORLIGHTLEVEL,
-		PCD_SETMUGSHOTSTATE,
-		PCD_THINGCOUNTSECTOR,
-		PCD_THINGCOUNTNAMESECTOR,
-		PCD_CHECKPLAYERCAMERA,		// [TN]
-		PCD_MORPHACTOR,				// [MH]
-		PCD_UNMORPHACTOR,			// [MH]
-		PCD_GETPLAYERINPUT,
-		PCD_CLASSIFYACTOR,
-		PCD_PRINTBINARY,
-/*350*/	PCD_PRINTHEX,
-		PCD_CALLFUNC,
-		PCD_SAVESTRING,			// [FDARI] create string (temporary)
-		PCD_PRINTMAPCHRANGE,	// [FDARI] output range (print part of array)
-		PCD_PRINTWORLDCHRANGE,
-		PCD_PRINTGLOBALCHRANGE,
-		PCD_STRCPYTOMAPCHRANGE,	// [FDARI] input range (copy string to all/part of array)
-		PCD_STRCPYTOWORLDCHRANGE,
-		PCD_STRCPYTOGLOBALCHRANGE,
-		PCD_PUSHFUNCTION,		// from Eternity
-/*360*/	PCD_CALLSTACK,			// from Eternity
-		PCD_SCRIPTWAITNAMED,
-		PCD_TRANSLATIONRANGE3,
-		PCD_GOTOSTACK,
-		PCD_ASSIGNSCRIPTARRAY,
-		PCD_PUSHSCRIPTARRAY,
-		PCD_ADDSCRIPTARRAY,
-		PCD_SUBSCRIPTARRAY,
-		PCD_MULSCRIPTARRAY,
-		PCD_DIVSCRIPTARRAY,
-/*370*/	PCD_MODSCRIPTARRAY,
-		PCD_INCSCRIPTARRAY,
-		PCD_DECSCRIPTARRAY,
-		PCD_ANDSCRIPTARRAY,
-		PCD_EORSCRIPTARRAY,
-		PCD_ORSCRIPTARRAY,
-		PCD_LSSCRIPTARRAY,
-		PCD_RSSCRIPTARRAY,
-		PCD_PRINTSCRIPTCHARARRAY,
-		PCD_PRINTSCRIPTCHRANGE,
-/*380*/	PCD_STRCPYTOSCRIPTCHRANGE,
-		PCD_LSPEC5EX,
-		PCD_LSPEC5EXRESULT,
-		PCD_TRANSLATIONRANGE4,
-		PCD_TRANSLATIONRANGE5,
-
-/*381*/	PCODE_COMMAND_COUNT
-	};
+EXTERN_CVAR(Bool, acs_jit)
+#endif
 
 	// Some constants used by ACS scripts
 	enum {
@@ -538,10 +150,6 @@
 
 FRandom pr_acs ("ACS");
 
-// I imagine this much stack space is probably overkill, but it could
-// potentially get used with recursive functions.
-#define STACK_SIZE 4096
-
 #define CLAMPCOLOR(c)		(EColorRange)((unsigned)(c) >= NUM_TEXT_COLORS ? CR_UNTRANSLATED : (c))
 #define LANGREGIONMASK		MAKE_ID(0,0,0xff,0xff)
 
@@ -673,6 +281,7 @@ public:
 		const int *args, int argcount, int flags);
 
 	void Serialize(FSerializer &arc);
+	bool UpdateWaitState();
 	int RunScript();
 	PClass *GetClassForIndex(int index) const;
 
@@ -2203,7 +1812,7 @@ FBehavior::FBehavior()
 	memset (MapVarStore, 0, sizeof(MapVarStore));
 	ModuleName[0] = 0;
 	FunctionProfileData = NULL;
-
+	Jit = NULL;
 }
 	
 	
@@ -2719,7 +2328,25 @@ FBehavior::~FBehavior ()
 		delete[] Data;
 		Data = NULL;
 	}
+#ifdef HAVE_VM_JIT
+	if (Jit != NULL)
+	{
+		delete Jit;
+		Jit = NULL;
+	}
+#endif
+}
+
+#ifdef HAVE_VM_JIT
+FACSJit *FBehavior::GetJit()
+{
+	if (Jit == NULL)
+	{
+		Jit = new FACSJit(this);
+	}
+	return Jit;
 }
+#endif
 
 void FBehavior::LoadScriptsDirectory ()
 {
@@ -3418,7 +3045,10 @@ void DACSThinker::Tick ()
 	while (script)
 	{
 		DLevelScript *next = script->next;
-		script->RunScript();
+		if (script->UpdateWaitState())
+		{
+			script->RunScript();
+		}
 		script = next;
 	}
 
@@ -6768,29 +6398,19 @@ PClass *DLevelScript::GetClassForIndex(int index) const
 	return PClass::FindActor(Level->Behaviors.LookupString(index));
 }
 
-int DLevelScript::RunScript()
-{
-	DACSThinker *controller = Level->ACSThinker;
-	ACSLocalVariables locals(Localvars);
-	ACSLocalArrays noarrays;
-	ACSLocalArrays *localarrays = &noarrays;
-	ScriptFunction *activeFunction = NULL;
-	FRemapTable *translation = 0;
-	int resultValue = 1;
-
-	if (InModuleScriptNumber >= 0)
-	{
-		ScriptPtr *ptr = activeBehavior->GetScriptPtr(InModuleScriptNumber);
-		assert(ptr != NULL);
-		if (ptr != NULL)
-		{
-			localarrays = &ptr->LocalArrays;
-		}
-	}
-
-	// Hexen truncates all special arguments to bytes (only when using an old MAPINFO and old ACS format
-	const int specialargmask = ((Level->flags2 & LEVEL2_HEXENHACK) && activeBehavior->GetFormat() == ACS_Old) ? 255 : ~0;
+//==========================================================================
+//
+// DLevelScript :: UpdateWaitState
+//
+// Checks whether whatever the script waits for has happened. This gets
+// called every tic for every script, so it stays out of RunScript, which
+// has a lot more to set up before it can look at the script's state.
+// Returns true if the script needs to run this tic.
+//
+//==========================================================================
 
+bool DLevelScript::UpdateWaitState()
+{
 	switch (state)
 	{
 	case SCRIPT_Delayed:
@@ -6809,7 +6429,7 @@ int DLevelScript::RunScript()
 		while ((secnum = it.Next()) >= 0)
 		{
 			if (Level->sectors[secnum].floordata || Level->sectors[secnum].ceilingdata)
-				return resultValue;
+				return false;
 		}
 
 		// If we got here, none of the tagged sectors were busy
@@ -6827,14 +6447,14 @@ int DLevelScript::RunScript()
 
 	case SCRIPT_ScriptWaitPre:
 		// Wait for a script to start running, then enter state scriptwait
-		if (controller->RunningScripts.CheckKey(statedata) != NULL)
+		if (Level->ACSThinker->RunningScripts.CheckKey(statedata) != NULL)
 			state = SCRIPT_ScriptWait;
 		break;
 
 	case SCRIPT_ScriptWait:
 		// Wait for a script to stop running, then enter state running
-		if (controller->RunningScripts.CheckKey(statedata) != NULL)
-			return resultValue;
+		if (Level->ACSThinker->RunningScripts.CheckKey(statedata) != NULL)
+			return false;
 
 		state = SCRIPT_Running;
 		PutFirst ();
@@ -6844,6 +6464,36 @@ int DLevelScript::RunScript()
 		break;
 	}
 
+	// Scripts that are to be removed go through RunScript to do so.
+	return state == SCRIPT_Running || state == SCRIPT_PleaseRemove;
+}
+
+int DLevelScript::RunScript()
+{
+	DACSThinker *controller = Level->ACSThinker;
+	ACSLocalVariables locals(Localvars);
+	ACSLocalArrays noarrays;
+	ACSLocalArrays *localarrays = &noarrays;
+	ScriptFunction *activeFunction = NULL;
+	FRemapTable *translation = 0;
+	int resultValue = 1;
+
+	// Scripts can change just about anything that affects sight.
+	P_InvalidateSightQueries();
+
+	if (InModuleScriptNumber >= 0)
+	{
+		ScriptPtr *ptr = activeBehavior->GetScriptPtr(InModuleScriptNumber);
+		assert(ptr != NULL);
+		if (ptr != NULL)
+		{
+			localarrays = &ptr->LocalArrays;
+		}
+	}
+
+	// Hexen truncates all special arguments to bytes (only when using an old MAPINFO and old ACS format
+	const int specialargmask = ((Level->flags2 & LEVEL2_HEXENHACK) && activeBehavior->GetFormat() == ACS_Old) ? 255 : ~0;
+
 	FACSStack stackobj;
 	FACSStackMemory& Stack = stackobj.buffer;
 	int &sp = stackobj.sp;
@@ -6860,6 +6510,30 @@ int DLevelScript::RunScript()
 
 	while (state == SCRIPT_Running)
 	{
+#ifdef HAVE_VM_JIT
+		if (acs_jit)
+		{
+			// Let native code run as far as it can. It leaves the stack, sp and
+			// runaway exactly as the interpreter would have.
+			FACSJitContext ctx;
+			ctx.Stack = Stack.Pointer();
+			ctx.Locals = const_cast<int32_t *>(locals.GetPointer());
+			ctx.WorldVars = ACS_WorldVars.Pointer();
+			ctx.GlobalVars = ACS_GlobalVars.Pointer();
+			ctx.Sp = sp;
+			ctx.NumLocals = (int)locals.GetCount();
+			ctx.Runaway = runaway;
+			int *newpc = activeBehavior->GetJit()->Run(pc, ctx);
+			if (newpc != pc)
+			{
+				pc = newpc;
+				sp = ctx.Sp;
+				runaway = ctx.Runaway;
+				continue;
+			}
+		}
+#endif
+
 		if (++runaway > 2000000)
 		{
 			Printf ("Runaway %s terminated\n", ScriptPresentation(script).GetChars());
@@ -8929,6 +8603,7 @@ scriptwait:
 						break;
 					}
 				}
+				P_FlushSightCache();
 
 				sp -= 2;
 			}
@@ -10755,6 +10430,72 @@ CCMD(acsprofile)
 	}
 }
 
+#ifdef HAVE_VM_JIT
+//==========================================================================
+//
+// acsbench <script> [<runs>]
+//
+// Runs a script repeatedly, first in the interpreter and then as native
+// code, and prints how long each took. Only meaningful for scripts that
+// run to completion without waiting.
+//
+//==========================================================================
+
+static double ACSBenchRun(int script, int runs)
+{
+	cycle_t time;
+	time.Reset();
+	time.Clock();
+	for (int i = 0; i < runs; i++)
+	{
+		P_StartScript(primaryLevel, players[consoleplayer].mo, nullptr, script, primaryLevel->MapName, nullptr, 0, ACS_ALWAYS | ACS_WANTRESULT);
+	}
+	time.Unclock();
+	return time.TimeMS();
+}
+
+CCMD(acsbench)
+{
+	if (argv.argc() < 2)
+	{
+		Printf("Usage: acsbench <script> [<runs>]\n");
+		return;
+	}
+	if (netgame)
+	{
+		Printf("acsbench cannot be used in a network game\n");
+		return;
+	}
+	if (gamestate != GS_LEVEL)
+	{
+		Printf("acsbench needs a running level\n");
+		return;
+	}
+
+	char *end;
+	int script = (int)strtol(argv[1], &end, 10);
+	if (*end != 0)
+	{
+		script = -FName(argv[1]);
+	}
+	int runs = argv.argc() > 2 ? atoi(argv[2]) : 1000;
+	if (runs <= 0) runs = 1000;
+
+	bool savedjit = acs_jit;
+	acs_jit = false;
+	double interp = ACSBenchRun(script, runs);
+	acs_jit = true;
+	double first = ACSBenchRun(script, runs);
+	double native = ACSBenchRun(script, runs);
+	acs_jit = savedjit;
+
+	Printf("%s, %d runs:\n", ScriptPresentation(script).GetChars(), runs);
+	Printf("  interpreter: %.3f ms\n", interp);
+	Printf("  native, including compilation: %.3f ms\n", first);
+	Printf("  native: %.3f ms (%.2fx)\n", native, native > 0 ? interp / native : 0.);
+}
+#endif
+
 ADD_STAT(ACS)
 {
 	return FStringf("ACS time: %f ms", ACSTime.TimeMS());
@@ -42,8 +42,13 @@
 #define LOCAL_SIZE				20
 #define NUM_MAPVARS				128
 
+// I imagine this much stack space is probably overkill, but it could
+// potentially get used with recursive functions.
+#define STACK_SIZE 4096
+
 class FFont;
 class FileReader;
+class FACSJit;
 struct line_t;
 class FSerializer;
 
@@ -200,6 +205,11 @@ public:
 		return memory;
 	}
 
+	size_t GetCount() const
+	{
+		return count;
+	}
+
 private:
 	int32_t *memory;
 	size_t count;
@@ -379,6 +389,7 @@ public:
 	ACSProfileInfo *GetFunctionProfileData(int index) { return index >= 0 && index < NumFunctions ? &FunctionProfileData[index] : NULL; }
 	ACSProfileInfo *GetFunctionProfileData(ScriptFunction *func) { return GetFunctionProfileData((int)(func - (ScriptFunction *)Functions)); }
 	const char *LookupString (uint32_t index, bool forprint = false) const;
+	FACSJit *GetJit();
 
 	BoundsCheckingArray<int32_t *, NUM_MAPVARS> MapVars;
 
@@ -410,6 +421,7 @@ private:
 	TArray<FBehavior *> Imports;
 	char ModuleName[9];
 	TArray<int> JumpPoints;
+	FACSJit *Jit;
 
 	void LoadScriptsDirectory ();
 
@@ -0,0 +1,1084 @@
+//-----------------------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/
+//
+//-----------------------------------------------------------------------------
+//
+// DESCRIPTION:
+//		Native code compiler for ACS.
+//
+//		The interpreter asks for native code every time it is about to
+//		execute a p-code. Once an offset has been asked for often enough,
+//		the straight-line code starting there is decoded up to the first
+//		p-code this compiler does not handle, and compiled into one native
+//		function. Jumps inside that region stay native, everything else
+//		returns to the interpreter. The values on the ACS stack are kept in
+//		registers within a basic block and written back at its end, so the
+//		interpreter always finds the stack exactly as it would have left it.
+//
+
+#include "p_acsjit.h"
+#include "p_acs.h"
+#include "p_acspcodes.h"
+#include "c_cvars.h"
+#include "cmdlib.h"
+#include "jitintern.h"
+
+CVAR(Bool, acs_jit, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
+
+enum
+{
+	MinRegionLength = 3,		// shorter regions are not worth the call
+	MaxRegionLength = 4096,
+	MaxRunaway = 2000000,		// the limit DLevelScript::RunScript enforces
+};
+
+enum EACSVarKind
+{
+	VAR_Script,
+	VAR_Map,
+	VAR_World,
+	VAR_Global,
+	NUM_VARKINDS
+};
+
+enum EACSVarOp
+{
+	VOP_Push,
+	VOP_Assign,
+	VOP_Add,
+	VOP_Sub,
+	VOP_Mul,
+	VOP_And,
+	VOP_Or,
+	VOP_Eor,
+	VOP_LShift,
+	VOP_RShift,
+	VOP_Inc,
+	VOP_Dec,
+	NUM_VAROPS
+};
+
+// The p-codes for each variable operation, by variable kind.
+static const int VarOpCodes[NUM_VAROPS][NUM_VARKINDS] =
+{
+	{ PCD_PUSHSCRIPTVAR, PCD_PUSHMAPVAR, PCD_PUSHWORLDVAR, PCD_PUSHGLOBALVAR },
+	{ PCD_ASSIGNSCRIPTVAR, PCD_ASSIGNMAPVAR, PCD_ASSIGNWORLDVAR, PCD_ASSIGNGLOBALVAR },
+	{ PCD_ADDSCRIPTVAR, PCD_ADDMAPVAR, PCD_ADDWORLDVAR, PCD_ADDGLOBALVAR },
+	{ PCD_SUBSCRIPTVAR, PCD_SUBMAPVAR, PCD_SUBWORLDVAR, PCD_SUBGLOBALVAR },
+	{ PCD_MULSCRIPTVAR, PCD_MULMAPVAR, PCD_MULWORLDVAR, PCD_MULGLOBALVAR },
+	{ PCD_ANDSCRIPTVAR, PCD_ANDMAPVAR, PCD_ANDWORLDVAR, PCD_ANDGLOBALVAR },
+	{ PCD_ORSCRIPTVAR, PCD_ORMAPVAR, PCD_ORWORLDVAR, PCD_ORGLOBALVAR },
+	{ PCD_EORSCRIPTVAR, PCD_EORMAPVAR, PCD_EORWORLDVAR, PCD_EORGLOBALVAR },
+	{ PCD_LSSCRIPTVAR, PCD_LSMAPVAR, PCD_LSWORLDVAR, PCD_LSGLOBALVAR },
+	{ PCD_RSSCRIPTVAR, PCD_RSMAPVAR, PCD_RSWORLDVAR, PCD_RSGLOBALVAR },
+	{ PCD_INCSCRIPTVAR, PCD_INCMAPVAR, PCD_INCWORLDVAR, PCD_INCGLOBALVAR },
+	{ PCD_DECSCRIPTVAR, PCD_DECMAPVAR, PCD_DECWORLDVAR, PCD_DECGLOBALVAR },
+};
+
+struct FACSJitInstr
+{
+	uint32_t Ofs;
+	uint32_t Next;
+	int Pcd;
+	int Arg;				// immediate value, variable index or byte count
+	int Arg2;				// the value CASEGOTO compares against
+	uint32_t Target;		// jump target
+	const uint8_t *Bytes;	// the values of the PUSH*BYTES p-codes
+	int VarKind;
+	int VarOp;
+	int Pops;
+	int Pushes;
+};
+
+// An entry of the virtual stack: a value that has not been written to the ACS stack yet.
+struct FACSJitValue
+{
+	bool IsConst;
+	int32_t Const;
+	asmjit::X86Gp Reg;
+};
+
+class FACSRegionCompiler
+{
+public:
+	FACSRegionCompiler(asmjit::X86Compiler &cc, FBehavior *module);
+
+	bool Decode(uint32_t start);
+	asmjit::CCFunc *Codegen();
+
+private:
+	bool DecodeInstr(uint32_t ofs, FACSJitInstr &instr) const;
+	bool ReadByte(uint32_t &ofs, int &val) const;
+	bool ReadLong(uint32_t &ofs, int &val) const;
+	bool DecodeVarOp(uint32_t &ofs, FACSJitInstr &instr) const;
+
+	void EmitBlockChecks(unsigned int first);
+	void EmitInstr(const FACSJitInstr &instr, unsigned int remaining);
+	void EmitBinaryOp(int pcd);
+	void EmitUnaryOp(int pcd);
+	void EmitDivision(int pcd, uint32_t ofs, unsigned int remaining);
+	void EmitVarOp(const FACSJitInstr &instr);
+	void EmitBranch(const FACSJitInstr &instr);
+	void EmitExit(uint32_t ofs, unsigned int runawayAdjust = 0);
+	asmjit::X86Gp EmitCompare(int pcd, const asmjit::X86Gp &a, const FACSJitValue &b);
+
+	void PushConst(int32_t val);
+	void PushReg(const asmjit::X86Gp &reg);
+	FACSJitValue Pop();
+	void Flush();
+	asmjit::X86Gp ToReg(const FACSJitValue &val);
+	asmjit::Operand ToOperand(const FACSJitValue &val);
+	asmjit::X86Mem VarSlot(int kind, int index);
+	asmjit::Label JumpLabel(uint32_t ofs);
+	asmjit::Label ExitStubLabel(uint32_t ofs);
+
+	asmjit::X86Compiler &cc;
+	FBehavior *Module;
+	const uint8_t *Data;
+	uint32_t DataSize;
+	ACSFormat Format;
+
+	TArray<FACSJitInstr> Instrs;
+	TMap<uint32_t, unsigned int> InstrIndex;
+	TArray<bool> IsLeader;
+	TArray<asmjit::Label> Labels;
+	int MaxLocal = -1;
+	bool UsesVars[NUM_VARKINDS] = {};
+
+	struct ExitStub
+	{
+		asmjit::Label Label;
+		uint32_t Ofs;
+	};
+	TArray<ExitStub> ExitStubs;
+
+	asmjit::X86Gp ctx, stack, sp, runaway, retval;
+	asmjit::X86Gp varbase[NUM_VARKINDS];
+	asmjit::Label ExitLabel;
+
+	TArray<FACSJitValue> Items;
+	int SpDelta = 0;		// the top of the in-memory stack, relative to sp
+};
+
+FACSRegionCompiler::FACSRegionCompiler(asmjit::X86Compiler &cc, FBehavior *module) : cc(cc), Module(module)
+{
+	Data = (const uint8_t *)module->Ofs2PC(0);
+	DataSize = module->GetDataSize();
+	Format = module->GetFormat();
+}
+
+//==========================================================================
+//
+// Decoding
+//
+//==========================================================================
+
+bool FACSRegionCompiler::ReadByte(uint32_t &ofs, int &val) const
+{
+	if (ofs >= DataSize) return false;
+	val = Data[ofs++];
+	return true;
+}
+
+bool FACSRegionCompiler::ReadLong(uint32_t &ofs, int &val) const
+{
+	if (ofs + 4 > DataSize || ofs + 4 < ofs) return false;
+	val = (int)(Data[ofs] | (Data[ofs + 1] << 8) | (Data[ofs + 2] << 16) | ((uint32_t)Data[ofs + 3] << 24));
+	ofs += 4;
+	return true;
+}
+
+bool FACSRegionCompiler::DecodeVarOp(uint32_t &ofs, FACSJitInstr &instr) const
+{
+	for (int op = 0; op < NUM_VAROPS; op++)
+	{
+		for (int kind = 0; kind < NUM_VARKINDS; kind++)
+		{
+			if (VarOpCodes[op][kind] != instr.Pcd) continue;
+
+			int index;
+			if (!(Format == ACS_LittleEnhanced ? ReadByte(ofs, index) : ReadLong(ofs, index)))
+				return false;
+
+			// Anything the interpreter would abort on is left to the interpreter.
+			switch (kind)
+			{
+			case VAR_Script:
+				if ((unsigned)index >= 65536) return false;
+				break;
+			case VAR_Map:
+				if ((unsigned)index >= NUM_MAPVARS || Module->MapVars[index] == nullptr) return false;
+				break;
+			case VAR_World:
+				if ((unsigned)index >= NUM_WORLDVARS) return false;
+				break;
+			case VAR_Global:
+				if ((unsigned)index >= NUM_GLOBALVARS) return false;
+				break;
+			}
+
+			instr.VarKind = kind;
+			instr.VarOp = op;
+			instr.Arg = index;
+			instr.Pops = (op == VOP_Push || op == VOP_Inc || op == VOP_Dec) ? 0 : 1;
+			instr.Pushes = op == VOP_Push ? 1 : 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool FACSRegionCompiler::DecodeInstr(uint32_t ofs, FACSJitInstr &instr) const
+{
+	memset(&instr, 0, sizeof(instr));
+	instr.Ofs = ofs;
+	instr.VarKind = -1;
+
+	int pcd;
+	if (Format == ACS_LittleEnhanced)
+	{
+		if (!ReadByte(ofs, pcd)) return false;
+		if (pcd >= 256-16)
+		{
+			int lo;
+			if (!ReadByte(ofs, lo)) return false;
+			pcd = (256-16) + ((pcd - (256-16)) << 8) + lo;
+		}
+	}
+	else if (!ReadLong(ofs, pcd))
+	{
+		return false;
+	}
+	instr.Pcd = pcd;
+
+	switch (pcd)
+	{
+	case PCD_NOP:
+		break;
+
+	case PCD_PUSHNUMBER:
+		if (!ReadLong(ofs, instr.Arg)) return false;
+		instr.Pushes = 1;
+		break;
+
+	case PCD_PUSHBYTE:
+		if (!ReadByte(ofs, instr.Arg)) return false;
+		instr.Pushes = 1;
+		break;
+
+	case PCD_PUSH2BYTES:
+	case PCD_PUSH3BYTES:
+	case PCD_PUSH4BYTES:
+	case PCD_PUSH5BYTES:
+	case PCD_PUSHBYTES:
+		if (pcd == PCD_PUSHBYTES)
+		{
+			if (!ReadByte(ofs, instr.Arg)) return false;
+		}
+		else
+		{
+			instr.Arg = pcd == PCD_PUSH2BYTES ? 2 : pcd == PCD_PUSH3BYTES ? 3 : pcd == PCD_PUSH4BYTES ? 4 : 5;
+		}
+		if (ofs + instr.Arg > DataSize) return false;
+		instr.Bytes = Data + ofs;
+		ofs += instr.Arg;
+		instr.Pushes = instr.Arg;
+		break;
+
+	case PCD_DUP:
+		instr.Pops = 1;
+		instr.Pushes = 2;
+		break;
+
+	case PCD_SWAP:
+		instr.Pops = 2;
+		instr.Pushes = 2;
+		break;
+
+	case PCD_DROP:
+		instr.Pops = 1;
+		break;
+
+	case PCD_ADD:
+	case PCD_SUBTRACT:
+	case PCD_MULTIPLY:
+	case PCD_DIVIDE:
+	case PCD_MODULUS:
+	case PCD_EQ:
+	case PCD_NE:
+	case PCD_LT:
+	case PCD_GT:
+	case PCD_LE:
+	case PCD_GE:
+	case PCD_ANDLOGICAL:
+	case PCD_ORLOGICAL:
+	case PCD_ANDBITWISE:
+	case PCD_ORBITWISE:
+	case PCD_EORBITWISE:
+	case PCD_LSHIFT:
+	case PCD_RSHIFT:
+	case PCD_FIXEDMUL:
+		instr.Pops = 2;
+		instr.Pushes = 1;
+		break;
+
+	case PCD_UNARYMINUS:
+	case PCD_NEGATELOGICAL:
+	case PCD_NEGATEBINARY:
+		instr.Pops = 1;
+		instr.Pushes = 1;
+		break;
+
+	case PCD_GOTO:
+	case PCD_IFGOTO:
+	case PCD_IFNOTGOTO:
+	{
+		int target;
+		if (!ReadLong(ofs, target)) return false;
+		instr.Target = target;
+		instr.Pops = pcd == PCD_GOTO ? 0 : 1;
+		break;
+	}
+
+	case PCD_CASEGOTO:
+	{
+		int target;
+		if (!ReadLong(ofs, instr.Arg2) || !ReadLong(ofs, target)) return false;
+		instr.Target = target;
+		instr.Pops = 1;		// only pops when it jumps
+		instr.Pushes = 1;
+		break;
+	}
+
+	default:
+		if (!DecodeVarOp(ofs, instr)) return false;
+		break;
+	}
+
+	instr.Next = ofs;
+	return true;
+}
+
+bool FACSRegionCompiler::Decode(uint32_t start)
+{
+	uint32_t ofs = start;
+	while (Instrs.Size() < MaxRegionLength)
+	{
+		FACSJitInstr instr;
+		if (!DecodeInstr(ofs, instr)) break;
+		InstrIndex[ofs] = Instrs.Push(instr);
+		if (instr.VarKind == VAR_Script) MaxLocal = MAX(MaxLocal, instr.Arg);
+		if (instr.VarKind >= 0) UsesVars[instr.VarKind] = true;
+		ofs = instr.Next;
+	}
+	if (Instrs.Size() < MinRegionLength) return false;
+
+	// Basic blocks start at the entry point, at every jump target inside the region and after every jump.
+	IsLeader.Resize(Instrs.Size());
+	for (auto &l : IsLeader) l = false;
+	IsLeader[0] = true;
+	for (unsigned int i = 0; i < Instrs.Size(); i++)
+	{
+		auto &instr = Instrs[i];
+		if (instr.Pcd == PCD_GOTO || instr.Pcd == PCD_IFGOTO || instr.Pcd == PCD_IFNOTGOTO || instr.Pcd == PCD_CASEGOTO)
+		{
+			if (i + 1 < Instrs.Size()) IsLeader[i + 1] = true;
+			auto target = InstrIndex.CheckKey(instr.Target);
+			if (target) IsLeader[*target] = true;
+		}
+	}
+	return true;
+}
+
+//==========================================================================
+//
+// The virtual stack
+//
+//==========================================================================
+
+void FACSRegionCompiler::PushConst(int32_t val)
+{
+	FACSJitValue &item = Items[Items.Reserve(1)];
+	item.IsConst = true;
+	item.Const = val;
+	item.Reg = asmjit::X86Gp();
+}
+
+void FACSRegionCompiler::PushReg(const asmjit::X86Gp &reg)
+{
+	FACSJitValue &item = Items[Items.Reserve(1)];
+	item.IsConst = false;
+	item.Const = 0;
+	item.Reg = reg;
+}
+
+FACSJitValue FACSRegionCompiler::Pop()
+{
+	FACSJitValue val;
+	if (Items.Pop(val))
+		return val;
+
+	SpDelta--;
+	val.IsConst = false;
+	val.Const = 0;
+	val.Reg = cc.newInt32();
+	cc.mov(val.Reg, asmjit::x86::dword_ptr(stack, sp, 2, SpDelta * 4));
+	return val;
+}
+
+// Writes the virtual stack to memory, so that sp is the real stack pointer again.
+void FACSRegionCompiler::Flush()
+{
+	using namespace asmjit;
+
+	for (unsigned int i = 0; i < Items.Size(); i++)
+	{
+		cc.emit(X86Inst::kIdMov, asmjit::x86::dword_ptr(stack, sp, 2, (SpDelta + i) * 4), ToOperand(Items[i]));
+	}
+	int delta = SpDelta + Items.Size();
+	if (delta != 0)
+		cc.add(sp, delta);
+	Items.Clear();
+	SpDelta = 0;
+}
+
+asmjit::X86Gp FACSRegionCompiler::ToReg(const FACSJitValue &val)
+{
+	if (!val.IsConst)
+		return val.Reg;
+
+	auto reg = cc.newInt32();
+	cc.mov(reg, val.Const);
+	return reg;
+}
+
+asmjit::Operand FACSRegionCompiler::ToOperand(const FACSJitValue &val)
+{
+	if (val.IsConst)
+		return asmjit::imm(val.Const);
+	return val.Reg;
+}
+
+//==========================================================================
+//
+// Code generation
+//
+//==========================================================================
+
+asmjit::CCFunc *FACSRegionCompiler::Codegen()
+{
+	using namespace asmjit;
+
+	ctx = cc.newIntPtr("ctx");
+	CCFunc *func = cc.addFunc(FuncSignature1<int, void *>());
+	cc.setArg(0, ctx);
+
+	stack = cc.newIntPtr("stack");
+	sp = cc.newInt32("sp");
+	runaway = cc.newInt32("runaway");
+	retval = cc.newInt32("retval");
+	ExitLabel = cc.newLabel();
+
+	cc.mov(stack, x86::ptr(ctx, myoffsetof(FACSJitContext, Stack)));
+	cc.mov(sp, x86::dword_ptr(ctx, myoffsetof(FACSJitContext, Sp)));
+	cc.mov(runaway, x86::dword_ptr(ctx, myoffsetof(FACSJitContext, Runaway)));
+
+	static const size_t varbaseofs[] = { myoffsetof(FACSJitContext, Locals), 0, myoffsetof(FACSJitContext, WorldVars), myoffsetof(FACSJitContext, GlobalVars) };
+	for (int kind = 0; kind < NUM_VARKINDS; kind++)
+	{
+		if (kind != VAR_Map && UsesVars[kind])
+		{
+			varbase[kind] = cc.newIntPtr();
+			cc.mov(varbase[kind], x86::ptr(ctx, varbaseofs[kind]));
+		}
+	}
+
+	// The interpreter aborts the script on a bad local variable index, so let it do that.
+	if (MaxLocal >= 0)
+	{
+		cc.cmp(x86::dword_ptr(ctx, myoffsetof(FACSJitContext, NumLocals)), MaxLocal);
+		cc.jle(ExitStubLabel(Instrs[0].Ofs));
+	}
+
+	Labels.Resize(Instrs.Size());
+	for (unsigned int i = 0; i < Instrs.Size(); i++)
+	{
+		if (IsLeader[i]) Labels[i] = cc.newLabel();
+	}
+
+	unsigned int blockend = 0;
+	for (unsigned int i = 0; i < Instrs.Size(); i++)
+	{
+		if (IsLeader[i])
+		{
+			Flush();
+			cc.bind(Labels[i]);
+			EmitBlockChecks(i);
+			for (blockend = i + 1; blockend < Instrs.Size() && !IsLeader[blockend]; blockend++) {}
+		}
+		EmitInstr(Instrs[i], blockend - i);
+	}
+
+	auto &last = Instrs.Last();
+	if (last.Pcd != PCD_GOTO)
+	{
+		EmitExit(last.Next);
+	}
+
+	for (unsigned int i = 0; i < ExitStubs.Size(); i++)
+	{
+		cc.bind(ExitStubs[i].Label);
+		cc.mov(retval, (int)ExitStubs[i].Ofs);
+		cc.jmp(ExitLabel);
+	}
+
+	cc.bind(ExitLabel);
+	cc.mov(x86::dword_ptr(ctx, myoffsetof(FACSJitContext, Sp)), sp);
+	cc.mov(x86::dword_ptr(ctx, myoffsetof(FACSJitContext, Runaway)), runaway);
+	cc.ret(retval);
+	cc.endFunc();
+	return func;
+}
+
+// Returns the label for a jump to ofs. Jumps out of the region go back to the interpreter.
+// The virtual stack must be flushed at every place that uses it.
+asmjit::Label FACSRegionCompiler::JumpLabel(uint32_t ofs)
+{
+	auto index = InstrIndex.CheckKey(ofs);
+	if (index && IsLeader[*index])
+		return Labels[*index];
+	return ExitStubLabel(ofs);
+}
+
+asmjit::Label FACSRegionCompiler::ExitStubLabel(uint32_t ofs)
+{
+	for (auto &stub : ExitStubs)
+	{
+		if (stub.Ofs == ofs) return stub.Label;
+	}
+	ExitStub stub = { cc.newLabel(), ofs };
+	ExitStubs.Push(stub);
+	return stub.Label;
+}
+
+// Stack bounds and the runaway counter are checked once per basic block. If
+// either would fail somewhere inside it, the interpreter runs the block
+// instead, so it can report the error at the right p-code.
+void FACSRegionCompiler::EmitBlockChecks(unsigned int first)
+{
+	int depth = 0, lowest = 0, highest = 0;
+	unsigned int count = 0;
+	for (unsigned int i = first; i < Instrs.Size() && (i == first || !IsLeader[i]); i++, count++)
+	{
+		depth -= Instrs[i].Pops;
+		lowest = MIN(lowest, depth);
+		depth += Instrs[i].Pushes;
+		highest = MAX(highest, depth);
+	}
+
+	auto bail = ExitStubLabel(Instrs[first].Ofs);
+	if (lowest < 0)
+	{
+		cc.cmp(sp, -lowest);
+		cc.jl(bail);
+	}
+	if (highest > 0)
+	{
+		cc.cmp(sp, STACK_SIZE - highest);
+		cc.jg(bail);
+	}
+
+	auto newrunaway = cc.newInt32();
+	cc.mov(newrunaway, runaway);
+	cc.add(newrunaway, count);
+	cc.cmp(newrunaway, (int)MaxRunaway);
+	cc.ja(bail);
+	cc.mov(runaway, newrunaway);
+}
+
+void FACSRegionCompiler::EmitExit(uint32_t ofs, unsigned int runawayAdjust)
+{
+	// Exits in the middle of a block must not change the state the rest of the block is compiled with.
+	TArray<FACSJitValue> saveditems = Items;
+	int savedspdelta = SpDelta;
+
+	Flush();
+	if (runawayAdjust != 0)
+		cc.sub(runaway, runawayAdjust);
+	cc.mov(retval, (int)ofs);
+	cc.jmp(ExitLabel);
+
+	Items = std::move(saveditems);
+	SpDelta = savedspdelta;
+}
+
+void FACSRegionCompiler::EmitInstr(const FACSJitInstr &instr, unsigned int remaining)
+{
+	switch (instr.Pcd)
+	{
+	case PCD_NOP:
+		break;
+
+	case PCD_PUSHNUMBER:
+	case PCD_PUSHBYTE:
+		PushConst(instr.Arg);
+		break;
+
+	case PCD_PUSH2BYTES:
+	case PCD_PUSH3BYTES:
+	case PCD_PUSH4BYTES:
+	case PCD_PUSH5BYTES:
+	case PCD_PUSHBYTES:
+		for (int i = 0; i < instr.Arg; i++)
+		{
+			PushConst(instr.Bytes[i]);
+		}
+		break;
+
+	case PCD_DUP:
+	{
+		// Values are never modified in place, so both copies can share the register.
+		auto val = Pop();
+		Items.Push(val);
+		Items.Push(val);
+		break;
+	}
+
+	case PCD_SWAP:
+	{
+		auto b = Pop();
+		auto a = Pop();
+		Items.Push(b);
+		Items.Push(a);
+		break;
+	}
+
+	case PCD_DROP:
+		if (Items.Size() > 0) Items.Pop();
+		else SpDelta--;
+		break;
+
+	case PCD_DIVIDE:
+	case PCD_MODULUS:
+		EmitDivision(instr.Pcd, instr.Ofs, remaining);
+		break;
+
+	case PCD_UNARYMINUS:
+	case PCD_NEGATELOGICAL:
+	case PCD_NEGATEBINARY:
+		EmitUnaryOp(instr.Pcd);
+		break;
+
+	case PCD_GOTO:
+	case PCD_IFGOTO:
+	case PCD_IFNOTGOTO:
+	case PCD_CASEGOTO:
+		EmitBranch(instr);
+		break;
+
+	default:
+		if (instr.VarKind >= 0) EmitVarOp(instr);
+		else EmitBinaryOp(instr.Pcd);
+		break;
+	}
+}
+
+static int32_t FoldBinaryOp(int pcd, int32_t a, int32_t b)
+{
+	switch (pcd)
+	{
+	default:
+	case PCD_ADD:			return (int32_t)((uint32_t)a + (uint32_t)b);
+	case PCD_SUBTRACT:		return (int32_t)((uint32_t)a - (uint32_t)b);
+	case PCD_MULTIPLY:		return (int32_t)((uint32_t)a * (uint32_t)b);
+	case PCD_EQ:			return a == b;
+	case PCD_NE:			return a != b;
+	case PCD_LT:			return a < b;
+	case PCD_GT:			return a > b;
+	case PCD_LE:			return a <= b;
+	case PCD_GE:			return a >= b;
+	case PCD_ANDLOGICAL:	return a && b;
+	case PCD_ORLOGICAL:		return a || b;
+	case PCD_ANDBITWISE:	return a & b;
+	case PCD_ORBITWISE:		return a | b;
+	case PCD_EORBITWISE:	return a ^ b;
+	case PCD_LSHIFT:		return (int32_t)((uint32_t)a << (b & 31));
+	case PCD_RSHIFT:		return a >> (b & 31);
+	case PCD_FIXEDMUL:		return (int32_t)(((int64_t)a * b) >> 16);
+	}
+}
+
+asmjit::X86Gp FACSRegionCompiler::EmitCompare(int pcd, const asmjit::X86Gp &a, const FACSJitValue &b)
+{
+	auto result = cc.newInt32();
+	cc.xor_(result, result);
+	if (b.IsConst) cc.cmp(a, b.Const);
+	else cc.cmp(a, b.Reg);
+	switch (pcd)
+	{
+	default:
+	case PCD_EQ: cc.sete(result.r8Lo()); break;
+	case PCD_NE: cc.setne(result.r8Lo()); break;
+	case PCD_LT: cc.setl(result.r8Lo()); break;
+	case PCD_GT: cc.setg(result.r8Lo()); break;
+	case PCD_LE: cc.setle(result.r8Lo()); break;
+	case PCD_GE: cc.setge(result.r8Lo()); break;
+	}
+	return result;
+}
+
+void FACSRegionCompiler::EmitBinaryOp(int pcd)
+{
+	using namespace asmjit;
+
+	auto b = Pop();
+	auto a = Pop();
+	if (a.IsConst && b.IsConst)
+	{
+		PushConst(FoldBinaryOp(pcd, a.Const, b.Const));
+		return;
+	}
+
+	auto result = cc.newInt32();
+	switch (pcd)
+	{
+	case PCD_ADD:
+	case PCD_SUBTRACT:
+	case PCD_MULTIPLY:
+	case PCD_ANDBITWISE:
+	case PCD_ORBITWISE:
+	case PCD_EORBITWISE:
+	{
+		uint32_t inst = pcd == PCD_ADD ? X86Inst::kIdAdd : pcd == PCD_SUBTRACT ? X86Inst::kIdSub : pcd == PCD_MULTIPLY ? X86Inst::kIdImul :
+			pcd == PCD_ANDBITWISE ? X86Inst::kIdAnd : pcd == PCD_ORBITWISE ? X86Inst::kIdOr : X86Inst::kIdXor;
+		cc.emit(X86Inst::kIdMov, result, ToOperand(a));
+		cc.emit(inst, result, ToOperand(b));
+		break;
+	}
+
+	case PCD_LSHIFT:
+	case PCD_RSHIFT:
+		cc.emit(X86Inst::kIdMov, result, ToOperand(a));
+		if (b.IsConst)
+		{
+			if (pcd == PCD_LSHIFT) cc.shl(result, b.Const & 31);
+			else cc.sar(result, b.Const & 31);
+		}
+		else
+		{
+			if (pcd == PCD_LSHIFT) cc.shl(result, b.Reg);
+			else cc.sar(result, b.Reg);
+		}
+		break;
+
+	case PCD_EQ:
+	case PCD_NE:
+	case PCD_LT:
+	case PCD_GT:
+	case PCD_LE:
+	case PCD_GE:
+		result = EmitCompare(pcd, ToReg(a), b);
+		break;
+
+	case PCD_ANDLOGICAL:
+	{
+		auto areg = ToReg(a), breg = ToReg(b);
+		auto tmp = cc.newInt32();
+		cc.xor_(result, result);
+		cc.xor_(tmp, tmp);
+		cc.test(areg, areg);
+		cc.setne(result.r8Lo());
+		cc.test(breg, breg);
+		cc.setne(tmp.r8Lo());
+		cc.and_(result, tmp);
+		break;
+	}
+
+	case PCD_ORLOGICAL:
+	{
+		auto tmp = cc.newInt32();
+		cc.emit(X86Inst::kIdMov, tmp, ToOperand(a));
+		cc.emit(X86Inst::kIdOr, tmp, ToOperand(b));
+		cc.xor_(result, result);
+		cc.test(tmp, tmp);
+		cc.setne(result.r8Lo());
+		break;
+	}
+
+	case PCD_FIXEDMUL:
+	{
+		auto a64 = cc.newInt64();
+		auto b64 = cc.newInt64();
+		cc.movsxd(a64, ToReg(a));
+		cc.movsxd(b64, ToReg(b));
+		cc.imul(a64, b64);
+		cc.sar(a64, 16);
+		cc.mov(result, a64.r32());
+		break;
+	}
+	}
+	PushReg(result);
+}
+
+void FACSRegionCompiler::EmitUnaryOp(int pcd)
+{
+	auto a = Pop();
+	if (a.IsConst)
+	{
+		PushConst(pcd == PCD_UNARYMINUS ? (int32_t)(0u - (uint32_t)a.Const) : pcd == PCD_NEGATEBINARY ? ~a.Const : !a.Const);
+		return;
+	}
+
+	auto result = cc.newInt32();
+	if (pcd == PCD_NEGATELOGICAL)
+	{
+		cc.xor_(result, result);
+		cc.test(a.Reg, a.Reg);
+		cc.sete(result.r8Lo());
+	}
+	else
+	{
+		cc.mov(result, a.Reg);
+		if (pcd == PCD_UNARYMINUS) cc.neg(result);
+		else cc.not_(result);
+	}
+	PushReg(result);
+}
+
+// Division by zero ends the script, which is left to the interpreter. It gets
+// the stack as it was before this p-code and counts the rest of the block itself.
+void FACSRegionCompiler::EmitDivision(int pcd, uint32_t ofs, unsigned int remaining)
+{
+	using namespace asmjit;
+
+	auto b = Pop();
+	auto a = Pop();
+	if (a.IsConst && b.IsConst && b.Const != 0 && !(a.Const == INT_MIN && b.Const == -1))
+	{
+		PushConst(pcd == PCD_DIVIDE ? a.Const / b.Const : a.Const % b.Const);
+		return;
+	}
+
+	auto breg = ToReg(b);
+	if (!b.IsConst || b.Const == 0)
+	{
+		auto ok = cc.newLabel();
+		cc.test(breg, breg);
+		cc.jnz(ok);
+		Items.Push(a);
+		Items.Push(b);
+		EmitExit(ofs, remaining);
+		Items.Pop();
+		Items.Pop();
+		cc.bind(ok);
+	}
+
+	auto quotient = cc.newInt32();
+	auto remainder = cc.newInt32();
+	cc.emit(X86Inst::kIdMov, quotient, ToOperand(a));
+	cc.cdq(remainder, quotient);
+	cc.idiv(remainder, quotient, breg);
+	PushReg(pcd == PCD_DIVIDE ? quotient : remainder);
+}
+
+asmjit::X86Mem FACSRegionCompiler::VarSlot(int kind, int index)
+{
+	if (kind == VAR_Map)
+	{
+		auto ptr = cc.newIntPtr();
+		cc.mov(ptr, asmjit::imm_ptr(Module->MapVars[index]));
+		return asmjit::x86::dword_ptr(ptr);
+	}
+	return asmjit::x86::dword_ptr(varbase[kind], index * 4);
+}
+
+void FACSRegionCompiler::EmitVarOp(const FACSJitInstr &instr)
+{
+	using namespace asmjit;
+
+	switch (instr.VarOp)
+	{
+	case VOP_Push:
+	{
+		auto reg = cc.newInt32();
+		cc.mov(reg, VarSlot(instr.VarKind, instr.Arg));
+		PushReg(reg);
+		break;
+	}
+
+	case VOP_Assign:
+	case VOP_Add:
+	case VOP_Sub:
+	case VOP_And:
+	case VOP_Or:
+	case VOP_Eor:
+	{
+		auto val = Pop();
+		auto slot = VarSlot(instr.VarKind, instr.Arg);
+		static const uint32_t insts[] = { 0, X86Inst::kIdMov, X86Inst::kIdAdd, X86Inst::kIdSub, 0, X86Inst::kIdAnd, X86Inst::kIdOr, X86Inst::kIdXor };
+		cc.emit(insts[instr.VarOp], slot, ToOperand(val));
+		break;
+	}
+
+	case VOP_Mul:
+	case VOP_LShift:
+	case VOP_RShift:
+	{
+		auto val = Pop();
+		auto slot = VarSlot(instr.VarKind, instr.Arg);
+		auto tmp = cc.newInt32();
+		cc.mov(tmp, slot);
+		if (instr.VarOp == VOP_Mul) cc.emit(X86Inst::kIdImul, tmp, ToOperand(val));
+		else if (val.IsConst && instr.VarOp == VOP_LShift) cc.shl(tmp, val.Const & 31);
+		else if (val.IsConst) cc.sar(tmp, val.Const & 31);
+		else if (instr.VarOp == VOP_LShift) cc.shl(tmp, val.Reg);
+		else cc.sar(tmp, val.Reg);
+		cc.mov(slot, tmp);
+		break;
+	}
+
+	case VOP_Inc:
+		cc.add(VarSlot(instr.VarKind, instr.Arg), 1);
+		break;
+
+	case VOP_Dec:
+		cc.sub(VarSlot(instr.VarKind, instr.Arg), 1);
+		break;
+	}
+}
+
+void FACSRegionCompiler::EmitBranch(const FACSJitInstr &instr)
+{
+	if (instr.Pcd == PCD_GOTO)
+	{
+		Flush();
+		cc.jmp(JumpLabel(instr.Target));
+		return;
+	}
+
+	auto val = Pop();
+	if (instr.Pcd == PCD_CASEGOTO)
+	{
+		if (val.IsConst)
+		{
+			if (val.Const == instr.Arg2)
+			{
+				Flush();
+				cc.jmp(JumpLabel(instr.Target));
+			}
+			Items.Push(val);
+			return;
+		}
+		Flush();
+		cc.cmp(val.Reg, instr.Arg2);
+		cc.je(JumpLabel(instr.Target));
+		Items.Push(val);
+		return;
+	}
+
+	bool jumpifset = instr.Pcd == PCD_IFGOTO;
+	if (val.IsConst)
+	{
+		Flush();
+		if ((val.Const != 0) == jumpifset)
+			cc.jmp(JumpLabel(instr.Target));
+		return;
+	}
+
+	Flush();
+	cc.test(val.Reg, val.Reg);
+	if (jumpifset) cc.jnz(JumpLabel(instr.Target));
+	else cc.jz(JumpLabel(instr.Target));
+}
+
+//==========================================================================
+//
+// FACSJit
+//
+//==========================================================================
+
+FACSJit::FACSJit(FBehavior *module) : Module(module)
+{
+	EntryState.Resize(module->GetDataSize());
+	if (EntryState.Size() > 0)
+		memset(&EntryState[0], 0, EntryState.Size());
+	Code = new JitCodeArena;
+}
+
+FACSJit::~FACSJit()
+{
+	JitReleaseArena(Code);
+	delete Code;
+}
+
+int *FACSJit::Run(int *pc, FACSJitContext &ctx)
+{
+	uint32_t ofs = Module->PC2Ofs(pc);
+	if (ofs >= EntryState.Size())
+		return pc;
+
+	uint8_t &state = EntryState[ofs];
+	RegionFunc func;
+	if (state == Compiled)
+	{
+		func = Entries[ofs];
+	}
+	else if (state == NoCode || ++state < HotThreshold)
+	{
+		return pc;
+	}
+	else
+	{
+		func = Compile(ofs);
+		if (func == nullptr)
+		{
+			state = NoCode;
+			return pc;
+		}
+		Entries[ofs] = func;
+		state = Compiled;
+	}
+	return Module->Ofs2PC(func(&ctx));
+}
+
+FACSJit::RegionFunc FACSJit::Compile(uint32_t ofs)
+{
+	using namespace asmjit;
+	try
+	{
+		ThrowingErrorHandler errorHandler;
+		CodeHolder code;
+		code.init(GetHostCodeInfo());
+		code.setErrorHandler(&errorHandler);
+
+		X86Compiler cc(&code);
+		FACSRegionCompiler compiler(cc, Module);
+		if (!compiler.Decode(ofs))
+			return nullptr;
+
+		CCFunc *func = compiler.Codegen();
+		cc.finalize();
+
+		FString name;
+		name.Format("ACS code at %u", ofs);
+		TArray<JitLineInfo> lineinfo;
+		return reinterpret_cast<RegionFunc>(AddJitFunction(&code, func, name.GetChars(), Module->GetModuleName(), lineinfo, Code));
+	}
+	catch (const std::exception &e)
+	{
+		Printf("%s: Unexpected ACS JIT error at %u: %s\n", Module->GetModuleName(), ofs, e.what());
+		return nullptr;
+	}
+}
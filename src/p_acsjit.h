@@ -0,0 +1,49 @@
+#pragma once
+
+#include "tarray.h"
+
+class FBehavior;
+struct JitCodeArena;
+
+// The part of the interpreter state that native code reads and writes.
+struct FACSJitContext
+{
+	int32_t *Stack;
+	int32_t *Locals;
+	int32_t *WorldVars;
+	int32_t *GlobalVars;
+	int Sp;
+	int NumLocals;
+	unsigned int Runaway;
+};
+
+// Compiles the hot, straight-line parts of an ACS module into native code.
+// A compiled region covers the stack, arithmetic, variable and branch p-codes
+// from its entry point up to the first p-code it does not understand. Running
+// it returns the byte offset where the interpreter has to continue.
+class FACSJit
+{
+public:
+	typedef int(*RegionFunc)(FACSJitContext *ctx);
+
+	FACSJit(FBehavior *module);
+	~FACSJit();
+
+	// Returns the new pc if native code ran, or the unchanged pc if the interpreter has to execute the next p-code itself.
+	int *Run(int *pc, FACSJitContext &ctx);
+
+private:
+	enum
+	{
+		HotThreshold = 16,
+		NoCode = 254,
+		Compiled = 255,
+	};
+
+	RegionFunc Compile(uint32_t ofs);
+
+	FBehavior *Module;
+	TArray<uint8_t> EntryState;		// execution count of each entry point, or NoCode/Compiled
+	TMap<uint32_t, RegionFunc> Entries;
+	JitCodeArena *Code;				// all compiled regions of the module, freed with it
+};
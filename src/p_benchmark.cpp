@@ -0,0 +1,243 @@
+//-----------------------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/
+//
+//-----------------------------------------------------------------------------
+//
+// DESCRIPTION:
+//		Headless playsim benchmark.
+//
+//		-benchmark <file> runs the game loop without drawing, sound or
+//		input processing, as fast as the playsim allows, and writes the
+//		per-tic subsystem timings to <file> when the demo ends or the
+//		tic limit given with -benchtics is reached. The output is JSON
+//		if the file name ends in .json, otherwise CSV.
+//
+//-----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include "p_benchmark.h"
+#include "m_argv.h"
+#include "files.h"
+#include "doomstat.h"
+#include "g_game.h"
+#include "templates.h"
+#include "cmdlib.h"
+#include "doomerrors.h"
+
+// EXTERNAL DATA DECLARATIONS ----------------------------------------------
+
+extern cycle_t ThinkCycles;
+extern cycle_t SightCycles;
+extern cycle_t ACSTime;
+extern cycle_t VMCycles[10];
+extern cycle_t GCCycles;
+
+// PUBLIC DATA DEFINITIONS -------------------------------------------------
+
+bool benchmarking;
+cycle_t BenchCycles[NUM_BENCHTIMERS];
+
+// PRIVATE DATA DEFINITIONS ------------------------------------------------
+
+struct FBenchSample
+{
+	int tic;
+	double ms[NUM_BENCHTIMERS];
+};
+
+static const char *BenchTimerNames[NUM_BENCHTIMERS] =
+{
+	"total", "thinkers", "sight", "acs", "vm", "gc", "sound"
+};
+
+static TArray<FBenchSample> BenchSamples;
+static FString BenchFile;
+static int BenchMaxTics;
+static double BenchVMStart;
+
+// CODE --------------------------------------------------------------------
+
+//==========================================================================
+//
+// P_SetupBenchmark
+//
+//==========================================================================
+
+void P_SetupBenchmark ()
+{
+	const char *v = Args->CheckValue("-benchmark");
+	if (v == nullptr || *v == 0) return;
+
+	benchmarking = true;
+	BenchFile = v;
+	FixPathSeperator(BenchFile);
+
+	v = Args->CheckValue("-benchtics");
+	BenchMaxTics = v != nullptr ? MAX(0, atoi(v)) : 0;
+
+	// Without a demo the only way to end the run is the tic limit.
+	if (BenchMaxTics == 0 && !Args->CheckParm("-playdemo") && !Args->CheckParm("-timedemo"))
+	{
+		BenchMaxTics = 60 * TICRATE;
+	}
+}
+
+//==========================================================================
+//
+// P_BenchmarkStartTic
+//
+//==========================================================================
+
+void P_BenchmarkStartTic ()
+{
+	for (auto &c : BenchCycles) c.Reset();
+	GCCycles.Reset();
+	BenchVMStart = VMCycles[0].TimeMS();
+	BenchCycles[BENCH_Total].Clock();
+}
+
+//==========================================================================
+//
+// P_BenchmarkEndTic
+//
+// Only tics that actually ran the playsim are recorded.
+//
+//==========================================================================
+
+void P_BenchmarkEndTic ()
+{
+	BenchCycles[BENCH_Total].Unclock();
+
+	if (gamestate != GS_LEVEL || paused)
+	{
+		return;
+	}
+
+	FBenchSample sample;
+	sample.tic = gametic;
+	sample.ms[BENCH_Total] = BenchCycles[BENCH_Total].TimeMS();
+	sample.ms[BENCH_Thinkers] = ThinkCycles.TimeMS();
+	sample.ms[BENCH_Sight] = SightCycles.TimeMS();
+	sample.ms[BENCH_ACS] = ACSTime.TimeMS();
+	sample.ms[BENCH_VM] = VMCycles[0].TimeMS() - BenchVMStart;
+	sample.ms[BENCH_GC] = GCCycles.TimeMS();
+	sample.ms[BENCH_Sound] = BenchCycles[BENCH_Sound].TimeMS();
+	BenchSamples.Push(sample);
+
+	if (BenchMaxTics > 0 && BenchSamples.Size() >= (unsigned)BenchMaxTics)
+	{
+		P_FinishBenchmark();
+	}
+}
+
+//==========================================================================
+//
+// WriteBenchmarkCSV
+//
+//==========================================================================
+
+static void WriteBenchmarkCSV(FileWriter *fw)
+{
+	fw->Printf("tic");
+	for (auto name : BenchTimerNames) fw->Printf(",%s_ms", name);
+	fw->Printf("\n");
+
+	for (auto &sample : BenchSamples)
+	{
+		fw->Printf("%d", sample.tic);
+		for (auto ms : sample.ms) fw->Printf(",%.4f", ms);
+		fw->Printf("\n");
+	}
+}
+
+//==========================================================================
+//
+// WriteBenchmarkJSON
+//
+//==========================================================================
+
+static void WriteBenchmarkJSON(FileWriter *fw, const double *avg, const double *peak)
+{
+	fw->Printf("{\n\t\"tics\": %u,\n\t\"summary\": {\n", BenchSamples.Size());
+	for (int i = 0; i < NUM_BENCHTIMERS; i++)
+	{
+		fw->Printf("\t\t\"%s\": { \"avg_ms\": %.4f, \"max_ms\": %.4f }%s\n", BenchTimerNames[i], avg[i], peak[i], i < NUM_BENCHTIMERS - 1 ? "," : "");
+	}
+	fw->Printf("\t},\n\t\"samples\": [\n");
+	for (unsigned j = 0; j < BenchSamples.Size(); j++)
+	{
+		auto &sample = BenchSamples[j];
+		fw->Printf("\t\t{ \"tic\": %d", sample.tic);
+		for (int i = 0; i < NUM_BENCHTIMERS; i++)
+		{
+			fw->Printf(", \"%s\": %.4f", BenchTimerNames[i], sample.ms[i]);
+		}
+		fw->Printf(" }%s\n", j < BenchSamples.Size() - 1 ? "," : "");
+	}
+	fw->Printf("\t]\n}\n");
+}
+
+//==========================================================================
+//
+// P_FinishBenchmark
+//
+//==========================================================================
+
+void P_FinishBenchmark ()
+{
+	double avg[NUM_BENCHTIMERS] = {}, peak[NUM_BENCHTIMERS] = {};
+
+	for (auto &sample : BenchSamples)
+	{
+		for (int i = 0; i < NUM_BENCHTIMERS; i++)
+		{
+			avg[i] += sample.ms[i];
+			peak[i] = MAX(peak[i], sample.ms[i]);
+		}
+	}
+	if (BenchSamples.Size() > 0)
+	{
+		for (auto &a : avg) a /= BenchSamples.Size();
+	}
+
+	Printf("Benchmark: %u tics\n", BenchSamples.Size());
+	for (int i = 0; i < NUM_BENCHTIMERS; i++)
+	{
+		Printf("  %-10s avg %8.4f ms, max %8.4f ms\n", BenchTimerNames[i], avg[i], peak[i]);
+	}
+
+	FileWriter *fw = FileWriter::Open(BenchFile);
+	if (fw == nullptr)
+	{
+		Printf("Could not open %s\n", BenchFile.GetChars());
+	}
+	else
+	{
+		auto len = BenchFile.Len();
+		if (len > 5 && !stricmp(BenchFile.GetChars() + len - 5, ".json"))
+		{
+			WriteBenchmarkJSON(fw, avg, peak);
+		}
+		else
+		{
+			WriteBenchmarkCSV(fw);
+		}
+		delete fw;
+	}
+
+	// Like a timedemo, end through the error path so that the stack
+	// unwinds and all shutdown handlers run.
+	I_FatalError("Benchmark finished after %u tics\n(This is not really an error.)", BenchSamples.Size());
+}
@@ -0,0 +1,34 @@
+#ifndef __P_BENCHMARK_H__
+#define __P_BENCHMARK_H__
+
+#include "stats.h"
+
+// Per-tic timers recorded by the headless playsim benchmark.
+// The subsystem timers are inclusive and may overlap, e.g. sight checks
+// and VM time are mostly spent inside the thinker loop.
+enum EBenchTimer
+{
+	BENCH_Total,
+	BENCH_Thinkers,
+	BENCH_Sight,
+	BENCH_ACS,
+	BENCH_VM,
+	BENCH_GC,
+	BENCH_Sound,
+
+	NUM_BENCHTIMERS
+};
+
+extern cycle_t BenchCycles[NUM_BENCHTIMERS];
+
+// Checks for -benchmark <file> [-benchtics <n>]. Must be called before
+// the sound system gets initialized.
+void P_SetupBenchmark ();
+
+void P_BenchmarkStartTic ();
+void P_BenchmarkEndTic ();
+
+// Writes the collected samples and ends the program the same way a timedemo does.
+void P_FinishBenchmark ();
+
+#endif
@@ -15,6 +15,7 @@ struct FBlockNode
 	FBlockNode *NextActor;			// next actor in this block
 	FBlockNode **PrevBlock;			// previous block this actor is in
 	FBlockNode *NextBlock;			// next block this actor is in
+	unsigned ThingIndex;			// index into the block's packed thing list
 
 	static FBlockNode *Create (AActor *who, int x, int y, int group = -1);
 	void Release ();
@@ -22,6 +23,32 @@ struct FBlockNode
 	static FBlockNode *FreeBlocks;
 };
 
+// Packed copy of a block link, so that iterators can walk a block's things
+// without chasing node pointers. DX and DY are the offset from the actor's
+// position to the block's portal group, taken when the actor is linked, so
+// the actor's current position can be tested without PosRelative. New links are appended and
+// removing one keeps the order of the rest, so walking the array backwards
+// gives the same order as the node list.
+struct FBlockThing
+{
+	AActor *Me;
+	FBlockNode *Node;
+	double DX, DY;
+	uint32_t Flags;
+	uint32_t Seq;					// increases with every link in the block, so the array is sorted by it
+};
+
+struct FBlockThings
+{
+	TArray<FBlockThing> Things;
+	uint32_t NextSeq = 0;
+};
+
+enum
+{
+	BTF_SingleBlock = 1,			// this is the actor's only link, so it needs no duplicate check
+};
+
 // BLOCKMAP
 // Created from axis aligned bounding box
 // of the map, a rectangular array of
@@ -40,6 +67,7 @@ struct FBlockmap
 	double				bmaporgx;
 	double				bmaporgy;		// origin of block map
 	FBlockNode**		blocklinks; 	// for thing chains
+	FBlockThings*		blockthings;	// packed copy of blocklinks
 
 	// mapblocks are used to check movement
 	// against lines and things
@@ -75,6 +103,27 @@ struct FBlockmap
 
 	bool VerifyBlockMap(int count, unsigned numlines);
 
+	void LinkThing(FBlockNode *node, double dx, double dy)
+	{
+		auto &block = blockthings[node->BlockIndex];
+		node->ThingIndex = block.Things.Push({ node->Me, node, dx, dy, 0, block.NextSeq++ });
+	}
+
+	void UnlinkThing(FBlockNode *node)
+	{
+		auto &things = blockthings[node->BlockIndex].Things;
+		things.Delete(node->ThingIndex);
+		for (unsigned i = node->ThingIndex; i < things.Size(); i++)
+		{
+			things[i].Node->ThingIndex = i;
+		}
+	}
+
+	void SetSingleBlock(FBlockNode *node)
+	{
+		blockthings[node->BlockIndex].Things[node->ThingIndex].Flags |= BTF_SingleBlock;
+	}
+
 	void Clear()
 	{
 		if (blockmaplump != nullptr)
@@ -87,6 +136,11 @@ struct FBlockmap
 			delete[] blocklinks;
 			blocklinks = nullptr;
 		}
+		if (blockthings != nullptr)
+		{
+			delete[] blockthings;
+			blockthings = nullptr;
+		}
 	}
 
 	~FBlockmap()
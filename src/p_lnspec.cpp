@@ -2754,6 +2754,7 @@ FUNC(LS_Line_SetBlocking)
 	{
 		Level->lines[line].flags = (Level->lines[line].flags & ~clearflags) | setflags;
 	}
+	P_FlushSightCache();
 	return true;
 }
 
@@ -3933,6 +3934,7 @@ int P_ExecuteSpecial(FLevelLocals *Level, int			num,
 {
 	if (num >= 0 && num < (int)countof(LineSpecials))
 	{
+		P_InvalidateSightQueries();
 		return LineSpecials[num](Level, line, activator, backSide, arg1, arg2, arg3, arg4, arg5);
 	}
 	return 0;
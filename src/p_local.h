@@ -272,7 +272,18 @@ enum ESightFlags
 	SF_IGNOREWATERBOUNDARY=8
 };
 
+struct FSightRequest
+{
+	AActor *t1, *t2;
+	int flags;
+	bool result;
+};
+
 void	P_ResetSightCounters (bool full);
+void	P_CheckSightBatch (FSightRequest *requests, unsigned count);
+void	P_PrepareSightQueries (FLevelLocals *Level);
+void	P_InvalidateSightQueries ();
+void	P_FlushSightCache ();
 bool	P_TalkFacing (AActor *player);
 void	P_UseLines (player_t* player);
 int	P_UsePuzzleItem (AActor *actor, int itemType);
@@ -96,6 +96,7 @@
 CVAR(Bool, cl_bloodsplats, true, CVAR_ARCHIVE)
 CVAR(Int, sv_smartaim, 0, CVAR_ARCHIVE | CVAR_SERVERINFO)
 CVAR(Bool, cl_doautoaim, false, CVAR_ARCHIVE)
+CVAR(Bool, sv_thingbroadphase, false, CVAR_SERVERINFO)	// reject things by their packed blockmap data
 
 static void CheckForPushSpecial(line_t *line, int side, AActor *mobj, DVector2 * posforwindowcheck = NULL);
 static void SpawnShootDecal(AActor *t1, AActor *defaults, const FTraceResults &trace);
@@ -1760,6 +1761,7 @@ bool P_CheckPosition(AActor *thing, const DVector2 &pos, FCheckPosition &tm, boo
 	FPortalGroupArray pcheck;
 	FMultiBlockThingsIterator it2(pcheck, thing->Level, pos.X, pos.Y, thing->Z(), thing->Height, thing->radius, false, newsec);
 	FMultiBlockThingsIterator::CheckResult tcres;
+	if (sv_thingbroadphase) it2.EnableBroadPhase();
 
 	while ((it2.Next(&tcres)))
 	{
@@ -1952,6 +1954,7 @@ int P_TestMobjZ(AActor *actor, bool quick, AActor **pOnmobj)
 	FPortalGroupArray check;
 	FMultiBlockThingsIterator it(check, actor, -1, true);
 	FMultiBlockThingsIterator::CheckResult cres;
+	if (sv_thingbroadphase) it.EnableBroadPhase();
 
 	while (it.Next(&cres))
 	{
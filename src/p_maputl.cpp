@@ -79,6 +79,9 @@
 // State.
 #include "po_man.h"
 #include "vm.h"
+#include "c_dispatch.h"
+#include "g_levellocals.h"
+#include "g_game.h"
 
 int P_VanillaPointOnDivlineSide(double x, double y, const divline_t* line);
 
@@ -340,6 +343,7 @@ void AActor::UnlinkFromWorld (FLinkContext *ctx)
 				block->NextActor->PrevActor = block->PrevActor;
 			}
 			*(block->PrevActor) = block->NextActor;
+			Level->blockmap.UnlinkThing(block);
 			FBlockNode *next = block->NextBlock;
 			block->Release ();
 			block = next;
@@ -551,10 +555,16 @@ void AActor::LinkToWorld(FLinkContext *ctx, bool spawningmapthing, sector_t *sec
 						node->NextBlock = NULL;
 						(*alink) = node;
 						alink = &node->NextBlock;
+
+						Level->blockmap.LinkThing(node, pos.X - X(), pos.Y - Y());
 					}
 				}
 			}
 		}
+		if (BlockNode != nullptr && BlockNode->NextBlock == nullptr)
+		{
+			Level->blockmap.SetSingleBlock(BlockNode);
+		}
 	}
 	// Portal links cannot be done unless the level is fully initialized.
 	if (!spawningmapthing) UpdateRenderSectorList();
@@ -895,7 +905,9 @@ FBlockThingsIterator::FBlockThingsIterator(FLevelLocals *l)
 	minx = maxx = 0;
 	miny = maxy = 0;
 	ClearHash();
-	block = NULL;
+	blockthings = nullptr;
+	thingindex = 0;
+	lastseq = 0;
 }
 
 FBlockThingsIterator::FBlockThingsIterator(FLevelLocals *l, int _minx, int _miny, int _maxx, int _maxy)
@@ -920,6 +932,28 @@ void FBlockThingsIterator::init(const FBoundingBox &box)
 	Reset();
 }
 
+//===========================================================================
+//
+// FBlockThingsIterator :: SetFilter
+//
+// Skips things whose bounding box does not overlap the given box. Only
+// usable if the caller rejects those things anyway. The test uses the
+// thing's current position and radius, which can have changed since it
+// was linked, plus the portal offset of the block it was linked into.
+//
+//===========================================================================
+
+void FBlockThingsIterator::SetFilter(const FBoundingBox &box)
+{
+	const double margin = 1. / 65536;	// so rounding can only let things through
+
+	filter = true;
+	filterbox[BOXTOP] = box.Top() + margin;
+	filterbox[BOXBOTTOM] = box.Bottom() - margin;
+	filterbox[BOXLEFT] = box.Left() - margin;
+	filterbox[BOXRIGHT] = box.Right() + margin;
+}
+
 //===========================================================================
 //
 // FBlockThingsIterator :: ClearHash
@@ -945,12 +979,16 @@ void FBlockThingsIterator::StartBlock(int x, int y)
 	cury = y;
 	if (Level->blockmap.isValidBlock(x, y))
 	{
-		block = Level->blockmap.blocklinks[y*Level->blockmap.bmapwidth + x];
+		blockthings = &Level->blockmap.blockthings[y*Level->blockmap.bmapwidth + x];
+		thingindex = blockthings->Things.Size();
+		lastseq = blockthings->NextSeq;
 	}
 	else
 	{
 		// invalid block
-		block = NULL;
+		blockthings = nullptr;
+		thingindex = 0;
+		lastseq = 0;
 	}
 }
 
@@ -967,6 +1005,29 @@ void FBlockThingsIterator::SwitchBlock(int x, int y)
 	StartBlock(x, y);
 }
 
+//===========================================================================
+//
+// FBlockThingsIterator :: FindNextThing
+//
+// Returns the number of entries in the current block that have not been
+// looked at yet. Those are exactly the ones with a lower sequence number
+// than the last one, since the entries are sorted by it.
+//
+//===========================================================================
+
+unsigned FBlockThingsIterator::FindNextThing()
+{
+	auto &things = blockthings->Things;
+	if (thingindex <= things.Size() &&
+		(thingindex == 0 || things[thingindex - 1].Seq < lastseq) &&
+		(thingindex == things.Size() || things[thingindex].Seq >= lastseq))
+	{
+		return thingindex;
+	}
+	return unsigned(std::lower_bound(things.begin(), things.end(), lastseq,
+		[](const FBlockThing &link, uint32_t seq) { return link.Seq < seq; }) - things.begin());
+}
+
 //===========================================================================
 //
 // FBlockThingsIterator :: Next
@@ -977,16 +1038,32 @@ AActor *FBlockThingsIterator::Next(bool centeronly)
 {
 	for (;;)
 	{
-		while (block != NULL)
+		// The block is walked backwards. Things linked after the walk started
+		// come after all visited entries and are skipped, like they were with
+		// the node list. If the caller unlinked anything from this block,
+		// the entries move and the position needs to be found again.
+		while (blockthings != nullptr && (thingindex = FindNextThing()) > 0)
 		{
-			AActor *me = block->Me;
-			FBlockNode *mynode = block;
+			const FBlockThing &link = blockthings->Things[--thingindex];
+			AActor *me = link.Me;
 			HashEntry *entry;
 			int i;
 
-			block = block->NextActor;
+			assert(link.Seq < lastseq);
+			lastseq = link.Seq;
+
+			if (filter)
+			{
+				double x = me->X() + link.DX;
+				double y = me->Y() + link.DY;
+				if (x + me->radius <= filterbox[BOXLEFT] || x - me->radius >= filterbox[BOXRIGHT] ||
+					y + me->radius <= filterbox[BOXBOTTOM] || y - me->radius >= filterbox[BOXTOP])
+				{
+					continue;
+				}
+			}
 			// Don't recheck things that were already checked
-			if (mynode->NextBlock == NULL && mynode->PrevBlock == &me->BlockNode)
+			if (link.Flags & BTF_SingleBlock)
 			{ // This actor doesn't span blocks, so we know it can only ever be checked once.
 				return me;
 			}
@@ -1140,6 +1217,7 @@ void FMultiBlockThingsIterator::startIteratorForGroup(int group)
 	offset.Y += checkpoint.Y;
 	bbox.setBox(offset.X, offset.Y, checkpoint.Z);
 	blockIterator.init(bbox);
+	if (broadphase) blockIterator.SetFilter(bbox);
 }
 
 //===========================================================================
@@ -1155,6 +1233,21 @@ void FMultiBlockThingsIterator::Reset()
 	startIteratorForGroup(basegroup);
 }
 
+//===========================================================================
+//
+// Lets the block iterator skip things whose bounding box doesn't overlap
+// the checked area. This may only be used by callers that reject those
+// things themselves. It applies to all groups that are still to be
+// iterated, so it should be called right after construction.
+//
+//===========================================================================
+
+void FMultiBlockThingsIterator::EnableBroadPhase()
+{
+	broadphase = true;
+	blockIterator.SetFilter(bbox);
+}
+
 //===========================================================================
 //
 // FPathTraverse :: Intercepts
@@ -2017,3 +2110,155 @@ subsector_t *FLevelLocals::PointInRenderSubsector (fixed_t x, fixed_t y)
 	return (subsector_t *)((uint8_t *)node - 1);
 }
 
+
+//==========================================================================
+//
+// TestBlockThings
+//
+// Walks a block while changing its links behind the iterator's back and
+// returns the number of things that were not visited exactly as often as
+// expected: once if they were linked when the walk started and were not
+// unlinked before being reached, never otherwise.
+//
+//==========================================================================
+
+enum
+{
+	BTT_UnlinkCurrent,			// unlink every thing right after it was returned
+	BTT_UnlinkOldest,			// unlink the thing that would be returned last
+	BTT_LinkNew,				// link a new thing after every returned one
+	BTT_Relink,					// unlink and link again the thing that was returned
+	BTT_NumTests
+};
+
+static int TestBlockThings(FLevelLocals *Level, const TArray<AActor *> &actors, int test)
+{
+	auto &block = Level->blockmap.blockthings[0];
+	const unsigned numstart = actors.Size() / 2;
+	unsigned numlinked = 0;
+
+	TArray<FBlockNode> nodes(actors.Size(), true);
+	TArray<int> returned(actors.Size(), true);
+	TArray<bool> skipped(actors.Size(), true);
+
+	auto link = [&](unsigned i)
+	{
+		nodes[i].Me = actors[i];
+		nodes[i].BlockIndex = 0;
+		Level->blockmap.LinkThing(&nodes[i], 0, 0);
+		Level->blockmap.SetSingleBlock(&nodes[i]);
+	};
+
+	for (unsigned i = 0; i < actors.Size(); i++)
+	{
+		returned[i] = 0;
+		skipped[i] = false;
+	}
+	for (; numlinked < numstart; numlinked++)
+	{
+		link(numlinked);
+	}
+
+	FBlockThingsIterator it(Level, 0, 0, 0, 0);
+	AActor *mo;
+	while ((mo = it.Next()) != nullptr)
+	{
+		unsigned i = 0;
+		while (i < actors.Size() && actors[i] != mo) i++;
+		if (i == actors.Size()) break;
+		returned[i]++;
+
+		switch (test)
+		{
+		case BTT_UnlinkCurrent:
+			Level->blockmap.UnlinkThing(&nodes[i]);
+			break;
+
+		case BTT_UnlinkOldest:
+			if (block.Things.Size() > 0)
+			{
+				unsigned oldest = unsigned(block.Things[0].Node - &nodes[0]);
+				if (returned[oldest] == 0)
+				{
+					Level->blockmap.UnlinkThing(&nodes[oldest]);
+					skipped[oldest] = true;
+				}
+			}
+			break;
+
+		case BTT_LinkNew:
+			if (numlinked < actors.Size())
+			{
+				link(numlinked++);
+			}
+			break;
+
+		case BTT_Relink:
+			Level->blockmap.UnlinkThing(&nodes[i]);
+			link(i);
+			break;
+		}
+	}
+
+	int errors = 0;
+	for (unsigned i = 0; i < actors.Size(); i++)
+	{
+		int expected = (i < numstart && !skipped[i]) ? 1 : 0;
+		if (returned[i] != expected) errors++;
+	}
+	block.Things.Clear();
+	return errors;
+}
+
+//==========================================================================
+//
+// CCMD blockthingstest
+//
+// Checks that FBlockThingsIterator neither repeats nor skips things when
+// the blocks it walks get changed during the walk. This runs on the first
+// block after putting its real contents aside, and only uses the level's
+// actors as identities, so nothing in the level is changed.
+//
+//==========================================================================
+
+CCMD(blockthingstest)
+{
+	if (gamestate != GS_LEVEL || primaryLevel->blockmap.blockthings == nullptr)
+	{
+		Printf("blockthingstest: not in a level\n");
+		return;
+	}
+
+	auto Level = primaryLevel;
+	TArray<AActor *> actors;
+	auto it = Level->GetThinkerIterator<AActor>();
+	AActor *mo;
+	while ((mo = it.Next()) != nullptr && actors.Size() < 32)
+	{
+		actors.Push(mo);
+	}
+	if (actors.Size() < 4)
+	{
+		Printf("blockthingstest: not enough actors in the level\n");
+		return;
+	}
+
+	static const char *const names[] = { "unlink current", "unlink oldest", "link new", "relink" };
+	static_assert(countof(names) == BTT_NumTests, "test names do not match");
+
+	FBlockThings saved;
+	saved.Things.Swap(Level->blockmap.blockthings[0].Things);
+	saved.NextSeq = Level->blockmap.blockthings[0].NextSeq;
+
+	int failed = 0;
+	for (int i = 0; i < BTT_NumTests; i++)
+	{
+		int errors = TestBlockThings(Level, actors, i);
+		Printf("%s: %s\n", names[i], errors == 0 ? "ok" : "FAILED");
+		if (errors > 0) failed++;
+	}
+
+	Level->blockmap.blockthings[0].Things.Swap(saved.Things);
+	Level->blockmap.blockthings[0].NextSeq = saved.NextSeq;
+	Printf("%d of %d block thing tests failed\n", failed, int(BTT_NumTests));
+}
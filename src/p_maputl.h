@@ -9,6 +9,7 @@
 
 extern int validcount;
 struct FBlockNode;
+struct FBlockThings;
 
 struct divline_t
 {
@@ -285,7 +286,12 @@ class FBlockThingsIterator
 
 	int curx, cury;
 
-	FBlockNode *block;
+	FBlockThings *blockthings;
+	unsigned thingindex;
+	uint32_t lastseq;				// sequence number of the last entry that was looked at
+
+	bool filter = false;
+	double filterbox[4];
 
 	int Buckets[32];
 
@@ -303,6 +309,7 @@ class FBlockThingsIterator
 	void StartBlock(int x, int y);
 	void SwitchBlock(int x, int y);
 	void ClearHash();
+	unsigned FindNextThing();
 
 	// The following is only for use in the path traverser 
 	// and therefore declared private.
@@ -319,6 +326,7 @@ public:
 		init(box);
 	}
 	void init(const FBoundingBox &box);
+	void SetFilter(const FBoundingBox &box);
 	AActor *Next(bool centeronly = false);
 	void Reset() { StartBlock(minx, miny); }
 };
@@ -332,6 +340,7 @@ class FMultiBlockThingsIterator
 	short index;
 	FBlockThingsIterator blockIterator;
 	FBoundingBox bbox;
+	bool broadphase = false;
 
 	void startIteratorForGroup(int group);
 
@@ -350,6 +359,7 @@ public:
 	FMultiBlockThingsIterator(FPortalGroupArray &check, FLevelLocals *Level, double checkx, double checky, double checkz, double checkh, double checkradius, bool ignorerestricted, sector_t *newsec);
 	bool Next(CheckResult *item);
 	void Reset();
+	void EnableBroadPhase();
 	const FBoundingBox &Box() const
 	{
 		return bbox;
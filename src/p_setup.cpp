@@ -256,8 +256,10 @@ void FLevelLocals::ClearPortals()
 void FLevelLocals::ClearLevelData()
 {
 	interpolator.ClearInterpolations();	// [RH] Nothing to interpolate on a fresh level.
+	P_CancelRejectBuilder(this);
 	Thinkers.DestroyAllThinkers();
 	ClearAllSubsectorLinks(); // can't be done as part of the polyobj deletion process.
+	P_FlushSightCache();
 
 	total_monsters = total_items = total_secrets =
 	killed_monsters = found_items = found_secrets = 0;
@@ -560,6 +562,8 @@ void P_SetupLevel(FLevelLocals *Level, int position, bool newGame)
 		Level->StartLightning();
 	}
 
+	// Maps without a usable REJECT get one generated in the background.
+	P_StartRejectBuilder(Level);
 }
 
 //
@@ -144,6 +144,11 @@ void P_SetupLevel (FLevelLocals *Level, int position, bool newGame);
 
 void P_FreeLevelData();
 
+// rejectbuilder.cpp
+void P_StartRejectBuilder(FLevelLocals *Level);
+void P_UpdateRejectBuilder(FLevelLocals *Level);
+void P_CancelRejectBuilder(FLevelLocals *Level);
+
 // Called by startup code.
 void P_Init (void);
 
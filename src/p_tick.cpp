@@ -38,6 +38,7 @@
 #include "events.h"
 #include "actorinlines.h"
 #include "g_game.h"
+#include "p_setup.h"
 
 extern gamestate_t wipegamestate;
 extern uint8_t globalfreeze, globalchangefreeze;
@@ -151,6 +152,7 @@ void P_Ticker (void)
 		// [ZZ] call the WorldTick hook
 		Level->localEventManager->WorldTick();
 		Level->Tick();			// [RH] let the level tick
+		P_UpdateRejectBuilder(Level);
 		Level->Thinkers.RunThinkers(Level);
 
 		//if added by MC: Freeze mode.
@@ -170,8 +170,8 @@ bool FDMDModel::Load(const char * path, int lumpnum, const char * buffer, int le
 void FDMDModel::LoadGeometry()
 {
 	static int axis[3] = { VX, VY, VZ };
-	FMemLump lumpdata = Wads.ReadLump(mLumpNum);
-	const char *buffer = (const char *)lumpdata.GetMem();
+	FLumpView lumpdata = Wads.ViewLump(mLumpNum);
+	const char *buffer = (const char *)lumpdata.Data();
 	texCoords = new FTexCoord[info.numTexCoords];
 	memcpy(texCoords, buffer + info.offsetTexCoords, info.numTexCoords * sizeof(FTexCoord));
 
@@ -496,8 +496,8 @@ void FMD2Model::LoadGeometry()
 {
 	static int axis[3] = { VX, VY, VZ };
 	uint8_t   *md2_frames;
-	FMemLump lumpdata = Wads.ReadLump(mLumpNum);
-	const char *buffer = (const char *)lumpdata.GetMem();
+	FLumpView lumpdata = Wads.ViewLump(mLumpNum);
+	const char *buffer = (const char *)lumpdata.Data();
 
 	texCoords = new FTexCoord[info.numTexCoords];
 	memcpy(texCoords, (uint8_t*)buffer + info.offsetTexCoords, info.numTexCoords * sizeof(FTexCoord));
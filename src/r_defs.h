@@ -670,6 +670,7 @@ struct sector_t
 
 	int			sky;						// MBF sky transfer info.
 	int 		validcount;					// if == validcount, already checked
+	unsigned	changecount;				// incremented whenever a plane of this sector is moved
 
 	uint32_t bottommap, midmap, topmap;		// killough 4/4/98: dynamic colormaps
 											// [RH] these can also be blend values if
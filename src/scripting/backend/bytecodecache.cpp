@@ -0,0 +1,831 @@
+//-----------------------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/
+//
+//-----------------------------------------------------------------------------
+//
+// DESCRIPTION:
+//		On-disk cache of compiled script functions.
+//
+//		Generating code for every function in gzdoom.pk3 and the loaded
+//		mods is the bulk of the script compiler's work at startup. The
+//		cache stores the finished bytecode of each function and is keyed
+//		on the engine version and the contents of every ZScript and DECORATE
+//		lump that was parsed, so it gets used only if nothing changed.
+//
+//		The class and type tables are still built by the parser each time,
+//		since they are tied to native code and the actor defaults. Only the
+//		code generator is skipped.
+//
+//		Bytecode refers to the rest of the engine through address
+//		constants and name indices. Addresses are stored by what they point
+//		to (a class, a state, a function, a CVAR, ...) and looked up again
+//		when loading; a function with a constant that cannot be described
+//		this way is not cached and always gets compiled. Name indices are
+//		kept valid by storing the whole name table and checking that the
+//		current session creates its names in the same order. Functions
+//		that use state labels are never cached, because the labels are
+//		added to the global label storage while resolving the function.
+//
+//		Since cached functions are not resolved, warnings the code
+//		generator would print for them while resolving are not repeated
+//		until the source changes.
+//
+//-----------------------------------------------------------------------------
+
+#include "bytecodecache.h"
+#include "vmbuilder.h"
+#include "codegen.h"
+#include "c_cvars.h"
+#include "cmdlib.h"
+#include "info.h"
+#include "m_misc.h"
+#include "m_random.h"
+#include "md5.h"
+#include "s_sound.h"
+#include "textures.h"
+#include "v_font.h"
+#include "version.h"
+#include "w_wad.h"
+#include "v_text.h"
+
+#include <algorithm>
+#include <memory>
+
+EXTERN_CVAR(Bool, vm_jit)
+EXTERN_CVAR(Bool, vm_optimize)
+
+static const char CacheMagic[4] = { 'Z', 'S', 'B', 'C' };
+static const uint32_t CacheVersion = 2;
+
+static TArray<int> SourceLumps;
+
+//==========================================================================
+//
+// Serialization helpers
+//
+//==========================================================================
+
+class FCacheWriter
+{
+public:
+	FCacheWriter(TArray<uint8_t> &data) : Data(data) {}
+
+	void Bytes(const void *buffer, size_t len)
+	{
+		if (len == 0) return;
+		unsigned pos = Data.Reserve(len);
+		memcpy(&Data[pos], buffer, len);
+	}
+	void UInt(uint32_t value) { Bytes(&value, sizeof(value)); }
+	void String(const FString &str)
+	{
+		UInt((uint32_t)str.Len());
+		Bytes(str.GetChars(), str.Len());
+	}
+
+private:
+	TArray<uint8_t> &Data;
+};
+
+class FCacheReader
+{
+public:
+	FCacheReader(const uint8_t *data, size_t len) : Pos(data), End(data + len) {}
+
+	bool Bytes(void *buffer, size_t len)
+	{
+		if (Error || len > size_t(End - Pos))
+		{
+			Error = true;
+			return false;
+		}
+		memcpy(buffer, Pos, len);
+		Pos += len;
+		return true;
+	}
+	uint32_t UInt()
+	{
+		uint32_t value = 0;
+		Bytes(&value, sizeof(value));
+		return value;
+	}
+	FString String()
+	{
+		uint32_t len = UInt();
+		if (Error || len > size_t(End - Pos))
+		{
+			Error = true;
+			return FString();
+		}
+		FString str((const char *)Pos, len);
+		Pos += len;
+		return str;
+	}
+
+	bool Error = false;
+
+private:
+	const uint8_t *Pos, *End;
+};
+
+//==========================================================================
+//
+// BytecodeCacheAddSource
+//
+//==========================================================================
+
+void BytecodeCacheAddSource(int lump)
+{
+	if (lump >= 0) SourceLumps.Push(lump);
+}
+
+//==========================================================================
+//
+// Types
+//
+// Only the ones that can show up in a function's return types or in the
+// special inits of its extra stack space need to be handled.
+//
+//==========================================================================
+
+static PType *GetBuiltinType(unsigned index)
+{
+	PType *const types[] =
+	{
+		TypeVoid, TypeSInt8, TypeUInt8, TypeSInt16, TypeUInt16, TypeSInt32, TypeUInt32, TypeBool,
+		TypeFloat32, TypeFloat64, TypeString, TypeName, TypeSound, TypeColor, TypeTextureID, TypeSpriteID,
+		TypeVector2, TypeVector3, TypeColorStruct, TypeStringStruct, TypeState, TypeFont, TypeStateLabel,
+		TypeNullPtr, TypeVoidPtr
+	};
+	return index < countof(types) ? types[index] : nullptr;
+}
+
+static bool EncodeType(const PType *type, FString &out)
+{
+	for (unsigned i = 0; GetBuiltinType(i) != nullptr; i++)
+	{
+		if (GetBuiltinType(i) == type)
+		{
+			out.AppendFormat("b%u;", i);
+			return true;
+		}
+	}
+	if (type->isObjectPointer())
+	{
+		auto ptype = static_cast<const PObjectPointer *>(type);
+		out.AppendFormat("o%d%s;", ptype->IsConst, ptype->PointedClass()->TypeName.GetChars());
+		return true;
+	}
+	if (type->isClassPointer())
+	{
+		out.AppendFormat("k%s;", static_cast<const PClassPointer *>(type)->ClassRestriction->TypeName.GetChars());
+		return true;
+	}
+	if (type->isDynArray())
+	{
+		out += "d";
+		return EncodeType(static_cast<const PDynArray *>(type)->ElementType, out);
+	}
+	if (type->TypeTableType == NAME_Array)
+	{
+		auto atype = static_cast<const PArray *>(type);
+		out.AppendFormat("a%u,", atype->ElementCount);
+		return EncodeType(atype->ElementType, out);
+	}
+	return false;
+}
+
+static PType *DecodeType(const char *&p)
+{
+	char kind = *p++;
+	if (kind == 'd')
+	{
+		PType *element = DecodeType(p);
+		return element == nullptr ? nullptr : NewDynArray(element);
+	}
+	if (kind == 'a')
+	{
+		char *end;
+		unsigned count = (unsigned)strtoul(p, &end, 10);
+		if (*end != ',') return nullptr;
+		p = end + 1;
+		PType *element = DecodeType(p);
+		return element == nullptr ? nullptr : NewArray(element, count);
+	}
+
+	const char *semi = strchr(p, ';');
+	if (semi == nullptr) return nullptr;
+	FString arg(p, semi - p);
+	p = semi + 1;
+
+	switch (kind)
+	{
+	case 'b':
+		return GetBuiltinType((unsigned)strtoul(arg, nullptr, 10));
+
+	case 'o':
+	{
+		PClass *cls = arg.Len() > 1 ? PClass::FindClass(arg.Mid(1)) : nullptr;
+		return cls == nullptr ? nullptr : NewPointer(cls, arg[0] == '1');
+	}
+
+	case 'k':
+	{
+		PClass *cls = PClass::FindClass(arg);
+		return cls == nullptr ? nullptr : NewClassPointer(cls);
+	}
+	}
+	return nullptr;
+}
+
+//==========================================================================
+//
+// Address constants
+//
+//==========================================================================
+
+// Static variables have their absolute address stored as the field offset.
+static void CollectStaticFields(TMap<FName, size_t> &fields)
+{
+	auto addtable = [&](PSymbolTable &table)
+	{
+		auto it = table.GetIterator();
+		PSymbolTable::MapType::Pair *pair;
+		while (it.NextPair(pair))
+		{
+			auto field = dyn_cast<PField>(pair->Value);
+			if (field == nullptr || (field->Flags & (VARF_Static | VARF_Meta)) != VARF_Static)
+				continue;
+
+			size_t *existing = fields.CheckKey(field->SymbolName);
+			if (existing == nullptr) fields.Insert(field->SymbolName, field->Offset);
+			else if (*existing != field->Offset) *existing = 0;	// ambiguous
+		}
+	};
+
+	for (auto ns : Namespaces.AllNamespaces)
+	{
+		addtable(ns->Symbols);
+	}
+	for (auto bucket : TypeTable.TypeHash)
+	{
+		for (PType *type = bucket; type != nullptr; type = type->HashNext)
+		{
+			addtable(type->Symbols);
+		}
+	}
+}
+
+static void *GetStaticField(const char *name)
+{
+	static TMap<FName, size_t> fields;
+	static unsigned collected;
+	// New types can get added while the code generator runs.
+	if (collected != PClass::AllClasses.Size())
+	{
+		fields.Clear();
+		CollectStaticFields(fields);
+		collected = PClass::AllClasses.Size();
+	}
+	size_t *address = fields.CheckKey(FName(name, true));
+	return address == nullptr ? nullptr : (void *)*address;
+}
+
+class FAddressEncoder
+{
+public:
+	FAddressEncoder()
+	{
+		for (unsigned i = 0; i < VMFunction::AllFunctions.Size(); i++) Functions.Insert(VMFunction::AllFunctions[i], i);
+		for (auto cls : PClass::AllClasses) Classes.Insert(cls, cls);
+		for (auto cls : PClassActor::AllActorClasses)
+		{
+			if (cls->ActorInfo() != nullptr && cls->GetStateCount() > 0) StateOwners.Push(cls);
+		}
+		std::sort(StateOwners.begin(), StateOwners.end(), [](PClassActor *a, PClassActor *b) { return a->GetStates() < b->GetStates(); });
+	}
+
+	bool Encode(VMFunctionBuilder *build, void *ptr, FString &out)
+	{
+		FString *name = build->AddressNames.CheckKey(ptr);
+		if (name != nullptr)
+		{
+			out = *name;
+			// Make sure the lookup when loading will produce the same address.
+			if (!strncmp(out, "global:", 7)) return GetStaticField(out.GetChars() + 7) == ptr;
+			if (!strncmp(out, "cvar:", 5))
+			{
+				FBaseCVar *cvar = FindCVar(strchr(out.GetChars() + 5, ':') + 1, nullptr);
+				if (cvar == nullptr) return false;
+				out.Format("cvar:%d:%s", cvar->GetRealType(), name->GetChars() + 5);
+			}
+			return true;
+		}
+
+		if (ptr == nullptr)
+		{
+			out = "null";
+			return true;
+		}
+		if (unsigned *index = Functions.CheckKey(ptr))
+		{
+			out.Format("func:%u:%s", *index, VMFunction::AllFunctions[*index]->PrintableName.GetChars());
+			return true;
+		}
+		if (PClass **cls = Classes.CheckKey(ptr))
+		{
+			out.Format("class:%s", (*cls)->TypeName.GetChars());
+			return true;
+		}
+		if (PClassActor *cls = FindStateOwner((FState *)ptr))
+		{
+			out.Format("state:%s:%d", cls->TypeName.GetChars(), int((FState *)ptr - cls->GetStates()));
+			return true;
+		}
+		// Offsets into objects
+		if ((uintptr_t)ptr < 65536)
+		{
+			out.Format("int:%u", (unsigned)(uintptr_t)ptr);
+			return true;
+		}
+		return false;
+	}
+
+private:
+	// The state blocks of different classes don't overlap, so the owner is the last class whose block starts at or before the state.
+	PClassActor *FindStateOwner(FState *state)
+	{
+		auto it = std::upper_bound(StateOwners.begin(), StateOwners.end(), state, [](FState *s, PClassActor *cls) { return s < cls->GetStates(); });
+		if (it == StateOwners.begin()) return nullptr;
+		PClassActor *cls = *(it - 1);
+		return cls->OwnsState(state) ? cls : nullptr;
+	}
+
+	TMap<void *, unsigned> Functions;
+	TMap<void *, PClass *> Classes;
+	TArray<PClassActor *> StateOwners;	// sorted by the address of their states
+};
+
+//==========================================================================
+//
+// FBytecodeCache :: DecodeAddress
+//
+//==========================================================================
+
+bool FBytecodeCache::DecodeAddress(const FString &str, void *&ptr)
+{
+	const char *s = str.GetChars();
+	const char *colon = strchr(s, ':');
+	FString kind = colon == nullptr ? str : FString(s, colon - s);
+	const char *arg = colon == nullptr ? "" : colon + 1;
+	char *end;
+
+	ptr = nullptr;
+	if (kind.Compare("null") == 0)
+	{
+		return true;
+	}
+	else if (kind.Compare("int") == 0)
+	{
+		ptr = (void *)(uintptr_t)strtoul(arg, nullptr, 10);
+		return true;
+	}
+	else if (kind.Compare("func") == 0)
+	{
+		unsigned index = (unsigned)strtoul(arg, &end, 10);
+		if (*end != ':' || index >= VMFunction::AllFunctions.Size() || VMFunction::AllFunctions[index]->PrintableName.Compare(end + 1) != 0)
+			return false;
+		ptr = VMFunction::AllFunctions[index];
+	}
+	else if (kind.Compare("class") == 0)
+	{
+		ptr = PClass::FindClass(arg);
+	}
+	else if (kind.Compare("state") == 0)
+	{
+		const char *sep = strrchr(arg, ':');
+		if (sep == nullptr) return false;
+		PClassActor *cls = PClass::FindActor(FString(arg, sep - arg));
+		unsigned index = (unsigned)strtoul(sep + 1, nullptr, 10);
+		if (cls == nullptr || cls->ActorInfo() == nullptr || index >= cls->GetStateCount()) return false;
+		ptr = cls->GetStates() + index;
+	}
+	else if (kind.Compare("cvar") == 0)
+	{
+		int type = (int)strtol(arg, &end, 10);
+		if (*end != ':') return false;
+		int offset = (int)strtol(end + 1, &end, 10);
+		if (*end != ':') return false;
+		FBaseCVar *cvar = FindCVar(end + 1, nullptr);
+		if (cvar == nullptr || cvar->GetRealType() != type) return false;
+		ptr = (uint8_t *)cvar + offset;
+	}
+	else if (kind.Compare("global") == 0)
+	{
+		ptr = GetStaticField(arg);
+	}
+	else if (kind.Compare("font") == 0)
+	{
+		ptr = V_GetFont(arg);
+	}
+	else if (kind.Compare("rng") == 0)
+	{
+		ptr = FRandom::StaticFindRNG(arg);
+	}
+	else if (kind.Compare("texcount") == 0)
+	{
+		ptr = (void *)TexMan.GetTextureCountAddress();
+	}
+	else if (kind.Compare("regtypes") == 0)
+	{
+		// Type info for vararg calls. This lives in the class data arena like the one created by the code generator.
+		size_t len = strlen(arg) / 2;
+		uint8_t *regtypes = (uint8_t *)ClassDataAllocator.Alloc(len);
+		for (size_t i = 0; i < len; i++)
+		{
+			char hex[3] = { arg[i * 2], arg[i * 2 + 1], 0 };
+			regtypes[i] = (uint8_t)strtoul(hex, nullptr, 16);
+		}
+		ptr = regtypes;
+	}
+	return ptr != nullptr;
+}
+
+//==========================================================================
+//
+// FBytecodeCache :: FBytecodeCache
+//
+//==========================================================================
+
+FBytecodeCache::FBytecodeCache()
+{
+}
+
+FBytecodeCache::~FBytecodeCache()
+{
+}
+
+//==========================================================================
+//
+// FBytecodeCache :: Open
+//
+//==========================================================================
+
+static FString GetCacheFileName(bool create)
+{
+	FString path = M_GetCachePath(create);
+	if (create) CreatePath(path);
+	path << "/bytecodecache.zsbc";
+	return path;
+}
+
+void FBytecodeCache::Open(unsigned numfunctions)
+{
+	Active = true;
+	Entries.Resize(numfunctions);
+
+	MD5Context md5;
+	FString version;
+	version.Format("%s %s %d %d %d", GetVersionString(), GetGitHash(), (int)sizeof(void *), *vm_jit, *vm_optimize);
+	md5.Update((const uint8_t *)version.GetChars(), (unsigned)version.Len());
+	for (int lump : SourceLumps)
+	{
+		FString name = Wads.GetLumpFullPath(lump);
+		md5.Update((const uint8_t *)name.GetChars(), (unsigned)name.Len() + 1);
+		FMemLump data = Wads.ReadLump(lump);
+		md5.Update((const uint8_t *)data.GetMem(), (unsigned)data.GetSize());
+	}
+	// Sound constants get compiled to indices into the SNDINFO table.
+	for (auto &sfx : S_sfx)
+	{
+		md5.Update((const uint8_t *)sfx.name.GetChars(), (unsigned)sfx.name.Len() + 1);
+	}
+	md5.Final(Key);
+
+	if (!ReadFile() || !CheckNames())
+	{
+		for (auto &entry : Entries) entry.Clear();
+	}
+	Names.Clear();
+}
+
+//==========================================================================
+//
+// FBytecodeCache :: ReadFile
+//
+//==========================================================================
+
+bool FBytecodeCache::ReadFile()
+{
+	FileReader fr;
+	if (!fr.OpenFile(GetCacheFileName(false)))
+		return false;
+
+	TArray<uint8_t> data((size_t)fr.GetLength(), true);
+	if (data.Size() == 0 || fr.Read(data.Data(), data.Size()) != data.Size())
+		return false;
+
+	FCacheReader reader(data.Data(), data.Size());
+	char magic[4];
+	uint8_t key[16];
+	reader.Bytes(magic, 4);
+	uint32_t version = reader.UInt();
+	reader.Bytes(key, 16);
+	if (reader.Error || memcmp(magic, CacheMagic, 4) != 0 || version != CacheVersion || memcmp(key, Key, 16) != 0)
+		return false;
+
+	uint32_t numnames = reader.UInt();
+	for (uint32_t i = 0; i < numnames && !reader.Error; i++)
+	{
+		Names.Push(reader.String());
+	}
+	uint32_t numentries = reader.UInt();
+	if (reader.Error || numentries != Entries.Size())
+		return false;
+
+	for (auto &entry : Entries)
+	{
+		entry.Resize(reader.UInt());
+		if (!reader.Bytes(entry.Data(), entry.Size()))
+			return false;
+	}
+	return true;
+}
+
+//==========================================================================
+//
+// FBytecodeCache :: CheckNames
+//
+// The cached code contains name indices. These are only valid if all
+// names that exist now have the same index as when the cache was written.
+// The names that got created by the code generator are then added in the
+// same order.
+//
+//==========================================================================
+
+bool FBytecodeCache::CheckNames()
+{
+	int numnames = FName::GetNumNames();
+	if (numnames > (int)Names.Size())
+		return false;
+
+	for (int i = 0; i < numnames; i++)
+	{
+		if (Names[i].Compare(FName(ENamedName(i)).GetChars()) != 0)
+			return false;
+	}
+	for (int i = numnames; i < (int)Names.Size(); i++)
+	{
+		if (FName(Names[i]).GetIndex() != i)
+			return false;
+	}
+	return true;
+}
+
+//==========================================================================
+//
+// FBytecodeCache :: Load
+//
+//==========================================================================
+
+bool FBytecodeCache::Load(unsigned index, const FString &name, PFunction *func, VMScriptFunction *sfunc)
+{
+	if (!Active || index >= Entries.Size() || Entries[index].Size() == 0)
+		return false;
+
+	FCacheReader r(Entries[index].Data(), Entries[index].Size());
+	if (r.String().Compare(name) != 0)
+		return false;
+
+	bool unsafe = !!r.UInt();
+	FString sourcefile = r.String();
+	int extraspace = r.UInt();
+
+	TArray<FTypeAndOffset> specialinits;
+	specialinits.Resize(r.UInt());
+	for (auto &init : specialinits)
+	{
+		FString typestr = r.String();
+		const char *p = typestr.GetChars();
+		init.first = r.Error ? nullptr : DecodeType(p);
+		init.second = r.UInt();
+		if (init.first == nullptr) return false;
+	}
+
+	TArray<PType *> rettypes;
+	rettypes.Resize(r.UInt());
+	for (auto &type : rettypes)
+	{
+		FString typestr = r.String();
+		const char *p = typestr.GetChars();
+		type = r.Error ? nullptr : DecodeType(p);
+		if (type == nullptr) return false;
+	}
+
+	uint8_t numregs[4];
+	r.Bytes(numregs, 4);
+	int maxparam = r.UInt();
+
+	TArray<VMOP> code;
+	TArray<FStatementInfo> lines;
+	TArray<int> konstd;
+	TArray<double> konstf;
+	TArray<FString> konsts;
+	TArray<void *> konsta;
+
+	code.Resize(r.UInt());
+	r.Bytes(code.Data(), code.Size() * sizeof(VMOP));
+	lines.Resize(r.UInt());
+	r.Bytes(lines.Data(), lines.Size() * sizeof(FStatementInfo));
+	konstd.Resize(r.UInt());
+	r.Bytes(konstd.Data(), konstd.Size() * sizeof(int));
+	konstf.Resize(r.UInt());
+	r.Bytes(konstf.Data(), konstf.Size() * sizeof(double));
+	konsts.Resize(r.UInt());
+	for (auto &str : konsts) str = r.String();
+	konsta.Resize(r.UInt());
+	for (auto &ptr : konsta)
+	{
+		FString addr = r.String();
+		if (r.Error || !DecodeAddress(addr, ptr)) return false;
+	}
+
+	TArray<FVirtualCallSite> virtualcalls;
+	virtualcalls.Resize(r.UInt());
+	for (auto &site : virtualcalls)
+	{
+		site.InstructionIndex = r.UInt();
+		FString cls = r.String();
+		site.SelfClass = r.Error ? nullptr : PClass::FindClass(cls);
+		if (site.SelfClass == nullptr) return false;
+	}
+
+	TArray<uint16_t> nullchecked;
+	nullchecked.Resize(r.UInt());
+	r.Bytes(nullchecked.Data(), nullchecked.Size() * sizeof(uint16_t));
+
+	if (r.Error || code.Size() == 0)
+		return false;
+
+	// Everything could be resolved, so now set up the function.
+	sfunc->Alloc(code.Size(), konstd.Size(), konstf.Size(), konsts.Size(), konsta.Size(), lines.Size());
+	memcpy(sfunc->Code, code.Data(), code.Size() * sizeof(VMOP));
+	if (lines.Size() > 0) memcpy(sfunc->LineInfo, lines.Data(), lines.Size() * sizeof(FStatementInfo));
+	if (konstd.Size() > 0) memcpy(sfunc->KonstD, konstd.Data(), konstd.Size() * sizeof(int));
+	if (konstf.Size() > 0) memcpy(sfunc->KonstF, konstf.Data(), konstf.Size() * sizeof(double));
+	for (unsigned i = 0; i < konsts.Size(); i++) sfunc->KonstS[i] = konsts[i];
+	for (unsigned i = 0; i < konsta.Size(); i++) sfunc->KonstA[i].v = konsta[i];
+
+	sfunc->SourceFileName = sourcefile;
+	sfunc->Unsafe = unsafe;
+	sfunc->ExtraSpace = extraspace;
+	sfunc->SpecialInits = std::move(specialinits);
+	sfunc->NumRegD = numregs[REGT_INT];
+	sfunc->NumRegF = numregs[REGT_FLOAT];
+	sfunc->NumRegS = numregs[REGT_STRING];
+	sfunc->NumRegA = numregs[REGT_POINTER];
+	sfunc->MaxParam = maxparam;
+	sfunc->StackSize = VMFrame::FrameSize(sfunc->NumRegD, sfunc->NumRegF, sfunc->NumRegS, sfunc->NumRegA, sfunc->MaxParam, sfunc->ExtraSpace);
+	sfunc->VirtualCalls = std::move(virtualcalls);
+	sfunc->NullCheckedOps = std::move(nullchecked);
+
+	// Anonymous functions get their prototype from the code generator.
+	if (sfunc->Proto == nullptr)
+	{
+		sfunc->Proto = NewPrototype(rettypes, func->Variants[0].Proto->ArgumentTypes);
+		sfunc->ArgFlags = func->Variants[0].ArgFlags;
+	}
+	Hits++;
+	return true;
+}
+
+//==========================================================================
+//
+// FBytecodeCache :: Store
+//
+//==========================================================================
+
+void FBytecodeCache::Store(unsigned index, const FString &name, VMFunctionBuilder *build, VMScriptFunction *sfunc)
+{
+	if (!Active || index >= Entries.Size())
+		return;
+
+	TArray<uint8_t> data;
+	FCacheWriter w(data);
+	FString str;
+	bool ok = true;
+
+	w.String(name);
+	w.UInt(sfunc->Unsafe);
+	w.String(sfunc->SourceFileName);
+	w.UInt(sfunc->ExtraSpace);
+	w.UInt(sfunc->SpecialInits.Size());
+	for (auto &init : sfunc->SpecialInits)
+	{
+		str = "";
+		ok &= EncodeType(init.first, str);
+		w.String(str);
+		w.UInt(init.second);
+	}
+	w.UInt(sfunc->Proto->ReturnTypes.Size());
+	for (auto type : sfunc->Proto->ReturnTypes)
+	{
+		str = "";
+		ok &= EncodeType(type, str);
+		w.String(str);
+	}
+
+	uint8_t numregs[4];
+	numregs[REGT_INT] = sfunc->NumRegD;
+	numregs[REGT_FLOAT] = sfunc->NumRegF;
+	numregs[REGT_STRING] = sfunc->NumRegS;
+	numregs[REGT_POINTER] = sfunc->NumRegA;
+	w.Bytes(numregs, 4);
+	w.UInt(sfunc->MaxParam);
+
+	w.UInt(sfunc->CodeSize);
+	w.Bytes(sfunc->Code, sfunc->CodeSize * sizeof(VMOP));
+	w.UInt(sfunc->LineInfoCount);
+	w.Bytes(sfunc->LineInfo, sfunc->LineInfoCount * sizeof(FStatementInfo));
+	w.UInt(sfunc->NumKonstD);
+	w.Bytes(sfunc->KonstD, sfunc->NumKonstD * sizeof(int));
+	w.UInt(sfunc->NumKonstF);
+	w.Bytes(sfunc->KonstF, sfunc->NumKonstF * sizeof(double));
+	w.UInt(sfunc->NumKonstS);
+	for (int i = 0; i < sfunc->NumKonstS; i++) w.String(sfunc->KonstS[i]);
+
+	if (Encoder == nullptr) Encoder.reset(new FAddressEncoder);
+	w.UInt(sfunc->NumKonstA);
+	for (int i = 0; i < sfunc->NumKonstA && ok; i++)
+	{
+		ok &= Encoder->Encode(build, sfunc->KonstA[i].v, str);
+		w.String(str);
+	}
+
+	w.UInt(sfunc->VirtualCalls.Size());
+	for (auto &site : sfunc->VirtualCalls)
+	{
+		w.UInt(site.InstructionIndex);
+		w.String(site.SelfClass->TypeName.GetChars());
+	}
+	w.UInt(sfunc->NullCheckedOps.Size());
+	w.Bytes(sfunc->NullCheckedOps.Data(), sfunc->NullCheckedOps.Size() * sizeof(uint16_t));
+
+	if (!ok) data.Clear();
+	auto &entry = Entries[index];
+	if (entry.Size() != data.Size() || (data.Size() > 0 && memcmp(entry.Data(), data.Data(), data.Size()) != 0))
+	{
+		entry = std::move(data);
+		Dirty = true;
+	}
+}
+
+//==========================================================================
+//
+// FBytecodeCache :: Save
+//
+//==========================================================================
+
+void FBytecodeCache::Save()
+{
+	if (!Active || !Dirty)
+		return;
+
+	TArray<uint8_t> data;
+	FCacheWriter w(data);
+	w.Bytes(CacheMagic, 4);
+	w.UInt(CacheVersion);
+	w.Bytes(Key, 16);
+
+	int numnames = FName::GetNumNames();
+	w.UInt(numnames);
+	for (int i = 0; i < numnames; i++)
+	{
+		w.String(FName(ENamedName(i)).GetChars());
+	}
+	w.UInt(Entries.Size());
+	for (auto &entry : Entries)
+	{
+		w.UInt(entry.Size());
+		w.Bytes(entry.Data(), entry.Size());
+	}
+
+	std::unique_ptr<FileWriter> fw(FileWriter::Open(GetCacheFileName(true)));
+	if (fw == nullptr || fw->Write(data.Data(), data.Size()) != data.Size())
+	{
+		Printf(TEXTCOLOR_ORANGE "Unable to write the bytecode cache\n");
+	}
+	Dirty = false;
+}
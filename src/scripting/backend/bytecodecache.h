@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory>
+#include "tarray.h"
+#include "zstring.h"
+
+class PFunction;
+class VMFunctionBuilder;
+class VMScriptFunction;
+class FAddressEncoder;
+
+// Called by the ZScript and DECORATE parsers for every lump they read. The cache is only valid for the exact same set of lumps.
+void BytecodeCacheAddSource(int lump);
+
+class FBytecodeCache
+{
+public:
+	FBytecodeCache();
+	~FBytecodeCache();
+
+	// Checks the cache file against the current sources and prepares it for a build of numfunctions functions.
+	void Open(unsigned numfunctions);
+
+	// Fills in the function from the cache. Returns false if there is no usable entry for it.
+	bool Load(unsigned index, const FString &name, PFunction *func, VMScriptFunction *sfunc);
+
+	// Remembers a freshly compiled function.
+	void Store(unsigned index, const FString &name, VMFunctionBuilder *build, VMScriptFunction *sfunc);
+
+	// Writes the cache file if anything had to be compiled.
+	void Save();
+
+	unsigned Hits = 0;
+
+private:
+	bool ReadFile();
+	bool CheckNames();
+	static bool DecodeAddress(const FString &str, void *&ptr);
+
+	bool Active = false;
+	bool Dirty = false;
+	uint8_t Key[16];
+	TArray<FString> Names;				// the name table from the session that wrote the cache
+	TArray<TArray<uint8_t>> Entries;	// one per function, empty if it could not be cached
+	std::unique_ptr<FAddressEncoder> Encoder;	// created by the first Store, all functions exist by then
+};
@@ -554,11 +554,14 @@ ExpEmit FxConstant::Emit(VMFunctionBuilder *build)
 	}
 	else if (regtype == REGT_POINTER)
 	{
-		out.RegNum = build->GetConstantAddress(value.pointer);
+		if (value.Type == TypeFont && value.pointer != nullptr)
+			out.RegNum = build->GetConstantAddress(value.pointer, FString("font:") + static_cast<FFont *>(value.pointer)->GetName().GetChars());
+		else
+			out.RegNum = build->GetConstantAddress(value.pointer);
 	}
 	else if (regtype == REGT_STRING)
 	{
-		out.RegNum = build->GetConstantString(value.GetString());
+		out.RegNum = build->GetConstantString(value.GetChars());
 	}
 	else
 	{
@@ -2970,11 +2973,9 @@ ExpEmit FxAddSub::Emit(VMFunctionBuilder *build)
 
 texcheck:
 	// Do a bounds check for the texture index. Note that count can change at run time so this needs to read the value from the texture manager.
-	auto * ptr = (FArray*)&TexMan.Textures;
-	auto * countptr = &ptr->Count;
 	ExpEmit bndp(build, REGT_POINTER);
 	ExpEmit bndc(build, REGT_INT);
-	build->Emit(OP_LKP, bndp.RegNum, build->GetConstantAddress(countptr));
+	build->Emit(OP_LKP, bndp.RegNum, build->GetConstantAddress((void*)TexMan.GetTextureCountAddress(), "texcount"));
 	build->Emit(OP_LW, bndc.RegNum, bndp.RegNum, build->GetConstantInt(0));
 	build->Emit(OP_BOUND_R, to.RegNum, bndc.RegNum);
 	bndp.Free(build);
@@ -5522,6 +5523,17 @@ FxExpression *FxRandom::Resolve(FCompileContext &ctx)
 };
 
 
+//==========================================================================
+//
+// Identifies the RNG for the bytecode cache
+//
+//==========================================================================
+
+static FString GetRNGCacheName(FRandom *rng)
+{
+	return rng->GetName() == nullptr ? FString() : FStringf("rng:%s", rng->GetName());
+}
+
 //==========================================================================
 //
 //
@@ -5557,7 +5569,7 @@ ExpEmit FxRandom::Emit(VMFunctionBuilder *build)
 	assert(min && max);
 
 	FunctionCallEmitter emitters(callfunc);
-	emitters.AddParameterPointerConst(rng);
+	emitters.AddParameterPointerConst(rng, GetRNGCacheName(rng));
 	emitters.AddParameter(build, min);
 	emitters.AddParameter(build, max);
 	emitters.AddReturn(REGT_INT);
@@ -5661,7 +5673,7 @@ ExpEmit FxRandomPick::Emit(VMFunctionBuilder *build)
 	callfunc = sym->Variants[0].Implementation;
 
 	FunctionCallEmitter emitters(callfunc);
-	emitters.AddParameterPointerConst(rng);
+	emitters.AddParameterPointerConst(rng, GetRNGCacheName(rng));
 	emitters.AddParameterIntConst(0);
 	emitters.AddParameterIntConst(choices.Size() - 1);
 	emitters.AddReturn(REGT_INT);
@@ -5785,7 +5797,7 @@ ExpEmit FxFRandom::Emit(VMFunctionBuilder *build)
 	assert(min && max);
 
 	FunctionCallEmitter emitters(callfunc);
-	emitters.AddParameterPointerConst(rng);
+	emitters.AddParameterPointerConst(rng, GetRNGCacheName(rng));
 	emitters.AddParameter(build, min);
 	emitters.AddParameter(build, max);
 	emitters.AddReturn(REGT_FLOAT);
@@ -5867,7 +5879,7 @@ ExpEmit FxRandom2::Emit(VMFunctionBuilder *build)
 
 	FunctionCallEmitter emitters(callfunc);
 
-	emitters.AddParameterPointerConst(rng);
+	emitters.AddParameterPointerConst(rng, GetRNGCacheName(rng));
 	emitters.AddParameter(build, mask);
 	emitters.AddReturn(REGT_INT);
 	return emitters.EmitCall(build);
@@ -5941,7 +5953,7 @@ ExpEmit FxRandomSeed::Emit(VMFunctionBuilder *build)
 	callfunc = sym->Variants[0].Implementation;
 
 	FunctionCallEmitter emitters(callfunc);
-	emitters.AddParameterPointerConst(rng);
+	emitters.AddParameterPointerConst(rng, GetRNGCacheName(rng));
 	emitters.AddParameter(build, seed);
 	return emitters.EmitCall(build);
 }
@@ -6741,7 +6753,7 @@ ExpEmit FxGlobalVariable::Emit(VMFunctionBuilder *build)
 {
 	ExpEmit obj(build, REGT_POINTER);
 
-	build->Emit(OP_LKP, obj.RegNum, build->GetConstantAddress((void*)(intptr_t)membervar->Offset));
+	build->Emit(OP_LKP, obj.RegNum, build->GetConstantAddress((void*)(intptr_t)membervar->Offset, FString("global:") + membervar->SymbolName.GetChars()));
 	if (AddressRequested)
 	{
 		return obj;
@@ -6816,6 +6828,13 @@ FxExpression *FxCVar::Resolve(FCompileContext &ctx)
 	return this;
 }
 
+static unsigned GetCVarAddress(VMFunctionBuilder *build, FBaseCVar *cvar, void *addr)
+{
+	FString cachename;
+	cachename.Format("cvar:%d:%s", int((uint8_t *)addr - (uint8_t *)cvar), cvar->GetName());
+	return build->GetConstantAddress(addr, cachename);
+}
+
 ExpEmit FxCVar::Emit(VMFunctionBuilder *build)
 {
 	ExpEmit dest(build, ValueType->GetRegType());
@@ -6824,27 +6843,27 @@ ExpEmit FxCVar::Emit(VMFunctionBuilder *build)
 	switch (CVar->GetRealType())
 	{
 	case CVAR_Int:
-		build->Emit(OP_LKP, addr.RegNum, build->GetConstantAddress(&static_cast<FIntCVar *>(CVar)->Value));
+		build->Emit(OP_LKP, addr.RegNum, GetCVarAddress(build, CVar, &static_cast<FIntCVar *>(CVar)->Value));
 		build->Emit(OP_LW, dest.RegNum, addr.RegNum, nul);
 		break;
 
 	case CVAR_Color:
-		build->Emit(OP_LKP, addr.RegNum, build->GetConstantAddress(&static_cast<FColorCVar *>(CVar)->Value));
+		build->Emit(OP_LKP, addr.RegNum, GetCVarAddress(build, CVar, &static_cast<FColorCVar *>(CVar)->Value));
 		build->Emit(OP_LW, dest.RegNum, addr.RegNum, nul);
 		break;
 
 	case CVAR_Float:
-		build->Emit(OP_LKP, addr.RegNum, build->GetConstantAddress(&static_cast<FFloatCVar *>(CVar)->Value));
+		build->Emit(OP_LKP, addr.RegNum, GetCVarAddress(build, CVar, &static_cast<FFloatCVar *>(CVar)->Value));
 		build->Emit(OP_LSP, dest.RegNum, addr.RegNum, nul);
 		break;
 
 	case CVAR_Bool:
-		build->Emit(OP_LKP, addr.RegNum, build->GetConstantAddress(&static_cast<FBoolCVar *>(CVar)->Value));
+		build->Emit(OP_LKP, addr.RegNum, GetCVarAddress(build, CVar, &static_cast<FBoolCVar *>(CVar)->Value));
 		build->Emit(OP_LBU, dest.RegNum, addr.RegNum, nul);
 		break;
 
 	case CVAR_String:
-		build->Emit(OP_LKP, addr.RegNum, build->GetConstantAddress(&static_cast<FStringCVar *>(CVar)->Value));
+		build->Emit(OP_LKP, addr.RegNum, GetCVarAddress(build, CVar, &static_cast<FStringCVar *>(CVar)->Value));
 		build->Emit(OP_LCS, dest.RegNum, addr.RegNum, nul);
 		break;
 
@@ -6854,7 +6873,7 @@ ExpEmit FxCVar::Emit(VMFunctionBuilder *build)
 		auto cv = static_cast<FFlagCVar *>(CVar);
 		auto vcv = &cv->ValueVar;
 		pVal = &vcv->Value;
-		build->Emit(OP_LKP, addr.RegNum, build->GetConstantAddress(pVal));
+		build->Emit(OP_LKP, addr.RegNum, GetCVarAddress(build, CVar, pVal));
 		build->Emit(OP_LW, dest.RegNum, addr.RegNum, nul);
 		build->Emit(OP_SRL_RI, dest.RegNum, dest.RegNum, cv->BitNum);
 		build->Emit(OP_AND_RK, dest.RegNum, dest.RegNum, build->GetConstantInt(1));
@@ -6864,7 +6883,7 @@ ExpEmit FxCVar::Emit(VMFunctionBuilder *build)
 	case CVAR_DummyInt:
 	{
 		auto cv = static_cast<FMaskCVar *>(CVar);
-		build->Emit(OP_LKP, addr.RegNum, build->GetConstantAddress(&cv->ValueVar.Value));
+		build->Emit(OP_LKP, addr.RegNum, GetCVarAddress(build, CVar, &cv->ValueVar.Value));
 		build->Emit(OP_LW, dest.RegNum, addr.RegNum, nul);
 		build->Emit(OP_AND_RK, dest.RegNum, dest.RegNum, build->GetConstantInt(cv->BitVal));
 		build->Emit(OP_SRL_RI, dest.RegNum, dest.RegNum, cv->BitNum);
@@ -9200,7 +9219,11 @@ ExpEmit FxVMFunctionCall::Emit(VMFunctionBuilder *build)
 	ArgList.DeleteAndClear();
 	ArgList.ShrinkToFit();
 
-	if (!staticcall) emitters.SetVirtualReg(selfemit.RegNum);
+	if (!staticcall)
+	{
+		PClass *selfclass = Self->ValueType->isObjectPointer() ? static_cast<PObjectPointer*>(Self->ValueType)->PointedClass() : nullptr;
+		emitters.SetVirtualReg(selfemit.RegNum, selfclass);
+	}
 	int resultcount = vmfunc->Proto->ReturnTypes.Size() == 0 ? 0 : MAX(AssignCount, 1);
 
 	assert((unsigned)resultcount <= vmfunc->Proto->ReturnTypes.Size());
@@ -11388,7 +11411,7 @@ ExpEmit FxLocalVariableDeclaration::Emit(VMFunctionBuilder *build)
 					break;
 				}
 				case REGT_STRING:
-					build->Emit(OP_LKS, RegNum, build->GetConstantString(constval->GetValue().GetString()));
+					build->Emit(OP_LKS, RegNum, build->GetConstantString(constval->GetValue().GetChars()));
 				}
 				emitval.Free(build);
 			}
@@ -11665,7 +11688,7 @@ ExpEmit FxLocalArrayDeclaration::Emit(VMFunctionBuilder *build)
 				break;
 
 			case REGT_STRING:
-				build->Emit(OP_LKS, regNum, build->GetConstantString(constval->GetValue().GetString()));
+				build->Emit(OP_LKS, regNum, build->GetConstantString(constval->GetValue().GetChars()));
 				build->Emit(OP_SS_R, build->FramePointer.RegNum, regNum, arrOffsetReg);
 				break;
 			}
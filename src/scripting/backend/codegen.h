@@ -200,6 +200,12 @@ struct ExpVal
 		return Type == TypeString ? *(FString *)&pointer : Type == TypeName ? FString(FName(ENamedName(Int)).GetChars()) : "";
 	}
 
+	// Unlike GetString this does not add a reference to a shared string buffer, which is not thread safe.
+	const char *GetChars() const
+	{
+		return Type == TypeString ? ((FString *)&pointer)->GetChars() : Type == TypeName ? FName(ENamedName(Int)).GetChars() : "";
+	}
+
 	bool GetBool() const
 	{
 		int regtype = Type->GetRegType();
@@ -37,6 +37,15 @@
 #include "m_argv.h"
 #include "c_cvars.h"
 #include "scripting/vm/jit.h"
+#include "vmoptimizer.h"
+#include "bytecodecache.h"
+#include "stats.h"
+#include "parallel_for.h"
+#include <mutex>
+
+CVAR(Bool, vm_optimize, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
+CVAR(Bool, vm_bytecodecache, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
+CVAR(Bool, vm_parallelcompile, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
 
 struct VMRemap
 {
@@ -140,6 +149,8 @@ void VMFunctionBuilder::MakeFunction(VMScriptFunction *func)
 	func->NumRegS = Registers[REGT_STRING].MostUsed;
 	func->MaxParam = MaxParam;
 	func->StackSize = VMFrame::FrameSize(func->NumRegD, func->NumRegF, func->NumRegS, func->NumRegA, func->MaxParam, func->ExtraSpace);
+	func->VirtualCalls = VirtualCalls;
+	func->NullCheckedOps = NullCheckedOps;
 
 	// Technically, there's no reason why we can't end the function with
 	// entries on the parameter stack, but it means the caller probably
@@ -217,6 +228,21 @@ unsigned VMFunctionBuilder::GetConstantInt(int val)
 	}
 }
 
+//==========================================================================
+//
+// VMFunctionBuilder :: FindConstantInt
+//
+// Returns the constant register GetConstantInt would return for the given
+// value, without adding it to the constant table.
+//
+//==========================================================================
+
+unsigned VMFunctionBuilder::FindConstantInt(int val)
+{
+	unsigned int *locp = IntConstantMap.CheckKey(val);
+	return locp != NULL ? *locp : IntConstantList.Size();
+}
+
 //==========================================================================
 //
 // VMFunctionBuilder :: GetConstantFloat
@@ -287,6 +313,21 @@ unsigned VMFunctionBuilder::GetConstantAddress(void *ptr)
 	}
 }
 
+//==========================================================================
+//
+// VMFunctionBuilder :: GetConstantAddress
+//
+// Same as above, but also remembers how the bytecode cache can find the
+// address again in a later session.
+//
+//==========================================================================
+
+unsigned VMFunctionBuilder::GetConstantAddress(void *ptr, const FString &cachename)
+{
+	AddressNames[ptr] = cachename;
+	return GetConstantAddress(ptr);
+}
+
 //==========================================================================
 //
 // VMFunctionBuilder :: AllocConstants*
@@ -803,23 +844,95 @@ VMFunction *FFunctionBuildList::AddFunction(PNamespace *gnspc, const VersionInfo
 }
 
 
+//==========================================================================
+//
+// FFunctionBuildList :: Build
+//
+// Resolving needs the symbol and type tables and may add to them, so it is
+// done for all functions first. After that the symbol tables are frozen and
+// every function's code can be emitted independently, which is done in
+// parallel if vm_parallelcompile is set. Messages from code generation get
+// collected per function and are printed in the original order afterward,
+// so the output does not depend on the number of threads.
+//
+//==========================================================================
+
+struct FEmitJob
+{
+	enum EState { None, Cached, Emit };
+
+	EState State = None;
+	std::unique_ptr<FCompileContext> Context;
+	std::unique_ptr<VMFunctionBuilder> Builder;
+	int ArgRegs[4];
+	bool Success = false;
+	bool Uncacheable = false;
+	FBytecodeOptimizerStats OptStats;
+	TArray<FScriptMessage> Messages;
+	std::exception_ptr Exception;
+};
+
+static void EmitFunction(FEmitJob &job, FxExpression *code, const FString &name)
+{
+	auto &buildit = *job.Builder;
+	FScriptPosition::MessageLog = &job.Messages;
+	try
+	{
+		buildit.BeginStatement(code);
+		code->Emit(&buildit);
+		buildit.EndStatement();
+		if (vm_optimize) VMOptimizeFunction(&buildit, job.ArgRegs, job.OptStats);
+		// MakeFunction allocates from ClassDataAllocator, which is not thread safe, so it is left to Build.
+		job.Success = true;
+	}
+	catch (CRecoverableError &err)
+	{
+		// catch errors from the code generator and pring something meaningful.
+		code->ScriptPosition.Message(MSG_ERROR, "%s in %s", err.GetMessage(), name.GetChars());
+	}
+	catch (...)
+	{
+		job.Exception = std::current_exception();
+	}
+	FScriptPosition::MessageLog = nullptr;
+}
+
 void FFunctionBuildList::Build()
 {
 	int codesize = 0;
 	int datasize = 0;
 	FILE *dump = nullptr;
 
+	FBytecodeOptimizerStats optstats;
+	FBytecodeCache cache;
+	cycle_t timer;
+
+	timer.Reset(); timer.Clock();
 	if (Args->CheckParm("-dumpdisasm")) dump = fopen("disasm.txt", "w");
+	if (vm_bytecodecache) cache.Open(mItems.Size());
 
-	for (auto &item : mItems)
+	std::vector<FEmitJob> jobs(mItems.Size());
+	TArray<unsigned> queue;
+
+	for (unsigned index = 0; index < mItems.Size(); index++)
 	{
+		auto &item = mItems[index];
+		auto &job = jobs[index];
 		assert(item.Code != NULL);
 
+		if (cache.Load(index, item.PrintableName, item.Func, item.Function))
+		{
+			job.State = FEmitJob::Cached;
+			continue;
+		}
+
 		// We don't know the return type in advance for anonymous functions.
-		FCompileContext ctx(item.CurGlobals, item.Func, item.Func->SymbolName == NAME_None ? nullptr : item.Func->Variants[0].Proto, item.FromDecorate, item.StateIndex, item.StateCount, item.Lump, item.Version);
+		job.Context.reset(new FCompileContext(item.CurGlobals, item.Func, item.Func->SymbolName == NAME_None ? nullptr : item.Func->Variants[0].Proto, item.FromDecorate, item.StateIndex, item.StateCount, item.Lump, item.Version));
+		FCompileContext &ctx = *job.Context;
 
 		// Allocate registers for the function's arguments and create local variable nodes before starting to resolve it.
-		VMFunctionBuilder buildit(item.Func->GetImplicitArgs());
+		job.Builder.reset(new VMFunctionBuilder(item.Func->GetImplicitArgs()));
+		VMFunctionBuilder &buildit = *job.Builder;
 		for (unsigned i = 0; i < item.Func->Variants[0].Proto->ArgumentTypes.Size(); i++)
 		{
 			auto type = item.Func->Variants[0].Proto->ArgumentTypes[i];
@@ -831,8 +944,10 @@ void FFunctionBuildList::Build()
 			else local->RegNum = buildit.Registers[REGT_POINTER].Get(1);
 			ctx.FunctionArgs.Push(local);
 		}
+		for (int i = 0; i < 4; i++) job.ArgRegs[i] = buildit.Registers[i].GetMostUsed();
 
 		FScriptPosition::StrictErrors = !item.FromDecorate;
+		unsigned labelsize = StateLabels.Storage.Size();
 		item.Code = item.Code->Resolve(ctx);
 		// If we need extra space, load the frame pointer into a register so that we do not have to call the wasteful LFP instruction more than once.
 		if (item.Function->ExtraSpace > 0)
@@ -868,38 +983,66 @@ void FFunctionBuildList::Build()
 				sfunc->Proto = NewPrototype(item.Proto->ReturnTypes, item.Func->Variants[0].Proto->ArgumentTypes);
 				sfunc->ArgFlags = item.Func->Variants[0].ArgFlags;
 			}
+			sfunc->SourceFileName = item.Code->ScriptPosition.FileName;	// remember the file name for printing error messages if something goes wrong in the VM.
+			sfunc->Unsafe = ctx.Unsafe;
+			// State labels are compiled to offsets into StateLabels, which only get added by Resolve and can't be restored from the cache.
+			job.Uncacheable = StateLabels.Storage.Size() != labelsize;
+			job.State = FEmitJob::Emit;
+			queue.Push(index);
+		}
+	}
 
-			// Emit code
-			try
-			{
-				sfunc->SourceFileName = item.Code->ScriptPosition.FileName;	// remember the file name for printing error messages if something goes wrong in the VM.
-				buildit.BeginStatement(item.Code);
-				item.Code->Emit(&buildit);
-				buildit.EndStatement();
-				buildit.MakeFunction(sfunc);
-				sfunc->NumArgs = 0;
-				// NumArgs for the VMFunction must be the amount of stack elements, which can differ from the amount of logical function arguments if vectors are in the list.
-				// For the VM a vector is 2 or 3 args, depending on size.
-				for (auto s : item.Func->Variants[0].Proto->ArgumentTypes)
-				{
-					sfunc->NumArgs += s->GetRegCount();
-				}
+	// Emit code
+	auto emit = [&](unsigned i)
+	{
+		unsigned index = queue[i];
+		EmitFunction(jobs[index], mItems[index].Code, mItems[index].PrintableName);
+	};
+	if (vm_parallelcompile)
+	{
+		parallel_for(0u, queue.Size(), 1u, emit);
+	}
+	else
+	{
+		for (unsigned i = 0; i < queue.Size(); i++)
+		{
+			emit(i);
+		}
+	}
 
-				if (dump != nullptr)
-				{
-					DumpFunction(dump, sfunc, item.PrintableName.GetChars(), (int)item.PrintableName.Len());
-					codesize += sfunc->CodeSize;
-					datasize += sfunc->LineInfoCount * sizeof(FStatementInfo) + sfunc->ExtraSpace + sfunc->NumKonstD * sizeof(int) +
-						sfunc->NumKonstA * sizeof(void*) + sfunc->NumKonstF * sizeof(double) + sfunc->NumKonstS * sizeof(FString);
-				}
-				sfunc->Unsafe = ctx.Unsafe;
+	for (unsigned index = 0; index < mItems.Size(); index++)
+	{
+		auto &item = mItems[index];
+		auto &job = jobs[index];
+		VMScriptFunction *sfunc = item.Function;
+
+		FScriptPosition::StrictErrors = !item.FromDecorate;
+		FScriptPosition::PrintMessages(job.Messages);
+		if (job.Exception) std::rethrow_exception(job.Exception);
+		optstats.Add(job.OptStats);
+		if (job.Success) job.Builder->MakeFunction(sfunc);
+
+		if (job.State == FEmitJob::Cached || job.Success)
+		{
+			sfunc->NumArgs = 0;
+			// NumArgs for the VMFunction must be the amount of stack elements, which can differ from the amount of logical function arguments if vectors are in the list.
+			// For the VM a vector is 2 or 3 args, depending on size.
+			for (auto s : item.Func->Variants[0].Proto->ArgumentTypes)
+			{
+				sfunc->NumArgs += s->GetRegCount();
 			}
-			catch (CRecoverableError &err)
+
+			if (dump != nullptr)
 			{
-				// catch errors from the code generator and pring something meaningful.
-				item.Code->ScriptPosition.Message(MSG_ERROR, "%s in %s", err.GetMessage(), item.PrintableName.GetChars());
+				DumpFunction(dump, sfunc, item.PrintableName.GetChars(), (int)item.PrintableName.Len());
+				codesize += sfunc->CodeSize;
+				datasize += sfunc->LineInfoCount * sizeof(FStatementInfo) + sfunc->ExtraSpace + sfunc->NumKonstD * sizeof(int) +
+					sfunc->NumKonstA * sizeof(void*) + sfunc->NumKonstF * sizeof(double) + sfunc->NumKonstS * sizeof(FString);
 			}
+			if (job.Success && !job.Uncacheable) cache.Store(index, item.PrintableName, job.Builder.get(), sfunc);
 		}
+		job.Builder.reset();
+		job.Context.reset();
 		delete item.Code;
 		if (dump != nullptr)
 		{
@@ -909,8 +1052,26 @@ void FFunctionBuildList::Build()
 	if (dump != nullptr)
 	{
 		fprintf(dump, "\n*************************************************************************\n%i code bytes\n%i data bytes", codesize * 4, datasize);
+		if (optstats.Functions > 0)
+		{
+			fprintf(dump, "\n%i of %i functions optimized\n%i instructions before, %i after\n%i registers before, %i after\n%i null checks removed",
+				optstats.Functions - optstats.Skipped, optstats.Functions, optstats.InstructionsBefore, optstats.InstructionsAfter,
+				optstats.RegistersBefore, optstats.RegistersAfter, optstats.NullChecksRemoved);
+		}
 		fclose(dump);
 	}
+	if (optstats.Functions > 0)
+	{
+		DPrintf(DMSG_NOTIFY, "Bytecode optimizer: %d of %d functions, %d -> %d instructions, %d null checks removed\n",
+			optstats.Functions - optstats.Skipped, optstats.Functions, optstats.InstructionsBefore, optstats.InstructionsAfter, optstats.NullChecksRemoved);
+	}
+	if (FScriptPosition::ErrorCounter == 0) cache.Save();
+	timer.Unclock();
+	if (!batchrun)
+	{
+		if (vm_bytecodecache) Printf("script code generation took %.2f ms (%u of %u functions from the bytecode cache)\n", timer.TimeMS(), cache.Hits, mItems.Size());
+		else Printf("script code generation took %.2f ms\n", timer.TimeMS());
+	}
 	VMFunction::CreateRegUseInfo();
 	FScriptPosition::StrictErrors = false;
 
@@ -983,14 +1144,15 @@ void FunctionCallEmitter::AddParameter(ExpEmit &emit, bool reference)
 	});
 }
 
-void FunctionCallEmitter::AddParameterPointerConst(void *konst)
+void FunctionCallEmitter::AddParameterPointerConst(void *konst, const char *cachename)
 {
 	numparams++;
 	if (target->VarFlags & VARF_VarArg)
 		reginfo.Push(REGT_POINTER);
+	FString name = cachename;
 	emitters.push_back([=](VMFunctionBuilder *build) ->int
 	{
-		build->Emit(OP_PARAM, REGT_POINTER | REGT_KONST, build->GetConstantAddress(konst));
+		build->Emit(OP_PARAM, REGT_POINTER | REGT_KONST, name.IsEmpty() ? build->GetConstantAddress(konst) : build->GetConstantAddress(konst, name));
 		return 1;
 	});
 }
@@ -1044,15 +1206,19 @@ void FunctionCallEmitter::AddParameterStringConst(const FString &konst)
 	numparams++;
 	if (target->VarFlags & VARF_VarArg)
 		reginfo.Push(REGT_STRING);
+	// Take a private copy. konst may be a default argument shared with code emitted on another thread.
+	FString str = konst.GetChars();
 	emitters.push_back([=](VMFunctionBuilder *build) ->int
 	{
-		build->Emit(OP_PARAM, REGT_STRING | REGT_KONST, build->GetConstantString(konst));
+		build->Emit(OP_PARAM, REGT_STRING | REGT_KONST, build->GetConstantString(str));
 		return 1;
 	});
 }
 
 EXTERN_CVAR(Bool, vm_jit)
 
+static std::mutex RegInfoMutex;
+
 ExpEmit FunctionCallEmitter::EmitCall(VMFunctionBuilder *build, TArray<ExpEmit> *ReturnRegs)
 {
 	unsigned paramcount = 0;
@@ -1065,9 +1231,16 @@ ExpEmit FunctionCallEmitter::EmitCall(VMFunctionBuilder *build, TArray<ExpEmit>
 	{
 		// Pass a hidden type information parameter to vararg functions.
 		// It would really be nicer to actually pass real types but that'd require a far more complex interface on the compiler side than what we have.
-		uint8_t *regbuffer = (uint8_t*)ClassDataAllocator.Alloc(reginfo.Size());	// Allocate in the arena so that the pointer does not need to be maintained.
+		uint8_t *regbuffer;
+		{
+			// Functions can get emitted on several threads.
+			std::lock_guard<std::mutex> lock(RegInfoMutex);
+			regbuffer = (uint8_t*)ClassDataAllocator.Alloc(reginfo.Size());	// Allocate in the arena so that the pointer does not need to be maintained.
+		}
 		memcpy(regbuffer, reginfo.Data(), reginfo.Size());
-		build->Emit(OP_PARAM, REGT_POINTER | REGT_KONST, build->GetConstantAddress(regbuffer));
+		FString cachename = "regtypes:";
+		for (auto t : reginfo) cachename.AppendFormat("%02x", t);
+		build->Emit(OP_PARAM, REGT_POINTER | REGT_KONST, build->GetConstantAddress(regbuffer, cachename));
 		paramcount++;
 	}
 
@@ -1081,7 +1254,11 @@ ExpEmit FunctionCallEmitter::EmitCall(VMFunctionBuilder *build, TArray<ExpEmit>
 	{
 		ExpEmit funcreg(build, REGT_POINTER);
 
-		build->Emit(OP_VTBL, funcreg.RegNum, virtualselfreg, target->VirtualIndex);
+		size_t vtbl = build->Emit(OP_VTBL, funcreg.RegNum, virtualselfreg, target->VirtualIndex);
+		if (virtualselfclass != nullptr)
+		{
+			build->VirtualCalls.Push({ (unsigned)vtbl, virtualselfclass });
+		}
 		build->Emit(OP_CALL, funcreg.RegNum, paramcount, vm_jit? target->Proto->ReturnTypes.Size() : returns.Size());
 	}
 
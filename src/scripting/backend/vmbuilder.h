@@ -42,6 +42,7 @@ public:
 		int MostUsed;
 
 		friend class VMFunctionBuilder;
+		friend class VMOptimizer;
 	};
 
 	VMFunctionBuilder(int numimplicits);
@@ -53,8 +54,12 @@ public:
 
 	// Returns the constant register holding the value.
 	unsigned GetConstantInt(int val);
+	// Returns the constant register GetConstantInt would return, without adding the value.
+	unsigned FindConstantInt(int val);
 	unsigned GetConstantFloat(double val);
 	unsigned GetConstantAddress(void *ptr);
+	// For addresses of engine data that the bytecode cache needs to look up by name when loading the function.
+	unsigned GetConstantAddress(void *ptr, const FString &cachename);
 	unsigned GetConstantString(FString str);
 
 	unsigned AllocConstantsInt(unsigned int count, int *values);
@@ -97,6 +102,15 @@ public:
 	ExpEmit FramePointer;
 	TArray<FxLocalVariableDeclaration *> ConstructedStructs;
 
+	// Static receiver types of the virtual calls in this function
+	TArray<FVirtualCallSite> VirtualCalls;
+
+	// Instructions whose pointer operand is known to be non-null, filled in by the optimizer
+	TArray<uint16_t> NullCheckedOps;
+
+	// Cache names of the address constants registered with GetConstantAddress(ptr, cachename)
+	TMap<void *, FString> AddressNames;
+
 private:
 	TArray<FStatementInfo> LineNumbers;
 	TArray<FxExpression *> StatementStack;
@@ -116,6 +130,7 @@ private:
 
 	TArray<VMOP> Code;
 
+	friend class VMOptimizer;
 };
 
 void DumpFunction(FILE *dump, VMScriptFunction *sfunc, const char *label, int labellen);
@@ -173,6 +188,7 @@ class FunctionCallEmitter
 	unsigned numparams = 0;	// This counts the number of pushed elements, which can differ from the number of emitters with vectors.
 	VMFunction *target = nullptr;
 	int virtualselfreg = -1;
+	PClass *virtualselfclass = nullptr;
 
 public:
 	FunctionCallEmitter(VMFunction *func)
@@ -180,14 +196,15 @@ public:
 		target = func;
 	}
 
-	void SetVirtualReg(int virtreg)
+	void SetVirtualReg(int virtreg, PClass *selfclass = nullptr)
 	{
 		virtualselfreg = virtreg;
+		virtualselfclass = selfclass;
 	}
 
 	void AddParameter(VMFunctionBuilder *build, FxExpression *operand);
 	void AddParameter(ExpEmit &emit, bool reference);
-	void AddParameterPointerConst(void *konst);
+	void AddParameterPointerConst(void *konst, const char *cachename = nullptr);
 	void AddParameterPointer(int index, bool konst);
 	void AddParameterFloatConst(double konst);
 	void AddParameterIntConst(int konst);
@@ -0,0 +1,1617 @@
+//-----------------------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/
+//
+//-----------------------------------------------------------------------------
+//
+// DESCRIPTION:
+//		Bytecode optimizer.
+//
+//		Runs over the code of one function after the code generator is
+//		done with it and before it is handed to the interpreter or the JIT:
+//
+//		- constants and copies are propagated within each basic block.
+//		  Integer math on known values is folded, and register operands
+//		  holding a known constant are turned into constant operands;
+//		- instructions without side effects whose results are never read
+//		  are removed, as is unreachable code;
+//		- pointer registers already dereferenced earlier on every path
+//		  are recorded, so that the JIT can leave out the null check;
+//		- registers that are no longer used are removed from the frame.
+//
+//		Functions containing anything the optimizer does not understand
+//		are left alone.
+//
+//-----------------------------------------------------------------------------
+
+#include <limits.h>
+#include "templates.h"
+#include "vmbuilder.h"
+#include "vmoptimizer.h"
+
+// TYPES -------------------------------------------------------------------
+
+enum
+{
+	FIELD_A,
+	FIELD_B,
+	FIELD_C,
+	FIELD_BC,
+};
+
+enum
+{
+	ACCESS_USE = 1,
+	ACCESS_DEF = 2,
+	ACCESS_MAYDEF = 4,		// register passed by address; the call may or may not write it
+};
+
+enum EOpFlow
+{
+	FLOW_NEXT,
+	FLOW_SKIP,				// compare: continues with the next instruction (a JMP) or the one after it
+	FLOW_JUMP,
+	FLOW_TABLE,				// IJMP: continues with one of the BC JMPs following it
+	FLOW_EXIT,
+};
+
+struct FOperand
+{
+	uint8_t Field;
+	uint8_t Type;
+	uint8_t Count;
+	uint8_t Access;
+};
+
+struct FOpDesc
+{
+	FOperand Operands[4];
+	int NumOperands;
+	EOpFlow Flow;
+	bool Pure;				// may be removed if nothing reads its results
+	bool Call;
+
+	void Add(int field, int type, int count, int access)
+	{
+		assert(NumOperands < 4);
+		Operands[NumOperands++] = { (uint8_t)field, (uint8_t)type, (uint8_t)count, (uint8_t)access };
+	}
+	void Use(int field, int type, int count = 1) { Add(field, type, count, ACCESS_USE); }
+	void Def(int field, int type, int count = 1) { Add(field, type, count, ACCESS_DEF); }
+};
+
+// One bit per register for each register type
+struct FRegSet
+{
+	uint64_t Bits[4][4];
+
+	void Clear() { memset(Bits, 0, sizeof(Bits)); }
+	void Fill() { memset(Bits, 0xff, sizeof(Bits)); }
+	bool Test(int type, int reg) const { return !!(Bits[type][reg >> 6] & (1ull << (reg & 63))); }
+	void Set(int type, int reg) { Bits[type][reg >> 6] |= 1ull << (reg & 63); }
+	void Reset(int type, int reg) { Bits[type][reg >> 6] &= ~(1ull << (reg & 63)); }
+
+	bool Merge(const FRegSet &other)
+	{
+		bool changed = false;
+		for (int t = 0; t < 4; t++)
+		{
+			for (int i = 0; i < 4; i++)
+			{
+				uint64_t merged = Bits[t][i] | other.Bits[t][i];
+				changed |= merged != Bits[t][i];
+				Bits[t][i] = merged;
+			}
+		}
+		return changed;
+	}
+
+	void Intersect(const FRegSet &other)
+	{
+		for (int t = 0; t < 4; t++)
+			for (int i = 0; i < 4; i++)
+				Bits[t][i] &= other.Bits[t][i];
+	}
+
+	bool operator!=(const FRegSet &other) const { return memcmp(Bits, other.Bits, sizeof(Bits)) != 0; }
+};
+
+struct FBasicBlock
+{
+	int Start, End;
+	TArray<int> Succ;
+	bool Reachable;
+	FRegSet In, Out;
+};
+
+// What the local propagation pass knows about a register
+struct FRegValue
+{
+	enum { None, Int, Konst, Copy };
+	int Kind;
+	int Value;		// the integer, the constant index or the register copied from
+};
+
+class VMOptimizer
+{
+public:
+	VMOptimizer(VMFunctionBuilder *build, const int *argregs) : Build(build), Code(build->Code), ArgRegs(argregs) {}
+
+	bool Run(FBytecodeOptimizerStats &stats);
+
+private:
+	bool Decode(const VMOP &op, FOpDesc &desc) const;
+	void BuildBlocks();
+	void RemoveUnreachable();
+	void PropagateBlock(const FBasicBlock &block);
+	void Fold(VMOP &op);
+	bool RemoveDeadStores();
+	void Compact();
+	void FindCheckedPointers();
+	void CompactRegisters();
+
+	void Kill(int type, int reg);
+	bool KnownInt(int reg, int &value) const;
+	int KnownKonst(int type, int reg) const;
+	void LoadInt(VMOP &op, int reg, int value);
+	bool SmallIntKonst(int value, int &index);
+
+	VMFunctionBuilder *Build;
+	TArray<VMOP> &Code;
+	const int *ArgRegs;
+	TArray<FOpDesc> Descs;
+	TArray<FBasicBlock> Blocks;
+	TArray<int> BlockOf;
+	FRegValue Values[4][256];
+};
+
+// CODE --------------------------------------------------------------------
+
+static int GetField(const VMOP &op, int field)
+{
+	switch (field)
+	{
+	case FIELD_A:	return op.a;
+	case FIELD_B:	return op.b;
+	case FIELD_C:	return op.c;
+	default:		return op.i16u;
+	}
+}
+
+static void SetField(VMOP &op, int field, int value)
+{
+	switch (field)
+	{
+	case FIELD_A:	op.a = value; break;
+	case FIELD_B:	op.b = value; break;
+	case FIELD_C:	op.c = value; break;
+	default:		op.i16u = value; break;
+	}
+}
+
+static int RegCount(int regtype)
+{
+	return (regtype & REGT_MULTIREG3) ? 3 : (regtype & REGT_MULTIREG2) ? 2 : 1;
+}
+
+//==========================================================================
+//
+// VMOptimizer :: Decode
+//
+// Lists the registers an instruction reads and writes. Returns false for
+// anything the optimizer does not know how to handle.
+//
+//==========================================================================
+
+bool VMOptimizer::Decode(const VMOP &op, FOpDesc &d) const
+{
+	d.NumOperands = 0;
+	d.Flow = FLOW_NEXT;
+	d.Pure = false;
+	d.Call = false;
+
+	switch (op.op)
+	{
+	case OP_NOP:
+		d.Pure = true;
+		break;
+
+	case OP_LI:
+	case OP_LK:
+		d.Def(FIELD_A, REGT_INT);
+		d.Pure = true;
+		break;
+	case OP_LKF:
+		d.Def(FIELD_A, REGT_FLOAT);
+		d.Pure = true;
+		break;
+	case OP_LKS:
+		d.Def(FIELD_A, REGT_STRING);
+		break;
+	case OP_LKP:
+	case OP_LFP:
+		d.Def(FIELD_A, REGT_POINTER);
+		d.Pure = true;
+		break;
+	case OP_LK_R:
+		d.Def(FIELD_A, REGT_INT); d.Use(FIELD_B, REGT_INT);
+		d.Pure = true;
+		break;
+	case OP_LKF_R:
+		d.Def(FIELD_A, REGT_FLOAT); d.Use(FIELD_B, REGT_INT);
+		d.Pure = true;
+		break;
+	case OP_LKS_R:
+		d.Def(FIELD_A, REGT_STRING); d.Use(FIELD_B, REGT_INT);
+		break;
+	case OP_LKP_R:
+		d.Def(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_INT);
+		d.Pure = true;
+		break;
+	case OP_META:
+	case OP_CLSS:
+		d.Def(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_POINTER);
+		break;
+
+	// Loads. These can throw and are never removed.
+	case OP_LB: case OP_LH: case OP_LW: case OP_LBU: case OP_LHU: case OP_LBIT:
+		d.Def(FIELD_A, REGT_INT); d.Use(FIELD_B, REGT_POINTER);
+		break;
+	case OP_LB_R: case OP_LH_R: case OP_LW_R: case OP_LBU_R: case OP_LHU_R:
+		d.Def(FIELD_A, REGT_INT); d.Use(FIELD_B, REGT_POINTER); d.Use(FIELD_C, REGT_INT);
+		break;
+	case OP_LSP: case OP_LDP:
+		d.Def(FIELD_A, REGT_FLOAT); d.Use(FIELD_B, REGT_POINTER);
+		break;
+	case OP_LSP_R: case OP_LDP_R:
+		d.Def(FIELD_A, REGT_FLOAT); d.Use(FIELD_B, REGT_POINTER); d.Use(FIELD_C, REGT_INT);
+		break;
+	case OP_LS: case OP_LCS:
+		d.Def(FIELD_A, REGT_STRING); d.Use(FIELD_B, REGT_POINTER);
+		break;
+	case OP_LS_R: case OP_LCS_R:
+		d.Def(FIELD_A, REGT_STRING); d.Use(FIELD_B, REGT_POINTER); d.Use(FIELD_C, REGT_INT);
+		break;
+	case OP_LO: case OP_LP:
+		d.Def(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_POINTER);
+		break;
+	case OP_LO_R: case OP_LP_R:
+		d.Def(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_POINTER); d.Use(FIELD_C, REGT_INT);
+		break;
+	case OP_LV2:
+		d.Def(FIELD_A, REGT_FLOAT, 2); d.Use(FIELD_B, REGT_POINTER);
+		break;
+	case OP_LV2_R:
+		d.Def(FIELD_A, REGT_FLOAT, 2); d.Use(FIELD_B, REGT_POINTER); d.Use(FIELD_C, REGT_INT);
+		break;
+	case OP_LV3:
+		d.Def(FIELD_A, REGT_FLOAT, 3); d.Use(FIELD_B, REGT_POINTER);
+		break;
+	case OP_LV3_R:
+		d.Def(FIELD_A, REGT_FLOAT, 3); d.Use(FIELD_B, REGT_POINTER); d.Use(FIELD_C, REGT_INT);
+		break;
+
+	// Stores
+	case OP_SB: case OP_SH: case OP_SW: case OP_SBIT:
+		d.Use(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_INT);
+		break;
+	case OP_SB_R: case OP_SH_R: case OP_SW_R:
+		d.Use(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_INT); d.Use(FIELD_C, REGT_INT);
+		break;
+	case OP_SSP: case OP_SDP:
+		d.Use(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_FLOAT);
+		break;
+	case OP_SSP_R: case OP_SDP_R:
+		d.Use(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_FLOAT); d.Use(FIELD_C, REGT_INT);
+		break;
+	case OP_SS:
+		d.Use(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_STRING);
+		break;
+	case OP_SS_R:
+		d.Use(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_STRING); d.Use(FIELD_C, REGT_INT);
+		break;
+	case OP_SP: case OP_SO:
+		d.Use(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_POINTER);
+		break;
+	case OP_SP_R: case OP_SO_R:
+		d.Use(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_POINTER); d.Use(FIELD_C, REGT_INT);
+		break;
+	case OP_SV2:
+		d.Use(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_FLOAT, 2);
+		break;
+	case OP_SV2_R:
+		d.Use(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_FLOAT, 2); d.Use(FIELD_C, REGT_INT);
+		break;
+	case OP_SV3:
+		d.Use(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_FLOAT, 3);
+		break;
+	case OP_SV3_R:
+		d.Use(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_FLOAT, 3); d.Use(FIELD_C, REGT_INT);
+		break;
+
+	// Moves
+	case OP_MOVE:
+		d.Def(FIELD_A, REGT_INT); d.Use(FIELD_B, REGT_INT);
+		d.Pure = true;
+		break;
+	case OP_MOVEF:
+		d.Def(FIELD_A, REGT_FLOAT); d.Use(FIELD_B, REGT_FLOAT);
+		d.Pure = true;
+		break;
+	case OP_MOVES:
+		d.Def(FIELD_A, REGT_STRING); d.Use(FIELD_B, REGT_STRING);
+		break;
+	case OP_MOVEA:
+		d.Def(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_POINTER);
+		d.Pure = true;
+		break;
+	case OP_MOVEV2:
+		d.Def(FIELD_A, REGT_FLOAT, 2); d.Use(FIELD_B, REGT_FLOAT, 2);
+		d.Pure = true;
+		break;
+	case OP_MOVEV3:
+		d.Def(FIELD_A, REGT_FLOAT, 3); d.Use(FIELD_B, REGT_FLOAT, 3);
+		d.Pure = true;
+		break;
+
+	case OP_CAST:
+		switch (op.c)
+		{
+		case CAST_I2F: case CAST_U2F:
+			d.Def(FIELD_A, REGT_FLOAT); d.Use(FIELD_B, REGT_INT);
+			d.Pure = true;
+			break;
+		case CAST_F2I: case CAST_F2U:
+			d.Def(FIELD_A, REGT_INT); d.Use(FIELD_B, REGT_FLOAT);
+			d.Pure = true;
+			break;
+		case CAST_I2S: case CAST_U2S: case CAST_N2S: case CAST_Co2S: case CAST_So2S: case CAST_SID2S: case CAST_TID2S:
+			d.Def(FIELD_A, REGT_STRING); d.Use(FIELD_B, REGT_INT);
+			break;
+		case CAST_F2S:
+			d.Def(FIELD_A, REGT_STRING); d.Use(FIELD_B, REGT_FLOAT);
+			break;
+		case CAST_V22S:
+			d.Def(FIELD_A, REGT_STRING); d.Use(FIELD_B, REGT_FLOAT, 2);
+			break;
+		case CAST_V32S:
+			d.Def(FIELD_A, REGT_STRING); d.Use(FIELD_B, REGT_FLOAT, 3);
+			break;
+		case CAST_P2S:
+			d.Def(FIELD_A, REGT_STRING); d.Use(FIELD_B, REGT_POINTER);
+			break;
+		case CAST_S2I: case CAST_S2N: case CAST_S2Co: case CAST_S2So:
+			d.Def(FIELD_A, REGT_INT); d.Use(FIELD_B, REGT_STRING);
+			break;
+		case CAST_S2F:
+			d.Def(FIELD_A, REGT_FLOAT); d.Use(FIELD_B, REGT_STRING);
+			break;
+		default:
+			return false;
+		}
+		break;
+	case OP_CASTB:
+		switch (op.c)
+		{
+		case CASTB_I: d.Use(FIELD_B, REGT_INT); break;
+		case CASTB_F: d.Use(FIELD_B, REGT_FLOAT); break;
+		case CASTB_A: d.Use(FIELD_B, REGT_POINTER); break;
+		case CASTB_S: d.Use(FIELD_B, REGT_STRING); break;
+		default: return false;
+		}
+		d.Def(FIELD_A, REGT_INT);
+		d.Pure = true;
+		break;
+	case OP_DYNCAST_R:
+	case OP_DYNCASTC_R:
+		d.Def(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_POINTER); d.Use(FIELD_C, REGT_POINTER);
+		d.Pure = true;
+		break;
+	case OP_DYNCAST_K:
+	case OP_DYNCASTC_K:
+		d.Def(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_POINTER);
+		d.Pure = true;
+		break;
+
+	// Control flow
+	case OP_TEST:
+	case OP_TESTN:
+		d.Use(FIELD_A, REGT_INT);
+		d.Flow = FLOW_SKIP;
+		break;
+	case OP_JMP:
+		d.Flow = FLOW_JUMP;
+		break;
+	case OP_IJMP:
+		d.Use(FIELD_A, REGT_INT);
+		d.Flow = FLOW_TABLE;
+		break;
+	case OP_PARAMI:
+		break;
+	case OP_PARAM:
+		if (op.a == REGT_NIL || (op.a & REGT_KONST))
+			break;
+		switch (op.a)
+		{
+		case REGT_INT: case REGT_STRING: case REGT_POINTER: case REGT_FLOAT:
+		case REGT_FLOAT | REGT_MULTIREG2: case REGT_FLOAT | REGT_MULTIREG3:
+			d.Use(FIELD_BC, op.a & REGT_TYPE, RegCount(op.a));
+			break;
+		case REGT_INT | REGT_ADDROF: case REGT_STRING | REGT_ADDROF: case REGT_POINTER | REGT_ADDROF:
+			d.Add(FIELD_BC, op.a & REGT_TYPE, 1, ACCESS_USE | ACCESS_MAYDEF);
+			break;
+		case REGT_FLOAT | REGT_ADDROF:
+			// The callee may treat it as a float, vector2 or vector3.
+			d.Add(FIELD_BC, REGT_FLOAT, clamp(Build->Registers[REGT_FLOAT].MostUsed - op.i16u, 1, 3), ACCESS_USE | ACCESS_MAYDEF);
+			break;
+		default:
+			return false;
+		}
+		break;
+	case OP_CALL:
+		d.Use(FIELD_A, REGT_POINTER);
+		d.Call = true;
+		break;
+	case OP_CALL_K:
+		d.Call = true;
+		break;
+	case OP_VTBL:
+		d.Def(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_POINTER);
+		break;
+	case OP_SCOPE:
+		d.Use(FIELD_A, REGT_POINTER);
+		break;
+	case OP_RESULT:
+		d.Def(FIELD_C, op.b & REGT_TYPE, RegCount(op.b));
+		break;
+	case OP_RET:
+		if (op.b == REGT_NIL)
+		{
+			d.Flow = FLOW_EXIT;
+			break;
+		}
+		if (!(op.b & REGT_KONST))
+			d.Use(FIELD_C, op.b & REGT_TYPE, RegCount(op.b));
+		if (op.a & RET_FINAL)
+			d.Flow = FLOW_EXIT;
+		break;
+	case OP_RETI:
+		if (op.a & RET_FINAL)
+			d.Flow = FLOW_EXIT;
+		break;
+	case OP_THROW:
+		d.Flow = FLOW_EXIT;
+		break;
+	case OP_BOUND:
+	case OP_BOUND_K:
+		d.Use(FIELD_A, REGT_INT);
+		break;
+	case OP_BOUND_R:
+		d.Use(FIELD_A, REGT_INT); d.Use(FIELD_B, REGT_INT);
+		break;
+
+	// Strings
+	case OP_CONCAT:
+		d.Def(FIELD_A, REGT_STRING); d.Use(FIELD_B, REGT_STRING); d.Use(FIELD_C, REGT_STRING);
+		break;
+	case OP_LENS:
+		d.Def(FIELD_A, REGT_INT); d.Use(FIELD_B, REGT_STRING);
+		d.Pure = true;
+		break;
+	case OP_CMPS:
+		if (!(op.a & CMP_BK)) d.Use(FIELD_B, REGT_STRING);
+		if (!(op.a & CMP_CK)) d.Use(FIELD_C, REGT_STRING);
+		d.Flow = FLOW_SKIP;
+		break;
+
+	// Integer math
+	case OP_SLL_RR: case OP_SRL_RR: case OP_SRA_RR: case OP_ADD_RR: case OP_SUB_RR: case OP_MUL_RR:
+	case OP_AND_RR: case OP_OR_RR: case OP_XOR_RR: case OP_MIN_RR: case OP_MAX_RR: case OP_MINU_RR: case OP_MAXU_RR:
+		d.Def(FIELD_A, REGT_INT); d.Use(FIELD_B, REGT_INT); d.Use(FIELD_C, REGT_INT);
+		d.Pure = true;
+		break;
+	case OP_SLL_RI: case OP_SRL_RI: case OP_SRA_RI: case OP_ADD_RK: case OP_ADDI: case OP_SUB_RK: case OP_MUL_RK:
+	case OP_AND_RK: case OP_OR_RK: case OP_XOR_RK: case OP_MIN_RK: case OP_MAX_RK: case OP_MINU_RK: case OP_MAXU_RK:
+	case OP_ABS: case OP_NEG: case OP_NOT:
+		d.Def(FIELD_A, REGT_INT); d.Use(FIELD_B, REGT_INT);
+		d.Pure = true;
+		break;
+	case OP_SLL_KR: case OP_SRL_KR: case OP_SRA_KR: case OP_SUB_KR:
+		d.Def(FIELD_A, REGT_INT); d.Use(FIELD_C, REGT_INT);
+		d.Pure = true;
+		break;
+	// Division can throw
+	case OP_DIV_RR: case OP_DIVU_RR: case OP_MOD_RR: case OP_MODU_RR:
+		d.Def(FIELD_A, REGT_INT); d.Use(FIELD_B, REGT_INT); d.Use(FIELD_C, REGT_INT);
+		break;
+	case OP_DIV_RK: case OP_DIVU_RK: case OP_MOD_RK: case OP_MODU_RK:
+		d.Def(FIELD_A, REGT_INT); d.Use(FIELD_B, REGT_INT);
+		break;
+	case OP_DIV_KR: case OP_DIVU_KR: case OP_MOD_KR: case OP_MODU_KR:
+		d.Def(FIELD_A, REGT_INT); d.Use(FIELD_C, REGT_INT);
+		break;
+	case OP_EQ_R: case OP_LT_RR: case OP_LE_RR: case OP_LTU_RR: case OP_LEU_RR:
+		d.Use(FIELD_B, REGT_INT); d.Use(FIELD_C, REGT_INT);
+		d.Flow = FLOW_SKIP;
+		break;
+	case OP_EQ_K: case OP_LT_RK: case OP_LE_RK: case OP_LTU_RK: case OP_LEU_RK:
+		d.Use(FIELD_B, REGT_INT);
+		d.Flow = FLOW_SKIP;
+		break;
+	case OP_LT_KR: case OP_LE_KR: case OP_LTU_KR: case OP_LEU_KR:
+		d.Use(FIELD_C, REGT_INT);
+		d.Flow = FLOW_SKIP;
+		break;
+
+	// Floating point math
+	case OP_ADDF_RR: case OP_SUBF_RR: case OP_MULF_RR: case OP_POWF_RR: case OP_MINF_RR: case OP_MAXF_RR: case OP_ATAN2:
+		d.Def(FIELD_A, REGT_FLOAT); d.Use(FIELD_B, REGT_FLOAT); d.Use(FIELD_C, REGT_FLOAT);
+		d.Pure = true;
+		break;
+	case OP_ADDF_RK: case OP_SUBF_RK: case OP_MULF_RK: case OP_POWF_RK: case OP_MINF_RK: case OP_MAXF_RK: case OP_FLOP:
+		d.Def(FIELD_A, REGT_FLOAT); d.Use(FIELD_B, REGT_FLOAT);
+		d.Pure = true;
+		break;
+	case OP_SUBF_KR: case OP_POWF_KR:
+		d.Def(FIELD_A, REGT_FLOAT); d.Use(FIELD_C, REGT_FLOAT);
+		d.Pure = true;
+		break;
+	case OP_DIVF_RR: case OP_MODF_RR:
+		d.Def(FIELD_A, REGT_FLOAT); d.Use(FIELD_B, REGT_FLOAT); d.Use(FIELD_C, REGT_FLOAT);
+		break;
+	case OP_DIVF_RK: case OP_MODF_RK:
+		d.Def(FIELD_A, REGT_FLOAT); d.Use(FIELD_B, REGT_FLOAT);
+		break;
+	case OP_DIVF_KR: case OP_MODF_KR:
+		d.Def(FIELD_A, REGT_FLOAT); d.Use(FIELD_C, REGT_FLOAT);
+		break;
+	case OP_EQF_R: case OP_LTF_RR: case OP_LEF_RR:
+		d.Use(FIELD_B, REGT_FLOAT); d.Use(FIELD_C, REGT_FLOAT);
+		d.Flow = FLOW_SKIP;
+		break;
+	case OP_EQF_K: case OP_LTF_RK: case OP_LEF_RK:
+		d.Use(FIELD_B, REGT_FLOAT);
+		d.Flow = FLOW_SKIP;
+		break;
+	case OP_LTF_KR: case OP_LEF_KR:
+		d.Use(FIELD_C, REGT_FLOAT);
+		d.Flow = FLOW_SKIP;
+		break;
+
+	// Vector math
+	case OP_NEGV2:
+		d.Def(FIELD_A, REGT_FLOAT, 2); d.Use(FIELD_B, REGT_FLOAT, 2);
+		d.Pure = true;
+		break;
+	case OP_ADDV2_RR: case OP_SUBV2_RR:
+		d.Def(FIELD_A, REGT_FLOAT, 2); d.Use(FIELD_B, REGT_FLOAT, 2); d.Use(FIELD_C, REGT_FLOAT, 2);
+		d.Pure = true;
+		break;
+	case OP_DOTV2_RR:
+		d.Def(FIELD_A, REGT_FLOAT); d.Use(FIELD_B, REGT_FLOAT, 2); d.Use(FIELD_C, REGT_FLOAT, 2);
+		d.Pure = true;
+		break;
+	case OP_MULVF2_RR: case OP_DIVVF2_RR:
+		d.Def(FIELD_A, REGT_FLOAT, 2); d.Use(FIELD_B, REGT_FLOAT, 2); d.Use(FIELD_C, REGT_FLOAT);
+		d.Pure = true;
+		break;
+	case OP_MULVF2_RK: case OP_DIVVF2_RK:
+		d.Def(FIELD_A, REGT_FLOAT, 2); d.Use(FIELD_B, REGT_FLOAT, 2);
+		d.Pure = true;
+		break;
+	case OP_LENV2:
+		d.Def(FIELD_A, REGT_FLOAT); d.Use(FIELD_B, REGT_FLOAT, 2);
+		d.Pure = true;
+		break;
+	case OP_EQV2_R:
+		d.Use(FIELD_B, REGT_FLOAT, 2); d.Use(FIELD_C, REGT_FLOAT, 2);
+		d.Flow = FLOW_SKIP;
+		break;
+	case OP_NEGV3:
+		d.Def(FIELD_A, REGT_FLOAT, 3); d.Use(FIELD_B, REGT_FLOAT, 3);
+		d.Pure = true;
+		break;
+	case OP_ADDV3_RR: case OP_SUBV3_RR: case OP_CROSSV_RR:
+		d.Def(FIELD_A, REGT_FLOAT, 3); d.Use(FIELD_B, REGT_FLOAT, 3); d.Use(FIELD_C, REGT_FLOAT, 3);
+		d.Pure = true;
+		break;
+	case OP_DOTV3_RR:
+		d.Def(FIELD_A, REGT_FLOAT); d.Use(FIELD_B, REGT_FLOAT, 3); d.Use(FIELD_C, REGT_FLOAT, 3);
+		d.Pure = true;
+		break;
+	case OP_MULVF3_RR: case OP_DIVVF3_RR:
+		d.Def(FIELD_A, REGT_FLOAT, 3); d.Use(FIELD_B, REGT_FLOAT, 3); d.Use(FIELD_C, REGT_FLOAT);
+		d.Pure = true;
+		break;
+	case OP_MULVF3_RK: case OP_DIVVF3_RK:
+		d.Def(FIELD_A, REGT_FLOAT, 3); d.Use(FIELD_B, REGT_FLOAT, 3);
+		d.Pure = true;
+		break;
+	case OP_LENV3:
+		d.Def(FIELD_A, REGT_FLOAT); d.Use(FIELD_B, REGT_FLOAT, 3);
+		d.Pure = true;
+		break;
+	case OP_EQV3_R:
+		d.Use(FIELD_B, REGT_FLOAT, 3); d.Use(FIELD_C, REGT_FLOAT, 3);
+		d.Flow = FLOW_SKIP;
+		break;
+
+	// Pointer math
+	case OP_ADDA_RR:
+		d.Def(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_POINTER); d.Use(FIELD_C, REGT_INT);
+		d.Pure = true;
+		break;
+	case OP_ADDA_RK:
+		d.Def(FIELD_A, REGT_POINTER); d.Use(FIELD_B, REGT_POINTER);
+		d.Pure = true;
+		break;
+	case OP_SUBA:
+		d.Def(FIELD_A, REGT_INT); d.Use(FIELD_B, REGT_POINTER); d.Use(FIELD_C, REGT_POINTER);
+		d.Pure = true;
+		break;
+	case OP_EQA_R:
+		d.Use(FIELD_B, REGT_POINTER); d.Use(FIELD_C, REGT_POINTER);
+		d.Flow = FLOW_SKIP;
+		break;
+	case OP_EQA_K:
+		d.Use(FIELD_B, REGT_POINTER);
+		d.Flow = FLOW_SKIP;
+		break;
+
+	default:
+		return false;
+	}
+
+	for (int i = 0; i < d.NumOperands; i++)
+	{
+		if (GetField(op, d.Operands[i].Field) + d.Operands[i].Count > 256)
+			return false;
+	}
+	return true;
+}
+
+//==========================================================================
+//
+// VMOptimizer :: BuildBlocks
+//
+//==========================================================================
+
+void VMOptimizer::BuildBlocks()
+{
+	int size = Code.Size();
+	TArray<bool> leader(size + 1, true);
+	for (int i = 0; i <= size; i++) leader[i] = false;
+	leader[0] = true;
+
+	for (int i = 0; i < size; i++)
+	{
+		switch (Descs[i].Flow)
+		{
+		case FLOW_NEXT:
+			break;
+		case FLOW_SKIP:
+			leader[i + 1] = true;
+			if (i + 2 <= size) leader[i + 2] = true;
+			break;
+		case FLOW_JUMP:
+			leader[i + 1 + Code[i].i24] = true;
+			leader[i + 1] = true;
+			break;
+		case FLOW_TABLE:
+			for (int j = 1; j <= (int)Code[i].i16u + 1 && i + j <= size; j++)
+				leader[i + j] = true;
+			break;
+		case FLOW_EXIT:
+			leader[i + 1] = true;
+			break;
+		}
+	}
+
+	Blocks.Clear();
+	BlockOf.Resize(size);
+	for (int i = 0; i < size; i++)
+	{
+		if (leader[i])
+		{
+			FBasicBlock &block = Blocks[Blocks.Reserve(1)];
+			block.Start = i;
+			block.Succ.Clear();
+			block.Reachable = false;
+		}
+		BlockOf[i] = Blocks.Size() - 1;
+		Blocks.Last().End = i + 1;
+	}
+
+	for (auto &block : Blocks)
+	{
+		int last = block.End - 1;
+		auto addsucc = [&](int target) { if (target < size) block.Succ.Push(BlockOf[target]); };
+		switch (Descs[last].Flow)
+		{
+		case FLOW_NEXT:
+			addsucc(last + 1);
+			break;
+		case FLOW_SKIP:
+			addsucc(last + 1);
+			addsucc(last + 2);
+			break;
+		case FLOW_JUMP:
+			addsucc(last + 1 + Code[last].i24);
+			break;
+		case FLOW_TABLE:
+			for (int j = 1; j <= (int)Code[last].i16u; j++)
+				addsucc(last + j);
+			break;
+		case FLOW_EXIT:
+			break;
+		}
+	}
+
+	TArray<int> work;
+	Blocks[0].Reachable = true;
+	work.Push(0);
+	while (work.Size() > 0)
+	{
+		int b;
+		work.Pop(b);
+		for (int s : Blocks[b].Succ)
+		{
+			if (!Blocks[s].Reachable)
+			{
+				Blocks[s].Reachable = true;
+				work.Push(s);
+			}
+		}
+	}
+}
+
+//==========================================================================
+//
+// VMOptimizer :: RemoveUnreachable
+//
+//==========================================================================
+
+void VMOptimizer::RemoveUnreachable()
+{
+	for (auto &block : Blocks)
+	{
+		if (block.Reachable)
+			continue;
+
+		for (int i = block.Start; i < block.End; i++)
+		{
+			Code[i].word = 0;
+			Code[i].op = OP_NOP;
+			Decode(Code[i], Descs[i]);
+		}
+	}
+}
+
+//==========================================================================
+//
+// Local constant and copy propagation
+//
+//==========================================================================
+
+void VMOptimizer::Kill(int type, int reg)
+{
+	Values[type][reg].Kind = FRegValue::None;
+	for (auto &value : Values[type])
+	{
+		if (value.Kind == FRegValue::Copy && value.Value == reg)
+			value.Kind = FRegValue::None;
+	}
+}
+
+bool VMOptimizer::KnownInt(int reg, int &value) const
+{
+	if (Values[REGT_INT][reg].Kind != FRegValue::Int)
+		return false;
+	value = Values[REGT_INT][reg].Value;
+	return true;
+}
+
+int VMOptimizer::KnownKonst(int type, int reg) const
+{
+	return Values[type][reg].Kind == FRegValue::Konst ? Values[type][reg].Value : -1;
+}
+
+// Checks if the value has or would get a constant index usable in an 8 bit
+// operand field. The constant is not added, that's up to the caller once it
+// is certain to be used.
+bool VMOptimizer::SmallIntKonst(int value, int &index)
+{
+	index = Build->FindConstantInt(value);
+	return index <= 255;
+}
+
+void VMOptimizer::LoadInt(VMOP &op, int reg, int value)
+{
+	op.word = 0;
+	if (value >= SHRT_MIN && value <= SHRT_MAX)
+	{
+		op.op = OP_LI;
+		op.a = reg;
+		op.i16 = value;
+	}
+	else
+	{
+		op.op = OP_LK;
+		op.a = reg;
+		op.i16u = Build->GetConstantInt(value);
+	}
+}
+
+static bool EvalInt(int opcode, int b, int c, int &result)
+{
+	unsigned ub = b, uc = c;
+	switch (opcode)
+	{
+	case OP_ADD_RR: case OP_ADD_RK: case OP_ADDI:	result = (int)(ub + uc); return true;
+	case OP_SUB_RR: case OP_SUB_RK: case OP_SUB_KR:	result = (int)(ub - uc); return true;
+	case OP_MUL_RR: case OP_MUL_RK:					result = (int)(ub * uc); return true;
+	case OP_AND_RR: case OP_AND_RK:					result = b & c; return true;
+	case OP_OR_RR: case OP_OR_RK:					result = b | c; return true;
+	case OP_XOR_RR: case OP_XOR_RK:					result = b ^ c; return true;
+	case OP_MIN_RR: case OP_MIN_RK:					result = MIN(b, c); return true;
+	case OP_MAX_RR: case OP_MAX_RK:					result = MAX(b, c); return true;
+
+	case OP_SLL_RR: case OP_SLL_RI: case OP_SLL_KR:
+		if (c < 0 || c > 31) return false;
+		result = (int)(ub << c);
+		return true;
+	case OP_SRL_RR: case OP_SRL_RI: case OP_SRL_KR:
+		if (c < 0 || c > 31) return false;
+		result = (int)(ub >> c);
+		return true;
+	case OP_SRA_RR: case OP_SRA_RI: case OP_SRA_KR:
+		if (c < 0 || c > 31) return false;
+		result = b >> c;
+		return true;
+
+	case OP_DIV_RR: case OP_DIV_RK: case OP_DIV_KR:
+		if (c == 0 || (b == INT_MIN && c == -1)) return false;
+		result = b / c;
+		return true;
+	case OP_MOD_RR: case OP_MOD_RK: case OP_MOD_KR:
+		if (c == 0 || (b == INT_MIN && c == -1)) return false;
+		result = b % c;
+		return true;
+	case OP_DIVU_RR: case OP_DIVU_RK: case OP_DIVU_KR:
+		if (uc == 0) return false;
+		result = (int)(ub / uc);
+		return true;
+	case OP_MODU_RR: case OP_MODU_RK: case OP_MODU_KR:
+		if (uc == 0) return false;
+		result = (int)(ub % uc);
+		return true;
+
+	case OP_NEG:	result = (int)(0u - ub); return true;
+	case OP_NOT:	result = ~b; return true;
+	case OP_ABS:	if (b == INT_MIN) return false; result = abs(b); return true;
+	}
+	return false;
+}
+
+// Register/register opcodes and their forms with a constant operand
+struct FKonstForm
+{
+	uint8_t RR, RK, KR;		// KR is NOP if the operation is commutative
+	uint8_t Type;
+	bool Commutative;
+};
+
+static const FKonstForm KonstForms[] =
+{
+	{ OP_ADD_RR,	OP_ADD_RK,	OP_NOP,		REGT_INT,	true },
+	{ OP_SUB_RR,	OP_SUB_RK,	OP_SUB_KR,	REGT_INT,	false },
+	{ OP_MUL_RR,	OP_MUL_RK,	OP_NOP,		REGT_INT,	true },
+	{ OP_DIV_RR,	OP_DIV_RK,	OP_DIV_KR,	REGT_INT,	false },
+	{ OP_DIVU_RR,	OP_DIVU_RK,	OP_DIVU_KR,	REGT_INT,	false },
+	{ OP_MOD_RR,	OP_MOD_RK,	OP_MOD_KR,	REGT_INT,	false },
+	{ OP_MODU_RR,	OP_MODU_RK,	OP_MODU_KR,	REGT_INT,	false },
+	{ OP_AND_RR,	OP_AND_RK,	OP_NOP,		REGT_INT,	true },
+	{ OP_OR_RR,		OP_OR_RK,	OP_NOP,		REGT_INT,	true },
+	{ OP_XOR_RR,	OP_XOR_RK,	OP_NOP,		REGT_INT,	true },
+	{ OP_MIN_RR,	OP_MIN_RK,	OP_NOP,		REGT_INT,	true },
+	{ OP_MAX_RR,	OP_MAX_RK,	OP_NOP,		REGT_INT,	true },
+	{ OP_SLL_RR,	OP_NOP,		OP_SLL_KR,	REGT_INT,	false },
+	{ OP_SRL_RR,	OP_NOP,		OP_SRL_KR,	REGT_INT,	false },
+	{ OP_SRA_RR,	OP_NOP,		OP_SRA_KR,	REGT_INT,	false },
+	{ OP_EQ_R,		OP_EQ_K,	OP_NOP,		REGT_INT,	true },
+	{ OP_LT_RR,		OP_LT_RK,	OP_LT_KR,	REGT_INT,	false },
+	{ OP_LE_RR,		OP_LE_RK,	OP_LE_KR,	REGT_INT,	false },
+	{ OP_LTU_RR,	OP_LTU_RK,	OP_LTU_KR,	REGT_INT,	false },
+	{ OP_LEU_RR,	OP_LEU_RK,	OP_LEU_KR,	REGT_INT,	false },
+	{ OP_ADDF_RR,	OP_ADDF_RK,	OP_NOP,		REGT_FLOAT,	true },
+	{ OP_SUBF_RR,	OP_SUBF_RK,	OP_SUBF_KR,	REGT_FLOAT,	false },
+	{ OP_MULF_RR,	OP_MULF_RK,	OP_NOP,		REGT_FLOAT,	true },
+	{ OP_DIVF_RR,	OP_DIVF_RK,	OP_DIVF_KR,	REGT_FLOAT,	false },
+	{ OP_MODF_RR,	OP_MODF_RK,	OP_MODF_KR,	REGT_FLOAT,	false },
+	{ OP_POWF_RR,	OP_POWF_RK,	OP_POWF_KR,	REGT_FLOAT,	false },
+	{ OP_MINF_RR,	OP_MINF_RK,	OP_NOP,		REGT_FLOAT,	true },
+	{ OP_MAXF_RR,	OP_MAXF_RK,	OP_NOP,		REGT_FLOAT,	true },
+	{ OP_LTF_RR,	OP_LTF_RK,	OP_LTF_KR,	REGT_FLOAT,	false },
+	{ OP_LEF_RR,	OP_LEF_RK,	OP_LEF_KR,	REGT_FLOAT,	false },
+	{ OP_MULVF2_RR,	OP_MULVF2_RK, OP_NOP,	REGT_FLOAT,	false },
+	{ OP_DIVVF2_RR,	OP_DIVVF2_RK, OP_NOP,	REGT_FLOAT,	false },
+	{ OP_MULVF3_RR,	OP_MULVF3_RK, OP_NOP,	REGT_FLOAT,	false },
+	{ OP_DIVVF3_RR,	OP_DIVVF3_RK, OP_NOP,	REGT_FLOAT,	false },
+	{ OP_ADDA_RR,	OP_ADDA_RK,	OP_NOP,		REGT_INT,	false },
+	{ OP_EQA_R,		OP_EQA_K,	OP_NOP,		REGT_POINTER, true },
+};
+
+//==========================================================================
+//
+// VMOptimizer :: Fold
+//
+// Evaluates integer math on known values and replaces register operands
+// holding known constants with constant operands.
+//
+//==========================================================================
+
+void VMOptimizer::Fold(VMOP &op)
+{
+	int b, c, result, konst;
+	const int opcode = op.op;
+
+	switch (opcode)
+	{
+	case OP_MOVE:
+		if (KnownInt(op.b, b)) LoadInt(op, op.a, b);
+		return;
+
+	case OP_ADD_RR: case OP_SUB_RR: case OP_MUL_RR: case OP_DIV_RR: case OP_DIVU_RR: case OP_MOD_RR: case OP_MODU_RR:
+	case OP_AND_RR: case OP_OR_RR: case OP_XOR_RR: case OP_MIN_RR: case OP_MAX_RR: case OP_SLL_RR: case OP_SRL_RR: case OP_SRA_RR:
+		if (KnownInt(op.b, b) && KnownInt(op.c, c) && EvalInt(opcode, b, c, result))
+		{
+			LoadInt(op, op.a, result);
+			return;
+		}
+		break;
+
+	case OP_ADD_RK: case OP_SUB_RK: case OP_MUL_RK: case OP_DIV_RK: case OP_DIVU_RK: case OP_MOD_RK: case OP_MODU_RK:
+	case OP_AND_RK: case OP_OR_RK: case OP_XOR_RK: case OP_MIN_RK: case OP_MAX_RK:
+		if (KnownInt(op.b, b) && EvalInt(opcode, b, Build->IntConstantList[op.c], result))
+			LoadInt(op, op.a, result);
+		return;
+
+	case OP_SUB_KR: case OP_DIV_KR: case OP_DIVU_KR: case OP_MOD_KR: case OP_MODU_KR:
+	case OP_SLL_KR: case OP_SRL_KR: case OP_SRA_KR:
+		if (KnownInt(op.c, c) && EvalInt(opcode, Build->IntConstantList[op.b], c, result))
+			LoadInt(op, op.a, result);
+		return;
+
+	case OP_SLL_RI: case OP_SRL_RI: case OP_SRA_RI:
+		if (KnownInt(op.b, b) && EvalInt(opcode, b, op.c, result))
+			LoadInt(op, op.a, result);
+		return;
+
+	case OP_ADDI:
+		if (KnownInt(op.b, b) && EvalInt(opcode, b, op.cs, result))
+			LoadInt(op, op.a, result);
+		return;
+
+	case OP_NEG: case OP_NOT: case OP_ABS:
+		if (KnownInt(op.b, b) && EvalInt(opcode, b, 0, result))
+			LoadInt(op, op.a, result);
+		return;
+
+	case OP_BOUND_R:
+		if (KnownInt(op.b, b) && b >= 0)
+		{
+			int reg = op.a;
+			op.word = 0;
+			if (b <= 65535)
+			{
+				op.op = OP_BOUND;
+				op.a = reg;
+				op.i16u = b;
+			}
+			else
+			{
+				op.op = OP_BOUND_K;
+				op.a = reg;
+				op.i16u = Build->GetConstantInt(b);
+			}
+		}
+		return;
+
+	case OP_PARAM:
+		if (op.a == REGT_INT && KnownInt(op.i16u, b))
+		{
+			op.word = 0;
+			if (b >= -(1 << 23) && b < (1 << 23))
+			{
+				op.op = OP_PARAMI;
+				op.i24 = b;
+			}
+			else
+			{
+				op.op = OP_PARAM;
+				op.a = REGT_INT | REGT_KONST;
+				op.i16u = Build->GetConstantInt(b);
+			}
+		}
+		else if ((op.a == REGT_FLOAT || op.a == REGT_POINTER) && (konst = KnownKonst(op.a, op.i16u)) >= 0)
+		{
+			op.a |= REGT_KONST;
+			op.i16u = konst;
+		}
+		return;
+
+	case OP_RET:
+		if (op.b == REGT_INT && KnownInt(op.c, b) && b >= SHRT_MIN && b <= SHRT_MAX)
+		{
+			int retnum = op.a;
+			op.word = 0;
+			op.op = OP_RETI;
+			op.a = retnum;
+			op.i16 = b;
+		}
+		return;
+
+	default:
+		break;
+	}
+
+	// Try turning one of the register operands into a constant.
+	for (auto &form : KonstForms)
+	{
+		if (form.RR != opcode)
+			continue;
+
+		int type = form.Type;
+		int bkonst = -1, ckonst = -1;
+		int bvalue = 0, cvalue = 0;
+		if (opcode == OP_ADDA_RR)
+		{
+			if (KnownInt(op.c, cvalue) && SmallIntKonst(cvalue, konst)) ckonst = konst;
+		}
+		else if (type == REGT_INT)
+		{
+			if (KnownInt(op.c, cvalue)) ckonst = -2;
+			else if (KnownInt(op.b, bvalue)) bkonst = -2;
+		}
+		else
+		{
+			ckonst = KnownKonst(type, op.c);
+			if (ckonst < 0) bkonst = KnownKonst(type, op.b);
+		}
+
+		if (bkonst == -2 && form.Commutative)
+		{
+			std::swap(op.b, op.c);
+			std::swap(bvalue, cvalue);
+			ckonst = -2;
+			bkonst = -1;
+		}
+
+		// Small additions go into the immediate field
+		if (ckonst == -2 && (opcode == OP_ADD_RR || opcode == OP_SUB_RR))
+		{
+			int add = opcode == OP_ADD_RR ? cvalue : (cvalue == INT_MIN ? 128 : -cvalue);
+			if (add >= -128 && add <= 127)
+			{
+				op.op = OP_ADDI;
+				op.cs = add;
+				return;
+			}
+		}
+		if (ckonst == -2 && (opcode == OP_SLL_RR || opcode == OP_SRL_RR || opcode == OP_SRA_RR))
+		{
+			if (cvalue >= 0 && cvalue <= 31)
+			{
+				op.op = opcode == OP_SLL_RR ? OP_SLL_RI : opcode == OP_SRL_RR ? OP_SRL_RI : OP_SRA_RI;
+				op.c = cvalue;
+			}
+			return;
+		}
+
+		if (ckonst == -2 && (opcode == OP_DIV_RR || opcode == OP_DIVU_RR || opcode == OP_MOD_RR || opcode == OP_MODU_RR) && cvalue == 0)
+			return;	// keep the division by zero where it is reported at run time
+		if (ckonst == -2 && !SmallIntKonst(cvalue, ckonst))
+			return;
+		if (bkonst == -2 && !SmallIntKonst(bvalue, bkonst))
+			return;
+
+		// Int constants from SmallIntKonst still need to be added.
+		bool intkonst = type == REGT_INT;
+		if (ckonst >= 0 && form.RK != OP_NOP && ckonst <= 255)
+		{
+			if (intkonst) Build->GetConstantInt(cvalue);
+			op.op = form.RK;
+			op.c = ckonst;
+		}
+		else if (bkonst >= 0 && form.Commutative && form.RK != OP_NOP && bkonst <= 255)
+		{
+			if (intkonst) Build->GetConstantInt(bvalue);
+			op.op = form.RK;
+			op.b = op.c;
+			op.c = bkonst;
+		}
+		else if (bkonst >= 0 && form.KR != OP_NOP && bkonst <= 255)
+		{
+			if (intkonst) Build->GetConstantInt(bvalue);
+			op.op = form.KR;
+			op.b = bkonst;
+		}
+		return;
+	}
+}
+
+//==========================================================================
+//
+// VMOptimizer :: PropagateBlock
+//
+//==========================================================================
+
+void VMOptimizer::PropagateBlock(const FBasicBlock &block)
+{
+	for (auto &type : Values)
+		for (auto &value : type)
+			value.Kind = FRegValue::None;
+
+	for (int i = block.Start; i < block.End; i++)
+	{
+		VMOP &op = Code[i];
+		FOpDesc &desc = Descs[i];
+
+		// Read copies from the original register. The JIT only reads a PARAM's register
+		// once it gets to the CALL, so these have to stay where they are.
+		for (int j = 0; j < desc.NumOperands && op.op != OP_PARAM; j++)
+		{
+			auto &operand = desc.Operands[j];
+			if (operand.Access != ACCESS_USE || operand.Count != 1 || operand.Type == REGT_STRING)
+				continue;
+
+			auto &value = Values[operand.Type][GetField(op, operand.Field)];
+			if (value.Kind == FRegValue::Copy)
+				SetField(op, operand.Field, value.Value);
+		}
+
+		Fold(op);
+		Decode(op, desc);
+
+		if ((op.op == OP_MOVE || op.op == OP_MOVEF || op.op == OP_MOVEA || op.op == OP_MOVES) && op.a == op.b)
+		{
+			op.word = 0;
+			op.op = OP_NOP;
+			Decode(op, desc);
+			continue;
+		}
+
+		if (desc.Call)
+		{
+			for (auto &type : Values)
+				for (auto &value : type)
+					value.Kind = FRegValue::None;
+			continue;
+		}
+
+		for (int j = 0; j < desc.NumOperands; j++)
+		{
+			auto &operand = desc.Operands[j];
+			if (operand.Access & (ACCESS_DEF | ACCESS_MAYDEF))
+			{
+				int reg = GetField(op, operand.Field);
+				for (int k = 0; k < operand.Count; k++)
+					Kill(operand.Type, reg + k);
+			}
+		}
+
+		switch (op.op)
+		{
+		case OP_LI:
+			Values[REGT_INT][op.a] = { FRegValue::Int, op.i16 };
+			break;
+		case OP_LK:
+			Values[REGT_INT][op.a] = { FRegValue::Int, Build->IntConstantList[op.i16u] };
+			break;
+		case OP_LKF:
+			if (op.i16u <= 255) Values[REGT_FLOAT][op.a] = { FRegValue::Konst, op.i16u };
+			break;
+		case OP_LKP:
+			if (op.i16u <= 255) Values[REGT_POINTER][op.a] = { FRegValue::Konst, op.i16u };
+			break;
+		case OP_MOVE:
+		case OP_MOVEF:
+		case OP_MOVEA:
+		{
+			int type = op.op == OP_MOVE ? REGT_INT : op.op == OP_MOVEF ? REGT_FLOAT : REGT_POINTER;
+			auto &source = Values[type][op.b];
+			Values[type][op.a] = source.Kind == FRegValue::None ? FRegValue{ FRegValue::Copy, op.b } : source;
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+//==========================================================================
+//
+// VMOptimizer :: RemoveDeadStores
+//
+// Removes instructions without side effects whose results are never read.
+//
+//==========================================================================
+
+bool VMOptimizer::RemoveDeadStores()
+{
+	// Registers live at the start of each block
+	for (auto &block : Blocks) block.In.Clear();
+
+	auto transfer = [&](int i, FRegSet &live)
+	{
+		const VMOP &op = Code[i];
+		const FOpDesc &desc = Descs[i];
+		for (int j = 0; j < desc.NumOperands; j++)
+		{
+			auto &operand = desc.Operands[j];
+			if (operand.Access == ACCESS_DEF)
+			{
+				int reg = GetField(op, operand.Field);
+				for (int k = 0; k < operand.Count; k++) live.Reset(operand.Type, reg + k);
+			}
+		}
+		for (int j = 0; j < desc.NumOperands; j++)
+		{
+			auto &operand = desc.Operands[j];
+			if (operand.Access & ACCESS_USE)
+			{
+				int reg = GetField(op, operand.Field);
+				for (int k = 0; k < operand.Count; k++) live.Set(operand.Type, reg + k);
+			}
+		}
+	};
+
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (int b = Blocks.Size() - 1; b >= 0; b--)
+		{
+			auto &block = Blocks[b];
+			FRegSet live;
+			live.Clear();
+			for (int s : block.Succ) live.Merge(Blocks[s].In);
+			block.Out = live;
+			for (int i = block.End - 1; i >= block.Start; i--) transfer(i, live);
+			if (live != block.In)
+			{
+				block.In = live;
+				changed = true;
+			}
+		}
+	}
+
+	bool removed = false;
+	for (auto &block : Blocks)
+	{
+		FRegSet live = block.Out;
+		for (int i = block.End - 1; i >= block.Start; i--)
+		{
+			VMOP &op = Code[i];
+			FOpDesc &desc = Descs[i];
+			if (desc.Pure && op.op != OP_NOP)
+			{
+				bool dead = true;
+				for (int j = 0; j < desc.NumOperands && dead; j++)
+				{
+					auto &operand = desc.Operands[j];
+					if (operand.Access != ACCESS_DEF) continue;
+					int reg = GetField(op, operand.Field);
+					for (int k = 0; k < operand.Count; k++)
+					{
+						if (live.Test(operand.Type, reg + k)) dead = false;
+					}
+				}
+				if (dead)
+				{
+					op.word = 0;
+					op.op = OP_NOP;
+					Decode(op, desc);
+					removed = true;
+					continue;
+				}
+			}
+			transfer(i, live);
+		}
+	}
+	return removed;
+}
+
+//==========================================================================
+//
+// VMOptimizer :: Compact
+//
+// Removes the NOPs and fixes up everything that refers to instruction
+// positions.
+//
+//==========================================================================
+
+void VMOptimizer::Compact()
+{
+	int size = Code.Size();
+	TArray<int> newindex(size + 1, true);
+	TArray<bool> removed(size, true);
+	int count = 0;
+	for (int i = 0; i < size; i++)
+	{
+		newindex[i] = count;
+		removed[i] = Code[i].op == OP_NOP;
+		if (!removed[i]) count++;
+	}
+	newindex[size] = count;
+
+	if (count == size)
+		return;
+
+	for (int i = 0; i < size; i++)
+	{
+		VMOP op = Code[i];
+		if (op.op == OP_NOP)
+			continue;
+		if (op.op == OP_JMP)
+			op.i24 = newindex[i + 1 + op.i24] - newindex[i] - 1;
+		Code[newindex[i]] = op;
+		Descs[newindex[i]] = Descs[i];
+	}
+	Code.Resize(count);
+	Descs.Resize(count);
+
+	auto &lines = Build->LineNumbers;
+	unsigned j = 0;
+	for (unsigned i = 0; i < lines.Size(); i++)
+	{
+		FStatementInfo info = lines[i];
+		info.InstructionIndex = (uint16_t)newindex[info.InstructionIndex];
+		// If all instructions of a statement were removed, the next statement starts at the same place.
+		if (j > 0 && lines[j - 1].InstructionIndex == info.InstructionIndex) j--;
+		lines[j++] = info;
+	}
+	lines.Resize(j);
+
+	auto &sites = Build->VirtualCalls;
+	j = 0;
+	for (unsigned i = 0; i < sites.Size(); i++)
+	{
+		// Drop the call sites that were in unreachable code.
+		if (removed[sites[i].InstructionIndex]) continue;
+		sites[j] = sites[i];
+		sites[j++].InstructionIndex = newindex[sites[i].InstructionIndex];
+	}
+	sites.Resize(j);
+}
+
+//==========================================================================
+//
+// VMOptimizer :: FindCheckedPointers
+//
+// A pointer register that has been dereferenced on every path to an
+// instruction cannot be null there, unless it was written to since.
+//
+//==========================================================================
+
+static int DereferencedPointer(const VMOP &op)
+{
+	switch (op.op)
+	{
+	case OP_LB: case OP_LB_R: case OP_LH: case OP_LH_R: case OP_LW: case OP_LW_R: case OP_LBU: case OP_LBU_R:
+	case OP_LHU: case OP_LHU_R: case OP_LSP: case OP_LSP_R: case OP_LDP: case OP_LDP_R: case OP_LS: case OP_LS_R:
+	case OP_LO: case OP_LO_R: case OP_LP: case OP_LP_R: case OP_LV2: case OP_LV2_R: case OP_LV3: case OP_LV3_R:
+	case OP_LCS: case OP_LCS_R: case OP_LBIT:
+	case OP_VTBL: case OP_CLSS: case OP_META:
+		return op.b;
+
+	case OP_SB: case OP_SB_R: case OP_SH: case OP_SH_R: case OP_SW: case OP_SW_R: case OP_SSP: case OP_SSP_R:
+	case OP_SDP: case OP_SDP_R: case OP_SS: case OP_SS_R: case OP_SP: case OP_SP_R: case OP_SO: case OP_SO_R:
+	case OP_SV2: case OP_SV2_R: case OP_SV3: case OP_SV3_R: case OP_SBIT:
+	case OP_SCOPE:
+		return op.a;
+
+	default:
+		return -1;
+	}
+}
+
+void VMOptimizer::FindCheckedPointers()
+{
+	Build->NullCheckedOps.Clear();
+
+	// Only the pointer part of the sets is used here.
+	auto transfer = [&](int i, FRegSet &nonnull, bool record)
+	{
+		const VMOP &op = Code[i];
+		const FOpDesc &desc = Descs[i];
+		int ptr = DereferencedPointer(op);
+		if (ptr >= 0)
+		{
+			if (record && nonnull.Test(REGT_POINTER, ptr) && op.op != OP_VTBL && op.op != OP_SCOPE && op.op != OP_CLSS && op.op != OP_META)
+				Build->NullCheckedOps.Push(i);
+			nonnull.Set(REGT_POINTER, ptr);
+		}
+		for (int j = 0; j < desc.NumOperands; j++)
+		{
+			auto &operand = desc.Operands[j];
+			if (operand.Type == REGT_POINTER && (operand.Access & (ACCESS_DEF | ACCESS_MAYDEF)))
+				nonnull.Reset(REGT_POINTER, GetField(op, operand.Field));
+		}
+		if (op.op == OP_LFP)
+			nonnull.Set(REGT_POINTER, op.a);
+	};
+
+	for (unsigned b = 0; b < Blocks.Size(); b++)
+	{
+		if (b == 0 || !Blocks[b].Reachable) Blocks[b].In.Clear();
+		else Blocks[b].In.Fill();
+	}
+
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (unsigned b = 0; b < Blocks.Size(); b++)
+		{
+			auto &block = Blocks[b];
+			if (!block.Reachable) continue;
+			FRegSet nonnull = block.In;
+			for (int i = block.Start; i < block.End; i++) transfer(i, nonnull, false);
+			for (int s : block.Succ)
+			{
+				if (s == 0) continue;
+				FRegSet in = Blocks[s].In;
+				in.Intersect(nonnull);
+				if (in != Blocks[s].In)
+				{
+					Blocks[s].In = in;
+					changed = true;
+				}
+			}
+		}
+	}
+
+	for (auto &block : Blocks)
+	{
+		if (!block.Reachable) continue;
+		FRegSet nonnull = block.In;
+		for (int i = block.Start; i < block.End; i++) transfer(i, nonnull, true);
+	}
+}
+
+//==========================================================================
+//
+// VMOptimizer :: CompactRegisters
+//
+// Renumbers the registers so that the ones no longer used by any
+// instruction disappear from the frame. The argument registers keep their
+// numbers.
+//
+//==========================================================================
+
+void VMOptimizer::CompactRegisters()
+{
+	FRegSet used;
+	used.Clear();
+	for (unsigned i = 0; i < Code.Size(); i++)
+	{
+		const FOpDesc &desc = Descs[i];
+		for (int j = 0; j < desc.NumOperands; j++)
+		{
+			auto &operand = desc.Operands[j];
+			int reg = GetField(Code[i], operand.Field);
+			for (int k = 0; k < operand.Count; k++) used.Set(operand.Type, reg + k);
+		}
+	}
+
+	int remap[4][256];
+	for (int t = 0; t < 4; t++)
+	{
+		int count = 0;
+		int mostused = Build->Registers[t].MostUsed;
+		for (int r = 0; r < mostused; r++)
+		{
+			if (r < ArgRegs[t] || used.Test(t, r)) remap[t][r] = count++;
+			else remap[t][r] = -1;
+		}
+		Build->Registers[t].MostUsed = count;
+	}
+
+	for (unsigned i = 0; i < Code.Size(); i++)
+	{
+		const FOpDesc &desc = Descs[i];
+		for (int j = 0; j < desc.NumOperands; j++)
+		{
+			auto &operand = desc.Operands[j];
+			int reg = GetField(Code[i], operand.Field);
+			assert(remap[operand.Type][reg] >= 0);
+			SetField(Code[i], operand.Field, remap[operand.Type][reg]);
+		}
+	}
+}
+
+//==========================================================================
+//
+// VMOptimizer :: Run
+//
+//==========================================================================
+
+bool VMOptimizer::Run(FBytecodeOptimizerStats &stats)
+{
+	stats.Functions++;
+
+	if (Code.Size() == 0 || Code.Size() > 65535)
+	{
+		stats.Skipped++;
+		return false;
+	}
+
+	Descs.Resize(Code.Size());
+	for (unsigned i = 0; i < Code.Size(); i++)
+	{
+		if (!Decode(Code[i], Descs[i]))
+		{
+			stats.Skipped++;
+			return false;
+		}
+	}
+	for (int t = 0; t < 4; t++)
+	{
+		if (Build->Registers[t].MostUsed > 256)
+		{
+			stats.Skipped++;
+			return false;
+		}
+	}
+
+	int before = Code.Size();
+	int regsbefore = 0;
+	for (int t = 0; t < 4; t++) regsbefore += Build->Registers[t].MostUsed;
+
+	BuildBlocks();
+	RemoveUnreachable();
+	for (auto &block : Blocks)
+	{
+		if (block.Reachable) PropagateBlock(block);
+	}
+	while (RemoveDeadStores()) {}
+	Compact();
+
+	BuildBlocks();
+	FindCheckedPointers();
+	CompactRegisters();
+
+	int regsafter = 0;
+	for (int t = 0; t < 4; t++) regsafter += Build->Registers[t].MostUsed;
+
+	stats.InstructionsBefore += before;
+	stats.InstructionsAfter += Code.Size();
+	stats.RegistersBefore += regsbefore;
+	stats.RegistersAfter += regsafter;
+	stats.NullChecksRemoved += Build->NullCheckedOps.Size();
+	return true;
+}
+
+//==========================================================================
+//
+// VMOptimizeFunction
+//
+//==========================================================================
+
+bool VMOptimizeFunction(VMFunctionBuilder *build, const int *argregs, FBytecodeOptimizerStats &stats)
+{
+	VMOptimizer optimizer(build, argregs);
+	return optimizer.Run(stats);
+}
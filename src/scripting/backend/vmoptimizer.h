@@ -0,0 +1,29 @@
+#pragma once
+
+class VMFunctionBuilder;
+
+struct FBytecodeOptimizerStats
+{
+	int Functions = 0;
+	int Skipped = 0;				// functions containing something the optimizer does not understand
+	int InstructionsBefore = 0;
+	int InstructionsAfter = 0;
+	int RegistersBefore = 0;
+	int RegistersAfter = 0;
+	int NullChecksRemoved = 0;
+
+	void Add(const FBytecodeOptimizerStats &other)
+	{
+		Functions += other.Functions;
+		Skipped += other.Skipped;
+		InstructionsBefore += other.InstructionsBefore;
+		InstructionsAfter += other.InstructionsAfter;
+		RegistersBefore += other.RegistersBefore;
+		RegistersAfter += other.RegistersAfter;
+		NullChecksRemoved += other.NullChecksRemoved;
+	}
+};
+
+// Optimizes the code emitted into the builder before it is turned into a VMScriptFunction.
+// argregs holds the number of registers of each type occupied by the function's arguments.
+bool VMOptimizeFunction(VMFunctionBuilder *build, const int *argregs, FBytecodeOptimizerStats &stats);
@@ -44,6 +44,7 @@
 #include "thingdef.h"
 #include "a_morph.h"
 #include "backend/codegen.h"
+#include "backend/bytecodecache.h"
 #include "w_wad.h"
 #include "v_text.h"
 #include "m_argv.h"
@@ -1255,6 +1256,7 @@ static void ParseDamageDefinition(FScanner &sc)
 
 void ParseDecorate (FScanner &sc, PNamespace *ns)
 {
+	BytecodeCacheAddSource(sc.LumpNum);
 	// Get actor class name.
 	for(;;)
 	{
@@ -1,6 +1,7 @@
 
 #include "jit.h"
 #include "jitintern.h"
+#include <algorithm>
 
 extern PString *TypeString;
 extern PStruct *TypeVector2;
@@ -8,6 +9,14 @@ extern PStruct *TypeVector3;
 
 static void OutputJitLog(const asmjit::StringLogger &logger);
 
+// Asmjit has a 256 register limit. Functions using more VM registers than this
+// keep part of them in the VM frame. The remaining room is needed for the
+// temporaries the opcodes use.
+#define MAX_JIT_REGISTERS		200
+#define MAX_NATIVE_REGISTERS	128
+
+std::atomic<int> JitSpilledFunctions;
+
 JitFuncPtr JitCompile(VMScriptFunction *sfunc)
 {
 #if 0
@@ -26,7 +35,10 @@ JitFuncPtr JitCompile(VMScriptFunction *sfunc)
 		code.setLogger(&logger);
 
 		JitCompiler compiler(&code, sfunc);
-		return reinterpret_cast<JitFuncPtr>(AddJitFunction(&code, &compiler));
+		auto entry = reinterpret_cast<JitFuncPtr>(AddJitFunction(&code, &compiler));
+		if (entry && compiler.HasSpilledRegisters())
+			JitSpilledFunctions++;
+		return entry;
 	}
 	catch (const CRecoverableError &e)
 	{
@@ -36,6 +48,29 @@ JitFuncPtr JitCompile(VMScriptFunction *sfunc)
 	}
 }
 
+JitFuncPtr JitCompileBackground(VMScriptFunction *sfunc)
+{
+	using namespace asmjit;
+	try
+	{
+		ThrowingErrorHandler errorHandler;
+		CodeHolder code;
+		code.init(GetHostCodeInfo());
+		code.setErrorHandler(&errorHandler);
+
+		JitCompiler compiler(&code, sfunc);
+		auto entry = reinterpret_cast<JitFuncPtr>(AddJitFunction(&code, &compiler));
+		if (entry && compiler.HasSpilledRegisters())
+			JitSpilledFunctions++;
+		return entry;
+	}
+	catch (const std::exception &)
+	{
+		// The main thread compiles it again on the first call and prints the error there.
+		return nullptr;
+	}
+}
+
 void JitDumpLog(FILE *file, VMScriptFunction *sfunc)
 {
 	using namespace asmjit;
@@ -131,7 +166,9 @@ asmjit::CCFunc *JitCompiler::Codegen()
 
 		labels[i].cursor = cc.getCursor();
 		ResetTemp();
+		BeginOpcodeSpills();
 		EmitOpcode();
+		EndOpcodeSpills();
 
 		pc++;
 	}
@@ -294,6 +331,53 @@ void JitCompiler::SetupSimpleFrame()
 
 	vmframeCursor = cc.getCursor();
 
+	// Spilled registers are initialized in the frame directly
+	if (hasSpills)
+		CheckVMFrame();
+
+	auto loadD = [&](int r, int argpos)
+	{
+		auto src = x86::dword_ptr(args, argpos * sizeof(VMValue) + offsetof(VMValue, i));
+		if (!regD.IsSpilled(r))
+		{
+			cc.mov(regD.Native[r], src);
+		}
+		else
+		{
+			auto tmp = newTempInt32();
+			cc.mov(tmp, src);
+			cc.mov(x86::dword_ptr(vmframe, offsetD + r * sizeof(int32_t)), tmp);
+		}
+	};
+	auto loadF = [&](int r, int argpos)
+	{
+		auto src = x86::qword_ptr(args, argpos * sizeof(VMValue) + offsetof(VMValue, f));
+		if (!regF.IsSpilled(r))
+		{
+			cc.movsd(regF.Native[r], src);
+		}
+		else
+		{
+			auto tmp = newTempXmmSd();
+			cc.movsd(tmp, src);
+			cc.movsd(x86::qword_ptr(vmframe, offsetF + r * sizeof(double)), tmp);
+		}
+	};
+	auto loadA = [&](int r, int argpos)
+	{
+		auto src = x86::ptr(args, argpos * sizeof(VMValue) + offsetof(VMValue, a));
+		if (!regA.IsSpilled(r))
+		{
+			cc.mov(regA.Native[r], src);
+		}
+		else
+		{
+			auto tmp = newTempIntPtr();
+			cc.mov(tmp, src);
+			cc.mov(x86::ptr(vmframe, offsetA + r * sizeof(void*)), tmp);
+		}
+	};
+
 	int argsPos = 0;
 	int regd = 0, regf = 0, rega = 0;
 	for (unsigned int i = 0; i < sfunc->Proto->ArgumentTypes.Size(); i++)
@@ -301,22 +385,22 @@ void JitCompiler::SetupSimpleFrame()
 		const PType *type = sfunc->Proto->ArgumentTypes[i];
 		if (sfunc->ArgFlags.Size() && sfunc->ArgFlags[i] & (VARF_Out | VARF_Ref))
 		{
-			cc.mov(regA[rega++], x86::ptr(args, argsPos++ * sizeof(VMValue) + offsetof(VMValue, a)));
+			loadA(rega++, argsPos++);
 		}
 		else if (type == TypeVector2)
 		{
-			cc.movsd(regF[regf++], x86::qword_ptr(args, argsPos++ * sizeof(VMValue) + offsetof(VMValue, f)));
-			cc.movsd(regF[regf++], x86::qword_ptr(args, argsPos++ * sizeof(VMValue) + offsetof(VMValue, f)));
+			loadF(regf++, argsPos++);
+			loadF(regf++, argsPos++);
 		}
 		else if (type == TypeVector3)
 		{
-			cc.movsd(regF[regf++], x86::qword_ptr(args, argsPos++ * sizeof(VMValue) + offsetof(VMValue, f)));
-			cc.movsd(regF[regf++], x86::qword_ptr(args, argsPos++ * sizeof(VMValue) + offsetof(VMValue, f)));
-			cc.movsd(regF[regf++], x86::qword_ptr(args, argsPos++ * sizeof(VMValue) + offsetof(VMValue, f)));
+			loadF(regf++, argsPos++);
+			loadF(regf++, argsPos++);
+			loadF(regf++, argsPos++);
 		}
 		else if (type == TypeFloat64)
 		{
-			cc.movsd(regF[regf++], x86::qword_ptr(args, argsPos++ * sizeof(VMValue) + offsetof(VMValue, f)));
+			loadF(regf++, argsPos++);
 		}
 		else if (type == TypeString)
 		{
@@ -324,11 +408,11 @@ void JitCompiler::SetupSimpleFrame()
 		}
 		else if (type->isIntCompatible())
 		{
-			cc.mov(regD[regd++], x86::dword_ptr(args, argsPos++ * sizeof(VMValue) + offsetof(VMValue, i)));
+			loadD(regd++, argsPos++);
 		}
 		else
 		{
-			cc.mov(regA[rega++], x86::ptr(args, argsPos++ * sizeof(VMValue) + offsetof(VMValue, a)));
+			loadA(rega++, argsPos++);
 		}
 	}
 
@@ -336,13 +420,22 @@ void JitCompiler::SetupSimpleFrame()
 		I_FatalError("JIT: sfunc->NumArgs != argsPos || regd > sfunc->NumRegD || regf > sfunc->NumRegF || rega > sfunc->NumRegA");
 
 	for (int i = regd; i < sfunc->NumRegD; i++)
-		cc.xor_(regD[i], regD[i]);
+	{
+		if (!regD.IsSpilled(i)) cc.xor_(regD.Native[i], regD.Native[i]);
+		else cc.mov(x86::dword_ptr(vmframe, offsetD + i * sizeof(int32_t)), 0);
+	}
 
 	for (int i = regf; i < sfunc->NumRegF; i++)
-		cc.xorpd(regF[i], regF[i]);
+	{
+		if (!regF.IsSpilled(i)) cc.xorpd(regF.Native[i], regF.Native[i]);
+		else cc.mov(x86::qword_ptr(vmframe, offsetF + i * sizeof(double)), 0);
+	}
 
 	for (int i = rega; i < sfunc->NumRegA; i++)
-		cc.xor_(regA[i], regA[i]);
+	{
+		if (!regA.IsSpilled(i)) cc.xor_(regA.Native[i], regA.Native[i]);
+		else cc.mov(x86::qword_ptr(vmframe, offsetA + i * sizeof(void*)), 0);
+	}
 }
 
 static VMFrameStack *CreateFullVMFrame(VMScriptFunction *func, VMValue *args, int numargs)
@@ -369,17 +462,18 @@ void JitCompiler::SetupFullVMFrame()
 	cc.mov(vmframe, x86::ptr(vmframe, VMFrameStack::OffsetLastFrame())); // Blocks->LastFrame
 	vmframeAllocated = true;
 
-	for (int i = 0; i < sfunc->NumRegD; i++)
-		cc.mov(regD[i], x86::dword_ptr(vmframe, offsetD + i * sizeof(int32_t)));
+	// Spilled registers are already where they belong.
+	for (unsigned int i = 0; i < regD.Native.Size(); i++)
+		cc.mov(regD.Native[i], x86::dword_ptr(vmframe, offsetD + i * sizeof(int32_t)));
 
-	for (int i = 0; i < sfunc->NumRegF; i++)
-		cc.movsd(regF[i], x86::qword_ptr(vmframe, offsetF + i * sizeof(double)));
+	for (unsigned int i = 0; i < regF.Native.Size(); i++)
+		cc.movsd(regF.Native[i], x86::qword_ptr(vmframe, offsetF + i * sizeof(double)));
 
-	for (int i = 0; i < sfunc->NumRegS; i++)
-		cc.lea(regS[i], x86::ptr(vmframe, offsetS + i * sizeof(FString)));
+	for (unsigned int i = 0; i < regS.Native.Size(); i++)
+		cc.lea(regS.Native[i], x86::ptr(vmframe, offsetS + i * sizeof(FString)));
 
-	for (int i = 0; i < sfunc->NumRegA; i++)
-		cc.mov(regA[i], x86::ptr(vmframe, offsetA + i * sizeof(void*)));
+	for (unsigned int i = 0; i < regA.Native.Size(); i++)
+		cc.mov(regA.Native[i], x86::ptr(vmframe, offsetA + i * sizeof(void*)));
 }
 
 static void PopFullVMFrame(VMFrameStack *stack)
@@ -409,38 +503,171 @@ void JitCompiler::IncrementVMCalls()
 
 void JitCompiler::CreateRegisters()
 {
-	regD.Resize(sfunc->NumRegD);
-	regF.Resize(sfunc->NumRegF);
-	regA.Resize(sfunc->NumRegA);
-	regS.Resize(sfunc->NumRegS);
+	int numD = sfunc->NumRegD, numF = sfunc->NumRegF, numS = sfunc->NumRegS, numA = sfunc->NumRegA;
+	int total = numD + numF + numS + numA;
+
+	if (total >= MAX_JIT_REGISTERS)
+	{
+		// String registers only hold the address of their frame slot, so they
+		// are the cheapest to spill. The rest is split by register count.
+		hasSpills = true;
+		int numregs = numD + numF + numA;
+		numS = 0;
+		numD = sfunc->NumRegD * MAX_NATIVE_REGISTERS / numregs;
+		numF = sfunc->NumRegF * MAX_NATIVE_REGISTERS / numregs;
+		numA = sfunc->NumRegA * MAX_NATIVE_REGISTERS / numregs;
+	}
+
+	regD.Init(this, REGT_INT, sfunc->NumRegD, numD);
+	regF.Init(this, REGT_FLOAT, sfunc->NumRegF, numF);
+	regS.Init(this, REGT_STRING, sfunc->NumRegS, numS);
+	regA.Init(this, REGT_POINTER, sfunc->NumRegA, numA);
 
-	for (int i = 0; i < sfunc->NumRegD; i++)
+	for (int i = 0; i < numD; i++)
 	{
 		regname.Format("regD%d", i);
-		regD[i] = cc.newInt32(regname.GetChars());
+		regD.Native[i] = cc.newInt32(regname.GetChars());
 	}
 
-	for (int i = 0; i < sfunc->NumRegF; i++)
+	for (int i = 0; i < numF; i++)
 	{
 		regname.Format("regF%d", i);
-		regF[i] = cc.newXmmSd(regname.GetChars());
+		regF.Native[i] = cc.newXmmSd(regname.GetChars());
 	}
 
-	for (int i = 0; i < sfunc->NumRegS; i++)
+	for (int i = 0; i < numS; i++)
 	{
 		regname.Format("regS%d", i);
-		regS[i] = cc.newIntPtr(regname.GetChars());
+		regS.Native[i] = cc.newIntPtr(regname.GetChars());
 	}
 
-	for (int i = 0; i < sfunc->NumRegA; i++)
+	for (int i = 0; i < numA; i++)
 	{
 		regname.Format("regA%d", i);
-		regA[i] = cc.newIntPtr(regname.GetChars());
+		regA.Native[i] = cc.newIntPtr(regname.GetChars());
 	}
 }
 
+//==========================================================================
+//
+// Spilled registers
+//
+// Between opcodes a spilled register's value is always in its VM frame slot.
+// The first time an opcode uses one it gets loaded into a temporary in front
+// of the opcode's code, and after the opcode all temporaries are written back.
+// Jump targets are bound before the loads, so every path into an opcode
+// executes them. No opcode that writes a register leaves through a jump, so
+// the stores at the end are always reached when they are needed.
+//
+//==========================================================================
+
+void JitCompiler::BeginOpcodeSpills()
+{
+	if (!hasSpills)
+		return;
+
+	// The loads go between these two nodes. Opcodes never move the cursor
+	// in front of the second one.
+	cc.comment("", 0);
+	spillCursor = cc.getCursor();
+	cc.comment("", 0);
+
+	spillPosInt32 = 0;
+	spillPosIntPtr = 0;
+	spillPosXmmSd = 0;
+}
+
+void JitCompiler::EndOpcodeSpills()
+{
+	using namespace asmjit;
+
+	if (!hasSpills)
+		return;
+
+	for (auto &spill : Spilled)
+	{
+		switch (spill.Type)
+		{
+		case REGT_INT:
+			cc.mov(x86::dword_ptr(vmframe, offsetD + spill.Index * sizeof(int32_t)), spill.Reg.as<X86Gp>());
+			break;
+		case REGT_FLOAT:
+			cc.movsd(x86::qword_ptr(vmframe, offsetF + spill.Index * sizeof(double)), spill.Reg.as<X86Xmm>());
+			break;
+		case REGT_POINTER:
+			cc.mov(x86::ptr(vmframe, offsetA + spill.Index * sizeof(void*)), spill.Reg.as<X86Gp>());
+			break;
+		default:	// string registers are addresses and never change
+			break;
+		}
+	}
+	Spilled.Clear();
+	spillCursor = nullptr;
+}
+
+asmjit::X86Reg JitCompiler::GetSpilled(int regtype, int index)
+{
+	using namespace asmjit;
+
+	for (auto &spill : Spilled)
+	{
+		if (spill.Type == regtype && spill.Index == index)
+			return spill.Reg;
+	}
+
+	if (spillCursor == nullptr)
+		I_Error("JIT: Spilled register used outside of an opcode\n");
+
+	auto cursor = cc.getCursor();
+	cc.setCursor(spillCursor);
+
+	X86Reg reg;
+	switch (regtype)
+	{
+	case REGT_INT:
+	{
+		auto tmp = newTempRegister(regSpillInt32, spillPosInt32, "spillDword", [&](const char *name) { return cc.newInt32(name); });
+		cc.mov(tmp, x86::dword_ptr(vmframe, offsetD + index * sizeof(int32_t)));
+		reg = tmp;
+		break;
+	}
+	case REGT_FLOAT:
+	{
+		auto tmp = newTempRegister(regSpillXmmSd, spillPosXmmSd, "spillXmmSd", [&](const char *name) { return cc.newXmmSd(name); });
+		cc.movsd(tmp, x86::qword_ptr(vmframe, offsetF + index * sizeof(double)));
+		reg = tmp;
+		break;
+	}
+	case REGT_STRING:
+	{
+		auto tmp = newTempRegister(regSpillIntPtr, spillPosIntPtr, "spillPtr", [&](const char *name) { return cc.newIntPtr(name); });
+		cc.lea(tmp, x86::ptr(vmframe, offsetS + index * sizeof(FString)));
+		reg = tmp;
+		break;
+	}
+	default:
+	{
+		auto tmp = newTempRegister(regSpillIntPtr, spillPosIntPtr, "spillPtr", [&](const char *name) { return cc.newIntPtr(name); });
+		cc.mov(tmp, x86::ptr(vmframe, offsetA + index * sizeof(void*)));
+		reg = tmp;
+		break;
+	}
+	}
+
+	spillCursor = cc.getCursor();
+	cc.setCursor(cursor);
+
+	Spilled.Push({ regtype, index, reg });
+	return reg;
+}
+
 void JitCompiler::EmitNullPointerThrow(int index, EVMAbortException reason)
 {
+	// The bytecode optimizer found this pointer to have been dereferenced already on every path leading here.
+	auto &checked = sfunc->NullCheckedOps;
+	if (std::binary_search(checked.begin(), checked.end(), (uint16_t)(pc - sfunc->Code)))
+		return;
+
 	auto label = EmitThrowExceptionLabel(reason);
 	cc.test(regA[index], regA[index]);
 	cc.je(label);
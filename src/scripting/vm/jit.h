@@ -2,7 +2,15 @@
 #pragma once
 
 #include "vmintern.h"
+#include <atomic>
 
 JitFuncPtr JitCompile(VMScriptFunction *func);
 void JitDumpLog(FILE *file, VMScriptFunction *func);
 FString JitCaptureStackTrace(int framesToSkip, bool includeNativeFrames);
+
+// Same as JitCompile, but safe to call from a worker thread. Errors are not reported.
+JitFuncPtr JitCompileBackground(VMScriptFunction *func);
+JitFuncPtr JitCompileOnCall(VMScriptFunction *func);
+
+// Number of compiled functions that keep some of their registers in the VM frame
+extern std::atomic<int> JitSpilledFunctions;
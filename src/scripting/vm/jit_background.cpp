@@ -0,0 +1,271 @@
+
+#include "jit.h"
+#include "jitintern.h"
+#include "c_cvars.h"
+#include "g_game.h"
+#include "i_time.h"
+#include "templates.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Ahead-of-time compilation of all script functions on worker threads.
+//
+// Functions are normally compiled by VMScriptFunction::FirstScriptCall the
+// first time they are called, which stalls the game whenever a bunch of new
+// actors or weapons show up. With vm_jit_aot all functions that do not have
+// native code yet are queued after startup and on map load instead. A queued
+// function that gets called before its code is ready runs in the interpreter.
+// Only the main thread ever changes a function's ScriptCall.
+
+CVAR(Int, vm_jit_aot, 0, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)	// 1 = compile in the background, 2 = also wait for it when loading
+
+EXTERN_CVAR(Bool, vm_jit)
+
+extern int JitFunctions;
+
+struct FJitJobResult
+{
+	VMScriptFunction *Func;
+	JitFuncPtr Entry;
+};
+
+struct FJitCompileTime
+{
+	int Functions = 0;
+	uint64_t Time = 0;		// all times in ns
+	uint64_t MaxTime = 0;
+
+	void Add(uint64_t time)
+	{
+		Functions++;
+		Time += time;
+		if (time > MaxTime) MaxTime = time;
+	}
+};
+
+static std::mutex JobMutex;
+static std::condition_variable JobDone;
+static TArray<VMScriptFunction *> JobQueue;
+static unsigned JobPos;
+static TArray<FJitJobResult> JobResults;
+static std::vector<std::thread> Workers;
+static bool StopWorkers;
+static int ActiveWorkers;
+static unsigned NumThreads;
+
+static FJitCompileTime SyncStartup, SyncLevel, Background;
+static uint64_t BackgroundStart, BackgroundWall;
+static int BackgroundFailed;
+
+//==========================================================================
+//
+// JitWorkerMain
+//
+//==========================================================================
+
+static void JitWorkerMain()
+{
+	std::unique_lock<std::mutex> lock(JobMutex);
+	while (!StopWorkers && JobPos < JobQueue.Size())
+	{
+		VMScriptFunction *func = JobQueue[JobPos++];
+		lock.unlock();
+
+		uint64_t start = I_nsTime();
+		JitFuncPtr entry = JitCompileBackground(func);
+		uint64_t time = I_nsTime() - start;
+
+		lock.lock();
+		JobResults.Push({ func, entry });
+		Background.Add(time);
+	}
+	ActiveWorkers--;
+	JobDone.notify_all();
+}
+
+//==========================================================================
+//
+// JitJoinWorkers
+//
+//==========================================================================
+
+static void JitJoinWorkers()
+{
+	for (auto &thread : Workers)
+	{
+		thread.join();
+	}
+	Workers.clear();
+}
+
+//==========================================================================
+//
+// JitUpdateBackground
+//
+// Installs the code that has been compiled since the last call. Functions
+// that failed to compile go back to compiling on their first call, which
+// reports the error the usual way.
+//
+//==========================================================================
+
+void JitUpdateBackground()
+{
+	if (Workers.empty())
+		return;
+
+	TArray<FJitJobResult> results;
+	bool finished;
+	{
+		std::lock_guard<std::mutex> lock(JobMutex);
+		results = std::move(JobResults);
+		finished = ActiveWorkers == 0;
+		if (finished)
+		{
+			BackgroundWall += I_nsTime() - BackgroundStart;
+			JobQueue.Clear();
+			JobPos = 0;
+		}
+	}
+
+	for (auto &result : results)
+	{
+		result.Func->JitPending = false;
+		if (result.Entry != nullptr)
+		{
+			VMSetScriptEntry(result.Func, result.Entry);
+			JitFunctions++;
+		}
+		else
+		{
+			VMSetScriptEntry(result.Func, &VMScriptFunction::FirstScriptCall);
+			BackgroundFailed++;
+		}
+	}
+
+	if (finished)
+	{
+		JitJoinWorkers();
+	}
+}
+
+//==========================================================================
+//
+// JitCompileAhead
+//
+// Called after startup and after a map has been loaded.
+//
+//==========================================================================
+
+void JitCompileAhead()
+{
+	if (!vm_jit || vm_jit_aot <= 0)
+		return;
+
+	// While an earlier batch is still being worked on nothing new is queued.
+	// Whatever is missed gets picked up on the next map load.
+	if (Workers.empty())
+	{
+		for (auto f : VMFunction::AllFunctions)
+		{
+			if (f->VarFlags & VARF_Native) continue;
+
+			auto func = static_cast<VMScriptFunction *>(f);
+			if (func->Code != nullptr && !func->JitPending && VMGetScriptEntry(func) == &VMScriptFunction::FirstScriptCall)
+			{
+				func->JitPending = true;
+				JobQueue.Push(func);
+			}
+		}
+
+		if (JobQueue.Size() > 0)
+		{
+			// Initialize the static code info here, it is not thread safe.
+			GetHostCodeInfo();
+
+			unsigned numthreads = clamp<unsigned>(std::thread::hardware_concurrency(), 2, 9) - 1;
+			numthreads = MIN(numthreads, JobQueue.Size());
+			StopWorkers = false;
+			ActiveWorkers = numthreads;
+			NumThreads = numthreads;
+			BackgroundStart = I_nsTime();
+			for (unsigned i = 0; i < numthreads; i++)
+			{
+				Workers.push_back(std::thread(JitWorkerMain));
+			}
+		}
+	}
+
+	if (vm_jit_aot >= 2 && !Workers.empty())
+	{
+		std::unique_lock<std::mutex> lock(JobMutex);
+		JobDone.wait(lock, [] { return ActiveWorkers == 0; });
+		lock.unlock();
+		JitUpdateBackground();
+	}
+}
+
+//==========================================================================
+//
+// JitCancelBackground
+//
+// Called before the VM functions get deleted. Functions that have not been
+// compiled yet keep running in the interpreter.
+//
+//==========================================================================
+
+void JitCancelBackground()
+{
+	if (Workers.empty())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(JobMutex);
+		StopWorkers = true;
+	}
+	JitJoinWorkers();
+	for (auto func : JobQueue)
+	{
+		func->JitPending = false;
+	}
+	JobQueue.Clear();
+	JobResults.Clear();
+	JobPos = 0;
+}
+
+//==========================================================================
+//
+// JitCompileOnCall
+//
+// Compiles a function on its first call and records where that happened.
+// During a level this is a potential hitch.
+//
+//==========================================================================
+
+JitFuncPtr JitCompileOnCall(VMScriptFunction *func)
+{
+	uint64_t start = I_nsTime();
+	JitFuncPtr entry = JitCompile(func);
+	(gamestate == GS_LEVEL ? SyncLevel : SyncStartup).Add(I_nsTime() - start);
+	return entry;
+}
+
+//==========================================================================
+//
+// STAT jitcompile
+//
+//==========================================================================
+
+ADD_STAT(jitcompile)
+{
+	std::lock_guard<std::mutex> lock(JobMutex);
+
+	uint64_t wall = BackgroundWall + (Workers.empty() ? 0 : I_nsTime() - BackgroundStart);
+	FString out;
+	out.Format("On first call: %d in level (%.2f ms, max %.2f ms), %d elsewhere (%.2f ms)\n",
+		SyncLevel.Functions, SyncLevel.Time / 1e6, SyncLevel.MaxTime / 1e6, SyncStartup.Functions, SyncStartup.Time / 1e6);
+	out.AppendFormat("Background: %d (%.2f ms on %u threads, %.2f ms elapsed, %d failed)  Pending: %u",
+		Background.Functions, Background.Time / 1e6, NumThreads, wall / 1e6, BackgroundFailed,
+		JobQueue.Size() - JobPos);
+	return out;
+}
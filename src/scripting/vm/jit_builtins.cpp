@@ -0,0 +1,209 @@
+
+#include "jitintern.h"
+#include "c_cvars.h"
+#include "actor.h"
+#include "r_defs.h"
+
+// Some of the natives scripts call the most only do a few lines of vector
+// math on actor positions. For these the JIT emits the common case inline
+// and only calls the native function when the fast path does not apply.
+CVAR(Bool, vm_jit_inline, true, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
+
+enum EJitBuiltin
+{
+	JB_Distance2D,
+	JB_Distance2DSquared,
+	JB_Distance3D,
+	JB_Distance3DSquared,
+	JB_AngleTo,
+	JB_Vec3Offset,
+	JB_None
+};
+
+static const char *const BuiltinNames[] =
+{
+	"Actor.Distance2D",
+	"Actor.Distance2DSquared",
+	"Actor.Distance3D",
+	"Actor.Distance3DSquared",
+	"Actor.AngleTo",
+	"Actor.Vec3Offset",
+};
+
+static EJitBuiltin FindBuiltin(VMNativeFunction *target)
+{
+	for (int i = 0; i < JB_None; i++)
+	{
+		if (target->PrintableName.CompareNoCase(BuiltinNames[i]) == 0)
+			return (EJitBuiltin)i;
+	}
+	return JB_None;
+}
+
+// Gets the value of a parameter that is known at compile time.
+static bool GetConstParam(const VMOP *op, const int *konstd, int &value)
+{
+	if (op->op == OP_PARAMI)
+	{
+		value = op->i24;
+		return true;
+	}
+	if (op->a == (REGT_INT | REGT_KONST))
+	{
+		value = konstd[op->i16u];
+		return true;
+	}
+	return false;
+}
+
+static double VecToAngleDegrees(double x, double y)
+{
+	return VecToAngle(x, y).Degrees;
+}
+
+bool JitCompiler::EmitInlineNative(VMNativeFunction *target)
+{
+	using namespace asmjit;
+
+	if (!vm_jit_inline)
+		return false;
+
+	EJitBuiltin builtin = FindBuiltin(target);
+	if (builtin == JB_None)
+		return false;
+
+	// All of them are methods that take the other actor or the offset right after self.
+	const VMOP *retval = pc + 1;
+	int numret = C;
+	if (ParamOpcodes.Size() < 2 || ParamOpcodes[0]->op != OP_PARAM || ParamOpcodes[0]->a != REGT_POINTER)
+		return false;
+
+	int absolute = 0;
+	int self = ParamOpcodes[0]->i16u;
+
+	if (builtin == JB_Vec3Offset)
+	{
+		// Only the absolute version is plain math. The relative one has to look for line portals along the offset.
+		if (ParamOpcodes.Size() != 5 || numret != 1 || retval[0].b != (REGT_FLOAT | REGT_MULTIREG3))
+			return false;
+		if (!GetConstParam(ParamOpcodes[4], konstd, absolute) || !absolute)
+			return false;
+		for (int i = 1; i < 4; i++)
+		{
+			if (ParamOpcodes[i]->op != OP_PARAM || (ParamOpcodes[i]->a != REGT_FLOAT && ParamOpcodes[i]->a != (REGT_FLOAT | REGT_KONST)))
+				return false;
+		}
+	}
+	else
+	{
+		if (ParamOpcodes[1]->op != OP_PARAM || ParamOpcodes[1]->a != REGT_POINTER || numret != 1 || retval[0].b != REGT_FLOAT)
+			return false;
+		if (builtin == JB_AngleTo && (ParamOpcodes.Size() != 3 || !GetConstParam(ParamOpcodes[2], konstd, absolute)))
+			return false;
+		if (builtin != JB_AngleTo && ParamOpcodes.Size() != 2)
+			return false;
+	}
+
+	auto slowPath = cc.newLabel();
+	auto done = cc.newLabel();
+
+	auto selfPtr = newTempIntPtr();
+	cc.mov(selfPtr, regA[self]);
+	cc.test(selfPtr, selfPtr);
+	cc.jz(slowPath);
+
+	const int posX = myoffsetof(AActor, __Pos) + myoffsetof(DVector3, X);
+	const int posY = myoffsetof(AActor, __Pos) + myoffsetof(DVector3, Y);
+	const int posZ = myoffsetof(AActor, __Pos) + myoffsetof(DVector3, Z);
+
+	if (builtin == JB_Vec3Offset)
+	{
+		// Compute everything before storing, the result registers can be the same as the offset registers.
+		X86Xmm result[3];
+		for (int i = 0; i < 3; i++)
+		{
+			result[i] = newTempXmmSd();
+			cc.movsd(result[i], x86::qword_ptr(selfPtr, i == 0 ? posX : i == 1 ? posY : posZ));
+
+			int bc = ParamOpcodes[i + 1]->i16u;
+			if (ParamOpcodes[i + 1]->a & REGT_KONST)
+			{
+				auto ptr = newTempIntPtr();
+				cc.mov(ptr, imm_ptr(konstf + bc));
+				cc.addsd(result[i], x86::qword_ptr(ptr));
+			}
+			else
+			{
+				cc.addsd(result[i], regF[bc]);
+			}
+		}
+		for (int i = 0; i < 3; i++)
+			cc.movsd(regF[retval[0].c + i], result[i]);
+	}
+	else
+	{
+		auto otherPtr = newTempIntPtr();
+		cc.mov(otherPtr, regA[ParamOpcodes[1]->i16u]);
+		cc.test(otherPtr, otherPtr);
+		cc.jz(slowPath);
+
+		// PosRelative only adds a displacement if the actors are in different portal groups.
+		if (!absolute)
+		{
+			auto selfSector = newTempIntPtr();
+			auto otherSector = newTempIntPtr();
+			auto group = newTempInt32();
+			cc.mov(selfSector, x86::ptr(selfPtr, myoffsetof(AActor, Sector)));
+			cc.mov(otherSector, x86::ptr(otherPtr, myoffsetof(AActor, Sector)));
+			cc.mov(group, x86::dword_ptr(selfSector, myoffsetof(sector_t, PortalGroup)));
+			cc.cmp(group, x86::dword_ptr(otherSector, myoffsetof(sector_t, PortalGroup)));
+			cc.jne(slowPath);
+		}
+
+		if (builtin == JB_AngleTo)
+		{
+			auto dx = newTempXmmSd();
+			auto dy = newTempXmmSd();
+			cc.movsd(dx, x86::qword_ptr(otherPtr, posX));
+			cc.subsd(dx, x86::qword_ptr(selfPtr, posX));
+			cc.movsd(dy, x86::qword_ptr(otherPtr, posY));
+			cc.subsd(dy, x86::qword_ptr(selfPtr, posY));
+
+			auto result = newResultXmmSd();
+			auto call = CreateCall<double, double, double>(VecToAngleDegrees);
+			call->setRet(0, result);
+			call->setArg(0, dx);
+			call->setArg(1, dy);
+			cc.movsd(regF[retval[0].c], result);
+		}
+		else
+		{
+			bool is3D = builtin == JB_Distance3D || builtin == JB_Distance3DSquared;
+			auto sum = newTempXmmSd();
+			auto delta = newTempXmmSd();
+			cc.movsd(sum, x86::qword_ptr(selfPtr, posX));
+			cc.subsd(sum, x86::qword_ptr(otherPtr, posX));
+			cc.mulsd(sum, sum);
+			cc.movsd(delta, x86::qword_ptr(selfPtr, posY));
+			cc.subsd(delta, x86::qword_ptr(otherPtr, posY));
+			cc.mulsd(delta, delta);
+			cc.addsd(sum, delta);
+			if (is3D)
+			{
+				cc.movsd(delta, x86::qword_ptr(selfPtr, posZ));
+				cc.subsd(delta, x86::qword_ptr(otherPtr, posZ));
+				cc.mulsd(delta, delta);
+				cc.addsd(sum, delta);
+			}
+			if (builtin == JB_Distance2D || builtin == JB_Distance3D)
+				cc.sqrtsd(sum, sum);
+			cc.movsd(regF[retval[0].c], sum);
+		}
+	}
+	cc.jmp(done);
+
+	cc.bind(slowPath);
+	EmitNativeCall(target);
+	cc.bind(done);
+	return true;
+}
@@ -1,7 +1,75 @@
 
 #include "jitintern.h"
+#include "c_cvars.h"
+#include <algorithm>
 #include <map>
 #include <memory>
+#include <mutex>
+
+// Virtual calls on a receiver type whose subclasses all share one
+// implementation of the method are called directly. The others look up the
+// receiver class in a small cache of the classes last seen at the call site
+// before falling back to the virtual method table.
+CVAR(Bool, vm_jit_devirtualize, true, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
+
+struct JitCallCache
+{
+	enum { NumEntries = 2 };
+
+	struct Entry
+	{
+		PClass *Class;
+		VMFunction *Func;
+	};
+	Entry Entries[NumEntries];
+};
+
+static std::mutex callCacheMutex;
+static FMemArena callCacheArena(4096);
+static std::map<std::pair<PClass *, unsigned>, VMFunction *> singleImplementations;
+
+static JitCallCache *AllocCallCache()
+{
+	std::lock_guard<std::mutex> lock(callCacheMutex);
+	auto cache = (JitCallCache *)callCacheArena.Alloc(sizeof(JitCallCache));
+	memset(cache, 0, sizeof(JitCallCache));
+	return cache;
+}
+
+// Returns the method all descendants of selfclass use for the given virtual index, or null if they do not agree.
+static VMFunction *FindSingleImplementation(PClass *selfclass, unsigned index)
+{
+	std::lock_guard<std::mutex> lock(callCacheMutex);
+
+	auto it = singleImplementations.find({ selfclass, index });
+	if (it != singleImplementations.end())
+		return it->second;
+
+	VMFunction *found = nullptr;
+	for (auto cls : PClass::AllClasses)
+	{
+		if (!cls->IsDescendantOf(selfclass))
+			continue;
+
+		VMFunction *func = index < cls->Virtuals.Size() ? cls->Virtuals[index] : nullptr;
+		if (func == nullptr || (found != nullptr && found != func))
+		{
+			found = nullptr;
+			break;
+		}
+		found = func;
+	}
+
+	singleImplementations[{ selfclass, index }] = found;
+	return found;
+}
+
+void JitReleaseCallCaches()
+{
+	std::lock_guard<std::mutex> lock(callCacheMutex);
+	callCacheArena.FreeAllBlocks();
+	singleImplementations.clear();
+}
 
 void JitCompiler::EmitPARAM()
 {
@@ -35,14 +103,99 @@ void JitCompiler::EmitVtbl(const VMOP *op)
 	cc.test(regA[b], regA[b]);
 	cc.jz(label);
 
-	cc.mov(regA[a], asmjit::x86::qword_ptr(regA[b], myoffsetof(DObject, Class)));
-	cc.mov(regA[a], asmjit::x86::qword_ptr(regA[a], myoffsetof(PClass, Virtuals) + myoffsetof(FArray, Array)));
-	cc.mov(regA[a], asmjit::x86::qword_ptr(regA[a], c * (int)sizeof(void*)));
+	if (!vm_jit_devirtualize)
+	{
+		cc.mov(regA[a], asmjit::x86::qword_ptr(regA[b], myoffsetof(DObject, Class)));
+		cc.mov(regA[a], asmjit::x86::qword_ptr(regA[a], myoffsetof(PClass, Virtuals) + myoffsetof(FArray, Array)));
+		cc.mov(regA[a], asmjit::x86::qword_ptr(regA[a], c * (int)sizeof(void*)));
+		return;
+	}
+
+	using namespace asmjit;
+
+	JitCallCache *cache = AllocCallCache();
+	auto cls = newTempIntPtr();
+	auto cacheptr = newTempIntPtr();
+	auto tmp = newTempIntPtr();
+	auto done = cc.newLabel();
+
+	cc.mov(cls, x86::qword_ptr(regA[b], myoffsetof(DObject, Class)));
+	cc.mov(cacheptr, imm_ptr(cache));
+	for (int i = 0; i < JitCallCache::NumEntries; i++)
+	{
+		auto next = cc.newLabel();
+		cc.cmp(cls, x86::qword_ptr(cacheptr, i * sizeof(JitCallCache::Entry) + myoffsetof(JitCallCache::Entry, Class)));
+		cc.jne(next);
+		cc.mov(regA[a], x86::qword_ptr(cacheptr, i * sizeof(JitCallCache::Entry) + myoffsetof(JitCallCache::Entry, Func)));
+		cc.jmp(done);
+		cc.bind(next);
+	}
+
+	// Cache miss: look the method up and make it the most recent entry
+	cc.mov(regA[a], x86::qword_ptr(cls, myoffsetof(PClass, Virtuals) + myoffsetof(FArray, Array)));
+	cc.mov(regA[a], x86::qword_ptr(regA[a], c * (int)sizeof(void*)));
+	for (int i = JitCallCache::NumEntries - 1; i > 0; i--)
+	{
+		cc.mov(tmp, x86::qword_ptr(cacheptr, (i - 1) * sizeof(JitCallCache::Entry) + myoffsetof(JitCallCache::Entry, Class)));
+		cc.mov(x86::qword_ptr(cacheptr, i * sizeof(JitCallCache::Entry) + myoffsetof(JitCallCache::Entry, Class)), tmp);
+		cc.mov(tmp, x86::qword_ptr(cacheptr, (i - 1) * sizeof(JitCallCache::Entry) + myoffsetof(JitCallCache::Entry, Func)));
+		cc.mov(x86::qword_ptr(cacheptr, i * sizeof(JitCallCache::Entry) + myoffsetof(JitCallCache::Entry, Func)), tmp);
+	}
+	cc.mov(x86::qword_ptr(cacheptr, myoffsetof(JitCallCache::Entry, Class)), cls);
+	cc.mov(x86::qword_ptr(cacheptr, myoffsetof(JitCallCache::Entry, Func)), regA[a]);
+
+	cc.bind(done);
+}
+
+VMFunction *JitCompiler::FindVirtualCallTarget(const VMOP *vtbl)
+{
+	if (!vm_jit_devirtualize)
+		return nullptr;
+
+	unsigned index = (unsigned)(vtbl - sfunc->Code);
+	auto &sites = sfunc->VirtualCalls;
+	auto site = std::lower_bound(sites.begin(), sites.end(), index, [](const FVirtualCallSite &s, unsigned i) { return s.InstructionIndex < i; });
+	if (site == sites.end() || site->InstructionIndex != index || site->SelfClass == nullptr)
+		return nullptr;
+
+	return FindSingleImplementation(site->SelfClass, vtbl->c);
 }
 
 void JitCompiler::EmitCALL()
 {
-	EmitVMCall(regA[A], nullptr);
+	VMFunction *target = nullptr;
+	if ((pc - 1)->op == OP_VTBL)
+		target = FindVirtualCallTarget(pc - 1);
+
+	if (target == nullptr)
+	{
+		EmitVMCall(regA[A], nullptr);
+		pc += C; // Skip RESULTs
+		return;
+	}
+
+	// Devirtualized call. Only the null check is left from the OP_VTBL.
+	int self = (pc - 1)->b;
+	auto label = EmitThrowExceptionLabel(X_READ_NIL);
+	cc.test(regA[self], regA[self]);
+	cc.jz(label);
+
+	VMNativeFunction *ntarget = nullptr;
+	if (target->VarFlags & VARF_Native)
+		ntarget = static_cast<VMNativeFunction *>(target);
+
+	if (ntarget && ntarget->DirectNativeCall)
+	{
+		if (!EmitInlineNative(ntarget))
+			EmitNativeCall(ntarget);
+	}
+	else
+	{
+		auto ptr = newTempIntPtr();
+		cc.mov(ptr, asmjit::imm_ptr(target));
+		EmitVMCall(ptr, target);
+	}
+
 	pc += C; // Skip RESULTs
 }
 
@@ -56,7 +209,8 @@ void JitCompiler::EmitCALL_K()
 
 	if (ntarget && ntarget->DirectNativeCall)
 	{
-		EmitNativeCall(ntarget);
+		if (!EmitInlineNative(ntarget))
+			EmitNativeCall(ntarget);
 	}
 	else
 	{
@@ -78,7 +232,7 @@ void JitCompiler::EmitVMCall(asmjit::X86Gp vmfunc, VMFunction *target)
 	if (numparams != B)
 		I_Error("OP_CALL parameter count does not match the number of preceding OP_PARAM instructions");
 
-	if ((pc - 1)->op == OP_VTBL)
+	if ((pc - 1)->op == OP_VTBL && target == nullptr)
 		EmitVtbl(pc - 1);
 
 	FillReturns(pc + 1, C);
@@ -318,11 +472,6 @@ void JitCompiler::EmitNativeCall(VMNativeFunction *target)
 {
 	using namespace asmjit;
 
-	if ((pc - 1)->op == OP_VTBL)
-	{
-		I_Error("Native direct member function calls not implemented\n");
-	}
-
 	asmjit::CBNode *cursorBefore = cc.getCursor();
 	auto call = cc.call(imm_ptr(target->DirectNativeCall), CreateFuncSignature());
 	call->setInlineComment(target->PrintableName.GetChars());
@@ -544,6 +693,7 @@ void JitCompiler::EmitNativeCall(VMNativeFunction *target)
 }
 
 static std::map<FString, std::unique_ptr<TArray<uint8_t>>> argsCache;
+static std::mutex argsCacheMutex;
 
 asmjit::FuncSignature JitCompiler::CreateFuncSignature()
 {
@@ -659,6 +809,7 @@ asmjit::FuncSignature JitCompiler::CreateFuncSignature()
 	}
 
 	// FuncSignature only keeps a pointer to its args array. Store a copy of each args array variant.
+	std::lock_guard<std::mutex> lock(argsCacheMutex);
 	std::unique_ptr<TArray<uint8_t>> &cachedArgs = argsCache[key];
 	if (!cachedArgs) cachedArgs.reset(new TArray<uint8_t>(args));
 
@@ -1,6 +1,7 @@
 
 #include "jit.h"
 #include "jitintern.h"
+#include <mutex>
 
 #ifdef WIN32
 #include <DbgHelp.h>
@@ -19,13 +20,14 @@ struct JitFuncInfo
 	TArray<JitLineInfo> LineInfo;
 	void *start;
 	void *end;
+	JitCodeArena *arena;
 };
 
 static TArray<JitFuncInfo> JitDebugInfo;
-static TArray<uint8_t*> JitBlocks;
-static TArray<uint8_t*> JitFrames;
-static size_t JitBlockPos = 0;
-static size_t JitBlockSize = 0;
+static JitCodeArena VMCode;		// everything the VM compiles, released by JitRelease
+
+// Functions can be compiled on worker threads, see jit_background.cpp
+static std::mutex JitMutex;
 
 asmjit::CodeInfo GetHostCodeInfo()
 {
@@ -42,15 +44,15 @@ asmjit::CodeInfo GetHostCodeInfo()
 	return codeInfo;
 }
 
-static void *AllocJitMemory(size_t size)
+static void *AllocJitMemory(JitCodeArena *arena, size_t size)
 {
 	using namespace asmjit;
 
-	if (JitBlockPos + size <= JitBlockSize)
+	if (arena->BlockPos + size <= arena->BlockSize)
 	{
-		uint8_t *p = JitBlocks[JitBlocks.Size() - 1];
-		p += JitBlockPos;
-		JitBlockPos += size;
+		uint8_t *p = arena->Blocks.Last();
+		p += arena->BlockPos;
+		arena->BlockPos += size;
 		return p;
 	}
 	else
@@ -60,9 +62,10 @@ static void *AllocJitMemory(size_t size)
 		void *p = OSUtils::allocVirtualMemory(bytesToAllocate, &allocatedSize, OSUtils::kVMWritable | OSUtils::kVMExecutable);
 		if (!p)
 			return nullptr;
-		JitBlocks.Push((uint8_t*)p);
-		JitBlockSize = allocatedSize;
-		JitBlockPos = size;
+		arena->Blocks.Push((uint8_t*)p);
+		arena->BlockSizes.Push(allocatedSize);
+		arena->BlockSize = allocatedSize;
+		arena->BlockPos = size;
 		return p;
 	}
 }
@@ -251,11 +254,12 @@ static TArray<uint16_t> CreateUnwindInfoWindows(asmjit::CCFunc *func)
 	return info;
 }
 
-void *AddJitFunction(asmjit::CodeHolder* code, JitCompiler *compiler)
+void *AddJitFunction(asmjit::CodeHolder* code, asmjit::CCFunc *func, const char *name, const char *filename, const TArray<JitLineInfo> &lineinfo, JitCodeArena *arena)
 {
 	using namespace asmjit;
 
-	CCFunc *func = compiler->Codegen();
+	std::lock_guard<std::mutex> lock(JitMutex);
+	if (arena == nullptr) arena = &VMCode;
 
 	size_t codeSize = code->getCodeSize();
 	if (codeSize == 0)
@@ -272,7 +276,7 @@ void *AddJitFunction(asmjit::CodeHolder* code, JitCompiler *compiler)
 
 	codeSize = (codeSize + 15) / 16 * 16;
 
-	uint8_t *p = (uint8_t *)AllocJitMemory(codeSize + unwindInfoSize + functionTableSize);
+	uint8_t *p = (uint8_t *)AllocJitMemory(arena, codeSize + unwindInfoSize + functionTableSize);
 	if (!p)
 		return nullptr;
 
@@ -282,10 +286,10 @@ void *AddJitFunction(asmjit::CodeHolder* code, JitCompiler *compiler)
 
 	size_t unwindStart = relocSize;
 	unwindStart = (unwindStart + 15) / 16 * 16;
-	JitBlockPos -= codeSize - unwindStart;
+	arena->BlockPos -= codeSize - unwindStart;
 
 #ifdef _WIN64
-	uint8_t *baseaddr = JitBlocks.Last();
+	uint8_t *baseaddr = arena->Blocks.Last();
 	uint8_t *startaddr = p;
 	uint8_t *endaddr = p + relocSize;
 	uint8_t *unwindptr = p + unwindStart;
@@ -300,11 +304,12 @@ void *AddJitFunction(asmjit::CodeHolder* code, JitCompiler *compiler)
 	table[0].UnwindData = (DWORD)(ptrdiff_t)(unwindptr - baseaddr);
 #endif
 	BOOLEAN result = RtlAddFunctionTable(table, 1, (DWORD64)baseaddr);
-	JitFrames.Push((uint8_t*)table);
+	arena->Frames.Push((uint8_t*)table);
 	if (result == 0)
 		I_Error("RtlAddFunctionTable failed");
 
-	JitDebugInfo.Push({ compiler->GetScriptFunction()->PrintableName, compiler->GetScriptFunction()->SourceFileName, compiler->LineInfo, startaddr, endaddr });
+	// The strings are copied, FString's reference counting is not thread safe.
+	JitDebugInfo.Push({ name, filename, lineinfo, startaddr, endaddr, arena });
 #endif
 
 	return p;
@@ -647,11 +652,12 @@ static TArray<uint8_t> CreateUnwindInfoUnix(asmjit::CCFunc *func, unsigned int &
 	return stream;
 }
 
-void *AddJitFunction(asmjit::CodeHolder* code, JitCompiler *compiler)
+void *AddJitFunction(asmjit::CodeHolder* code, asmjit::CCFunc *func, const char *name, const char *filename, const TArray<JitLineInfo> &lineinfo, JitCodeArena *arena)
 {
 	using namespace asmjit;
 
-	CCFunc *func = compiler->Codegen();
+	std::lock_guard<std::mutex> lock(JitMutex);
+	if (arena == nullptr) arena = &VMCode;
 
 	size_t codeSize = code->getCodeSize();
 	if (codeSize == 0)
@@ -663,7 +669,7 @@ void *AddJitFunction(asmjit::CodeHolder* code, JitCompiler *compiler)
 
 	codeSize = (codeSize + 15) / 16 * 16;
 
-	uint8_t *p = (uint8_t *)AllocJitMemory(codeSize + unwindInfoSize);
+	uint8_t *p = (uint8_t *)AllocJitMemory(arena, codeSize + unwindInfoSize);
 	if (!p)
 		return nullptr;
 
@@ -673,9 +679,9 @@ void *AddJitFunction(asmjit::CodeHolder* code, JitCompiler *compiler)
 
 	size_t unwindStart = relocSize;
 	unwindStart = (unwindStart + 15) / 16 * 16;
-	JitBlockPos -= codeSize - unwindStart;
+	arena->BlockPos -= codeSize - unwindStart;
 
-	uint8_t *baseaddr = JitBlocks.Last();
+	uint8_t *baseaddr = arena->Blocks.Last();
 	uint8_t *startaddr = p;
 	uint8_t *endaddr = p + relocSize;
 	uint8_t *unwindptr = p + unwindStart;
@@ -706,7 +712,7 @@ void *AddJitFunction(asmjit::CodeHolder* code, JitCompiler *compiler)
 				if (offset != 0)
 				{
 					__register_frame(entry);
-					JitFrames.Push(entry);
+					arena->Frames.Push(entry);
 				}
 				entry += length64 + 12;
 			}
@@ -716,7 +722,7 @@ void *AddJitFunction(asmjit::CodeHolder* code, JitCompiler *compiler)
 				if (offset != 0)
 				{
 					__register_frame(entry);
-					JitFrames.Push(entry);
+					arena->Frames.Push(entry);
 				}
 				entry += length + 4;
 			}
@@ -724,38 +730,57 @@ void *AddJitFunction(asmjit::CodeHolder* code, JitCompiler *compiler)
 #else
 		// On Linux it takes a pointer to the entire .eh_frame
 		__register_frame(unwindptr);
-		JitFrames.Push(unwindptr);
+		arena->Frames.Push(unwindptr);
 #endif
 	}
 
-	JitDebugInfo.Push({ compiler->GetScriptFunction()->PrintableName, compiler->GetScriptFunction()->SourceFileName, compiler->LineInfo, startaddr, endaddr });
+	// The strings are copied, FString's reference counting is not thread safe.
+	JitDebugInfo.Push({ name, filename, lineinfo, startaddr, endaddr, arena });
 
 	return p;
 }
 #endif
 
-void JitRelease()
+void *AddJitFunction(asmjit::CodeHolder* code, JitCompiler *compiler)
+{
+	asmjit::CCFunc *func = compiler->Codegen();
+	auto sfunc = compiler->GetScriptFunction();
+	return AddJitFunction(code, func, sfunc->PrintableName.GetChars(), sfunc->SourceFileName.GetChars(), compiler->LineInfo);
+}
+
+void JitReleaseArena(JitCodeArena *arena)
 {
+	std::lock_guard<std::mutex> lock(JitMutex);
 #ifdef _WIN64
-	for (auto p : JitFrames)
+	for (auto p : arena->Frames)
 	{
 		RtlDeleteFunctionTable((PRUNTIME_FUNCTION)p);
 	}
 #elif !defined(WIN32)
-	for (auto p : JitFrames)
+	for (auto p : arena->Frames)
 	{
 		__deregister_frame(p);
 	}
 #endif
-	for (auto p : JitBlocks)
+	for (unsigned i = 0; i < arena->Blocks.Size(); i++)
+	{
+		asmjit::OSUtils::releaseVirtualMemory(arena->Blocks[i], arena->BlockSizes[i]);
+	}
+	for (unsigned i = JitDebugInfo.Size(); i-- > 0; )
 	{
-		asmjit::OSUtils::releaseVirtualMemory(p, 1024 * 1024);
+		if (JitDebugInfo[i].arena == arena) JitDebugInfo.Delete(i);
 	}
-	JitDebugInfo.Clear();
-	JitFrames.Clear();
-	JitBlocks.Clear();
-	JitBlockPos = 0;
-	JitBlockSize = 0;
+	arena->Frames.Clear();
+	arena->Blocks.Clear();
+	arena->BlockSizes.Clear();
+	arena->BlockPos = 0;
+	arena->BlockSize = 0;
+}
+
+void JitRelease()
+{
+	JitReleaseArena(&VMCode);
+	JitReleaseCallCaches();
 }
 
 static int CaptureStackTrace(int max_frames, void **out_frames)
@@ -960,6 +985,7 @@ FString JitCaptureStackTrace(int framesToSkip, bool includeNativeFrames)
 	if (includeNativeFrames)
 		nativeSymbols.reset(new NativeSymbolResolver());
 
+	std::lock_guard<std::mutex> lock(JitMutex);
 	FString s;
 	for (int i = framesToSkip + 1; i < numframes; i++)
 	{
@@ -32,6 +32,36 @@ struct JitLineInfo
 	asmjit::Label Label;
 };
 
+class JitCompiler;
+
+// The virtual registers for one VM register type. Asmjit cannot handle an
+// unlimited number of them, so large functions only get native registers for
+// a part of their VM registers. The others stay in their VM frame slot and
+// are loaded into a temporary by each opcode that uses them.
+template<typename RegType>
+class JitRegisters
+{
+public:
+	void Init(JitCompiler *compiler, int regtype, int count, int numnative)
+	{
+		Compiler = compiler;
+		Type = regtype;
+		Count = count;
+		Native.Resize(numnative);
+	}
+
+	RegType operator[](int index);
+	unsigned int Size() const { return Count; }
+	bool IsSpilled(int index) const { return (unsigned int)index >= Native.Size(); }
+
+	TArray<RegType> Native;
+
+private:
+	JitCompiler *Compiler = nullptr;
+	int Type = 0;
+	unsigned int Count = 0;
+};
+
 class JitCompiler
 {
 public:
@@ -39,6 +69,7 @@ public:
 
 	asmjit::CCFunc *Codegen();
 	VMScriptFunction *GetScriptFunction() { return sfunc; }
+	bool HasSpilledRegisters() const { return hasSpills; }
 
 	TArray<JitLineInfo> LineInfo;
 
@@ -52,6 +83,9 @@ private:
 
 	void Setup();
 	void CreateRegisters();
+	void BeginOpcodeSpills();
+	void EndOpcodeSpills();
+	asmjit::X86Reg GetSpilled(int regtype, int index);
 	void IncrementVMCalls();
 	void SetupFrame();
 	void SetupSimpleFrame();
@@ -61,8 +95,10 @@ private:
 	void EmitPopFrame();
 
 	void EmitNativeCall(VMNativeFunction *target);
+	bool EmitInlineNative(VMNativeFunction *target);
 	void EmitVMCall(asmjit::X86Gp ptr, VMFunction *target);
 	void EmitVtbl(const VMOP *op);
+	VMFunction *FindVirtualCallTarget(const VMOP *vtbl);
 
 	int StoreCallParams();
 	void LoadInOuts();
@@ -213,6 +249,22 @@ private:
 	asmjit::X86Gp newResultIntPtr() { return newTempRegister(regResultIntPtr, resultPosIntPtr, "resultPtr", [&](const char *name) { return cc.newIntPtr(name); }); }
 	asmjit::X86Xmm newResultXmmSd() { return newTempRegister(regResultXmmSd, resultPosXmmSd, "resultXmmSd", [&](const char *name) { return cc.newXmmSd(name); }); }
 
+	// Temporaries holding spilled VM registers during one opcode
+	struct SpilledRegister
+	{
+		int Type;
+		int Index;
+		asmjit::X86Reg Reg;
+	};
+	TArray<SpilledRegister> Spilled;
+	asmjit::CBNode *spillCursor = nullptr;	// loads for the current opcode are inserted after this node
+	bool hasSpills = false;
+	size_t spillPosInt32, spillPosIntPtr, spillPosXmmSd;
+	std::vector<asmjit::X86Gp> regSpillInt32, regSpillIntPtr;
+	std::vector<asmjit::X86Xmm> regSpillXmmSd;
+
+	template<typename T> friend class JitRegisters;
+
 	void EmitReadBarrier();
 
 	void EmitNullPointerThrow(int index, EVMAbortException reason);
@@ -264,10 +316,10 @@ private:
 	const FString *konsts;
 	const FVoidObj *konsta;
 
-	TArray<asmjit::X86Gp> regD;
-	TArray<asmjit::X86Xmm> regF;
-	TArray<asmjit::X86Gp> regA;
-	TArray<asmjit::X86Gp> regS;
+	JitRegisters<asmjit::X86Gp> regD;
+	JitRegisters<asmjit::X86Xmm> regF;
+	JitRegisters<asmjit::X86Gp> regA;
+	JitRegisters<asmjit::X86Gp> regS;
 
 	struct OpcodeLabel
 	{
@@ -293,6 +345,14 @@ private:
 	VM_UBYTE op;
 };
 
+template<typename RegType>
+inline RegType JitRegisters<RegType>::operator[](int index)
+{
+	if ((unsigned int)index < Native.Size())
+		return Native[index];
+	return Compiler->GetSpilled(Type, index).template as<RegType>();
+}
+
 class AsmJitException : public std::exception
 {
 public:
@@ -318,5 +378,21 @@ public:
 	}
 };
 
+// Executable memory for code that has to be released before the VM shuts down.
+struct JitCodeArena
+{
+	TArray<uint8_t*> Blocks;
+	TArray<size_t> BlockSizes;
+	TArray<uint8_t*> Frames;	// registered unwind info
+	size_t BlockPos = 0;
+	size_t BlockSize = 0;
+};
+
 void *AddJitFunction(asmjit::CodeHolder* code, JitCompiler *compiler);
+// For code that was not generated by JitCompiler. name and filename show up in stack traces.
+// Without an arena the code stays until JitRelease.
+void *AddJitFunction(asmjit::CodeHolder* code, asmjit::CCFunc *func, const char *name, const char *filename, const TArray<JitLineInfo> &lineinfo, JitCodeArena *arena = nullptr);
+// Frees all code in the arena. None of it may be running or get called afterwards.
+void JitReleaseArena(JitCodeArena *arena);
+void JitReleaseCallCaches();
 asmjit::CodeInfo GetHostCodeInfo();
@@ -54,6 +54,10 @@ extern FMemArena ClassDataAllocator;
 #define MAX_TRY_DEPTH	8	// Maximum number of nested TRYs in a single function
 
 void JitRelease();
+void JitCompileAhead();
+void JitUpdateBackground();
+void JitCancelBackground();
+void VMProfileRelease();
 
 
 typedef unsigned char		VM_UBYTE;
@@ -425,13 +429,15 @@ public:
 	void operator delete[](void *block) {}
 	static void DeleteAll()
 	{
+		JitCancelBackground();
 		for (auto f : AllFunctions)
 		{
 			f->~VMFunction();
 		}
 		AllFunctions.Clear();
-		// also release any JIT data
+		// also release any JIT and profiler data
 		JitRelease();
+		VMProfileRelease();
 	}
 	static void CreateRegUseInfo()
 	{
@@ -54,6 +54,9 @@ CUSTOM_CVAR(Bool, vm_jit, true, CVAR_NOINITCALL)
 CVAR(Bool, vm_jit, false, CVAR_NOINITCALL|CVAR_NOSET)
 FString JitCaptureStackTrace(int framesToSkip, bool includeNativeFrames) { return FString(); }
 void JitRelease() {}
+void JitCompileAhead() {}
+void JitUpdateBackground() {}
+void JitCancelBackground() {}
 #endif
 
 cycle_t VMCycles[10];
@@ -264,36 +267,70 @@ int VMScriptFunction::PCToLine(const VMOP *pc)
 	return -1;
 }
 
-static bool CanJit(VMScriptFunction *func)
+// Why functions run in the interpreter, for the jit stat
+enum
 {
-	// Asmjit has a 256 register limit. Stay safely away from it as the jit compiler uses a few for temporaries as well.
-	// Any function exceeding the limit will use the VM - a fair punishment to someone for writing a function so bloated ;)
+	INTERP_NoJit,			// vm_jit is off or unsupported
+	INTERP_JitError,		// the compiler failed on the function
+	NUM_INTERP_REASONS
+};
 
-	int maxregs = 200;
-	if (func->NumRegA + func->NumRegD + func->NumRegF + func->NumRegS < maxregs)
-		return true;
-
-	Printf(TEXTCOLOR_ORANGE "%s is using too many registers (%d of max %d)! Function will not use native code.\n", func->PrintableName.GetChars(), func->NumRegA + func->NumRegD + func->NumRegF + func->NumRegS, maxregs);
-
-	return false;
-}
+int JitFunctions;
+static int InterpretedFunctions[NUM_INTERP_REASONS];
 
 int VMScriptFunction::FirstScriptCall(VMFunction *func, VMValue *params, int numparams, VMReturn *ret, int numret)
 {
+	JitFuncPtr entry = nullptr;
+	int reason = INTERP_NoJit;
 #ifdef HAVE_VM_JIT
-	if (vm_jit && CanJit(static_cast<VMScriptFunction*>(func)))
+	if (vm_jit)
+	{
+		auto sfunc = static_cast<VMScriptFunction*>(func);
+		if (sfunc->JitPending)
+		{
+			// Still waiting for a worker thread. Interpret it until the code is ready.
+			VMSetScriptEntry(sfunc, VMExec);
+			return VMExec(func, params, numparams, ret, numret);
+		}
+		entry = JitCompileOnCall(sfunc);
+		reason = INTERP_JitError;
+	}
+#endif // HAVE_VM_JIT
+	if (!entry)
 	{
-		func->ScriptCall = JitCompile(static_cast<VMScriptFunction*>(func));
-		if (!func->ScriptCall)
-			func->ScriptCall = VMExec;
+		entry = VMExec;
+		InterpretedFunctions[reason]++;
 	}
 	else
-#endif // HAVE_VM_JIT
 	{
-		func->ScriptCall = VMExec;
+		JitFunctions++;
 	}
+	VMSetScriptEntry(static_cast<VMScriptFunction*>(func), entry);
 
-	return func->ScriptCall(func, params, numparams, ret, numret);
+	// Call the entry directly. If the profiler is active it is already timing this call.
+	return entry(func, params, numparams, ret, numret);
+}
+
+//==========================================================================
+//
+// STAT jit
+//
+// Only functions that have been called at least once or were compiled
+// ahead of time are counted.
+//
+//==========================================================================
+
+ADD_STAT(jit)
+{
+	FString out;
+	out.Format("Native: %d", JitFunctions);
+#ifdef HAVE_VM_JIT
+	out.AppendFormat(" (%d with spilled registers)", JitSpilledFunctions.load());
+#endif
+	out.AppendFormat("  Interpreted: %d (JIT off: %d, JIT error: %d)",
+		InterpretedFunctions[INTERP_NoJit] + InterpretedFunctions[INTERP_JitError],
+		InterpretedFunctions[INTERP_NoJit], InterpretedFunctions[INTERP_JitError]);
+	return out;
 }
 
 int VMNativeFunction::NativeScriptCall(VMFunction *func, VMValue *params, int numparams, VMReturn *returns, int numret)
@@ -345,6 +345,14 @@ struct FStatementInfo
 	uint16_t LineNumber;
 };
 
+// Static type of the object an OP_VTBL instruction looks up its method in.
+// The JIT uses this to turn virtual calls into direct ones.
+struct FVirtualCallSite
+{
+	unsigned InstructionIndex;
+	class PClass *SelfClass;
+};
+
 class VMFrameStack
 {
 public:
@@ -441,6 +449,12 @@ typedef std::pair<const class PType *, unsigned> FTypeAndOffset;
 
 typedef int(*JitFuncPtr)(VMFunction *func, VMValue *params, int numparams, VMReturn *ret, int numret);
 
+// Script profiler (vmprofiler.cpp)
+struct FScriptProfile;
+extern bool VMProfiling;
+void VMSetScriptEntry(VMScriptFunction *func, JitFuncPtr entry);
+JitFuncPtr VMGetScriptEntry(VMScriptFunction *func);
+
 class VMScriptFunction : public VMFunction
 {
 public:
@@ -470,12 +484,16 @@ public:
 	VM_UHALF MaxParam;		// Maximum number of parameters this function has on the stack at once
 	VM_UBYTE NumArgs;		// Number of arguments this function takes
 	TArray<FTypeAndOffset> SpecialInits;	// list of all contents on the extra stack which require construction and destruction
+	TArray<FVirtualCallSite> VirtualCalls;	// sorted by instruction index
+	TArray<uint16_t> NullCheckedOps;		// loads and stores whose pointer is known to be non-null, sorted
+	FScriptProfile *Profile = nullptr;		// only set once the script profiler has been started
+	bool JitPending = false;				// queued for compilation on a worker thread
 
 	void InitExtra(void *addr);
 	void DestroyExtra(void *addr);
 	int AllocExtraStack(PType *type);
 	int PCToLine(const VMOP *pc);
 
-private:
+	// ScriptCall of functions that have not been called or compiled yet
 	static int FirstScriptCall(VMFunction *func, VMValue *params, int numparams, VMReturn *ret, int numret);
 };
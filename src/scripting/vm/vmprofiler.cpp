@@ -0,0 +1,440 @@
+//-----------------------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/
+//
+//-----------------------------------------------------------------------------
+//
+// DESCRIPTION:
+//		Per-function script profiler.
+//
+//		Every call into a script function, whether it comes from native
+//		code, the interpreter or JIT-compiled code, goes through the
+//		function's ScriptCall pointer. While profiling, that pointer is
+//		replaced with a trampoline that times the call and then forwards
+//		it to the real entry point, so both execution engines are covered
+//		without changes to the generated code.
+//
+//		Besides the per-function totals a call tree is recorded, which
+//		can be written out as collapsed stacks for flame graph tools.
+//		Time spent in native functions is counted as self time of the
+//		script function that called them.
+//
+//-----------------------------------------------------------------------------
+
+#include <algorithm>
+#include "dobject.h"
+#include "c_dispatch.h"
+#include "files.h"
+#include "cmdlib.h"
+#include "i_time.h"
+#include "vmintern.h"
+#include "types.h"
+
+// TYPES -------------------------------------------------------------------
+
+struct FScriptProfile
+{
+	JitFuncPtr Call;			// the function's real entry point
+	uint64_t Calls;
+	uint64_t SelfTime;			// all times in ns
+	uint64_t InclusiveTime;
+	int Depth;					// active invocations, so that recursion isn't counted twice
+};
+
+// Node of the call tree. Node 0 is the root and has no function.
+struct FProfileNode
+{
+	VMScriptFunction *Func;
+	unsigned Parent;
+	unsigned FirstChild;
+	unsigned NextSibling;
+	uint64_t Calls;
+	uint64_t SelfTime;
+};
+
+struct FProfileFrame
+{
+	VMScriptFunction *Func;
+	unsigned Node;
+	uint64_t Start;
+	uint64_t ChildTime;
+};
+
+// PUBLIC DATA DEFINITIONS -------------------------------------------------
+
+bool VMProfiling;
+
+// PRIVATE DATA DEFINITIONS ------------------------------------------------
+
+static TArray<VMScriptFunction *> ProfiledFunctions;
+static TArray<FProfileNode> ProfileTree;
+static TArray<FProfileFrame> ProfileStack;
+static uint64_t ProfileStartTime, ProfileTotalTime;
+
+// CODE --------------------------------------------------------------------
+
+//==========================================================================
+//
+// FindChildNode
+//
+//==========================================================================
+
+static unsigned FindChildNode(unsigned parent, VMScriptFunction *func)
+{
+	unsigned i;
+	for (i = ProfileTree[parent].FirstChild; i != 0; i = ProfileTree[i].NextSibling)
+	{
+		if (ProfileTree[i].Func == func) return i;
+	}
+	i = ProfileTree.Reserve(1);
+	auto &node = ProfileTree[i];
+	node.Func = func;
+	node.Parent = parent;
+	node.FirstChild = 0;
+	node.NextSibling = ProfileTree[parent].FirstChild;
+	node.Calls = node.SelfTime = 0;
+	ProfileTree[parent].FirstChild = i;
+	return i;
+}
+
+//==========================================================================
+//
+// PopProfileFrame
+//
+//==========================================================================
+
+static void PopProfileFrame()
+{
+	uint64_t now = I_nsTime();
+	FProfileFrame frame;
+	// The stack is empty if the profile was cleared while this call was running.
+	if (!ProfileStack.Pop(frame)) return;
+
+	uint64_t elapsed = now - frame.Start;
+	uint64_t self = elapsed > frame.ChildTime ? elapsed - frame.ChildTime : 0;
+	auto prof = frame.Func->Profile;
+
+	ProfileTree[frame.Node].SelfTime += self;
+	prof->SelfTime += self;
+	if (--prof->Depth == 0)
+	{
+		prof->InclusiveTime += elapsed;
+	}
+	if (ProfileStack.Size() > 0)
+	{
+		ProfileStack.Last().ChildTime += elapsed;
+	}
+}
+
+//==========================================================================
+//
+// ProfiledScriptCall
+//
+// The ScriptCall trampoline that is installed while profiling.
+//
+//==========================================================================
+
+static int ProfiledScriptCall(VMFunction *func, VMValue *params, int numparams, VMReturn *ret, int numret)
+{
+	auto sfunc = static_cast<VMScriptFunction *>(func);
+	auto prof = sfunc->Profile;
+	unsigned parent = ProfileStack.Size() > 0 ? ProfileStack.Last().Node : 0;
+	unsigned node = FindChildNode(parent, sfunc);
+
+	prof->Calls++;
+	prof->Depth++;
+	ProfileTree[node].Calls++;
+	ProfileStack.Push({ sfunc, node, I_nsTime(), 0 });
+
+	int result;
+	try
+	{
+		result = prof->Call(func, params, numparams, ret, numret);
+	}
+	catch (...)
+	{
+		PopProfileFrame();
+		throw;
+	}
+	PopProfileFrame();
+	return result;
+}
+
+//==========================================================================
+//
+// VMSetScriptEntry
+//
+// Sets the entry point of a script function once it has been compiled.
+// While the profiler is active it must stay behind the trampoline.
+//
+//==========================================================================
+
+void VMSetScriptEntry(VMScriptFunction *func, JitFuncPtr entry)
+{
+	if (func->Profile != nullptr)
+	{
+		func->Profile->Call = entry;
+		if (func->ScriptCall == &ProfiledScriptCall) return;
+	}
+	func->ScriptCall = entry;
+}
+
+//==========================================================================
+//
+// VMGetScriptEntry
+//
+// Returns the entry point the trampoline forwards to, if there is one.
+//
+//==========================================================================
+
+JitFuncPtr VMGetScriptEntry(VMScriptFunction *func)
+{
+	if (func->ScriptCall == &ProfiledScriptCall)
+	{
+		return func->Profile->Call;
+	}
+	return func->ScriptCall;
+}
+
+//==========================================================================
+//
+// VMProfileReset
+//
+//==========================================================================
+
+static void VMProfileReset()
+{
+	for (auto func : ProfiledFunctions)
+	{
+		auto prof = func->Profile;
+		prof->Calls = prof->SelfTime = prof->InclusiveTime = 0;
+	}
+	ProfileTree.Clear();
+	ProfileTree.Reserve(1);
+	memset(&ProfileTree[0], 0, sizeof(ProfileTree[0]));
+	ProfileTotalTime = 0;
+	ProfileStartTime = I_nsTime();
+}
+
+//==========================================================================
+//
+// VMProfileStart
+//
+//==========================================================================
+
+static void VMProfileStart()
+{
+	if (VMProfiling) return;
+	if (ProfileStack.Size() > 0)
+	{
+		Printf("Cannot start profiling while script code is running\n");
+		return;
+	}
+
+	for (auto f : VMFunction::AllFunctions)
+	{
+		if (f->VarFlags & VARF_Native) continue;
+
+		auto func = static_cast<VMScriptFunction *>(f);
+		if (func->Profile == nullptr)
+		{
+			func->Profile = new FScriptProfile;
+			memset(func->Profile, 0, sizeof(*func->Profile));
+			ProfiledFunctions.Push(func);
+		}
+		func->Profile->Call = func->ScriptCall;
+		func->ScriptCall = &ProfiledScriptCall;
+	}
+	VMProfiling = true;
+	VMProfileReset();
+}
+
+//==========================================================================
+//
+// VMProfileStop
+//
+// Calls that are currently in progress still return through the
+// trampoline, so the collected data stays valid.
+//
+//==========================================================================
+
+static void VMProfileStop()
+{
+	if (!VMProfiling) return;
+
+	for (auto func : ProfiledFunctions)
+	{
+		if (func->ScriptCall == &ProfiledScriptCall)
+		{
+			func->ScriptCall = func->Profile->Call;
+		}
+	}
+	ProfileTotalTime += I_nsTime() - ProfileStartTime;
+	VMProfiling = false;
+}
+
+//==========================================================================
+//
+// VMProfileRelease
+//
+// Called when all VM functions get deleted.
+//
+//==========================================================================
+
+void VMProfileRelease()
+{
+	VMProfileStop();
+	for (auto func : ProfiledFunctions)
+	{
+		delete func->Profile;
+		func->Profile = nullptr;
+	}
+	ProfiledFunctions.Reset();
+	ProfileTree.Reset();
+	ProfileStack.Reset();
+}
+
+//==========================================================================
+//
+// VMProfileReport
+//
+//==========================================================================
+
+static void VMProfileReport(unsigned count, const char *sortby)
+{
+	TArray<VMScriptFunction *> list;
+	for (auto func : ProfiledFunctions)
+	{
+		if (func->Profile->Calls > 0) list.Push(func);
+	}
+
+	if (!stricmp(sortby, "calls"))
+	{
+		std::sort(list.begin(), list.end(), [](VMScriptFunction *a, VMScriptFunction *b) { return a->Profile->Calls > b->Profile->Calls; });
+	}
+	else if (!stricmp(sortby, "incl"))
+	{
+		std::sort(list.begin(), list.end(), [](VMScriptFunction *a, VMScriptFunction *b) { return a->Profile->InclusiveTime > b->Profile->InclusiveTime; });
+	}
+	else
+	{
+		std::sort(list.begin(), list.end(), [](VMScriptFunction *a, VMScriptFunction *b) { return a->Profile->SelfTime > b->Profile->SelfTime; });
+	}
+
+	uint64_t total = ProfileTotalTime + (VMProfiling ? I_nsTime() - ProfileStartTime : 0);
+	Printf("Script profile over %.2f s, %u functions called\n", total / 1e9, list.Size());
+	Printf("%10s %10s %10s %9s  %s\n", "calls", "incl ms", "self ms", "avg us", "function");
+	for (unsigned i = 0; i < list.Size() && i < count; i++)
+	{
+		auto prof = list[i]->Profile;
+		Printf("%10llu %10.3f %10.3f %9.3f  %s\n", (unsigned long long)prof->Calls,
+			prof->InclusiveTime / 1e6, prof->SelfTime / 1e6, prof->InclusiveTime / 1e3 / prof->Calls,
+			list[i]->PrintableName.GetChars());
+	}
+}
+
+//==========================================================================
+//
+// VMProfileWriteStacks
+//
+// Writes the call tree in the collapsed stack format that flame graph
+// tools read: one line per call path with its self time in microseconds.
+//
+//==========================================================================
+
+static void VMProfileWriteStacks(const char *filename)
+{
+	FString fn = filename;
+	FixPathSeperator(fn);
+	FileWriter *fw = FileWriter::Open(fn);
+	if (fw == nullptr)
+	{
+		Printf("Could not open %s\n", fn.GetChars());
+		return;
+	}
+
+	TArray<unsigned> path;
+	unsigned lines = 0;
+	for (unsigned i = 1; i < ProfileTree.Size(); i++)
+	{
+		uint64_t us = ProfileTree[i].SelfTime / 1000;
+		if (us == 0) continue;
+
+		path.Clear();
+		for (unsigned n = i; n != 0; n = ProfileTree[n].Parent)
+		{
+			path.Push(n);
+		}
+		FString line;
+		for (int j = path.Size() - 1; j >= 0; j--)
+		{
+			FString name = ProfileTree[path[j]].Func->PrintableName;
+			name.ReplaceChars(" ;", '_');
+			line << name << (j > 0 ? ";" : "");
+		}
+		fw->Printf("%s %llu\n", line.GetChars(), (unsigned long long)us);
+		lines++;
+	}
+	delete fw;
+	Printf("%u stacks written to %s\n", lines, fn.GetChars());
+}
+
+//==========================================================================
+//
+// CCMD vmprofile
+//
+//==========================================================================
+
+CCMD(vmprofile)
+{
+	if (argv.argc() >= 2)
+	{
+		if (!stricmp(argv[1], "start"))
+		{
+			VMProfileStart();
+			if (VMProfiling) Printf("Script profiling started\n");
+			return;
+		}
+		else if (!stricmp(argv[1], "stop"))
+		{
+			VMProfileStop();
+			Printf("Script profiling stopped\n");
+			return;
+		}
+		else if (!stricmp(argv[1], "reset"))
+		{
+			if (ProfileStack.Size() > 0)
+			{
+				Printf("Cannot reset the profile while script code is running\n");
+				return;
+			}
+			VMProfileReset();
+			return;
+		}
+		else if (!stricmp(argv[1], "report"))
+		{
+			unsigned count = argv.argc() >= 3 ? (unsigned)atoi(argv[2]) : 20;
+			VMProfileReport(count, argv.argc() >= 4 ? argv[3] : "self");
+			return;
+		}
+		else if (!stricmp(argv[1], "stacks") && argv.argc() >= 3)
+		{
+			VMProfileWriteStacks(argv[2]);
+			return;
+		}
+	}
+	Printf("Usage: vmprofile start|stop|reset\n"
+		"       vmprofile report [count] [self|incl|calls]\n"
+		"       vmprofile stacks <filename>\n");
+}
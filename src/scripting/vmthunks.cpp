@@ -1183,13 +1183,15 @@ DEFINE_ACTION_FUNCTION_NATIVE(_Sector, SetXOffset, SetXOffset)
  static void ClearPortal(sector_t *self, int pos)
  {
 	 self->ClearPortal(pos);
+	 P_InvalidateSightQueries();
+	 P_FlushSightCache();
  }
 
  DEFINE_ACTION_FUNCTION_NATIVE(_Sector, ClearPortal, ClearPortal)
  {
 	 PARAM_SELF_STRUCT_PROLOGUE(sector_t);
 	 PARAM_INT(pos);
-	 self->ClearPortal(pos);
+	 ClearPortal(self, pos);
 	 return 0;
  }
 
@@ -40,6 +40,7 @@
 #include "version.h"
 #include "zcc_parser.h"
 #include "zcc_compile.h"
+#include "backend/bytecodecache.h"
 
 TArray<FString> Includes;
 TArray<FScriptPosition> IncludeLocs;
@@ -260,6 +261,7 @@ static void ParseSingleFile(FScanner *pSC, const char *filename, int lump, void
 		pSC = &lsc;
 	}
 	FScanner &sc = *pSC;
+	BytecodeCacheAddSource(sc.LumpNum);
 	sc.SetParseVersion(state.ParseVersion);
 	state.sc = &sc;
 
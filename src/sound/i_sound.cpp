@@ -248,7 +248,7 @@ void I_InitSound ()
 	nosfx = !!Args->CheckParm ("-nosfx");
 
 	GSnd = NULL;
-	if (nosound || batchrun)
+	if (nosound || batchrun || benchmarking)
 	{
 		GSnd = new NullSoundRenderer;
 		I_InitMusic ();
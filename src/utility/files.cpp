@@ -33,6 +33,17 @@
 **
 */
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include <limits.h>
+
 #include "files.h"
 #include "templates.h"
 
@@ -348,6 +359,73 @@ public:
 
 
 
+//==========================================================================
+//
+// MappedFileReader
+//
+// maps a whole file into memory. Since it exposes its buffer, lumps in
+// uncompressed entries get cached as pointers into the mapping instead of
+// being read into a copy.
+//
+//==========================================================================
+
+class MappedFileReader : public MemoryReader
+{
+public:
+	~MappedFileReader()
+	{
+		if (bufptr != nullptr)
+		{
+#ifdef _WIN32
+			UnmapViewOfFile(bufptr);
+#else
+			munmap(const_cast<char*>(bufptr), Length);
+#endif
+		}
+	}
+
+	bool Open(const char *filename)
+	{
+#ifdef _WIN32
+		HANDLE file = CreateFileW(WideString(filename).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return false;
+
+		LARGE_INTEGER size;
+		void *mem = nullptr;
+		if (GetFileSizeEx(file, &size) && size.QuadPart > 0 && size.QuadPart <= LONG_MAX)
+		{
+			// The view keeps the mapping alive, so neither handle is needed afterward.
+			HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping != nullptr)
+			{
+				mem = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+				CloseHandle(mapping);
+			}
+		}
+		CloseHandle(file);
+		if (mem == nullptr) return false;
+		Length = (long)size.QuadPart;
+#else
+		int fd = open(filename, O_RDONLY);
+		if (fd < 0) return false;
+
+		struct stat st;
+		void *mem = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && st.st_size <= LONG_MAX)
+		{
+			mem = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		}
+		close(fd);
+		if (mem == MAP_FAILED) return false;
+		Length = (long)st.st_size;
+#endif
+		bufptr = (const char *)mem;
+		FilePos = 0;
+		return true;
+	}
+};
+
+
 //==========================================================================
 //
 // FileReader
@@ -369,6 +447,20 @@ bool FileReader::OpenFile(const char *filename, FileReader::Size start, FileRead
 	return true;
 }
 
+bool FileReader::OpenMappedFile(const char *filename)
+{
+	auto reader = new MappedFileReader;
+	if (!reader->Open(filename))
+	{
+		// Empty files and anything the OS refuses to map can still be read the normal way.
+		delete reader;
+		return OpenFile(filename);
+	}
+	Close();
+	mReader = reader;
+	return true;
+}
+
 bool FileReader::OpenFilePart(FileReader &parent, FileReader::Size start, FileReader::Size length)
 {
 	auto reader = new FileReaderRedirect(parent, (long)start, (long)length);
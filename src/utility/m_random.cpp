@@ -146,8 +146,8 @@ static TDeletingArray<FRandom *> NewRNGs;
 FRandom::FRandom ()
 : NameCRC (0)
 {
-#ifndef NDEBUG
 	Name = NULL;
+#ifndef NDEBUG
 	initialized = false;
 #endif
 	Next = RNGList;
@@ -166,9 +166,9 @@ FRandom::FRandom ()
 FRandom::FRandom (const char *name)
 {
 	NameCRC = CalcCRC32 ((const uint8_t *)name, (unsigned int)strlen (name));
+	Name = name;
 #ifndef NDEBUG
 	initialized = false;
-	Name = name;
 	// A CRC of 0 is reserved for nameless RNGs that don't get stored
 	// in savegames. The chance is very low that you would get a CRC of 0,
 	// but it's still possible.
@@ -182,10 +182,10 @@ public:
 	static void StaticPrintSeeds ();
 #endif
 
+	const char *GetName() const { return Name; }
+
 private:
-#ifndef NDEBUG
 	const char *Name;
-#endif
 	FRandom *Next;
 	uint32_t NameCRC;
 
@@ -42,11 +42,17 @@ inline void parallel_for(const Index first, const Index last, const Index step,
 template <typename Index, typename Function>
 inline void parallel_for(const Index first, const Index last, const Index step, const Function& function)
 {
+	if (last <= first)
+	{
+		return;
+	}
+
 	const dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
 
-	dispatch_apply((last - first) / step + 1, queue, ^(size_t slice)
+	// Same iterations as the generic loop: first, first + step, ... while below last.
+	dispatch_apply((last - first + step - 1) / step, queue, ^(size_t slice)
 	{
-		function(slice * step);
+		function(first + Index(slice) * step);
 	});
 }
 
@@ -1147,6 +1147,7 @@ int FScriptPosition::ErrorCounter;
 int FScriptPosition::WarnCounter;
 bool FScriptPosition::StrictErrors;	// makes all OPTERROR messages real errors.
 bool FScriptPosition::errorout;		// call I_Error instead of printing the error itself.
+thread_local TArray<FScriptMessage> *FScriptPosition::MessageLog;
 
 FScriptPosition::FScriptPosition(const FScriptPosition &other)
 {
@@ -1189,13 +1190,6 @@ void FScriptPosition::Message (int severity, const char *message, ...) const
 	if (severity == MSG_DEBUGERROR && developer < DMSG_ERROR) return;
 	if (severity == MSG_DEBUGWARN && developer < DMSG_WARNING) return;
 	if (severity == MSG_DEBUGMSG && developer < DMSG_NOTIFY) return;
-	if (severity == MSG_OPTERROR)
-	{
-		severity = StrictErrors || strictdecorate ? MSG_ERROR : MSG_WARNING;
-	}
-	// This is mainly for catching the error with an exception handler.
-	if (severity == MSG_ERROR && errorout) severity = MSG_FATAL;
-
 	if (message == NULL)
 	{
 		composed = "Bad syntax.";
@@ -1207,10 +1201,49 @@ void FScriptPosition::Message (int severity, const char *message, ...) const
 		composed.VFormat (message, arglist);
 		va_end (arglist);
 	}
+	if (MessageLog != nullptr)
+	{
+		MessageLog->Push({ *this, severity, composed });
+		return;
+	}
+	PrintMessage(severity, composed);
+}
+
+//==========================================================================
+//
+// FScriptPosition::PrintMessages
+//
+// Prints messages collected in a MessageLog, in order.
+//
+//==========================================================================
+
+void FScriptPosition::PrintMessages(const TArray<FScriptMessage> &log)
+{
+	for (auto &msg : log)
+	{
+		msg.Pos.PrintMessage(msg.Severity, msg.Text);
+	}
+}
+
+//==========================================================================
+//
+// FScriptPosition::PrintMessage
+//
+//==========================================================================
+
+void FScriptPosition::PrintMessage(int severity, const FString &composed) const
+{
 	const char *type = "";
 	const char *color;
 	int level = PRINT_HIGH;
 
+	if (severity == MSG_OPTERROR)
+	{
+		severity = StrictErrors || strictdecorate ? MSG_ERROR : MSG_WARNING;
+	}
+	// This is mainly for catching the error with an exception handler.
+	if (severity == MSG_ERROR && errorout) severity = MSG_FATAL;
+
 	switch (severity)
 	{
 	default:
@@ -158,12 +158,15 @@ enum
 //
 //==========================================================================
 
+struct FScriptMessage;
+
 struct FScriptPosition
 {
 	static int WarnCounter;
 	static int ErrorCounter;
 	static bool StrictErrors;
 	static bool errorout;
+	static thread_local TArray<FScriptMessage> *MessageLog;	// if set, messages from this thread are collected here instead of being printed
 	FName FileName;
 	int ScriptLine;
 
@@ -176,11 +179,22 @@ struct FScriptPosition
 	FScriptPosition(FScanner &sc);
 	FScriptPosition &operator=(const FScriptPosition &other);
 	void Message(int severity, const char *message,...) const GCCPRINTF(3,4);
+	static void PrintMessages(const TArray<FScriptMessage> &log);
 	static void ResetErrorCounter()
 	{
 		WarnCounter = 0;
 		ErrorCounter = 0;
 	}
+
+private:
+	void PrintMessage(int severity, const FString &composed) const;
+};
+
+struct FScriptMessage
+{
+	FScriptPosition Pos;
+	int Severity;
+	FString Text;
 };
 
 